@@ -7,6 +7,7 @@
 #include "db/filename.h"
 #include "db/dbformat.h"
 #include "db/table_cache.h"
+#include "db/value_log.h"
 #include "db/version_edit.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
@@ -19,11 +20,23 @@ Status BuildTable(const std::string& dbname,
                   const Options& options,
                   TableCache* table_cache,
                   Iterator* iter,
-                  FileMetaData* meta) {
+                  FileMetaData* meta,
+                  ValueLogMetaData* value_log) {
   Status s;
   meta->file_size = 0;
   iter->SeekToFirst();
 
+  const bool separate = (value_log != NULL &&
+                         options.value_log_threshold > 0);
+  std::string vname;
+  WritableFile* vfile = NULL;
+  ValueLogBuilder* vbuilder = NULL;
+  bool created_value_log = false;
+  if (separate) {
+    value_log->file_size = 0;
+    vname = ValueLogFileName(dbname, value_log->number);
+  }
+
   std::string fname = TableFileName(dbname, meta->number);
   if (iter->Valid()) {
     WritableFile* file;
@@ -33,11 +46,55 @@ Status BuildTable(const std::string& dbname,
     }
 
     TableBuilder* builder = new TableBuilder(options, file);
-    meta->smallest.DecodeFrom(iter->key());
+    std::string index_key, pointer;
+    ParsedInternalKey ikey;
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
+      Slice value = iter->value();
+      if (separate && value.size() >= options.value_log_threshold &&
+          ParseInternalKey(key, &ikey) && ikey.type == kTypeValue) {
+        // Move the value to the value log and store where it went
+        if (vbuilder == NULL) {
+          s = env->NewWritableFile(vname, &vfile);
+          if (!s.ok()) {
+            break;
+          }
+          created_value_log = true;
+          vbuilder = new ValueLogBuilder(value_log->number, vfile);
+        }
+        ValuePointer ptr;
+        s = vbuilder->Add(ikey.user_key, value, &ptr);
+        if (!s.ok()) {
+          break;
+        }
+        index_key.clear();
+        AppendInternalKey(&index_key, ParsedInternalKey(ikey.user_key,
+                                                        ikey.sequence,
+                                                        kTypeValueIndex));
+        pointer.clear();
+        ptr.EncodeTo(&pointer);
+        key = index_key;
+        value = pointer;
+      }
+      if (builder->NumEntries() == 0) {
+        meta->smallest.DecodeFrom(key);
+      }
       meta->largest.DecodeFrom(key);
-      builder->Add(key, iter->value());
+      builder->Add(key, value);
+    }
+
+    // The value log must be durable before the table refers to it
+    if (vbuilder != NULL) {
+      if (s.ok()) {
+        value_log->file_size = vbuilder->FileSize();
+        s = vfile->Sync();
+      }
+      if (s.ok()) {
+        s = vfile->Close();
+      }
+      delete vbuilder;
+      delete vfile;
+      vfile = NULL;
     }
 
     // Finish and check for builder errors
@@ -81,6 +138,10 @@ Status BuildTable(const std::string& dbname,
     // Keep it
   } else {
     env->DeleteFile(fname);
+    if (created_value_log) {
+      env->DeleteFile(vname);
+      value_log->file_size = 0;
+    }
   }
   return s;
 }
@@ -11,6 +11,7 @@ namespace leveldb {
 
 struct Options;
 struct FileMetaData;
+struct ValueLogMetaData;
 
 class Env;
 class Iterator;
@@ -22,12 +23,18 @@ class VersionEdit;
 // *meta will be filled with metadata about the generated table.
 // If no data is present in *iter, meta->file_size will be set to
 // zero, and no Table file will be produced.
+//
+// If "value_log" is non-NULL and options.value_log_threshold is
+// non-zero, values of at least that many bytes are moved to the value
+// log file named according to value_log->number, and value_log->file_size
+// is set to its size (zero if no value was moved and no file produced).
 extern Status BuildTable(const std::string& dbname,
                          Env* env,
                          const Options& options,
                          TableCache* table_cache,
                          Iterator* iter,
-                         FileMetaData* meta);
+                         FileMetaData* meta,
+                         ValueLogMetaData* value_log = NULL);
 
 }  // namespace leveldb
 
@@ -6,17 +6,23 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <vector>
 #include "leveldb/cache.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/iterator.h"
+#include "leveldb/merge_operator.h"
 #include "leveldb/options.h"
+#include "leveldb/rate_limiter.h"
+#include "leveldb/sst_file_writer.h"
 #include "leveldb/status.h"
 #include "leveldb/write_batch.h"
 
 using leveldb::Cache;
+using leveldb::CompactionFilter;
 using leveldb::Comparator;
 using leveldb::CompressionType;
 using leveldb::DB;
@@ -27,15 +33,22 @@ using leveldb::Iterator;
 using leveldb::kMajorVersion;
 using leveldb::kMinorVersion;
 using leveldb::Logger;
+using leveldb::MergeOperator;
 using leveldb::NewBloomFilterPolicy;
+using leveldb::NewClockCache;
+using leveldb::NewGenericRateLimiter;
 using leveldb::NewLRUCache;
+using leveldb::NewSublevelBloomFilterPolicy;
 using leveldb::Options;
+using leveldb::PinnableSlice;
 using leveldb::RandomAccessFile;
 using leveldb::Range;
+using leveldb::RateLimiter;
 using leveldb::ReadOptions;
 using leveldb::SequentialFile;
 using leveldb::Slice;
 using leveldb::Snapshot;
+using leveldb::SstFileWriter;
 using leveldb::Status;
 using leveldb::WritableFile;
 using leveldb::WriteBatch;
@@ -45,16 +58,32 @@ extern "C" {
 
 struct leveldb_t              { DB*               rep; };
 struct leveldb_iterator_t     { Iterator*         rep; };
+struct leveldb_pinnableslice_t { PinnableSlice    rep; };
+struct leveldb_mergeoperands_t {
+  PinnableSlice value;
+  bool read_value;
+  bool has_value;
+  uint64_t value_size;
+  std::vector<std::string> operands;
+};
 struct leveldb_writebatch_t   { WriteBatch        rep; };
 struct leveldb_snapshot_t     { const Snapshot*   rep; };
-struct leveldb_readoptions_t  { ReadOptions       rep; };
+struct leveldb_readoptions_t {
+  ReadOptions rep;
+  std::string prefix;
+  Slice prefix_slice;
+  std::string upper_bound;
+  Slice upper_bound_slice;
+};
 struct leveldb_writeoptions_t { WriteOptions      rep; };
 struct leveldb_options_t      { Options           rep; };
 struct leveldb_cache_t        { Cache*            rep; };
+struct leveldb_ratelimiter_t  { RateLimiter*      rep; };
 struct leveldb_seqfile_t      { SequentialFile*   rep; };
 struct leveldb_randomfile_t   { RandomAccessFile* rep; };
 struct leveldb_writablefile_t { WritableFile*     rep; };
 struct leveldb_logger_t       { Logger*           rep; };
+struct leveldb_sstfilewriter_t { SstFileWriter*   rep; };
 struct leveldb_filelock_t     { FileLock*         rep; };
 
 struct leveldb_comparator_t : public Comparator {
@@ -124,6 +153,126 @@ struct leveldb_filterpolicy_t : public FilterPolicy {
   }
 };
 
+struct leveldb_mergeoperator_t : public MergeOperator {
+  void* state_;
+  void (*destructor_)(void*);
+  const char* (*name_)(void*);
+  char* (*full_merge_)(
+      void*,
+      const char* key, size_t key_length,
+      const char* existing_value, size_t existing_value_length,
+      const char* const* operands_list, const size_t* operands_list_length,
+      int num_operands,
+      unsigned char* success, size_t* new_value_length);
+  char* (*partial_merge_)(
+      void*,
+      const char* key, size_t key_length,
+      const char* left_operand, size_t left_operand_length,
+      const char* right_operand, size_t right_operand_length,
+      unsigned char* success, size_t* new_value_length);
+
+  virtual ~leveldb_mergeoperator_t() {
+    (*destructor_)(state_);
+  }
+
+  virtual const char* Name() const {
+    return (*name_)(state_);
+  }
+
+  virtual bool FullMerge(const Slice& key, const Slice* existing_value,
+                         const std::vector<Slice>& operands,
+                         std::string* new_value) const {
+    const int n = operands.size();
+    std::vector<const char*> operand_pointers(n);
+    std::vector<size_t> operand_sizes(n);
+    for (int i = 0; i < n; i++) {
+      operand_pointers[i] = operands[i].data();
+      operand_sizes[i] = operands[i].size();
+    }
+    unsigned char success = 0;
+    size_t len = 0;
+    char* result = (*full_merge_)(
+        state_, key.data(), key.size(),
+        existing_value != NULL ? existing_value->data() : NULL,
+        existing_value != NULL ? existing_value->size() : 0,
+        n > 0 ? &operand_pointers[0] : NULL,
+        n > 0 ? &operand_sizes[0] : NULL, n,
+        &success, &len);
+    if (success) {
+      new_value->assign(result, len);
+    }
+    free(result);
+    return success;
+  }
+
+  virtual bool PartialMerge(const Slice& key, const Slice& left_operand,
+                            const Slice& right_operand,
+                            std::string* new_operand) const {
+    if (partial_merge_ == NULL) {
+      return false;
+    }
+    unsigned char success = 0;
+    size_t len = 0;
+    char* result = (*partial_merge_)(
+        state_, key.data(), key.size(),
+        left_operand.data(), left_operand.size(),
+        right_operand.data(), right_operand.size(),
+        &success, &len);
+    if (success) {
+      new_operand->assign(result, len);
+    }
+    free(result);
+    return success;
+  }
+};
+
+struct leveldb_compactionfilter_t : public CompactionFilter {
+  void* state_;
+  void (*destructor_)(void*);
+  const char* (*name_)(void*);
+  unsigned char (*filter_)(
+      void*,
+      int level,
+      const char* key, size_t key_length,
+      const char* existing_value, size_t value_length,
+      char** new_value, size_t* new_value_length,
+      unsigned char* value_changed);
+  unsigned char (*may_filter_)(void*, int level,
+                               const char* key, size_t key_length);
+
+  virtual ~leveldb_compactionfilter_t() {
+    (*destructor_)(state_);
+  }
+
+  virtual const char* Name() const {
+    return (*name_)(state_);
+  }
+
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const {
+    char* result = NULL;
+    size_t len = 0;
+    unsigned char changed = 0;
+    unsigned char remove = (*filter_)(
+        state_, level, key.data(), key.size(),
+        existing_value.data(), existing_value.size(),
+        &result, &len, &changed);
+    if (changed) {
+      new_value->assign(result, len);
+      *value_changed = true;
+    }
+    free(result);
+    return remove;
+  }
+
+  virtual bool MayFilter(int level, const Slice& key) const {
+    return may_filter_ == NULL ||
+           (*may_filter_)(state_, level, key.data(), key.size());
+  }
+};
+
 struct leveldb_env_t {
   Env* rep;
   bool is_default;
@@ -177,6 +326,17 @@ void leveldb_put(
             db->rep->Put(options->rep, Slice(key, keylen), Slice(val, vallen)));
 }
 
+void leveldb_merge(
+    leveldb_t* db,
+    const leveldb_writeoptions_t* options,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr) {
+  SaveError(errptr,
+            db->rep->Merge(options->rep, Slice(key, keylen),
+                           Slice(val, vallen)));
+}
+
 void leveldb_delete(
     leveldb_t* db,
     const leveldb_writeoptions_t* options,
@@ -215,6 +375,119 @@ char* leveldb_get(
   return result;
 }
 
+leveldb_pinnableslice_t* leveldb_get_pinned(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    const char* key, size_t keylen,
+    char** errptr) {
+  leveldb_pinnableslice_t* v = new leveldb_pinnableslice_t;
+  Status s = db->rep->GetPinned(options->rep, Slice(key, keylen), &v->rep);
+  if (!s.ok()) {
+    delete v;
+    if (!s.IsNotFound()) {
+      SaveError(errptr, s);
+    }
+    return NULL;
+  }
+  return v;
+}
+
+const char* leveldb_pinnableslice_value(const leveldb_pinnableslice_t* v,
+                                        size_t* vallen) {
+  *vallen = v->rep.size();
+  return v->rep.data();
+}
+
+void leveldb_pinnableslice_destroy(leveldb_pinnableslice_t* v) {
+  delete v;
+}
+
+leveldb_mergeoperands_t* leveldb_get_merge_operands(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    const char* key, size_t keylen,
+    unsigned char read_value,
+    char** errptr) {
+  leveldb_mergeoperands_t* m = new leveldb_mergeoperands_t;
+  m->read_value = read_value;
+  Status s = db->rep->GetMergeOperands(options->rep, Slice(key, keylen),
+                                       read_value ? &m->value : NULL,
+                                       &m->value_size, &m->has_value,
+                                       &m->operands);
+  if (!s.ok()) {
+    delete m;
+    if (!s.IsNotFound()) {
+      SaveError(errptr, s);
+    }
+    return NULL;
+  }
+  return m;
+}
+
+unsigned char leveldb_mergeoperands_has_value(
+    const leveldb_mergeoperands_t* m) {
+  return m->has_value;
+}
+
+uint64_t leveldb_mergeoperands_value_size(const leveldb_mergeoperands_t* m) {
+  return m->value_size;
+}
+
+const char* leveldb_mergeoperands_value(const leveldb_mergeoperands_t* m,
+                                        size_t* vallen) {
+  if (!m->read_value || !m->has_value) {
+    *vallen = 0;
+    return NULL;
+  }
+  *vallen = m->value.size();
+  return m->value.data();
+}
+
+size_t leveldb_mergeoperands_count(const leveldb_mergeoperands_t* m) {
+  return m->operands.size();
+}
+
+const char* leveldb_mergeoperands_operand(const leveldb_mergeoperands_t* m,
+                                          size_t i, size_t* len) {
+  *len = m->operands[i].size();
+  return m->operands[i].data();
+}
+
+void leveldb_mergeoperands_destroy(leveldb_mergeoperands_t* m) {
+  delete m;
+}
+
+void leveldb_multi_get(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    size_t num_keys,
+    const char* const* keys_list, const size_t* keys_list_sizes,
+    char** values_list, size_t* values_list_sizes,
+    char** errs) {
+  std::vector<Slice> keys(num_keys);
+  for (size_t i = 0; i < num_keys; i++) {
+    keys[i] = Slice(keys_list[i], keys_list_sizes[i]);
+  }
+  std::vector<std::string> values(num_keys);
+  std::vector<Status> statuses(num_keys);
+  if (num_keys > 0) {
+    db->rep->MultiGet(options->rep, num_keys, &keys[0], &values[0],
+                      &statuses[0]);
+  }
+  for (size_t i = 0; i < num_keys; i++) {
+    if (statuses[i].ok()) {
+      values_list_sizes[i] = values[i].size();
+      values_list[i] = CopyString(values[i]);
+    } else {
+      values_list_sizes[i] = 0;
+      values_list[i] = NULL;
+      if (!statuses[i].IsNotFound()) {
+        SaveError(&errs[i], statuses[i]);
+      }
+    }
+  }
+}
+
 leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db,
     const leveldb_readoptions_t* options) {
@@ -275,6 +548,14 @@ void leveldb_compact_range(
       (limit_key ? (b = Slice(limit_key, limit_key_len), &b) : NULL));
 }
 
+void leveldb_ingest_external_files(
+    leveldb_t* db,
+    const char* const* files, size_t num_files,
+    char** errptr) {
+  std::vector<std::string> names(files, files + num_files);
+  SaveError(errptr, db->rep->IngestExternalFiles(names));
+}
+
 void leveldb_destroy_db(
     const leveldb_options_t* options,
     const char* name,
@@ -359,6 +640,13 @@ void leveldb_writebatch_delete(
   b->rep.Delete(Slice(key, klen));
 }
 
+void leveldb_writebatch_merge(
+    leveldb_writebatch_t* b,
+    const char* key, size_t klen,
+    const char* val, size_t vlen) {
+  b->rep.Merge(Slice(key, klen), Slice(val, vlen));
+}
+
 void leveldb_writebatch_iterate(
     leveldb_writebatch_t* b,
     void* state,
@@ -403,6 +691,18 @@ void leveldb_options_set_filter_policy(
   opt->rep.filter_policy = policy;
 }
 
+void leveldb_options_set_merge_operator(
+    leveldb_options_t* opt,
+    leveldb_mergeoperator_t* merge_operator) {
+  opt->rep.merge_operator = merge_operator;
+}
+
+void leveldb_options_set_compaction_filter(
+    leveldb_options_t* opt,
+    leveldb_compactionfilter_t* filter) {
+  opt->rep.compaction_filter = filter;
+}
+
 void leveldb_options_set_create_if_missing(
     leveldb_options_t* opt, unsigned char v) {
   opt->rep.create_if_missing = v;
@@ -430,10 +730,94 @@ void leveldb_options_set_write_buffer_size(leveldb_options_t* opt, size_t s) {
   opt->rep.write_buffer_size = s;
 }
 
+void leveldb_options_set_allow_concurrent_memtable_write(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.allow_concurrent_memtable_write = v;
+}
+
+void leveldb_options_set_enable_pipelined_write(leveldb_options_t* opt,
+                                                unsigned char v) {
+  opt->rep.enable_pipelined_write = v;
+}
+
+void leveldb_options_set_level0_file_num_compaction_trigger(
+    leveldb_options_t* opt, int n) {
+  opt->rep.level0_file_num_compaction_trigger = n;
+}
+
+void leveldb_options_set_level0_slowdown_writes_trigger(
+    leveldb_options_t* opt, int n) {
+  opt->rep.level0_slowdown_writes_trigger = n;
+}
+
+void leveldb_options_set_level0_stop_writes_trigger(
+    leveldb_options_t* opt, int n) {
+  opt->rep.level0_stop_writes_trigger = n;
+}
+
+void leveldb_options_set_soft_pending_compaction_bytes_limit(
+    leveldb_options_t* opt, uint64_t v) {
+  opt->rep.soft_pending_compaction_bytes_limit = v;
+}
+
+void leveldb_options_set_hard_pending_compaction_bytes_limit(
+    leveldb_options_t* opt, uint64_t v) {
+  opt->rep.hard_pending_compaction_bytes_limit = v;
+}
+
+void leveldb_options_set_delayed_write_rate(leveldb_options_t* opt,
+                                            uint64_t v) {
+  opt->rep.delayed_write_rate = v;
+}
+
+void leveldb_options_set_rate_limiter(leveldb_options_t* opt,
+                                      leveldb_ratelimiter_t* limiter) {
+  opt->rep.rate_limiter = (limiter ? limiter->rep : NULL);
+}
+
+void leveldb_options_set_use_direct_io_for_flush_and_compaction(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.use_direct_io_for_flush_and_compaction = v;
+}
+
+void leveldb_options_set_use_direct_reads(leveldb_options_t* opt,
+                                          unsigned char v) {
+  opt->rep.use_direct_reads = v;
+}
+
+void leveldb_options_set_compaction_readahead_size(leveldb_options_t* opt,
+                                                   size_t s) {
+  opt->rep.compaction_readahead_size = s;
+}
+
+void leveldb_options_set_advise_random_on_open(leveldb_options_t* opt,
+                                               unsigned char v) {
+  opt->rep.advise_random_on_open = v;
+}
+
+void leveldb_options_set_bytes_per_sync(leveldb_options_t* opt,
+                                        uint64_t v) {
+  opt->rep.bytes_per_sync = v;
+}
+
+void leveldb_options_set_allow_fallocate(leveldb_options_t* opt,
+                                         unsigned char v) {
+  opt->rep.allow_fallocate = v;
+}
+
+void leveldb_options_set_recycle_log_file_num(leveldb_options_t* opt,
+                                              size_t n) {
+  opt->rep.recycle_log_file_num = n;
+}
+
 void leveldb_options_set_max_open_files(leveldb_options_t* opt, int n) {
   opt->rep.max_open_files = n;
 }
 
+void leveldb_options_set_max_subcompactions(leveldb_options_t* opt, int n) {
+  opt->rep.max_subcompactions = n;
+}
+
 void leveldb_options_set_cache(leveldb_options_t* opt, leveldb_cache_t* c) {
   opt->rep.block_cache = c->rep;
 }
@@ -446,10 +830,54 @@ void leveldb_options_set_block_restart_interval(leveldb_options_t* opt, int n) {
   opt->rep.block_restart_interval = n;
 }
 
+void leveldb_options_set_cache_index_and_filter_blocks(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.cache_index_and_filter_blocks = v;
+}
+
+void leveldb_options_set_pin_l0_filter_and_index_blocks_in_cache(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.pin_l0_filter_and_index_blocks_in_cache = v;
+}
+
+void leveldb_options_set_index_partition_size(leveldb_options_t* opt,
+                                              size_t s) {
+  opt->rep.index_partition_size = s;
+}
+
+void leveldb_options_set_value_log_threshold(leveldb_options_t* opt,
+                                             size_t n) {
+  opt->rep.value_log_threshold = n;
+}
+
+void leveldb_options_set_value_log_gc_ratio(leveldb_options_t* opt,
+                                            double r) {
+  opt->rep.value_log_gc_ratio = r;
+}
+
 void leveldb_options_set_compression(leveldb_options_t* opt, int t) {
   opt->rep.compression = static_cast<CompressionType>(t);
 }
 
+void leveldb_options_set_compression_threads(leveldb_options_t* opt, int n) {
+  opt->rep.compression_threads = n;
+}
+
+void leveldb_options_set_compression_per_level(leveldb_options_t* opt,
+                                               const int* level_values,
+                                               size_t num_levels) {
+  opt->rep.compression_per_level.clear();
+  for (size_t i = 0; i < num_levels; i++) {
+    opt->rep.compression_per_level.push_back(
+        static_cast<CompressionType>(level_values[i]));
+  }
+}
+
+void leveldb_options_set_compression_dict_size(leveldb_options_t* opt,
+                                               size_t s) {
+  opt->rep.compression_dict_size = s;
+}
+
 leveldb_comparator_t* leveldb_comparator_create(
     void* state,
     void (*destructor)(void*),
@@ -496,6 +924,69 @@ void leveldb_filterpolicy_destroy(leveldb_filterpolicy_t* filter) {
   delete filter;
 }
 
+leveldb_mergeoperator_t* leveldb_mergeoperator_create(
+    void* state,
+    void (*destructor)(void*),
+    char* (*full_merge)(
+        void*,
+        const char* key, size_t key_length,
+        const char* existing_value, size_t existing_value_length,
+        const char* const* operands_list, const size_t* operands_list_length,
+        int num_operands,
+        unsigned char* success, size_t* new_value_length),
+    char* (*partial_merge)(
+        void*,
+        const char* key, size_t key_length,
+        const char* left_operand, size_t left_operand_length,
+        const char* right_operand, size_t right_operand_length,
+        unsigned char* success, size_t* new_value_length),
+    const char* (*name)(void*)) {
+  leveldb_mergeoperator_t* result = new leveldb_mergeoperator_t;
+  result->state_ = state;
+  result->destructor_ = destructor;
+  result->full_merge_ = full_merge;
+  result->partial_merge_ = partial_merge;
+  result->name_ = name;
+  return result;
+}
+
+void leveldb_mergeoperator_destroy(leveldb_mergeoperator_t* merge_operator) {
+  delete merge_operator;
+}
+
+leveldb_compactionfilter_t* leveldb_compactionfilter_create(
+    void* state,
+    void (*destructor)(void*),
+    unsigned char (*filter)(
+        void*,
+        int level,
+        const char* key, size_t key_length,
+        const char* existing_value, size_t value_length,
+        char** new_value, size_t* new_value_length,
+        unsigned char* value_changed),
+    const char* (*name)(void*)) {
+  leveldb_compactionfilter_t* result = new leveldb_compactionfilter_t;
+  result->state_ = state;
+  result->destructor_ = destructor;
+  result->filter_ = filter;
+  result->may_filter_ = NULL;
+  result->name_ = name;
+  return result;
+}
+
+void leveldb_compactionfilter_set_may_filter(
+    leveldb_compactionfilter_t* filter,
+    unsigned char (*may_filter)(
+        void*,
+        int level,
+        const char* key, size_t key_length)) {
+  filter->may_filter_ = may_filter;
+}
+
+void leveldb_compactionfilter_destroy(leveldb_compactionfilter_t* filter) {
+  delete filter;
+}
+
 leveldb_filterpolicy_t* leveldb_filterpolicy_create_bloom(int bits_per_key) {
   // Make a leveldb_filterpolicy_t, but override all of its methods so
   // they delegate to a NewBloomFilterPolicy() instead of user
@@ -519,6 +1010,33 @@ leveldb_filterpolicy_t* leveldb_filterpolicy_create_bloom(int bits_per_key) {
   return wrapper;
 }
 
+leveldb_filterpolicy_t* leveldb_filterpolicy_create_sublevel_bloom(
+    int bits_per_key, const char* separator, size_t separator_len) {
+  // Like leveldb_filterpolicy_create_bloom(), but also forwards
+  // CoversPrefix() so that prefix restricted reads can use the filter.
+  struct Wrapper : public leveldb_filterpolicy_t {
+    const FilterPolicy* rep_;
+    ~Wrapper() { delete rep_; }
+    const char* Name() const { return rep_->Name(); }
+    void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+      return rep_->CreateFilter(keys, n, dst);
+    }
+    bool KeyMayMatch(const Slice& key, const Slice& filter) const {
+      return rep_->KeyMayMatch(key, filter);
+    }
+    bool CoversPrefix(const Slice& prefix) const {
+      return rep_->CoversPrefix(prefix);
+    }
+    static void DoNothing(void*) { }
+  };
+  Wrapper* wrapper = new Wrapper;
+  wrapper->rep_ = NewSublevelBloomFilterPolicy(
+      bits_per_key, Slice(separator, separator_len));
+  wrapper->state_ = NULL;
+  wrapper->destructor_ = &Wrapper::DoNothing;
+  return wrapper;
+}
+
 leveldb_readoptions_t* leveldb_readoptions_create() {
   return new leveldb_readoptions_t;
 }
@@ -538,12 +1056,48 @@ void leveldb_readoptions_set_fill_cache(
   opt->rep.fill_cache = v;
 }
 
+void leveldb_readoptions_set_batch_block_reads(
+    leveldb_readoptions_t* opt, unsigned char v) {
+  opt->rep.batch_block_reads = v;
+}
+
+void leveldb_readoptions_set_keys_only(
+    leveldb_readoptions_t* opt, unsigned char v) {
+  opt->rep.keys_only = v;
+}
+
 void leveldb_readoptions_set_snapshot(
     leveldb_readoptions_t* opt,
     const leveldb_snapshot_t* snap) {
   opt->rep.snapshot = (snap ? snap->rep : NULL);
 }
 
+void leveldb_readoptions_set_prefix(
+    leveldb_readoptions_t* opt,
+    const char* prefix, size_t prefix_len) {
+  if (prefix == NULL) {
+    opt->prefix.clear();
+    opt->rep.prefix = NULL;
+  } else {
+    opt->prefix.assign(prefix, prefix_len);
+    opt->prefix_slice = opt->prefix;
+    opt->rep.prefix = &opt->prefix_slice;
+  }
+}
+
+void leveldb_readoptions_set_iterate_upper_bound(
+    leveldb_readoptions_t* opt,
+    const char* key, size_t keylen) {
+  if (key == NULL) {
+    opt->upper_bound.clear();
+    opt->rep.iterate_upper_bound = NULL;
+  } else {
+    opt->upper_bound.assign(key, keylen);
+    opt->upper_bound_slice = opt->upper_bound;
+    opt->rep.iterate_upper_bound = &opt->upper_bound_slice;
+  }
+}
+
 leveldb_writeoptions_t* leveldb_writeoptions_create() {
   return new leveldb_writeoptions_t;
 }
@@ -563,11 +1117,39 @@ leveldb_cache_t* leveldb_cache_create_lru(size_t capacity) {
   return c;
 }
 
+leveldb_cache_t* leveldb_cache_create_lru_protected(
+    size_t capacity, double protected_ratio) {
+  leveldb_cache_t* c = new leveldb_cache_t;
+  c->rep = NewLRUCache(capacity, protected_ratio);
+  return c;
+}
+
+leveldb_cache_t* leveldb_cache_create_clock(
+    size_t capacity, int num_shard_bits, size_t estimated_entry_charge) {
+  leveldb_cache_t* c = new leveldb_cache_t;
+  c->rep = NewClockCache(capacity, num_shard_bits, estimated_entry_charge);
+  return c;
+}
+
 void leveldb_cache_destroy(leveldb_cache_t* cache) {
   delete cache->rep;
   delete cache;
 }
 
+leveldb_ratelimiter_t* leveldb_ratelimiter_create(
+    int64_t flush_bytes_per_sec, int64_t compaction_bytes_per_sec,
+    int64_t burst_micros, unsigned char auto_tuned) {
+  leveldb_ratelimiter_t* r = new leveldb_ratelimiter_t;
+  r->rep = NewGenericRateLimiter(flush_bytes_per_sec, compaction_bytes_per_sec,
+                                 burst_micros, auto_tuned);
+  return r;
+}
+
+void leveldb_ratelimiter_destroy(leveldb_ratelimiter_t* limiter) {
+  delete limiter->rep;
+  delete limiter;
+}
+
 leveldb_env_t* leveldb_create_default_env() {
   leveldb_env_t* result = new leveldb_env_t;
   result->rep = Env::Default();
@@ -575,11 +1157,73 @@ leveldb_env_t* leveldb_create_default_env() {
   return result;
 }
 
+leveldb_env_t* leveldb_create_io_uring_env() {
+  leveldb_env_t* result = new leveldb_env_t;
+  result->rep = NewIOUringEnv(Env::Default());
+  result->is_default = false;
+  return result;
+}
+
+leveldb_sstfilewriter_t* leveldb_sstfilewriter_create(
+    const leveldb_options_t* options) {
+  leveldb_sstfilewriter_t* result = new leveldb_sstfilewriter_t;
+  result->rep = new SstFileWriter(options->rep);
+  return result;
+}
+
+void leveldb_sstfilewriter_destroy(leveldb_sstfilewriter_t* writer) {
+  delete writer->rep;
+  delete writer;
+}
+
+void leveldb_sstfilewriter_open(
+    leveldb_sstfilewriter_t* writer, const char* name, char** errptr) {
+  SaveError(errptr, writer->rep->Open(name));
+}
+
+void leveldb_sstfilewriter_add(
+    leveldb_sstfilewriter_t* writer,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr) {
+  SaveError(errptr, writer->rep->Add(Slice(key, keylen), Slice(val, vallen)));
+}
+
+void leveldb_sstfilewriter_finish(
+    leveldb_sstfilewriter_t* writer, char** errptr) {
+  SaveError(errptr, writer->rep->Finish());
+}
+
+uint64_t leveldb_sstfilewriter_file_size(leveldb_sstfilewriter_t* writer) {
+  return writer->rep->FileSize();
+}
+
 void leveldb_env_destroy(leveldb_env_t* env) {
   if (!env->is_default) delete env->rep;
   delete env;
 }
 
+void leveldb_env_set_background_threads(
+    leveldb_env_t* env, int number, int priority) {
+  env->rep->SetBackgroundThreads(number, static_cast<Env::Priority>(priority));
+}
+
+void leveldb_env_lower_thread_pool_io_priority(leveldb_env_t* env,
+                                               int priority) {
+  env->rep->LowerThreadPoolIOPriority(static_cast<Env::Priority>(priority));
+}
+
+void leveldb_env_lower_thread_pool_cpu_priority(leveldb_env_t* env,
+                                                int priority) {
+  env->rep->LowerThreadPoolCPUPriority(static_cast<Env::Priority>(priority));
+}
+
+void leveldb_env_set_thread_pool_cpu_affinity(
+    leveldb_env_t* env, const int* cpus, size_t num_cpus, int priority) {
+  std::vector<int> v(cpus, cpus + num_cpus);
+  env->rep->SetThreadPoolCPUAffinity(v, static_cast<Env::Priority>(priority));
+}
+
 void leveldb_free(void* ptr) {
   free(ptr);
 }
@@ -4,6 +4,7 @@
 
 #include "leveldb/c.h"
 
+#include <ctype.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -154,10 +155,92 @@ unsigned char FilterKeyMatch(
   return fake_filter_result;
 }
 
+// Custom merge operator that concatenates the operands
+static void MergeDestroy(void* arg) { }
+static const char* MergeName(void* arg) {
+  return "TestMerge";
+}
+static char* MergeFull(
+    void* arg,
+    const char* key, size_t key_length,
+    const char* existing_value, size_t existing_value_length,
+    const char* const* operands_list, const size_t* operands_list_length,
+    int num_operands,
+    unsigned char* success, size_t* new_value_length) {
+  size_t n = existing_value_length;
+  int i;
+  char* result;
+  for (i = 0; i < num_operands; i++) {
+    n += operands_list_length[i];
+  }
+  result = malloc(n + 1);
+  if (existing_value != NULL) {
+    memcpy(result, existing_value, existing_value_length);
+  }
+  n = existing_value_length;
+  for (i = 0; i < num_operands; i++) {
+    memcpy(result + n, operands_list[i], operands_list_length[i]);
+    n += operands_list_length[i];
+  }
+  *new_value_length = n;
+  *success = 1;
+  return result;
+}
+static char* MergePartial(
+    void* arg,
+    const char* key, size_t key_length,
+    const char* left_operand, size_t left_operand_length,
+    const char* right_operand, size_t right_operand_length,
+    unsigned char* success, size_t* new_value_length) {
+  char* result = malloc(left_operand_length + right_operand_length);
+  memcpy(result, left_operand, left_operand_length);
+  memcpy(result + left_operand_length, right_operand, right_operand_length);
+  *new_value_length = left_operand_length + right_operand_length;
+  *success = 1;
+  return result;
+}
+
+// Custom compaction filter that removes keys starting with "tmp" and
+// upper-cases the value of "up", leaving "keep" alone
+static void CompactionFilterDestroy(void* arg) { }
+static const char* CompactionFilterName(void* arg) {
+  return "TestCompactionFilter";
+}
+static unsigned char CompactionFilterFilter(
+    void* arg,
+    int level,
+    const char* key, size_t key_length,
+    const char* existing_value, size_t value_length,
+    char** new_value, size_t* new_value_length,
+    unsigned char* value_changed) {
+  size_t i;
+  CheckCondition(level > 0);
+  CheckCondition(key_length != 4 || memcmp(key, "keep", 4) != 0);
+  if (key_length >= 3 && memcmp(key, "tmp", 3) == 0) {
+    return 1;
+  }
+  if (key_length == 2 && memcmp(key, "up", 2) == 0) {
+    *new_value = malloc(value_length);
+    for (i = 0; i < value_length; i++) {
+      (*new_value)[i] = toupper((unsigned char) existing_value[i]);
+    }
+    *new_value_length = value_length;
+    *value_changed = 1;
+  }
+  return 0;
+}
+static unsigned char CompactionFilterMayFilter(
+    void* arg,
+    int level,
+    const char* key, size_t key_length) {
+  return key_length != 4 || memcmp(key, "keep", 4) != 0;
+}
+
 int main(int argc, char** argv) {
   leveldb_t* db;
   leveldb_comparator_t* cmp;
   leveldb_cache_t* cache;
+  leveldb_ratelimiter_t* limiter;
   leveldb_env_t* env;
   leveldb_options_t* options;
   leveldb_readoptions_t* roptions;
@@ -177,11 +260,13 @@ int main(int argc, char** argv) {
   cmp = leveldb_comparator_create(NULL, CmpDestroy, CmpCompare, CmpName);
   env = leveldb_create_default_env();
   cache = leveldb_cache_create_lru(100000);
+  limiter = leveldb_ratelimiter_create(64 << 20, 32 << 20, 100000, 1);
 
   options = leveldb_options_create();
   leveldb_options_set_comparator(options, cmp);
   leveldb_options_set_error_if_exists(options, 1);
   leveldb_options_set_cache(options, cache);
+  leveldb_options_set_rate_limiter(options, limiter);
   leveldb_options_set_env(options, env);
   leveldb_options_set_info_log(options, NULL);
   leveldb_options_set_write_buffer_size(options, 100000);
@@ -273,6 +358,43 @@ int main(int argc, char** argv) {
     leveldb_iter_destroy(iter);
   }
 
+  StartPhase("get_pinned");
+  {
+    size_t len;
+    const char* val;
+    leveldb_pinnableslice_t* p;
+    p = leveldb_get_pinned(db, roptions, "foo", 3, &err);
+    CheckNoError(err);
+    CheckCondition(p != NULL);
+    val = leveldb_pinnableslice_value(p, &len);
+    CheckEqual("hello", val, len);
+    leveldb_pinnableslice_destroy(p);
+    p = leveldb_get_pinned(db, roptions, "missing", 7, &err);
+    CheckNoError(err);
+    CheckCondition(p == NULL);
+  }
+
+  StartPhase("multi_get");
+  {
+    const char* keys[3] = { "box", "missing", "foo" };
+    size_t keys_sizes[3] = { 3, 7, 3 };
+    char* vals[3];
+    size_t vals_sizes[3];
+    char* errs[3] = { NULL, NULL, NULL };
+    int i;
+    leveldb_multi_get(db, roptions, 3, keys, keys_sizes,
+                      vals, vals_sizes, errs);
+    for (i = 0; i < 3; i++) {
+      CheckNoError(errs[i]);
+    }
+    CheckEqual("c", vals[0], vals_sizes[0]);
+    CheckEqual(NULL, vals[1], vals_sizes[1]);
+    CheckEqual("hello", vals[2], vals_sizes[2]);
+    for (i = 0; i < 3; i++) {
+      Free(&vals[i]);
+    }
+  }
+
   StartPhase("approximate_sizes");
   {
     int i;
@@ -376,12 +498,160 @@ int main(int argc, char** argv) {
     leveldb_filterpolicy_destroy(policy);
   }
 
+  StartPhase("merge");
+  {
+    leveldb_mergeoperator_t* merge_operator = leveldb_mergeoperator_create(
+        NULL, MergeDestroy, MergeFull, MergePartial, MergeName);
+    leveldb_writebatch_t* wb;
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_merge_operator(options, merge_operator);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_merge(db, woptions, "foo", 3, "a", 1, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "foo", "a");
+    leveldb_put(db, woptions, "bar", 3, "x", 1, &err);
+    CheckNoError(err);
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    wb = leveldb_writebatch_create();
+    leveldb_writebatch_merge(wb, "foo", 3, "b", 1);
+    leveldb_writebatch_merge(wb, "bar", 3, "y", 1);
+    leveldb_write(db, woptions, wb, &err);
+    CheckNoError(err);
+    leveldb_writebatch_destroy(wb);
+    CheckGet(db, roptions, "foo", "ab");
+    CheckGet(db, roptions, "bar", "xy");
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    CheckGet(db, roptions, "foo", "ab");
+    CheckGet(db, roptions, "bar", "xy");
+    leveldb_merge(db, woptions, "bar", 3, "z", 1, &err);
+    CheckNoError(err);
+    {
+      leveldb_mergeoperands_t* m;
+      const char* val;
+      size_t len;
+      m = leveldb_get_merge_operands(db, roptions, "bar", 3, 0, &err);
+      CheckNoError(err);
+      CheckCondition(m != NULL);
+      CheckCondition(leveldb_mergeoperands_has_value(m));
+      CheckCondition(leveldb_mergeoperands_value_size(m) == 2);
+      CheckCondition(leveldb_mergeoperands_value(m, &len) == NULL);
+      CheckCondition(leveldb_mergeoperands_count(m) == 1);
+      val = leveldb_mergeoperands_operand(m, 0, &len);
+      CheckEqual("z", val, len);
+      leveldb_mergeoperands_destroy(m);
+      m = leveldb_get_merge_operands(db, roptions, "bar", 3, 1, &err);
+      CheckNoError(err);
+      val = leveldb_mergeoperands_value(m, &len);
+      CheckEqual("xy", val, len);
+      leveldb_mergeoperands_destroy(m);
+      m = leveldb_get_merge_operands(db, roptions, "missing", 7, 1, &err);
+      CheckNoError(err);
+      CheckCondition(m == NULL);
+    }
+    {
+      // A keys_only iterator does not apply the operands of "bar"
+      leveldb_readoptions_t* ro = leveldb_readoptions_create();
+      leveldb_iterator_t* iter;
+      leveldb_readoptions_set_keys_only(ro, 1);
+      iter = leveldb_create_iterator(db, ro);
+      leveldb_iter_seek_to_first(iter);
+      CheckIter(iter, "bar", "");
+      leveldb_iter_next(iter);
+      CheckIter(iter, "foo", "ab");
+      leveldb_iter_get_error(iter, &err);
+      CheckNoError(err);
+      leveldb_iter_destroy(iter);
+      leveldb_readoptions_destroy(ro);
+    }
+    leveldb_close(db);
+    leveldb_options_set_merge_operator(options, NULL);
+    leveldb_options_set_error_if_exists(options, 0);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_merge(db, woptions, "foo", 3, "c", 1, &err);
+    CheckCondition(err != NULL);
+    Free(&err);
+    leveldb_mergeoperator_destroy(merge_operator);
+  }
+
+  StartPhase("compaction_filter");
+  {
+    leveldb_compactionfilter_t* filter = leveldb_compactionfilter_create(
+        NULL, CompactionFilterDestroy, CompactionFilterFilter,
+        CompactionFilterName);
+    leveldb_compactionfilter_set_may_filter(filter,
+                                            CompactionFilterMayFilter);
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_compaction_filter(options, filter);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "tmp1", 4, "x", 1, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "up", 2, "value", 5, &err);
+    CheckNoError(err);
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    leveldb_put(db, woptions, "tmp2", 4, "y", 1, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "keep", 4, "z", 1, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "tmp2", "y");
+    // The second table overlaps the first, so both get compacted
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    CheckGet(db, roptions, "tmp1", NULL);
+    CheckGet(db, roptions, "tmp2", NULL);
+    CheckGet(db, roptions, "up", "VALUE");
+    CheckGet(db, roptions, "keep", "z");
+    leveldb_close(db);
+    leveldb_options_set_compaction_filter(options, NULL);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_compactionfilter_destroy(filter);
+  }
+
+  StartPhase("ingest");
+  {
+    char sstname[sizeof(dbname) + 4];
+    const char* files[1];
+    leveldb_sstfilewriter_t* writer = leveldb_sstfilewriter_create(options);
+    snprintf(sstname, sizeof(sstname), "%s.sst", dbname);
+    leveldb_sstfilewriter_open(writer, sstname, &err);
+    CheckNoError(err);
+    leveldb_sstfilewriter_add(writer, "x1", 2, "a", 1, &err);
+    CheckNoError(err);
+    leveldb_sstfilewriter_add(writer, "x2", 2, "b", 1, &err);
+    CheckNoError(err);
+    CheckCondition(leveldb_sstfilewriter_file_size(writer) == 0);
+    leveldb_sstfilewriter_add(writer, "x0", 2, "c", 1, &err);
+    CheckCondition(err != NULL);
+    Free(&err);
+    leveldb_sstfilewriter_finish(writer, &err);
+    CheckNoError(err);
+    leveldb_sstfilewriter_destroy(writer);
+    files[0] = sstname;
+    leveldb_ingest_external_files(db, files, 1, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "x1", "a");
+    CheckGet(db, roptions, "x2", "b");
+    leveldb_put(db, woptions, "x1", 2, "new", 3, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "x1", "new");
+    // The file goes on top of the keys it replaces
+    leveldb_ingest_external_files(db, files, 1, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "x1", "a");
+    unlink(sstname);
+  }
+
   StartPhase("cleanup");
   leveldb_close(db);
   leveldb_options_destroy(options);
   leveldb_readoptions_destroy(roptions);
   leveldb_writeoptions_destroy(woptions);
   leveldb_cache_destroy(cache);
+  leveldb_ratelimiter_destroy(limiter);
   leveldb_comparator_destroy(cmp);
   leveldb_env_destroy(env);
 
@@ -10,10 +10,13 @@
 #include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/write_batch.h"
 #include "port/port.h"
+#include "table/block_builder.h"
 #include "util/crc32c.h"
 #include "util/histogram.h"
+#include "util/lz.h"
 #include "util/mutexlock.h"
 #include "util/random.h"
 #include "util/testutil.h"
@@ -22,6 +25,8 @@
 //   Actual benchmarks:
 //      fillseq       -- write N values in sequential key order in async mode
 //      fillrandom    -- write N values in random key order in async mode
+//      fillmulti     -- like fillrandom, but the N values are split among
+//                       --threads writers that write at the same time
 //      overwrite     -- overwrite N values in random key order in async mode
 //      fillsync      -- write N/100 values in random key order in sync mode
 //      fill100K      -- write N/1000 100K values in random order in async mode
@@ -31,14 +36,31 @@
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
 //      readmissing   -- read N missing keys in random order
+//      multireadrandom -- read N keys with MultiGet, in batches of
+//                       --multiget_batch consecutive keys at random spots
 //      readhot       -- read N times in random order from 1% section of DB
+//      scanreadhot   -- readhot interleaved with 10000-entry scans, reports
+//                       the block cache hit rate of the point lookups
+//      readwhilecompacting -- --threads readers read N times in random
+//                       order while another thread overwrites keys as fast
+//                       as it can, keeping compactions busy.  Reports read
+//                       latency percentiles; compare runs with and without
+//                       --bg_io_priority_low, --bg_cpu_priority_low and
+//                       --bg_cpus
 //      seekrandom    -- N random seeks
 //      crc32c        -- repeated crc32c of 4K of data
 //      acquireload   -- load N*1000 times
+//      snappycomp    -- compress 1G of data blocks with snappy, reports the
+//                       compressed size (see --levelfs_data)
+//      snappyuncomp  -- uncompress 1G of data blocks with snappy
+//      lzcomp        -- like snappycomp with the built-in LZ codec
+//      lzuncomp      -- like snappyuncomp with the built-in LZ codec
 //   Meta operations:
 //      compact     -- Compact the entire DB
 //      stats       -- Print DB stats
 //      sstables    -- Print sstable info
+//      writestalls -- Print the writes slowed down or stopped so far
+//      ratelimiter -- Print the background writes held back so far
 //      heapprofile -- Dump a heap profile (if supported by this port)
 static const char* FLAGS_benchmarks =
     "fillseq,"
@@ -57,6 +79,8 @@ static const char* FLAGS_benchmarks =
     "crc32c,"
     "snappycomp,"
     "snappyuncomp,"
+    "lzcomp,"
+    "lzuncomp,"
     "acquireload,"
     ;
 
@@ -76,6 +100,22 @@ static int FLAGS_value_size = 100;
 // their original size after compression
 static double FLAGS_compression_ratio = 0.5;
 
+// Compression used for tables: none, snappy or lz
+static leveldb::CompressionType FLAGS_compression =
+    leveldb::kSnappyCompression;
+
+// Compression of each level, as a comma-separated list of the values of
+// --compression.  Empty means use --compression for all levels.
+static const char* FLAGS_compression_per_level = "";
+
+// Size of the compression dictionary of each table (0 for none)
+static int FLAGS_compression_dict_size = 0;
+
+// If true, the compression benchmarks work on data blocks of levelfs
+// entries (file paths as keys and text file contents as values) instead
+// of blocks of random data.
+static bool FLAGS_levelfs_data = false;
+
 // Print histogram of operation timings
 static bool FLAGS_histogram = false;
 
@@ -87,9 +127,83 @@ static int FLAGS_write_buffer_size = 0;
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// Fraction of the block cache reserved for entries that have been used
+// more than once.  Zero gives a plain LRU cache; anything larger makes
+// the cache scan resistant.
+static double FLAGS_cache_protected_ratio = 0;
+
+// If false, copy table reads out of mmap()ed files so that data blocks go
+// through the block cache even when they are stored uncompressed.
+static bool FLAGS_mmap_read = true;
+
+// If true, keep index and filter blocks in the block cache
+static bool FLAGS_cache_index_and_filter_blocks = false;
+
+// If non-zero, partition table indexes into blocks of this many bytes
+static int FLAGS_index_partition_size = 0;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
+// Maximum number of threads that work on a single compaction
+static int FLAGS_max_subcompactions = 0;
+
+// Number of threads that compress the blocks of a table being written
+static int FLAGS_compression_threads = 0;
+
+// If true, the writers of a write group insert into the memtable in
+// parallel
+static bool FLAGS_concurrent_memtable_writes = false;
+
+// If true, write groups insert into the memtable while the next group
+// appends to the log
+static bool FLAGS_pipelined_writes = false;
+
+// Number of level-0 files at which compactions start, writes are slowed
+// down and writes stop (use defaults if == 0)
+static int FLAGS_level0_file_num_compaction_trigger = 0;
+static int FLAGS_level0_slowdown_writes_trigger = 0;
+static int FLAGS_level0_stop_writes_trigger = 0;
+
+// If true, lower the I/O or CPU priority of the compaction threads
+static bool FLAGS_bg_io_priority_low = false;
+static bool FLAGS_bg_cpu_priority_low = false;
+
+// Comma-separated CPUs the compaction threads run on (any CPU if empty)
+static const char* FLAGS_bg_cpus = "";
+
+// Highest rate in bytes per second of writes that are slowed down
+static int FLAGS_delayed_write_rate = 0;
+
+// Limits in bytes per second on the writes of flushes and compactions
+// (unlimited if == 0), and whether they are auto-tuned
+static int FLAGS_flush_rate_limit = 0;
+static int FLAGS_compaction_rate_limit = 0;
+static bool FLAGS_rate_limit_auto_tune = false;
+
+// If true, flushes and compactions, or user reads, bypass the page cache
+static bool FLAGS_use_direct_io_for_flush_and_compaction = false;
+static bool FLAGS_use_direct_reads = false;
+
+// Size of the buffer compactions read their inputs through (use default
+// if < 0), and whether tables for user reads are advised as read at random
+static int FLAGS_compaction_readahead_size = -1;
+static bool FLAGS_advise_random_on_open = true;
+
+// Bytes appended to a file between starts of its write-back (off if 0),
+// whether files are preallocated, and how many old logs are reused
+static int FLAGS_bytes_per_sync = 0;
+static bool FLAGS_allow_fallocate = true;
+static int FLAGS_recycle_log_file_num = 0;
+
+// Number of keys looked up by each MultiGet in multireadrandom
+static int FLAGS_multiget_batch = 32;
+
+// If true, table reads go through an io_uring Env, and seekrandom and
+// multireadrandom read the blocks of each lookup with one batch
+static bool FLAGS_io_uring = false;
+static bool FLAGS_batch_block_reads = false;
+
 // Bloom filter bits per key.
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
@@ -106,6 +220,76 @@ namespace leveldb {
 
 namespace {
 
+// Block cache wrapper that counts lookup hits and misses.
+class CountingCache : public Cache {
+ private:
+  Cache* target_;
+  uint64_t hits_;     // Accessed atomically
+  uint64_t misses_;   // Accessed atomically
+
+ public:
+  explicit CountingCache(Cache* target)
+      : target_(target), hits_(0), misses_(0) { }
+  virtual ~CountingCache() { delete target_; }
+
+  uint64_t hits() const { return __atomic_load_n(&hits_, __ATOMIC_RELAXED); }
+  uint64_t misses() const {
+    return __atomic_load_n(&misses_, __ATOMIC_RELAXED);
+  }
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    return target_->Insert(key, value, charge, deleter);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    return target_->Insert(key, value, charge, deleter, priority);
+  }
+  virtual Handle* Lookup(const Slice& key) {
+    Handle* h = target_->Lookup(key);
+    __atomic_add_fetch(h != NULL ? &hits_ : &misses_, 1, __ATOMIC_RELAXED);
+    return h;
+  }
+  virtual void Release(Handle* handle) { target_->Release(handle); }
+  virtual void* Value(Handle* handle) { return target_->Value(handle); }
+  virtual void Erase(const Slice& key) { target_->Erase(key); }
+  virtual uint64_t NewId() { return target_->NewId(); }
+};
+
+// Env that copies mmap()ed table reads into the caller's scratch buffer,
+// which makes the blocks read from them eligible for the block cache.
+class CopyingReadEnv : public EnvWrapper {
+ private:
+  class CopyingFile : public RandomAccessFile {
+   private:
+    RandomAccessFile* target_;
+   public:
+    explicit CopyingFile(RandomAccessFile* target) : target_(target) { }
+    virtual ~CopyingFile() { delete target_; }
+    virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                        char* scratch) const {
+      Status s = target_->Read(offset, n, result, scratch);
+      if (s.ok() && result->data() != scratch) {
+        memcpy(scratch, result->data(), result->size());
+        *result = Slice(scratch, result->size());
+      }
+      return s;
+    }
+  };
+
+ public:
+  explicit CopyingReadEnv(Env* target) : EnvWrapper(target) { }
+  virtual Status NewRandomAccessFile(const std::string& f,
+                                     RandomAccessFile** r) {
+    Status s = target()->NewRandomAccessFile(f, r);
+    if (s.ok()) {
+      *r = new CopyingFile(*r);
+    }
+    return s;
+  }
+};
+
 // Helper for quickly generating random data.
 class RandomGenerator {
  private:
@@ -138,6 +322,20 @@ class RandomGenerator {
   }
 };
 
+// Parse the name of a compression type as given to --compression
+static bool ParseCompression(const Slice& name, CompressionType* type) {
+  if (name == Slice("none")) {
+    *type = kNoCompression;
+  } else if (name == Slice("snappy")) {
+    *type = kSnappyCompression;
+  } else if (name == Slice("lz")) {
+    *type = kLZCompression;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 static Slice TrimSpace(Slice s) {
   size_t start = 0;
   while (start < s.size() && isspace(s[start])) {
@@ -281,7 +479,10 @@ struct SharedState {
   int num_done;
   bool start;
 
-  SharedState() : cv(&mu) { }
+  // Latency of the reads of readwhilecompacting
+  Histogram read_latency;
+
+  SharedState() : cv(&mu) { read_latency.Clear(); }
 };
 
 // Per-thread state for concurrent executions of the same benchmark.
@@ -301,8 +502,9 @@ struct ThreadState {
 
 class Benchmark {
  private:
-  Cache* cache_;
+  CountingCache* cache_;
   const FilterPolicy* filter_policy_;
+  RateLimiter* rate_limiter_;
   DB* db_;
   int num_;
   int value_size_;
@@ -387,10 +589,18 @@ class Benchmark {
 
  public:
   Benchmark()
-  : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
+  : cache_(FLAGS_cache_size >= 0
+           ? new CountingCache(NewLRUCache(FLAGS_cache_size,
+                                           FLAGS_cache_protected_ratio))
+           : NULL),
     filter_policy_(FLAGS_bloom_bits >= 0
                    ? NewBloomFilterPolicy(FLAGS_bloom_bits)
                    : NULL),
+    rate_limiter_(FLAGS_flush_rate_limit > 0 || FLAGS_compaction_rate_limit > 0
+                  ? NewGenericRateLimiter(FLAGS_flush_rate_limit,
+                                          FLAGS_compaction_rate_limit,
+                                          100000, FLAGS_rate_limit_auto_tune)
+                  : NULL),
     db_(NULL),
     num_(FLAGS_num),
     value_size_(FLAGS_value_size),
@@ -413,6 +623,7 @@ class Benchmark {
     delete db_;
     delete cache_;
     delete filter_policy_;
+    delete rate_limiter_;
   }
 
   void Run() {
@@ -452,6 +663,10 @@ class Benchmark {
       } else if (name == Slice("fillrandom")) {
         fresh_db = true;
         method = &Benchmark::WriteRandom;
+      } else if (name == Slice("fillmulti")) {
+        fresh_db = true;
+        num_ /= num_threads;
+        method = &Benchmark::WriteRandom;
       } else if (name == Slice("overwrite")) {
         fresh_db = false;
         method = &Benchmark::WriteRandom;
@@ -471,12 +686,16 @@ class Benchmark {
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("multireadrandom")) {
+        method = &Benchmark::MultiReadRandom;
       } else if (name == Slice("readmissing")) {
         method = &Benchmark::ReadMissing;
       } else if (name == Slice("seekrandom")) {
         method = &Benchmark::SeekRandom;
       } else if (name == Slice("readhot")) {
         method = &Benchmark::ReadHot;
+      } else if (name == Slice("scanreadhot")) {
+        method = &Benchmark::ScanReadHot;
       } else if (name == Slice("readrandomsmall")) {
         reads_ /= 1000;
         method = &Benchmark::ReadRandom;
@@ -487,6 +706,9 @@ class Benchmark {
       } else if (name == Slice("readwhilewriting")) {
         num_threads++;  // Add extra thread for writing
         method = &Benchmark::ReadWhileWriting;
+      } else if (name == Slice("readwhilecompacting")) {
+        num_threads++;  // Add extra thread for writing
+        method = &Benchmark::ReadWhileCompacting;
       } else if (name == Slice("compact")) {
         method = &Benchmark::Compact;
       } else if (name == Slice("crc32c")) {
@@ -497,12 +719,20 @@ class Benchmark {
         method = &Benchmark::SnappyCompress;
       } else if (name == Slice("snappyuncomp")) {
         method = &Benchmark::SnappyUncompress;
+      } else if (name == Slice("lzcomp")) {
+        method = &Benchmark::LZCompress;
+      } else if (name == Slice("lzuncomp")) {
+        method = &Benchmark::LZUncompress;
       } else if (name == Slice("heapprofile")) {
         HeapProfile();
       } else if (name == Slice("stats")) {
         PrintStats("leveldb.stats");
       } else if (name == Slice("sstables")) {
         PrintStats("leveldb.sstables");
+      } else if (name == Slice("writestalls")) {
+        PrintStats("leveldb.write-stalls");
+      } else if (name == Slice("ratelimiter")) {
+        PrintStats("leveldb.rate-limiter");
       } else {
         if (name != Slice()) {  // No error message for empty name
           fprintf(stderr, "unknown benchmark '%s'\n", name.ToString().c_str());
@@ -640,22 +870,75 @@ class Benchmark {
     if (ptr == NULL) exit(1); // Disable unused variable warning.
   }
 
-  void SnappyCompress(ThreadState* thread) {
-    RandomGenerator gen;
-    Slice input = gen.Generate(Options().block_size);
+  // Return a data block of about block_size bytes to compress
+  std::string CompressionInput() {
+    const size_t block_size = Options().block_size;
+    if (!FLAGS_levelfs_data) {
+      RandomGenerator gen;
+      return gen.Generate(block_size).ToString();
+    }
+
+    // Keys are paths with levelfs' separator and an internal key
+    // trailer; values are lines of words, like source or text files.
+    static const char* kWords[] = {
+      "the", "int", "return", "if", "else", "for", "while", "static",
+      "const", "char", "void", "struct", "include", "define", "data",
+      "file", "value", "result", "error", "buffer", "size", "count",
+    };
+    static const int kNumWords = sizeof(kWords) / sizeof(kWords[0]);
+    static const char kSep[] = "\xc3\xbf";
+    Random rnd(301);
+    Options options;
+    BlockBuilder builder(&options);
+    for (int i = 0; builder.CurrentSizeEstimate() < block_size; i++) {
+      char path[100];
+      snprintf(path, sizeof(path),
+               "%shome%suser%sproject%d%ssrc%sfile%05d.c",
+               kSep, kSep, kSep, i / 64, kSep, kSep, i);
+      std::string key = path;
+      key.append(8, '\0');
+      std::string value;
+      const size_t len = 20 + rnd.Skewed(10);
+      while (value.size() < len) {
+        value.append(rnd.OneIn(8) ? "\n\t" : " ");
+        value.append(kWords[rnd.Uniform(kNumWords)]);
+      }
+      builder.Add(key, value);
+    }
+    return builder.Finish().ToString();
+  }
+
+  static bool CompressBlock(CompressionType type, const std::string& input,
+                            std::string* output) {
+    if (type == kSnappyCompression) {
+      return port::Snappy_Compress(input.data(), input.size(), output);
+    }
+    return lz::Compress(input.data(), input.size(), output);
+  }
+
+  static bool UncompressBlock(CompressionType type, const std::string& input,
+                              char* output) {
+    if (type == kSnappyCompression) {
+      return port::Snappy_Uncompress(input.data(), input.size(), output);
+    }
+    return lz::Uncompress(input.data(), input.size(), output);
+  }
+
+  void Compress(ThreadState* thread, CompressionType type) {
+    std::string input = CompressionInput();
     int64_t bytes = 0;
     int64_t produced = 0;
     bool ok = true;
     std::string compressed;
     while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+      ok = CompressBlock(type, input, &compressed);
       produced += compressed.size();
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      thread->stats.AddMessage("(compression failure)");
     } else {
       char buf[100];
       snprintf(buf, sizeof(buf), "(output: %.1f%%)",
@@ -665,28 +948,42 @@ class Benchmark {
     }
   }
 
-  void SnappyUncompress(ThreadState* thread) {
-    RandomGenerator gen;
-    Slice input = gen.Generate(Options().block_size);
+  void Uncompress(ThreadState* thread, CompressionType type) {
+    std::string input = CompressionInput();
     std::string compressed;
-    bool ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+    bool ok = CompressBlock(type, input, &compressed);
     int64_t bytes = 0;
     char* uncompressed = new char[input.size()];
-    while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok =  port::Snappy_Uncompress(compressed.data(), compressed.size(),
-                                    uncompressed);
+    while (ok && bytes < 1024 * 1048576) {  // Uncompress 1G
+      ok = UncompressBlock(type, compressed, uncompressed);
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
     delete[] uncompressed;
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      thread->stats.AddMessage("(compression failure)");
     } else {
       thread->stats.AddBytes(bytes);
     }
   }
 
+  void SnappyCompress(ThreadState* thread) {
+    Compress(thread, kSnappyCompression);
+  }
+
+  void SnappyUncompress(ThreadState* thread) {
+    Uncompress(thread, kSnappyCompression);
+  }
+
+  void LZCompress(ThreadState* thread) {
+    Compress(thread, kLZCompression);
+  }
+
+  void LZUncompress(ThreadState* thread) {
+    Uncompress(thread, kLZCompression);
+  }
+
   void Open() {
     assert(db_ == NULL);
     Options options;
@@ -694,7 +991,54 @@ class Benchmark {
     options.block_cache = cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
     options.max_open_files = FLAGS_open_files;
+    options.max_subcompactions = FLAGS_max_subcompactions;
+    options.compression_threads = FLAGS_compression_threads;
+    options.allow_concurrent_memtable_write =
+        FLAGS_concurrent_memtable_writes;
+    options.enable_pipelined_write = FLAGS_pipelined_writes;
+    options.level0_file_num_compaction_trigger =
+        FLAGS_level0_file_num_compaction_trigger;
+    options.level0_slowdown_writes_trigger =
+        FLAGS_level0_slowdown_writes_trigger;
+    options.level0_stop_writes_trigger = FLAGS_level0_stop_writes_trigger;
+    options.delayed_write_rate = FLAGS_delayed_write_rate;
+    options.rate_limiter = rate_limiter_;
+    options.use_direct_io_for_flush_and_compaction =
+        FLAGS_use_direct_io_for_flush_and_compaction;
+    options.use_direct_reads = FLAGS_use_direct_reads;
+    if (FLAGS_compaction_readahead_size >= 0) {
+      options.compaction_readahead_size = FLAGS_compaction_readahead_size;
+    }
+    options.advise_random_on_open = FLAGS_advise_random_on_open;
+    options.bytes_per_sync = FLAGS_bytes_per_sync;
+    options.allow_fallocate = FLAGS_allow_fallocate;
+    options.recycle_log_file_num = FLAGS_recycle_log_file_num;
+    options.compression = FLAGS_compression;
+    options.compression_dict_size = FLAGS_compression_dict_size;
+    Slice levels = FLAGS_compression_per_level;
+    while (!levels.empty()) {
+      const char* comma = strchr(levels.data(), ',');
+      const size_t len = (comma == NULL) ? levels.size() : comma - levels.data();
+      CompressionType type;
+      if (!ParseCompression(Slice(levels.data(), len), &type)) {
+        fprintf(stderr, "invalid --compression_per_level\n");
+        exit(1);
+      }
+      options.compression_per_level.push_back(type);
+      levels.remove_prefix(comma == NULL ? len : len + 1);
+    }
     options.filter_policy = filter_policy_;
+    options.cache_index_and_filter_blocks = FLAGS_cache_index_and_filter_blocks;
+    options.pin_l0_filter_and_index_blocks_in_cache =
+        FLAGS_cache_index_and_filter_blocks;
+    options.index_partition_size = FLAGS_index_partition_size;
+    if (FLAGS_io_uring) {
+      static Env* io_uring_env = NewIOUringEnv(Env::Default());
+      options.env = io_uring_env;
+    } else if (!FLAGS_mmap_read) {
+      static CopyingReadEnv copying_env(Env::Default());
+      options.env = &copying_env;
+    }
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -784,6 +1128,37 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  void MultiReadRandom(ThreadState* thread) {
+    ReadOptions options;
+    options.batch_block_reads = FLAGS_batch_block_reads;
+    const int batch = FLAGS_multiget_batch;
+    std::vector<std::string> key_strings(batch);
+    std::vector<Slice> keys(batch);
+    std::vector<std::string> values(batch);
+    std::vector<Status> statuses(batch);
+    int found = 0;
+    for (int i = 0; i < reads_; i += batch) {
+      // A run of neighbouring keys, like the entries of one directory
+      const int start = thread->rand.Next() % FLAGS_num;
+      for (int j = 0; j < batch; j++) {
+        char key[100];
+        snprintf(key, sizeof(key), "%016d", (start + j) % FLAGS_num);
+        key_strings[j] = key;
+        keys[j] = key_strings[j];
+      }
+      db_->MultiGet(options, batch, &keys[0], &values[0], &statuses[0]);
+      for (int j = 0; j < batch; j++) {
+        if (statuses[j].ok()) {
+          found++;
+        }
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -809,8 +1184,50 @@ class Benchmark {
     }
   }
 
+  void ScanReadHot(ThreadState* thread) {
+    if (cache_ == NULL) {
+      thread->stats.AddMessage("(needs --cache_size)");
+      return;
+    }
+    ReadOptions options;
+    std::string value;
+    const int range = (FLAGS_num + 99) / 100;
+    const int kReadsPerScan = 100;
+    const int kScanLength = 10000;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    for (int i = 0; i < reads_; i++) {
+      if (i % kReadsPerScan == 0) {
+        // Scans fill the cache with blocks that are never read again
+        Iterator* iter = db_->NewIterator(options);
+        char key[100];
+        snprintf(key, sizeof(key), "%016d", thread->rand.Next() % FLAGS_num);
+        iter->Seek(key);
+        for (int j = 0; j < kScanLength && iter->Valid(); j++) {
+          iter->Next();
+        }
+        delete iter;
+      }
+      char key[100];
+      const int k = thread->rand.Next() % range;
+      snprintf(key, sizeof(key), "%016d", k);
+      // Exact with a single thread, approximate otherwise
+      const uint64_t hits_before = cache_->hits();
+      const uint64_t misses_before = cache_->misses();
+      db_->Get(options, key, &value);
+      hits += cache_->hits() - hits_before;
+      misses += cache_->misses() - misses_before;
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(hot block cache hit rate %.1f%%)",
+             hits + misses == 0 ? 0.0 : 100.0 * hits / (hits + misses));
+    thread->stats.AddMessage(msg);
+  }
+
   void SeekRandom(ThreadState* thread) {
     ReadOptions options;
+    options.batch_block_reads = FLAGS_batch_block_reads;
     std::string value;
     int found = 0;
     for (int i = 0; i < reads_; i++) {
@@ -861,30 +1278,64 @@ class Benchmark {
     if (thread->tid > 0) {
       ReadRandom(thread);
     } else {
-      // Special thread that keeps writing until other threads are done.
-      RandomGenerator gen;
-      while (true) {
-        {
-          MutexLock l(&thread->shared->mu);
-          if (thread->shared->num_done + 1 >= thread->shared->num_initialized) {
-            // Other threads have finished
-            break;
-          }
-        }
+      WriteUntilOthersDone(thread);
+    }
+  }
 
-        const int k = thread->rand.Next() % FLAGS_num;
+  void ReadWhileCompacting(ThreadState* thread) {
+    if (thread->tid > 0) {
+      ReadOptions options;
+      std::string value;
+      Histogram latency;
+      latency.Clear();
+      for (int i = 0; i < reads_; i++) {
         char key[100];
+        const int k = thread->rand.Next() % FLAGS_num;
         snprintf(key, sizeof(key), "%016d", k);
-        Status s = db_->Put(write_options_, key, gen.Generate(value_size_));
-        if (!s.ok()) {
-          fprintf(stderr, "put error: %s\n", s.ToString().c_str());
-          exit(1);
+        const uint64_t start = Env::Default()->NowMicros();
+        db_->Get(options, key, &value);
+        latency.Add(Env::Default()->NowMicros() - start);
+        thread->stats.FinishedSingleOp();
+      }
+      MutexLock l(&thread->shared->mu);
+      thread->shared->read_latency.Merge(latency);
+    } else {
+      WriteUntilOthersDone(thread);
+      // The readers have merged their latencies before counting as done
+      MutexLock l(&thread->shared->mu);
+      const Histogram& h = thread->shared->read_latency;
+      char msg[100];
+      snprintf(msg, sizeof(msg), "(read p50 %.1f p99 %.1f p99.9 %.1f micros)",
+               h.Median(), h.Percentile(99.0), h.Percentile(99.9));
+      thread->stats.AddMessage(msg);
+    }
+  }
+
+  // Keep writing until all other threads are done, without counting the
+  // writes in the stats of this thread.
+  void WriteUntilOthersDone(ThreadState* thread) {
+    RandomGenerator gen;
+    while (true) {
+      {
+        MutexLock l(&thread->shared->mu);
+        if (thread->shared->num_done + 1 >= thread->shared->num_initialized) {
+          // Other threads have finished
+          break;
         }
       }
 
-      // Do not count any of the preceding work/delay in stats.
-      thread->stats.Start();
+      const int k = thread->rand.Next() % FLAGS_num;
+      char key[100];
+      snprintf(key, sizeof(key), "%016d", k);
+      Status s = db_->Put(write_options_, key, gen.Generate(value_size_));
+      if (!s.ok()) {
+        fprintf(stderr, "put error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
     }
+
+    // Do not count any of the preceding work/delay in stats.
+    thread->stats.Start();
   }
 
   void Compact(ThreadState* thread) {
@@ -926,6 +1377,15 @@ class Benchmark {
 int main(int argc, char** argv) {
   FLAGS_write_buffer_size = leveldb::Options().write_buffer_size;
   FLAGS_open_files = leveldb::Options().max_open_files;
+  FLAGS_max_subcompactions = leveldb::Options().max_subcompactions;
+  FLAGS_compression_threads = leveldb::Options().compression_threads;
+  FLAGS_level0_file_num_compaction_trigger =
+      leveldb::Options().level0_file_num_compaction_trigger;
+  FLAGS_level0_slowdown_writes_trigger =
+      leveldb::Options().level0_slowdown_writes_trigger;
+  FLAGS_level0_stop_writes_trigger =
+      leveldb::Options().level0_stop_writes_trigger;
+  FLAGS_delayed_write_rate = leveldb::Options().delayed_write_rate;
   std::string default_db_path;
 
   for (int i = 1; i < argc; i++) {
@@ -936,9 +1396,79 @@ int main(int argc, char** argv) {
       FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
+    } else if (leveldb::Slice(argv[i]).starts_with("--compression=") &&
+               leveldb::ParseCompression(argv[i] + strlen("--compression="),
+                                         &FLAGS_compression)) {
+      // Parsed
+    } else if (leveldb::Slice(argv[i]).starts_with(
+                   "--compression_per_level=")) {
+      FLAGS_compression_per_level =
+          argv[i] + strlen("--compression_per_level=");
+    } else if (sscanf(argv[i], "--compression_dict_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compression_dict_size = n;
+    } else if (sscanf(argv[i], "--levelfs_data=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_levelfs_data = n;
     } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_histogram = n;
+    } else if (sscanf(argv[i], "--mmap_read=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_mmap_read = n;
+    } else if (sscanf(argv[i], "--concurrent_memtable_writes=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_concurrent_memtable_writes = n;
+    } else if (sscanf(argv[i], "--pipelined_writes=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_pipelined_writes = n;
+    } else if (sscanf(argv[i], "--level0_file_num_compaction_trigger=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_level0_file_num_compaction_trigger = n;
+    } else if (sscanf(argv[i], "--level0_slowdown_writes_trigger=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_level0_slowdown_writes_trigger = n;
+    } else if (sscanf(argv[i], "--level0_stop_writes_trigger=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_level0_stop_writes_trigger = n;
+    } else if (sscanf(argv[i], "--delayed_write_rate=%d%c", &n, &junk) == 1) {
+      FLAGS_delayed_write_rate = n;
+    } else if (sscanf(argv[i], "--bg_io_priority_low=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_bg_io_priority_low = n;
+    } else if (sscanf(argv[i], "--bg_cpu_priority_low=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_bg_cpu_priority_low = n;
+    } else if (strncmp(argv[i], "--bg_cpus=", 10) == 0) {
+      FLAGS_bg_cpus = argv[i] + 10;
+    } else if (sscanf(argv[i], "--flush_rate_limit=%d%c", &n, &junk) == 1) {
+      FLAGS_flush_rate_limit = n;
+    } else if (sscanf(argv[i], "--compaction_rate_limit=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compaction_rate_limit = n;
+    } else if (sscanf(argv[i], "--rate_limit_auto_tune=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_rate_limit_auto_tune = n;
+    } else if (sscanf(argv[i], "--use_direct_io_for_flush_and_compaction=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_use_direct_io_for_flush_and_compaction = n;
+    } else if (sscanf(argv[i], "--use_direct_reads=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_use_direct_reads = n;
+    } else if (sscanf(argv[i], "--compaction_readahead_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compaction_readahead_size = n;
+    } else if (sscanf(argv[i], "--advise_random_on_open=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_advise_random_on_open = n;
+    } else if (sscanf(argv[i], "--bytes_per_sync=%d%c", &n, &junk) == 1) {
+      FLAGS_bytes_per_sync = n;
+    } else if (sscanf(argv[i], "--allow_fallocate=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_allow_fallocate = n;
+    } else if (sscanf(argv[i], "--recycle_log_file_num=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_recycle_log_file_num = n;
     } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_use_existing_db = n;
@@ -954,10 +1484,34 @@ int main(int argc, char** argv) {
       FLAGS_write_buffer_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--cache_protected_ratio=%lf%c",
+                      &d, &junk) == 1) {
+      FLAGS_cache_protected_ratio = d;
+    } else if (sscanf(argv[i], "--cache_index_and_filter_blocks=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_cache_index_and_filter_blocks = n;
+    } else if (sscanf(argv[i], "--index_partition_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_index_partition_size = n;
+    } else if (sscanf(argv[i], "--multiget_batch=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_multiget_batch = n;
+    } else if (sscanf(argv[i], "--io_uring=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_io_uring = n;
+    } else if (sscanf(argv[i], "--batch_block_reads=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_batch_block_reads = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--max_subcompactions=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_max_subcompactions = n;
+    } else if (sscanf(argv[i], "--compression_threads=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compression_threads = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
@@ -973,6 +1527,25 @@ int main(int argc, char** argv) {
       FLAGS_db = default_db_path.c_str();
   }
 
+  // Compactions run on the LOW pool of the default Env
+  leveldb::Env* env = leveldb::Env::Default();
+  if (FLAGS_bg_io_priority_low) {
+    env->LowerThreadPoolIOPriority(leveldb::Env::LOW);
+  }
+  if (FLAGS_bg_cpu_priority_low) {
+    env->LowerThreadPoolCPUPriority(leveldb::Env::LOW);
+  }
+  if (FLAGS_bg_cpus[0] != '\0') {
+    std::vector<int> cpus;
+    for (const char* p = FLAGS_bg_cpus; *p != '\0'; ) {
+      cpus.push_back(atoi(p));
+      p = strchr(p, ',');
+      if (p == NULL) break;
+      p++;
+    }
+    env->SetThreadPoolCPUAffinity(cpus, leveldb::Env::LOW);
+  }
+
   leveldb::Benchmark benchmark;
   benchmark.Run();
   return 0;
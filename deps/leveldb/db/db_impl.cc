@@ -5,6 +5,7 @@
 #include "db/db_impl.h"
 
 #include <algorithm>
+#include <map>
 #include <set>
 #include <string>
 #include <stdint.h>
@@ -17,11 +18,16 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/merge_context.h"
 #include "db/table_cache.h"
+#include "db/value_log.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/merge_operator.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/status.h"
 #include "leveldb/table.h"
 #include "leveldb/table_builder.h"
@@ -32,6 +38,8 @@
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/syncing_file.h"
+#include "util/work_queue.h"
 
 namespace leveldb {
 
@@ -43,9 +51,34 @@ struct DBImpl::Writer {
   WriteBatch* batch;
   bool sync;
   bool done;
+  bool insert;  // Set by the leader once the writer may insert its batch
   port::CondVar cv;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) { }
+  // Last sequence number of the group of a leader in memtable_writers_
+  SequenceNumber last_sequence;
+
+  // Values the value log garbage collector moves out of file
+  // relocate_from, or NULL for an ordinary write
+  uint64_t relocate_from;
+  std::vector<Relocation>* relocations;
+
+  explicit Writer(port::Mutex* mu)
+      : insert(false), cv(mu), relocate_from(0), relocations(NULL) { }
+};
+
+// A value the value log garbage collector writes back to the database
+struct DBImpl::Relocation {
+  std::string key;
+  std::string value;
+  uint64_t offset;    // Offset of the value in the value log file
+  std::string merged; // "value" with the key's newer merge operands applied
+  bool has_merged;
+};
+
+// WorkQueue task that runs one subcompaction
+struct DBImpl::SubcompactionTask {
+  DBImpl* db;
+  CompactionState* compact;
 };
 
 struct DBImpl::CompactionState {
@@ -57,6 +90,25 @@ struct DBImpl::CompactionState {
   // we can drop all entries for the same key with sequence numbers < S.
   SequenceNumber smallest_snapshot;
 
+  // Sequence number of the newest live snapshot, or zero if there is
+  // none.  Only entries newer than it may be passed through the
+  // compaction filter, since no snapshot can tell that they changed.
+  SequenceNumber newest_snapshot;
+
+  // User key range [start, end) merged by this state.  The range is
+  // unbounded on a side for which has_start/has_end is false.  Only a
+  // subcompaction has a bounded range.
+  bool has_start;
+  bool has_end;
+  std::string start;
+  std::string end;
+
+  // Position of this state's keys among the compaction's inputs
+  CompactionCursor cursor;
+
+  // Result of merging this state's key range
+  Status status;
+
   // Files produced by compaction
   struct Output {
     uint64_t number;
@@ -71,13 +123,27 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // Bytes of value log records dropped by the compaction, by file number
+  std::map<uint64_t, uint64_t> value_log_garbage;
+
+  // Value log files produced by compaction for the large values it
+  // creates by applying merge operands or the compaction filter, and the
+  // one being generated, which is the last of them.
+  std::vector<ValueLogMetaData> value_logs;
+  WritableFile* value_log_file;
+  ValueLogBuilder* value_log_builder;
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
+        has_start(false),
+        has_end(false),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        value_log_file(NULL),
+        value_log_builder(NULL) {
   }
 };
 
@@ -95,8 +161,28 @@ Options SanitizeOptions(const std::string& dbname,
   result.comparator = icmp;
   result.filter_policy = (src.filter_policy != NULL) ? ipolicy : NULL;
   ClipToRange(&result.max_open_files,    64 + kNumNonTableCacheFiles, 50000);
+  ClipToRange(&result.max_subcompactions, 1,                          64);
+  ClipToRange(&result.compression_threads, 1,                         64);
+  ClipToRange(&result.compression_dict_size, 0,                       65535);
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.compaction_readahead_size, 0,                   64<<20);
+  ClipToRange(&result.value_log_gc_ratio, 0.1,                        1.0);
+  ClipToRange(&result.level0_file_num_compaction_trigger, 1,          1000);
+  ClipToRange(&result.level0_slowdown_writes_trigger,
+              result.level0_file_num_compaction_trigger,              1000);
+  ClipToRange(&result.level0_stop_writes_trigger,
+              result.level0_slowdown_writes_trigger,                  1000);
+  if (result.hard_pending_compaction_bytes_limit > 0 &&
+      result.hard_pending_compaction_bytes_limit <
+      result.soft_pending_compaction_bytes_limit) {
+    result.hard_pending_compaction_bytes_limit =
+        result.soft_pending_compaction_bytes_limit;
+  }
+  if (result.use_direct_io_for_flush_and_compaction &&
+      result.compaction_readahead_size == 0) {
+    result.compaction_readahead_size = Options().compaction_readahead_size;
+  }
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -113,6 +199,99 @@ Options SanitizeOptions(const std::string& dbname,
   return result;
 }
 
+namespace {
+
+// Env whose writable files are opened for direct I/O
+class DirectWriteEnv : public EnvWrapper {
+ public:
+  DirectWriteEnv(Env* target, bool owns_target)
+      : EnvWrapper(target), owns_target_(owns_target) { }
+  virtual ~DirectWriteEnv() {
+    if (owns_target_) delete target();
+  }
+
+  virtual Status NewWritableFile(const std::string& fname,
+                                 WritableFile** result) {
+    return target()->NewDirectWritableFile(fname, result);
+  }
+
+ private:
+  const bool owns_target_;
+};
+
+// Env whose writable files reserve their storage and start their
+// write-back as they grow
+class SyncingEnv : public EnvWrapper {
+ public:
+  SyncingEnv(Env* target, bool owns_target, uint64_t bytes_per_sync,
+             uint64_t preallocation_size)
+      : EnvWrapper(target),
+        owns_target_(owns_target),
+        bytes_per_sync_(bytes_per_sync),
+        preallocation_size_(preallocation_size) { }
+  virtual ~SyncingEnv() {
+    if (owns_target_) delete target();
+  }
+
+  virtual Status NewWritableFile(const std::string& fname,
+                                 WritableFile** result) {
+    Status s = target()->NewWritableFile(fname, result);
+    Wrap(s, result);
+    return s;
+  }
+
+  virtual Status NewDirectWritableFile(const std::string& fname,
+                                       WritableFile** result) {
+    Status s = target()->NewDirectWritableFile(fname, result);
+    Wrap(s, result);
+    return s;
+  }
+
+ private:
+  void Wrap(const Status& s, WritableFile** result) {
+    if (s.ok()) {
+      *result = NewSyncingWritableFile(*result, bytes_per_sync_,
+                                       preallocation_size_);
+    }
+  }
+
+  const bool owns_target_;
+  const uint64_t bytes_per_sync_;
+  const uint64_t preallocation_size_;
+};
+
+}  // namespace
+
+// Storage reserved ahead of a file expected to grow to about "size"
+// bytes, with some slack since files are cut a little past their target.
+static uint64_t PreallocationSize(const Options& options, uint64_t size) {
+  return options.allow_fallocate ? size + size / 10 : 0;
+}
+
+// Return the Env through which background work of kind "pri" creates
+// its output files: *env itself, or wrappers around it that are owned
+// by the caller.
+static Env* NewOutputEnv(Env* env, const Options& options,
+                         RateLimiter::IOPriority pri) {
+  Env* result = env;
+  if (options.rate_limiter != NULL) {
+    result = NewRateLimitedEnv(result, options.rate_limiter, pri);
+  }
+  if (options.use_direct_io_for_flush_and_compaction) {
+    result = new DirectWriteEnv(result, result != env);
+  }
+  // Flushes write about a memtable's worth, compactions cut their output
+  // at the target file size
+  const uint64_t preallocation_size = PreallocationSize(
+      options, (pri == RateLimiter::kFlush) ? options.write_buffer_size
+                                            : config::kTargetFileSize);
+  if (options.bytes_per_sync > 0 || preallocation_size > 0) {
+    result = new SyncingEnv(result, result != env, options.bytes_per_sync,
+                            preallocation_size);
+  }
+  return result;
+}
+
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
@@ -122,6 +301,8 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       owns_info_log_(options_.info_log != raw_options.info_log),
       owns_cache_(options_.block_cache != raw_options.block_cache),
       dbname_(dbname),
+      flush_env_(NewOutputEnv(env_, options_, RateLimiter::kFlush)),
+      compaction_env_(NewOutputEnv(env_, options_, RateLimiter::kCompaction)),
       db_lock_(NULL),
       shutting_down_(NULL),
       bg_cv_(&mutex_),
@@ -130,26 +311,53 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       logfile_(NULL),
       logfile_number_(0),
       log_(NULL),
+      first_recyclable_log_(~static_cast<uint64_t>(0)),
       seed_(0),
       tmp_batch_(new WriteBatch),
+      pending_memtable_inserts_(0),
+      memtable_insert_cv_(&mutex_),
+      write_controller_(options_.delayed_write_rate),
       bg_compaction_scheduled_(false),
+      bg_flush_scheduled_(false),
+      logging_edit_(false),
+      bg_gc_scheduled_(false),
+      gc_pending_number_(0),
+      gc_pending_sequence_(0),
       manual_compaction_(NULL) {
   mem_->Ref();
-  has_imm_.Release_Store(NULL);
 
-  // Reserve ten files or so for other uses and give the rest to TableCache.
-  const int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles;
+  // Reserve ten files or so for other uses, a tenth of the rest for value
+  // log files if large values are separated, and give the rest to
+  // TableCache.
+  int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles;
+  int value_log_cache_size = 0;
+  if (options_.value_log_threshold > 0) {
+    value_log_cache_size = table_cache_size / 10;
+    table_cache_size -= value_log_cache_size;
+  }
   table_cache_ = new TableCache(dbname_, &options_, table_cache_size);
+  value_log_ = new ValueLog(dbname_, &options_, value_log_cache_size);
 
-  versions_ = new VersionSet(dbname_, &options_, table_cache_,
+  versions_ = new VersionSet(dbname_, &options_, table_cache_, value_log_,
                              &internal_comparator_);
+
+  // Subcompactions run on threads of the LOW pool next to the compaction
+  // thread, and the tables they and the flush thread write have blocks
+  // compressed by further LOW threads (see Options::max_subcompactions
+  // and Options::compression_threads).
+  const int low_threads = (options_.max_subcompactions + 1) *
+                          options_.compression_threads - 1;
+  if (low_threads > 1) {
+    env_->SetBackgroundThreads(low_threads, Env::LOW);
+  }
 }
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_) {
+  while (bg_compaction_scheduled_ || bg_flush_scheduled_ ||
+         bg_gc_scheduled_) {
     bg_cv_.Wait();
   }
   mutex_.Unlock();
@@ -165,6 +373,9 @@ DBImpl::~DBImpl() {
   delete log_;
   delete logfile_;
   delete table_cache_;
+  delete value_log_;
+  if (flush_env_ != env_) delete flush_env_;
+  if (compaction_env_ != env_) delete compaction_env_;
 
   if (owns_info_log_) {
     delete options_.info_log;
@@ -237,6 +448,17 @@ void DBImpl::DeleteObsoleteFiles() {
         case kLogFile:
           keep = ((number >= versions_->LogNumber()) ||
                   (number == versions_->PrevLogNumber()));
+          if (!keep && number >= first_recyclable_log_) {
+            // Keep it for NewLogFile() to reuse if there is room
+            if (std::find(log_recycle_files_.begin(), log_recycle_files_.end(),
+                          number) != log_recycle_files_.end()) {
+              keep = true;
+            } else if (log_recycle_files_.size() <
+                       options_.recycle_log_file_num) {
+              log_recycle_files_.push_back(number);
+              keep = true;
+            }
+          }
           break;
         case kDescriptorFile:
           // Keep my manifest file, and any newer incarnations'
@@ -244,6 +466,7 @@ void DBImpl::DeleteObsoleteFiles() {
           keep = (number >= versions_->ManifestFileNumber());
           break;
         case kTableFile:
+        case kValueLogFile:
           keep = (live.find(number) != live.end());
           break;
         case kTempFile:
@@ -261,6 +484,8 @@ void DBImpl::DeleteObsoleteFiles() {
       if (!keep) {
         if (type == kTableFile) {
           table_cache_->Evict(number);
+        } else if (type == kValueLogFile) {
+          value_log_->Evict(number);
         }
         Log(options_.info_log, "Delete type=%d #%lld\n",
             int(type),
@@ -271,6 +496,30 @@ void DBImpl::DeleteObsoleteFiles() {
   }
 }
 
+Status DBImpl::NewLogFile(uint64_t number, WritableFile** file) {
+  mutex_.AssertHeld();
+  const std::string fname = LogFileName(dbname_, number);
+  Status s;
+  if (!log_recycle_files_.empty()) {
+    const uint64_t old_number = log_recycle_files_.front();
+    log_recycle_files_.pop_front();
+    Log(options_.info_log, "Reusing log #%llu as #%llu\n",
+        static_cast<unsigned long long>(old_number),
+        static_cast<unsigned long long>(number));
+    s = env_->ReuseWritableFile(fname, LogFileName(dbname_, old_number), file);
+  } else {
+    s = env_->NewWritableFile(fname, file);
+  }
+  // A log is switched for a new one once it holds about a memtable's worth
+  const uint64_t preallocation_size =
+      PreallocationSize(options_, options_.write_buffer_size);
+  if (s.ok() && (options_.bytes_per_sync > 0 || preallocation_size > 0)) {
+    *file = NewSyncingWritableFile(*file, options_.bytes_per_sync,
+                                   preallocation_size);
+  }
+  return s;
+}
+
 Status DBImpl::Recover(VersionEdit* edit) {
   mutex_.AssertHeld();
 
@@ -397,7 +646,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
   // to be skipped instead of propagating bad information (like overly
   // large sequence numbers).
   log::Reader reader(file, &reporter, true/*checksum*/,
-                     0/*initial_offset*/);
+                     0/*initial_offset*/, log_number);
   Log(options_.info_log, "Recovering log #%llu",
       (unsigned long long) log_number);
 
@@ -432,7 +681,10 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
     }
 
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
-      status = WriteLevel0Table(mem, edit, NULL);
+      uint64_t number, value_log_number;
+      status = WriteLevel0Table(mem, edit, NULL, &number, &value_log_number);
+      pending_outputs_.erase(number);
+      pending_outputs_.erase(value_log_number);
       if (!status.ok()) {
         // Reflect errors immediately so that conditions like full
         // file-systems cause the DB::Open() to fail.
@@ -444,7 +696,10 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
   }
 
   if (status.ok() && mem != NULL) {
-    status = WriteLevel0Table(mem, edit, NULL);
+    uint64_t number, value_log_number;
+    status = WriteLevel0Table(mem, edit, NULL, &number, &value_log_number);
+    pending_outputs_.erase(number);
+    pending_outputs_.erase(value_log_number);
     // Reflect errors immediately so that conditions like full
     // file-systems cause the DB::Open() to fail.
   }
@@ -455,12 +710,20 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
 }
 
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+                                Version* base, uint64_t* number,
+                                uint64_t* value_log_number) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
   meta.number = versions_->NewFileNumber();
   pending_outputs_.insert(meta.number);
+  *number = meta.number;
+  ValueLogMetaData value_log;
+  if (options_.value_log_threshold > 0) {
+    value_log.number = versions_->NewFileNumber();
+    pending_outputs_.insert(value_log.number);
+  }
+  *value_log_number = value_log.number;
   Iterator* iter = mem->NewIterator();
   Log(options_.info_log, "Level-0 table #%llu: started",
       (unsigned long long) meta.number);
@@ -468,7 +731,8 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    s = BuildTable(dbname_, flush_env_, TableOptions(0), table_cache_, iter,
+                   &meta, value_log.number != 0 ? &value_log : NULL);
     mutex_.Lock();
   }
 
@@ -476,9 +740,13 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long) meta.number,
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
+  if (value_log.file_size > 0) {
+    Log(options_.info_log, "Level-0 table #%llu: value log #%llu: %lld bytes",
+        (unsigned long long) meta.number,
+        (unsigned long long) value_log.number,
+        (unsigned long long) value_log.file_size);
+  }
   delete iter;
-  pending_outputs_.erase(meta.number);
-
 
   // Note that if file_size is zero, the file has been deleted and
   // should not be added to the manifest.
@@ -486,16 +754,24 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   if (s.ok() && meta.file_size > 0) {
     const Slice min_user_key = meta.smallest.user_key();
     const Slice max_user_key = meta.largest.user_key();
-    if (base != NULL) {
+    // A table compaction running on another thread has outputs that are
+    // not part of any version yet, so only level-0 is safe until it is
+    // done.  Otherwise consult the current version, which may be newer
+    // than "base" if a compaction finished while the table was built.
+    if (base != NULL && !bg_compaction_scheduled_) {
+      base = versions_->current();
       level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
     }
     edit->AddFile(level, meta.number, meta.file_size,
                   meta.smallest, meta.largest);
+    if (value_log.file_size > 0) {
+      edit->AddValueLog(value_log.number, value_log.file_size, 0);
+    }
   }
 
   CompactionStats stats;
   stats.micros = env_->NowMicros() - start_micros;
-  stats.bytes_written = meta.file_size;
+  stats.bytes_written = meta.file_size + value_log.file_size;
   stats_[level].Add(stats);
   return s;
 }
@@ -508,7 +784,8 @@ void DBImpl::CompactMemTable() {
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  uint64_t number, value_log_number;
+  Status s = WriteLevel0Table(imm_, &edit, base, &number, &value_log_number);
   base->Unref();
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
@@ -519,20 +796,240 @@ void DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
+  pending_outputs_.erase(number);
+  pending_outputs_.erase(value_log_number);
 
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = NULL;
-    has_imm_.Release_Store(NULL);
     DeleteObsoleteFiles();
   } else {
     RecordBackgroundError(s);
   }
 }
 
+namespace {
+struct BySmallestKey {
+  const InternalKeyComparator* icmp;
+
+  explicit BySmallestKey(const InternalKeyComparator* c) : icmp(c) { }
+
+  bool operator()(const FileMetaData& f1, const FileMetaData& f2) const {
+    return icmp->Compare(f1.smallest, f2.smallest) < 0;
+  }
+};
+}  // namespace
+
+// Returns true if "mem" holds an entry for a user key in
+// [smallest,largest].
+static bool MemTableOverlaps(MemTable* mem, const Comparator* ucmp,
+                             const Slice& smallest, const Slice& largest) {
+  Iterator* iter = mem->NewIterator();
+  InternalKey start(smallest, kMaxSequenceNumber, kValueTypeForSeek);
+  iter->Seek(start.Encode());
+  const bool overlap = iter->Valid() &&
+      ucmp->Compare(ExtractUserKey(iter->key()), largest) <= 0;
+  delete iter;
+  return overlap;
+}
+
+Status DBImpl::ReadIngestedKeyRange(FileMetaData* meta) {
+  Iterator* iter = table_cache_->NewIterator(ReadOptions(), meta->number,
+                                             meta->file_size);
+  Status s;
+  ParsedInternalKey ikey;
+  for (int end = 0; s.ok() && end < 2; end++) {
+    if (end == 0) {
+      iter->SeekToFirst();
+    } else {
+      iter->SeekToLast();
+    }
+    if (!iter->Valid()) {
+      s = iter->status();
+      if (s.ok()) {
+        s = Status::InvalidArgument("ingested table is empty");
+      }
+    } else if (!ParseInternalKey(iter->key(), &ikey) || ikey.sequence != 0) {
+      s = Status::InvalidArgument("not a table built by SstFileWriter");
+    } else if (end == 0) {
+      meta->smallest.DecodeFrom(iter->key());
+    } else {
+      meta->largest.DecodeFrom(iter->key());
+    }
+  }
+  delete iter;
+  return s;
+}
+
+Status DBImpl::IngestExternalFiles(const std::vector<std::string>& files) {
+  // SstFileWriter stores every entry with sequence number zero.  The
+  // files are read with a sequence number of their own instead, newer
+  // than any write before the ingestion, so that snapshots taken before
+  // it do not see the new keys, and so that the files can go on top of
+  // the entries already held for their keys.
+  const Comparator* ucmp = user_comparator();
+  const int n = files.size();
+  std::vector<FileMetaData> metas(n);
+  {
+    MutexLock l(&mutex_);
+    for (int i = 0; i < n; i++) {
+      metas[i].number = versions_->NewFileNumber();
+      pending_outputs_.insert(metas[i].number);
+    }
+  }
+
+  // Link the files into the database and find their key ranges
+  Status s;
+  int linked = 0;
+  for (; s.ok() && linked < n; linked++) {
+    FileMetaData* meta = &metas[linked];
+    const std::string fname = TableFileName(dbname_, meta->number);
+    s = env_->LinkFile(files[linked], fname);
+    if (!s.ok()) {
+      break;
+    }
+    s = env_->GetFileSize(fname, &meta->file_size);
+    if (s.ok()) {
+      s = ReadIngestedKeyRange(meta);
+    }
+    if (!s.ok()) {
+      s = Status::InvalidArgument(files[linked], s.ToString());
+    }
+  }
+  if (s.ok()) {
+    std::sort(metas.begin(), metas.end(),
+              BySmallestKey(&internal_comparator_));
+    for (int i = 0; s.ok() && i + 1 < n; i++) {
+      if (ucmp->Compare(metas[i].largest.user_key(),
+                        metas[i + 1].smallest.user_key()) >= 0) {
+        s = Status::InvalidArgument("ingested tables overlap");
+      }
+    }
+  }
+
+  MutexLock l(&mutex_);
+  Writer w(&mutex_);
+  w.batch = NULL;
+  w.sync = false;
+  w.done = false;
+  bool claimed = false;
+  if (s.ok()) {
+    // Take the front of the writer queue, and wait for pipelined writes
+    // to publish their sequence numbers, so that no write can take a
+    // sequence number while the files get theirs.
+    writers_.push_back(&w);
+    while (&w != writers_.front()) {
+      w.cv.Wait();
+    }
+    while (!memtable_writers_.empty()) {
+      memtable_insert_cv_.Wait();
+    }
+    // Entries of the memtables are older than the files, so flush the
+    // memtables if they hold keys in the range of a file.
+    bool overlap = false;
+    for (int i = 0; !overlap && i < n; i++) {
+      const Slice smallest = metas[i].smallest.user_key();
+      const Slice largest = metas[i].largest.user_key();
+      overlap = MemTableOverlaps(mem_, ucmp, smallest, largest) ||
+          (imm_ != NULL && MemTableOverlaps(imm_, ucmp, smallest, largest));
+    }
+    if (overlap) {
+      s = MakeRoomForWrite(true /* force flush */);
+      while (s.ok() && imm_ != NULL) {
+        bg_cv_.Wait();
+        s = bg_error_;
+      }
+    }
+    // A table compaction may write the gaps between its inputs, so keep
+    // compactions from running until the files are part of a version.
+    while (s.ok() && bg_compaction_scheduled_) {
+      bg_cv_.Wait();
+    }
+    if (s.ok()) {
+      bg_compaction_scheduled_ = true;
+      claimed = true;
+      s = bg_error_;
+    }
+  }
+  if (s.ok()) {
+    // The sequence number becomes visible to snapshots only once the
+    // files are part of the current version.
+    const SequenceNumber seq = versions_->LastSequence() + 1;
+    Version* current = versions_->current();
+    VersionEdit edit;
+    edit.SetLastSequence(seq);
+    uint64_t bytes = 0;
+    for (int i = 0; s.ok() && i < n; i++) {
+      FileMetaData* meta = &metas[i];
+      const Slice smallest = meta->smallest.user_key();
+      const Slice largest = meta->largest.user_key();
+
+      // Place the file just above the first level holding keys in its
+      // range, where lookups find it before those older entries, or in
+      // the last level if there is none.
+      int level = config::kNumLevels - 1;
+      for (int l = 0; l < config::kNumLevels; l++) {
+        if (current->OverlapInLevel(l, &smallest, &largest)) {
+          level = (l > 0) ? l - 1 : 0;
+          break;
+        }
+      }
+      if (level == 0) {
+        // Level-0 files are searched from the highest file number down,
+        // so the file needs a number above those it goes on top of.
+        const uint64_t number = versions_->NewFileNumber();
+        s = env_->RenameFile(TableFileName(dbname_, meta->number),
+                             TableFileName(dbname_, number));
+        if (!s.ok()) {
+          break;
+        }
+        table_cache_->Evict(meta->number);
+        pending_outputs_.erase(meta->number);
+        pending_outputs_.insert(number);
+        meta->number = number;
+      }
+
+      meta->smallest = InternalKey(smallest, seq,
+                                   ExtractValueType(meta->smallest.Encode()));
+      meta->largest = InternalKey(largest, seq,
+                                  ExtractValueType(meta->largest.Encode()));
+      edit.AddFile(level, meta->number, meta->file_size,
+                   meta->smallest, meta->largest, seq);
+      bytes += meta->file_size;
+    }
+    if (s.ok()) {
+      s = LogAndApply(&edit);
+    }
+    if (s.ok()) {
+      versions_->SetLastSequence(seq);
+    }
+    Log(options_.info_log, "Ingested %d tables, %llu bytes at #%llu: %s",
+        n, (unsigned long long) bytes, (unsigned long long) seq,
+        s.ToString().c_str());
+  }
+
+  for (int i = 0; i < n; i++) {
+    pending_outputs_.erase(metas[i].number);
+    if (!s.ok() && i < linked) {
+      table_cache_->Evict(metas[i].number);
+      env_->DeleteFile(TableFileName(dbname_, metas[i].number));
+    }
+  }
+  if (claimed) {
+    bg_compaction_scheduled_ = false;
+    MaybeScheduleCompaction();
+    bg_cv_.SignalAll();
+    writers_.pop_front();
+    if (!writers_.empty()) {
+      writers_.front()->cv.Signal();
+    }
+  }
+  return s;
+}
+
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   int max_level_with_files = 1;
   {
@@ -613,19 +1110,29 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.Acquire_Load()) {
+  if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
+    return;
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == NULL &&
-             manual_compaction_ == NULL &&
+    return;
+  }
+
+  // Memtable compactions go to the HIGH priority pool so that they
+  // never wait behind a long-running table compaction.
+  if (imm_ != NULL && !bg_flush_scheduled_) {
+    bg_flush_scheduled_ = true;
+    env_->Schedule(&DBImpl::BGWorkFlush, this, Env::HIGH);
+  }
+
+  if (bg_compaction_scheduled_) {
+    // Already scheduled
+  } else if (manual_compaction_ == NULL &&
              !versions_->NeedsCompaction()) {
     // No work to be done
   } else {
     bg_compaction_scheduled_ = true;
-    env_->Schedule(&DBImpl::BGWork, this);
+    env_->Schedule(&DBImpl::BGWork, this, Env::LOW);
   }
 }
 
@@ -633,6 +1140,10 @@ void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
 
+void DBImpl::BGWorkFlush(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
   assert(bg_compaction_scheduled_);
@@ -647,18 +1158,250 @@ void DBImpl::BackgroundCall() {
   bg_compaction_scheduled_ = false;
 
   // Previous compaction may have produced too many files in a level,
-  // so reschedule another compaction if needed.
+  // so reschedule another compaction if needed.  It may also have left
+  // a value log file with enough garbage to collect.
   MaybeScheduleCompaction();
+  MaybeScheduleValueLogGC();
   bg_cv_.SignalAll();
 }
 
-void DBImpl::BackgroundCompaction() {
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (imm_ != NULL) {
+    CompactMemTable();
+  }
+
+  bg_flush_scheduled_ = false;
+
+  // The new level-0 file may have triggered the need for a compaction.
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+}
+
+void DBImpl::MaybeScheduleValueLogGC() {
   mutex_.AssertHeld();
+  bool needed = false;
+  if (bg_gc_scheduled_) {
+    // Already scheduled
+  } else if (shutting_down_.Acquire_Load() || !bg_error_.ok()) {
+    // No more changes
+  } else if (gc_pending_number_ != 0) {
+    // Only the deletion of a collected file is left to do
+    needed = (snapshots_.empty() ||
+              snapshots_.oldest()->number_ >= gc_pending_sequence_);
+  } else {
+    ValueLogMetaData f;
+    needed = versions_->current()->PickValueLogToCollect(
+        options_.value_log_gc_ratio, gc_failed_, &f);
+  }
+  if (needed) {
+    bg_gc_scheduled_ = true;
+    env_->StartThread(&DBImpl::BGWorkValueLogGC, this);
+  }
+}
 
-  if (imm_ != NULL) {
-    CompactMemTable();
+void DBImpl::BGWorkValueLogGC(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundValueLogGCCall();
+}
+
+void DBImpl::BackgroundValueLogGCCall() {
+  MutexLock l(&mutex_);
+  assert(bg_gc_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else {
+    CollectValueLog();
+  }
+
+  bg_gc_scheduled_ = false;
+
+  // Other files may be worth collecting as well.
+  MaybeScheduleValueLogGC();
+  bg_cv_.SignalAll();
+}
+
+void DBImpl::CollectValueLog() {
+  mutex_.AssertHeld();
+  if (gc_pending_number_ == 0) {
+    ValueLogMetaData f;
+    if (!versions_->current()->PickValueLogToCollect(
+            options_.value_log_gc_ratio, gc_failed_, &f)) {
+      return;
+    }
+    Log(options_.info_log, "Collecting value log #%llu: %lld of %lld bytes "
+        "garbage",
+        (unsigned long long) f.number,
+        (unsigned long long) f.garbage,
+        (unsigned long long) f.file_size);
+
+    SequenceNumber last_sequence = 0;
+    mutex_.Unlock();
+    Status s = RelocateValueLog(f, &last_sequence);
+    mutex_.Lock();
+    if (!s.ok()) {
+      // Keep the file; reads of its live values report the problem.
+      Log(options_.info_log, "Collecting value log #%llu failed: %s",
+          (unsigned long long) f.number, s.ToString().c_str());
+      gc_failed_.insert(f.number);
+      return;
+    }
+    gc_pending_number_ = f.number;
+    gc_pending_sequence_ = last_sequence;
+  }
+
+  if (!snapshots_.empty() &&
+      snapshots_.oldest()->number_ < gc_pending_sequence_) {
+    // An older snapshot may still read values from the file.
+    // ReleaseSnapshot() reschedules the deletion.
     return;
   }
+  VersionEdit edit;
+  edit.DeleteValueLog(gc_pending_number_);
+  Status s = LogAndApply(&edit);
+  if (s.ok()) {
+    Log(options_.info_log, "Collected value log #%llu",
+        (unsigned long long) gc_pending_number_);
+    gc_pending_number_ = 0;
+    DeleteObsoleteFiles();
+  } else {
+    RecordBackgroundError(s);
+  }
+}
+
+Status DBImpl::RelocateValueLog(const ValueLogMetaData& f,
+                                SequenceNumber* last_sequence) {
+  // Values are written back in batches of about this many bytes
+  static const size_t kRelocationBatchSize = 4 << 20;
+
+  RandomAccessFile* file;
+  Status s = env_->NewRandomAccessFile(ValueLogFileName(dbname_, f.number),
+                                       &file);
+  if (!s.ok()) {
+    return s;
+  }
+  WriteOptions write_options;
+  write_options.sync = true;  // The file is deleted afterwards
+  ValueLogReader reader(file, f.number, f.file_size);
+  std::vector<Relocation> relocations;
+  size_t bytes = 0;
+  bool more = true;
+  while (s.ok() && more) {
+    more = reader.Next();
+    if (more) {
+      relocations.resize(relocations.size() + 1);
+      Relocation* r = &relocations.back();
+      r->key = reader.key().ToString();
+      r->value = reader.value().ToString();
+      r->offset = reader.pointer().offset;
+      r->has_merged = false;
+      bytes += r->key.size() + r->value.size();
+    } else {
+      s = reader.status();
+    }
+    if (s.ok() && !relocations.empty() &&
+        (!more || bytes >= kRelocationBatchSize)) {
+      if (shutting_down_.Acquire_Load()) {
+        s = Status::IOError("Deleting DB during value log collection");
+        break;
+      }
+      // Most values are usually dead; skip copying those into the batch.
+      mutex_.Lock();
+      s = DropStaleRelocations(f.number, &relocations);
+      mutex_.Unlock();
+      if (s.ok() && !relocations.empty()) {
+        WriteBatch batch;
+        s = WriteImpl(write_options, &batch, f.number, &relocations);
+      }
+      relocations.clear();
+      bytes = 0;
+    }
+  }
+  delete file;
+
+  if (s.ok()) {
+    MutexLock l(&mutex_);
+    *last_sequence = versions_->LastSequence();
+  }
+  return s;
+}
+
+Status DBImpl::DropStaleRelocations(uint64_t number,
+                                    std::vector<Relocation>* relocations) {
+  mutex_.AssertHeld();
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+
+  Status s;
+  size_t live = 0;
+  {
+    mutex_.Unlock();
+    std::string index;
+    for (size_t i = 0; s.ok() && i < relocations->size(); i++) {
+      Relocation* r = &(*relocations)[i];
+      LookupKey lkey(r->key, kMaxSequenceNumber);
+      MergeContext merge(options_.merge_operator, r->key);
+      Slice v;
+      Status found;
+      if (mem->Get(lkey, &v, &found, &merge) ||
+          (imm != NULL && imm->Get(lkey, &v, &found, &merge))) {
+        // Written or deleted again since the file was created
+        continue;
+      }
+      bool is_index = false;
+      Version::GetStats stats;
+      s = current->GetIndex(ReadOptions(), lkey, &index, &is_index, &merge,
+                            &stats);
+      ValuePointer ptr;
+      if (s.IsNotFound()) {
+        s = Status::OK();
+      } else if (s.ok() && is_index && ptr.DecodeFrom(index) &&
+                 ptr.number == number && ptr.offset == r->offset) {
+        // The relocated value replaces the operands written on top of it
+        r->has_merged = !merge.empty();
+        if (r->has_merged) {
+          const Slice base(r->value);
+          s = merge.Finish(&base, &r->merged);
+        }
+        if (live != i) {
+          Relocation* l = &(*relocations)[live];
+          l->key.swap(r->key);
+          l->value.swap(r->value);
+          l->offset = r->offset;
+          l->merged.swap(r->merged);
+          l->has_merged = r->has_merged;
+        }
+        live++;
+      }
+    }
+    mutex_.Lock();
+  }
+  relocations->resize(live);
+
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  return s;
+}
+
+void DBImpl::BackgroundCompaction() {
+  mutex_.AssertHeld();
+
+  // Let a concurrent memtable compaction finish installing its output
+  // so that the compaction is picked from a complete version.
+  while (logging_edit_) {
+    bg_cv_.Wait();
+  }
 
   Compaction* c;
   bool is_manual = (manual_compaction_ != NULL);
@@ -689,8 +1432,8 @@ void DBImpl::BackgroundCompaction() {
     FileMetaData* f = c->input(0, 0);
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
-                       f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+                       f->smallest, f->largest, f->global_seqno);
+    status = LogAndApply(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
@@ -747,10 +1490,15 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
     assert(compact->outfile == NULL);
   }
   delete compact->outfile;
+  delete compact->value_log_builder;
+  delete compact->value_log_file;
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
     pending_outputs_.erase(out.number);
   }
+  for (size_t i = 0; i < compact->value_logs.size(); i++) {
+    pending_outputs_.erase(compact->value_logs[i].number);
+  }
   delete compact;
 }
 
@@ -772,13 +1520,25 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
 
   // Make the output file
   std::string fname = TableFileName(dbname_, file_number);
-  Status s = env_->NewWritableFile(fname, &compact->outfile);
+  Status s = compaction_env_->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
-    compact->builder = new TableBuilder(options_, compact->outfile);
+    compact->builder = new TableBuilder(
+        TableOptions(compact->compaction->level() + 1), compact->outfile);
   }
   return s;
 }
 
+Options DBImpl::TableOptions(int level) const {
+  Options result = options_;
+  const std::vector<CompressionType>& per_level =
+      options_.compression_per_level;
+  if (!per_level.empty()) {
+    const size_t i = std::min(static_cast<size_t>(level), per_level.size() - 1);
+    result.compression = per_level[i];
+  }
+  return result;
+}
+
 Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
                                           Iterator* input) {
   assert(compact != NULL);
@@ -849,12 +1609,33 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
         level + 1,
         out.number, out.file_size, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  for (size_t i = 0; i < compact->value_logs.size(); i++) {
+    const ValueLogMetaData& f = compact->value_logs[i];
+    compact->compaction->edit()->AddValueLog(f.number, f.file_size, 0);
+  }
+  for (std::map<uint64_t, uint64_t>::const_iterator it =
+           compact->value_log_garbage.begin();
+       it != compact->value_log_garbage.end();
+       ++it) {
+    compact->compaction->edit()->AddValueLogGarbage(it->first, it->second);
+  }
+  return LogAndApply(compact->compaction->edit());
+}
+
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (logging_edit_) {
+    bg_cv_.Wait();
+  }
+  logging_edit_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  logging_edit_ = false;
+  bg_cv_.SignalAll();
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
   Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
       compact->compaction->num_input_files(0),
@@ -867,35 +1648,144 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   assert(compact->outfile == NULL);
   if (snapshots_.empty()) {
     compact->smallest_snapshot = versions_->LastSequence();
+    compact->newest_snapshot = 0;
   } else {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
+    compact->newest_snapshot = snapshots_.newest()->number_;
   }
 
+  std::vector<std::string> boundaries;
+  compact->compaction->GetSplitPoints(options_.max_subcompactions,
+                                      &boundaries);
+
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
+  Status status;
+  if (boundaries.empty()) {
+    status = DoCompactionRange(compact);
+  } else {
+    status = DoSubcompactions(compact, boundaries);
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+  for (size_t i = 0; i < compact->value_logs.size(); i++) {
+    stats.bytes_written += compact->value_logs[i].file_size;
+  }
+
+  mutex_.Lock();
+  stats_[compact->compaction->level() + 1].Add(stats);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+Status DBImpl::DoSubcompactions(CompactionState* compact,
+                                const std::vector<std::string>& boundaries) {
+  const int n = boundaries.size() + 1;
+  Log(options_.info_log, "Splitting compaction into %d subcompactions", n);
+
+  std::vector<CompactionState*> subs(n);
+  for (int i = 0; i < n; i++) {
+    subs[i] = new CompactionState(compact->compaction);
+    subs[i]->smallest_snapshot = compact->smallest_snapshot;
+    subs[i]->newest_snapshot = compact->newest_snapshot;
+    if (i > 0) {
+      subs[i]->has_start = true;
+      subs[i]->start = boundaries[i - 1];
+    }
+    if (i < n - 1) {
+      subs[i]->has_end = true;
+      subs[i]->end = boundaries[i];
+    }
+  }
+
+  // Run the first range on this thread and queue the others for threads
+  // of the LOW pool.  This thread then takes on the ranges that no pool
+  // thread has started, and waits for the ones that are running.
+  WorkQueue* queue = new WorkQueue(env_, Env::LOW, n - 1);
+  std::vector<SubcompactionTask> tasks(n);
+  for (int i = 1; i < n; i++) {
+    tasks[i].db = this;
+    tasks[i].compact = subs[i];
+    queue->Add(&DBImpl::RunSubcompaction, &tasks[i]);
+  }
+  subs[0]->status = DoCompactionRange(subs[0]);
+  while (queue->RunOne()) { }
+  queue->Close();
+
+  // Collect the outputs of all ranges in key order so that they are
+  // installed by a single edit.
+  Status status;
+  mutex_.Lock();
+  for (int i = 0; i < n; i++) {
+    CompactionState* sub = subs[i];
+    if (status.ok()) {
+      status = sub->status;
+    }
+    compact->outputs.insert(compact->outputs.end(),
+                            sub->outputs.begin(), sub->outputs.end());
+    compact->value_logs.insert(compact->value_logs.end(),
+                               sub->value_logs.begin(),
+                               sub->value_logs.end());
+    compact->total_bytes += sub->total_bytes;
+    for (std::map<uint64_t, uint64_t>::const_iterator it =
+             sub->value_log_garbage.begin();
+         it != sub->value_log_garbage.end();
+         ++it) {
+      compact->value_log_garbage[it->first] += it->second;
+    }
+    sub->outputs.clear();  // Now owned by "compact"
+    sub->value_logs.clear();
+    CleanupCompaction(sub);
+  }
+  mutex_.Unlock();
+  return status;
+}
+
+void DBImpl::RunSubcompaction(void* arg) {
+  SubcompactionTask* task = reinterpret_cast<SubcompactionTask*>(arg);
+  task->compact->status = task->db->DoCompactionRange(task->compact);
+}
+
+Status DBImpl::DoCompactionRange(CompactionState* compact) {
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+  if (compact->has_start) {
+    InternalKey start(compact->start, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
+  } else {
+    input->SeekToFirst();
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
-    // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
-      const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
-      }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
-    }
-
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    if (compact->has_end && key.size() >= 8 &&
+        user_comparator()->Compare(ExtractUserKey(key), compact->end) >= 0) {
+      // Rest of the input belongs to the next subcompaction
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->cursor) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -905,6 +1795,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
     // Handle key/value, add to state, etc.
     bool drop = false;
+    bool merge = false;
+    bool filtered = false;
+    std::string filtered_key, filtered_value;
     if (!ParseInternalKey(key, &ikey)) {
       // Do not hide error keys
       current_user_key.clear();
@@ -919,13 +1812,15 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         has_current_user_key = true;
         last_sequence_for_key = kMaxSequenceNumber;
       }
+      const bool newest_for_key = (last_sequence_for_key == kMaxSequenceNumber);
 
       if (last_sequence_for_key <= compact->smallest_snapshot) {
         // Hidden by an newer entry for same user key
         drop = true;    // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        &compact->cursor)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -934,9 +1829,35 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (ikey.type == kTypeMerge &&
+                 ikey.sequence <= compact->smallest_snapshot &&
+                 options_.merge_operator != NULL) {
+        // Every snapshot sees this operand applied to the older entries
+        // of the key, so they can be combined.
+        merge = true;
+      } else if ((ikey.type == kTypeValue || ikey.type == kTypeValueIndex) &&
+                 newest_for_key &&
+                 ikey.sequence > compact->newest_snapshot &&
+                 options_.compaction_filter != NULL) {
+        filtered = FilterCompactionEntry(compact, ikey, input->value(),
+                                         &drop, &filtered_key,
+                                         &filtered_value);
+      }
+
+      if (ikey.type != kTypeMerge || options_.merge_operator != NULL) {
+        last_sequence_for_key = ikey.sequence;
+      } else {
+        // Without a merge operator the operand cannot be combined with
+        // the older entries, which therefore have to be kept.
       }
 
-      last_sequence_for_key = ikey.sequence;
+      ValuePointer ptr;
+      if ((drop || filtered) && ikey.type == kTypeValueIndex &&
+          ptr.DecodeFrom(input->value())) {
+        // No table will refer to this record of the value log anymore
+        compact->value_log_garbage[ptr.number] +=
+            ptr.RecordSize(ikey.user_key.size());
+      }
     }
 #if 0
     Log(options_.info_log,
@@ -948,27 +1869,31 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
-    if (!drop) {
-      // Open output file if necessary
-      if (compact->builder == NULL) {
-        status = OpenCompactionOutputFile(compact);
-        if (!status.ok()) {
-          break;
-        }
-      }
-      if (compact->builder->NumEntries() == 0) {
-        compact->current_output()->smallest.DecodeFrom(key);
+    if (merge) {
+      status = MergeCompactionEntries(compact, input, &last_sequence_for_key);
+      if (!status.ok()) {
+        break;
       }
-      compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      continue;
+    }
 
-      // Close output file if it is big enough
-      if (compact->builder->FileSize() >=
-          compact->compaction->MaxOutputFileSize()) {
-        status = FinishCompactionOutputFile(compact, input);
-        if (!status.ok()) {
-          break;
-        }
+    if (filtered && !drop) {
+      ParsedInternalKey filtered_ikey;
+      if (ParseInternalKey(filtered_key, &filtered_ikey) &&
+          filtered_ikey.type == kTypeValue) {
+        status = AddCompactionValue(compact, input, filtered_ikey,
+                                    filtered_value);
+      } else {
+        status = AddCompactionOutput(compact, input, filtered_key,
+                                     filtered_value);
+      }
+      if (!status.ok()) {
+        break;
+      }
+    } else if (!drop) {
+      status = AddCompactionOutput(compact, input, key, input->value());
+      if (!status.ok()) {
+        break;
       }
     }
 
@@ -984,33 +1909,269 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (status.ok()) {
     status = input->status();
   }
+  if (status.ok() && compact->value_log_builder != NULL) {
+    // The value log must be durable before the tables refer to it
+    status = FinishCompactionValueLog(compact);
+  }
   delete input;
-  input = NULL;
+  return status;
+}
 
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+Status DBImpl::AddCompactionOutput(CompactionState* compact, Iterator* input,
+                                   const Slice& key, const Slice& value) {
+  // Open output file if necessary
+  if (compact->builder == NULL) {
+    Status s = OpenCompactionOutputFile(compact);
+    if (!s.ok()) {
+      return s;
     }
   }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
+  if (compact->builder->NumEntries() == 0) {
+    compact->current_output()->smallest.DecodeFrom(key);
   }
+  compact->current_output()->largest.DecodeFrom(key);
+  compact->builder->Add(key, value);
 
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
+  // Close output file if it is big enough
+  if (compact->builder->FileSize() >=
+      compact->compaction->MaxOutputFileSize()) {
+    return FinishCompactionOutputFile(compact, input);
+  }
+  return Status::OK();
+}
 
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
+Status DBImpl::AddCompactionValue(CompactionState* compact, Iterator* input,
+                                  const ParsedInternalKey& ikey,
+                                  const Slice& value) {
+  std::string key;
+  if (options_.value_log_threshold == 0 ||
+      value.size() < options_.value_log_threshold) {
+    AppendInternalKey(&key, ParsedInternalKey(ikey.user_key, ikey.sequence,
+                                              kTypeValue));
+    return AddCompactionOutput(compact, input, key, value);
   }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
+
+  // Open a value log if necessary
+  if (compact->value_log_builder == NULL) {
+    ValueLogMetaData f;
+    mutex_.Lock();
+    f.number = versions_->NewFileNumber();
+    pending_outputs_.insert(f.number);
+    compact->value_logs.push_back(f);
+    mutex_.Unlock();
+    Status s = compaction_env_->NewWritableFile(
+        ValueLogFileName(dbname_, f.number), &compact->value_log_file);
+    if (!s.ok()) {
+      return s;
+    }
+    compact->value_log_builder = new ValueLogBuilder(f.number,
+                                                     compact->value_log_file);
   }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log,
-      "compacted to: %s", versions_->LevelSummary(&tmp));
-  return status;
+
+  ValuePointer ptr;
+  Status s = compact->value_log_builder->Add(ikey.user_key, value, &ptr);
+  if (!s.ok()) {
+    return s;
+  }
+  std::string pointer;
+  ptr.EncodeTo(&pointer);
+  AppendInternalKey(&key, ParsedInternalKey(ikey.user_key, ikey.sequence,
+                                            kTypeValueIndex));
+  return AddCompactionOutput(compact, input, key, pointer);
+}
+
+Status DBImpl::FinishCompactionValueLog(CompactionState* compact) {
+  assert(compact->value_log_builder != NULL);
+  ValueLogMetaData* f = &compact->value_logs.back();
+  f->file_size = compact->value_log_builder->FileSize();
+  delete compact->value_log_builder;
+  compact->value_log_builder = NULL;
+  Status s = compact->value_log_file->Sync();
+  if (s.ok()) {
+    s = compact->value_log_file->Close();
+  }
+  delete compact->value_log_file;
+  compact->value_log_file = NULL;
+  if (s.ok()) {
+    Log(options_.info_log, "Generated value log #%llu: %lld bytes",
+        (unsigned long long) f->number,
+        (unsigned long long) f->file_size);
+  }
+  return s;
+}
+
+Status DBImpl::MergeCompactionEntries(CompactionState* compact,
+                                      Iterator* input,
+                                      SequenceNumber* last_sequence_for_key) {
+  const MergeOperator* op = options_.merge_operator;
+  ParsedInternalKey ikey;
+  if (!ParseInternalKey(input->key(), &ikey)) {
+    return Status::Corruption("corrupted merge operand key");
+  }
+  const std::string user_key = ikey.user_key.ToString();
+  const SequenceNumber newest = ikey.sequence;
+
+  // Gather the operands, newest first, down to the entry they apply to
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  bool has_base = false;
+  ValueType base_type = kTypeDeletion;
+  while (input->Valid()) {
+    if (!ParseInternalKey(input->key(), &ikey) ||
+        user_comparator()->Compare(ikey.user_key, user_key) != 0) {
+      break;
+    }
+    keys.push_back(input->key().ToString());
+    values.push_back(input->value().ToString());
+    *last_sequence_for_key = ikey.sequence;
+    input->Next();
+    if (ikey.type != kTypeMerge) {
+      has_base = true;
+      base_type = ikey.type;
+      break;
+    }
+  }
+  const size_t num_operands = has_base ? keys.size() - 1 : keys.size();
+
+  // Read a base kept in the value log so that the result can replace it
+  Status s;
+  std::string logged;
+  ValuePointer ptr;
+  bool base_known = has_base ||
+      compact->compaction->IsBaseLevelForKey(user_key, &compact->cursor);
+  if (has_base && base_type == kTypeValueIndex) {
+    s = ptr.DecodeFrom(values.back())
+            ? value_log_->Get(ReadOptions(), values.back(), &logged)
+            : Status::Corruption("bad value log pointer");
+    if (!s.ok()) {
+      // Keep the entries so that readers see the error
+      Log(options_.info_log, "Compaction merge skipped %s: %s",
+          user_key.c_str(), s.ToString().c_str());
+      base_known = false;
+      s = Status::OK();
+    }
+  }
+
+  if (base_known) {
+    // The entry the operands apply to is known: store the result as a
+    // value in place of all of them.
+    MergeContext merge(op, user_key);
+    for (size_t i = 0; i < num_operands; i++) {
+      merge.AddOperand(values[i]);
+    }
+    Slice base;
+    if (base_type == kTypeValue) {
+      base = values.back();
+    } else if (base_type == kTypeValueIndex) {
+      base = logged;
+    }
+    std::string result;
+    if (merge.Finish(base_type != kTypeDeletion ? &base : NULL,
+                     &result).ok()) {
+      if (base_type == kTypeValueIndex) {
+        // No table will refer to the record of the base anymore
+        compact->value_log_garbage[ptr.number] +=
+            ptr.RecordSize(user_key.size());
+      }
+      const ParsedInternalKey merged(user_key, newest, kTypeValue);
+      std::string key, value;
+      bool drop = false;
+      if (newest > compact->newest_snapshot &&
+          options_.compaction_filter != NULL &&
+          FilterCompactionEntry(compact, merged, result,
+                                &drop, &key, &value)) {
+        ParsedInternalKey filtered;
+        if (drop) {
+          return Status::OK();
+        } else if (ParseInternalKey(key, &filtered) &&
+                   filtered.type == kTypeValue) {
+          return AddCompactionValue(compact, input, filtered, value);
+        }
+        return AddCompactionOutput(compact, input, key, value);
+      }
+      return AddCompactionValue(compact, input, merged, result);
+    }
+    // Leave the operands for readers to report the failure
+  } else {
+    // The entry the operands apply to is in a deeper level, or could not
+    // be read, so only runs of operands are combined.  Each combined
+    // operand keeps the sequence number of the newest operand in its
+    // run.
+    size_t i = 0;
+    while (s.ok() && i < num_operands) {
+      std::string operand = values[i];
+      size_t j = i + 1;
+      std::string combined;
+      while (j < num_operands &&
+             op->PartialMerge(user_key, values[j], operand, &combined)) {
+        operand.swap(combined);
+        j++;
+      }
+      s = AddCompactionOutput(compact, input, keys[i], operand);
+      i = j;
+    }
+    if (s.ok() && has_base) {
+      s = AddCompactionOutput(compact, input, keys.back(), values.back());
+    }
+    return s;
+  }
+
+  for (size_t i = 0; s.ok() && i < keys.size(); i++) {
+    s = AddCompactionOutput(compact, input, keys[i], values[i]);
+  }
+  return s;
+}
+
+bool DBImpl::FilterCompactionEntry(CompactionState* compact,
+                                   const ParsedInternalKey& ikey,
+                                   const Slice& value, bool* drop,
+                                   std::string* new_key,
+                                   std::string* new_value) {
+  const CompactionFilter* filter = options_.compaction_filter;
+  const int level = compact->compaction->level() + 1;
+  if (!filter->MayFilter(level, ikey.user_key)) {
+    return false;
+  }
+
+  Slice existing = value;
+  std::string buf;
+  if (ikey.type == kTypeValueIndex) {
+    Status s = value_log_->Get(ReadOptions(), value, &buf);
+    if (!s.ok()) {
+      // Keep the entry so that readers see the error
+      Log(options_.info_log, "Compaction filter skipped %s: %s",
+          ikey.user_key.ToString().c_str(), s.ToString().c_str());
+      return false;
+    }
+    existing = buf;
+  }
+
+  bool value_changed = false;
+  new_value->clear();
+  const bool remove = filter->Filter(level, ikey.user_key, existing,
+                                     new_value, &value_changed);
+  new_key->clear();
+  if (remove) {
+    if (ikey.sequence <= compact->smallest_snapshot &&
+        compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                               &compact->cursor)) {
+      // Nothing older can show through, as for an obsolete deletion
+      // marker (see DoCompactionRange)
+      *drop = true;
+    } else {
+      AppendInternalKey(new_key, ParsedInternalKey(ikey.user_key,
+                                                   ikey.sequence,
+                                                   kTypeDeletion));
+      new_value->clear();
+    }
+    return true;
+  }
+  if (value_changed) {
+    AppendInternalKey(new_key, ParsedInternalKey(ikey.user_key,
+                                                 ikey.sequence, kTypeValue));
+    return true;
+  }
+  return false;
 }
 
 namespace {
@@ -1019,6 +2180,10 @@ struct IterState {
   Version* version;
   MemTable* mem;
   MemTable* imm;
+  // ReadOptions::iterate_upper_bound as an internal key, which is what
+  // the table and level iterators compare against.
+  std::string upper_bound;
+  Slice upper_bound_slice;
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
@@ -1030,12 +2195,52 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
   state->mu->Unlock();
   delete state;
 }
+
+// Reads the blocks a Seek() lands in across all tables of "version" with
+// one Env::MultiRead() call before handing the Seek() to the merging
+// iterator, which would otherwise read them one table at a time.
+class SeekPrefetchIterator : public Iterator {
+ public:
+  SeekPrefetchIterator(Iterator* iter, Version* version,
+                       const ReadOptions& options)
+      : iter_(iter), version_(version), options_(options) { }
+  virtual ~SeekPrefetchIterator() { delete iter_; }
+
+  virtual bool Valid() const { return iter_->Valid(); }
+  virtual void SeekToFirst() { iter_->SeekToFirst(); }
+  virtual void SeekToLast() { iter_->SeekToLast(); }
+  virtual void Seek(const Slice& target) {
+    version_->PrefetchSeekBlocks(options_, target);
+    iter_->Seek(target);
+  }
+  virtual void Next() { iter_->Next(); }
+  virtual void Prev() { iter_->Prev(); }
+  virtual Slice key() const { return iter_->key(); }
+  virtual Slice value() const { return iter_->value(); }
+  virtual Status status() const { return iter_->status(); }
+
+ private:
+  Iterator* iter_;
+  Version* const version_;  // Kept alive by the cleanup of *iter_
+  const ReadOptions options_;
+};
 }  // namespace
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
                                       uint32_t* seed) {
   IterState* cleanup = new IterState;
+  ReadOptions internal_options = options;
+  if (options.iterate_upper_bound != NULL) {
+    // The smallest internal key for the bound user key
+    AppendInternalKey(&cleanup->upper_bound,
+                      ParsedInternalKey(*options.iterate_upper_bound,
+                                        kMaxSequenceNumber,
+                                        kValueTypeForSeek));
+    cleanup->upper_bound_slice = cleanup->upper_bound;
+    internal_options.iterate_upper_bound = &cleanup->upper_bound_slice;
+  }
+
   mutex_.Lock();
   *latest_snapshot = versions_->LastSequence();
 
@@ -1047,7 +2252,7 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
     list.push_back(imm_->NewIterator());
     imm_->Ref();
   }
-  versions_->current()->AddIterators(options, &list);
+  versions_->current()->AddIterators(internal_options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
   versions_->current()->Ref();
@@ -1057,6 +2262,11 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
   cleanup->imm = imm_;
   cleanup->version = versions_->current();
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
+  if (options.batch_block_reads && options.fill_cache &&
+      options.prefix == NULL) {
+    internal_iter = new SeekPrefetchIterator(internal_iter, cleanup->version,
+                                             internal_options);
+  }
 
   *seed = ++seed_;
   mutex_.Unlock();
@@ -1074,6 +2284,11 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+uint64_t DBImpl::TEST_LogfileNumber() {
+  MutexLock l(&mutex_);
+  return logfile_number_;
+}
+
 Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
@@ -1101,12 +2316,13 @@ Status DBImpl::Get(const ReadOptions& options,
     mutex_.Unlock();
     // First look in the memtable, then in the immutable memtable (if any).
     LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
+    MergeContext merge(options_.merge_operator, key);
+    if (mem->Get(lkey, value, &s, &merge)) {
       // Done
-    } else if (imm != NULL && imm->Get(lkey, value, &s)) {
+    } else if (imm != NULL && imm->Get(lkey, value, &s, &merge)) {
       // Done
     } else {
-      s = current->Get(options, lkey, value, &stats);
+      s = current->Get(options, lkey, value, &merge, &stats);
       have_stat_update = true;
     }
     mutex_.Lock();
@@ -1121,6 +2337,265 @@ Status DBImpl::Get(const ReadOptions& options,
   return s;
 }
 
+namespace {
+static void UnrefMemTable(void* arg1, void* arg2) {
+  port::Mutex* mu = reinterpret_cast<port::Mutex*>(arg1);
+  MemTable* mem = reinterpret_cast<MemTable*>(arg2);
+  mu->Lock();
+  mem->Unref();
+  mu->Unlock();
+}
+}  // namespace
+
+Status DBImpl::GetPinned(const ReadOptions& options,
+                         const Slice& key,
+                         PinnableSlice* value) {
+  value->Reset();
+  Status s;
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+
+  bool have_stat_update = false;
+  Version::GetStats stats;
+  MemTable* found_in = NULL;
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+    // First look in the memtable, then in the immutable memtable (if any).
+    LookupKey lkey(key, snapshot);
+    MergeContext merge(options_.merge_operator, key);
+    Slice v;
+    if (mem->Get(lkey, &v, &s, &merge)) {
+      found_in = mem;
+    } else if (imm != NULL && imm->Get(lkey, &v, &s, &merge)) {
+      found_in = imm;
+    } else {
+      s = current->Get(options, lkey, value, &merge, &stats);
+      have_stat_update = true;
+    }
+    if (found_in != NULL && !merge.empty()) {
+      // The merged value is not in the memtable
+      s = merge.Finish(s.ok() ? &v : NULL, value->GetSelf());
+      if (s.ok()) {
+        value->PinSelf();
+      }
+      found_in = NULL;
+    } else if (found_in != NULL && s.ok()) {
+      value->PinSlice(v);
+    }
+    mutex_.Lock();
+  }
+
+  if (found_in != NULL && s.ok()) {
+    // The value lives in the memtable's arena; keep the memtable alive
+    found_in->Ref();
+    value->RegisterCleanup(&UnrefMemTable, &mutex_, found_in);
+  }
+  if (have_stat_update && current->UpdateStats(stats)) {
+    MaybeScheduleCompaction();
+  }
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  return s;
+}
+
+Status DBImpl::GetMergeOperands(const ReadOptions& options,
+                                const Slice& key,
+                                PinnableSlice* value,
+                                uint64_t* value_size,
+                                bool* has_value,
+                                std::vector<std::string>* operands) {
+  PinnableSlice raw;
+  PinnableSlice* base = (value != NULL) ? value : &raw;
+  base->Reset();
+  *value_size = 0;
+  *has_value = false;
+  Status s;
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+
+  bool have_stat_update = false;
+  Version::GetStats stats;
+  MemTable* found_in = NULL;
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+    LookupKey lkey(key, snapshot);
+    MergeContext merge(options_.merge_operator, key);
+    Slice v;
+    bool is_index = false;
+    if (mem->Get(lkey, &v, &s, &merge)) {
+      found_in = mem;
+    } else if (imm != NULL && imm->Get(lkey, &v, &s, &merge)) {
+      found_in = imm;
+    } else {
+      s = current->GetUnmerged(options, lkey, base, &is_index, &merge,
+                               &stats);
+      have_stat_update = true;
+    }
+    if (found_in != NULL && s.ok()) {
+      base->PinSlice(v);
+    }
+    if (s.ok() && is_index) {
+      // Only the pointer is needed for the size of the value
+      ValuePointer ptr;
+      if (!ptr.DecodeFrom(*base)) {
+        s = Status::Corruption("bad value log pointer for ", key);
+      } else if (value != NULL) {
+        const std::string pointer(base->data(), base->size());
+        value->Reset();
+        s = value_log_->Get(options, pointer, value);
+      }
+      *value_size = ptr.size;
+    } else if (s.ok()) {
+      *value_size = base->size();
+    }
+    *has_value = s.ok();
+    if (s.IsNotFound() && !merge.empty()) {
+      s = Status::OK();
+    }
+    merge.TakeOperands(operands);
+    raw.Reset();
+    mutex_.Lock();
+  }
+
+  if (found_in != NULL && value != NULL && *has_value) {
+    // The value lives in the memtable's arena; keep the memtable alive
+    found_in->Ref();
+    value->RegisterCleanup(&UnrefMemTable, &mutex_, found_in);
+  }
+  if (have_stat_update && current->UpdateStats(stats)) {
+    MaybeScheduleCompaction();
+  }
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  return s;
+}
+
+namespace {
+// Orders lookups by user key
+struct LookupKeyLess {
+  const Comparator* ucmp;
+  const std::vector<LookupKey*>* keys;
+  bool operator()(int a, int b) const {
+    return ucmp->Compare((*keys)[a]->user_key(), (*keys)[b]->user_key()) < 0;
+  }
+};
+}  // namespace
+
+void DBImpl::MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                      std::string* values, Status* statuses) {
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  // Pin the memtables and version once for the whole batch
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+
+  std::vector<Version::GetStats> stats;
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+    std::vector<LookupKey*> lkeys(n);
+    std::vector<int> pending;
+    for (int i = 0; i < n; i++) {
+      lkeys[i] = new LookupKey(keys[i], snapshot);
+      statuses[i] = Status::OK();
+      // First look in the memtable, then in the immutable memtable (if any).
+      MergeContext merge(options_.merge_operator, keys[i]);
+      if (mem->Get(*lkeys[i], &values[i], &statuses[i], &merge)) {
+        // Done
+      } else if (imm != NULL && imm->Get(*lkeys[i], &values[i],
+                                         &statuses[i], &merge)) {
+        // Done
+      } else if (!merge.empty()) {
+        // The operands found so far are applied by a lookup of its own
+        Version::GetStats unused;
+        statuses[i] = current->Get(options, *lkeys[i], &values[i], &merge,
+                                   &unused);
+      } else {
+        pending.push_back(i);
+      }
+    }
+
+    if (!pending.empty()) {
+      // Search the files for the rest of the batch in key order
+      LookupKeyLess less;
+      less.ucmp = user_comparator();
+      less.keys = &lkeys;
+      std::stable_sort(pending.begin(), pending.end(), less);
+      const int m = pending.size();
+      std::vector<const LookupKey*> pkeys(m);
+      std::vector<std::string*> pvalues(m);
+      std::vector<Status*> pstatuses(m);
+      for (int p = 0; p < m; p++) {
+        pkeys[p] = lkeys[pending[p]];
+        pvalues[p] = &values[pending[p]];
+        pstatuses[p] = &statuses[pending[p]];
+      }
+      stats.resize(m);
+      current->MultiGet(options, m, &pkeys[0], &pvalues[0], &pstatuses[0],
+                        &stats[0]);
+    }
+
+    for (int i = 0; i < n; i++) {
+      delete lkeys[i];
+    }
+    mutex_.Lock();
+  }
+
+  bool schedule = false;
+  for (size_t i = 0; i < stats.size(); i++) {
+    if (current->UpdateStats(stats[i])) {
+      schedule = true;
+    }
+  }
+  if (schedule) {
+    MaybeScheduleCompaction();
+  }
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1130,7 +2605,9 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
       (options.snapshot != NULL
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
        : latest_snapshot),
-      seed);
+      seed, options.prefix, options.iterate_upper_bound,
+      value_log_, options.verify_checksums, options_.merge_operator,
+      options.keys_only);
 }
 
 void DBImpl::RecordReadSample(Slice key) {
@@ -1148,6 +2625,10 @@ const Snapshot* DBImpl::GetSnapshot() {
 void DBImpl::ReleaseSnapshot(const Snapshot* s) {
   MutexLock l(&mutex_);
   snapshots_.Delete(reinterpret_cast<const SnapshotImpl*>(s));
+  if (gc_pending_number_ != 0) {
+    // A collected value log file may have been waiting for the snapshot
+    MaybeScheduleValueLogGC();
+  }
 }
 
 // Convenience methods
@@ -1159,29 +2640,86 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+Status DBImpl::Merge(const WriteOptions& options, const Slice& key,
+                     const Slice& value) {
+  if (options_.merge_operator == NULL) {
+    return Status::NotSupported("no merge operator");
+  }
+  return DB::Merge(options, key, value);
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
+  return WriteImpl(options, my_batch, 0, NULL);
+}
+
+Status DBImpl::WriteImpl(const WriteOptions& options, WriteBatch* my_batch,
+                         uint64_t relocate_from,
+                         std::vector<Relocation>* relocations) {
   Writer w(&mutex_);
   w.batch = my_batch;
   w.sync = options.sync;
   w.done = false;
+  w.relocate_from = relocate_from;
+  w.relocations = relocations;
 
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  // With pipelined writes, the writers of a logged group have left the
+  // queue and only wait for their leader
+  while (!w.done && !w.insert &&
+         (writers_.empty() || &w != writers_.front())) {
     w.cv.Wait();
   }
+  if (w.insert) {
+    // The leader has logged our batch as part of its group and leaves
+    // the memtable insert to us
+    MemTable* mem = mem_;
+    mutex_.Unlock();
+    Status s = WriteBatchInternal::InsertConcurrentlyInto(my_batch, mem);
+    mutex_.Lock();
+    if (!s.ok() && memtable_insert_status_.ok()) {
+      memtable_insert_status_ = s;
+    }
+    if (--pending_memtable_inserts_ == 0) {
+      memtable_insert_cv_.SignalAll();
+    }
+    while (!w.done) {
+      w.cv.Wait();
+    }
+  }
   if (w.done) {
     return w.status;
   }
 
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(my_batch == NULL);
-  uint64_t last_sequence = versions_->LastSequence();
+  if (status.ok() && relocations != NULL) {
+    // The values may have been overwritten since the collector read
+    // them.  Check again now that no other write can get in between,
+    // once pipelined writes that may hold newer values are visible.
+    while (!memtable_writers_.empty()) {
+      memtable_insert_cv_.Wait();
+    }
+    status = DropStaleRelocations(relocate_from, relocations);
+    for (size_t i = 0; status.ok() && i < relocations->size(); i++) {
+      const Relocation& r = (*relocations)[i];
+      my_batch->Put(r.key, r.has_merged ? r.merged : r.value);
+    }
+  }
+  // Groups that are still inserting into the memtable have not
+  // published their sequence numbers yet
+  uint64_t last_sequence = memtable_writers_.empty() ?
+      versions_->LastSequence() : memtable_writers_.back()->last_sequence;
   Writer* last_writer = &w;
   if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
     WriteBatch* updates = BuildBatchGroup(&last_writer);
-    WriteBatchInternal::SetSequence(updates, last_sequence + 1);
+    const SequenceNumber first_sequence = last_sequence + 1;
+    WriteBatchInternal::SetSequence(updates, first_sequence);
     last_sequence += WriteBatchInternal::Count(updates);
+    // A group of one batch gains nothing from concurrent inserts
+    const bool defer_insert =
+        options_.enable_pipelined_write ||
+        (options_.allow_concurrent_memtable_write && updates == tmp_batch_);
 
     // Add to log and apply to memtable.  We can release the lock
     // during this phase since &w is currently responsible for logging
@@ -1197,7 +2735,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
           sync_error = true;
         }
       }
-      if (status.ok()) {
+      if (status.ok() && !defer_insert) {
         status = WriteBatchInternal::InsertInto(updates, mem_);
       }
       mutex_.Lock();
@@ -1208,8 +2746,50 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         RecordBackgroundError(status);
       }
     }
+    if (write_controller_.delayed()) {
+      write_controller_.Consume(env_->NowMicros(),
+                                WriteBatchInternal::ByteSize(updates));
+    }
     if (updates == tmp_batch_) tmp_batch_->Clear();
 
+    if (status.ok() && defer_insert) {
+      std::vector<Writer*> group;
+      for (std::deque<Writer*>::iterator iter = writers_.begin(); ; ++iter) {
+        group.push_back(*iter);
+        if (*iter == last_writer) break;
+      }
+      if (options_.enable_pipelined_write) {
+        // Let the next group append to the log while this one inserts
+        // into the memtable.  Groups insert one at a time in the order
+        // they were logged, so their sequence numbers are published in
+        // order.
+        writers_.erase(writers_.begin(), writers_.begin() + group.size());
+        if (!writers_.empty()) {
+          writers_.front()->cv.Signal();
+        }
+        w.last_sequence = last_sequence;
+        memtable_writers_.push_back(&w);
+        while (memtable_writers_.front() != &w) {
+          w.cv.Wait();
+        }
+        status = InsertWriteGroup(group, first_sequence);
+        versions_->SetLastSequence(last_sequence);
+
+        memtable_writers_.pop_front();
+        if (!memtable_writers_.empty()) {
+          memtable_writers_.front()->cv.Signal();
+        }
+        memtable_insert_cv_.SignalAll();
+        for (size_t i = 1; i < group.size(); i++) {
+          group[i]->status = status;
+          group[i]->done = true;
+          group[i]->cv.Signal();
+        }
+        return status;
+      }
+      status = InsertWriteGroup(group, first_sequence);
+    }
+
     versions_->SetLastSequence(last_sequence);
   }
 
@@ -1260,71 +2840,159 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
       break;
     }
 
-    if (w->batch != NULL) {
-      size += WriteBatchInternal::ByteSize(w->batch);
-      if (size > max_size) {
-        // Do not make batch too big
-        break;
-      }
+    if (w->relocations != NULL) {
+      // The garbage collector has to check its values as the leader.
+      break;
+    }
 
-      // Append to *reuslt
-      if (result == first->batch) {
-        // Switch to temporary batch instead of disturbing caller's batch
-        result = tmp_batch_;
-        assert(WriteBatchInternal::Count(result) == 0);
-        WriteBatchInternal::Append(result, first->batch);
-      }
-      WriteBatchInternal::Append(result, w->batch);
+    if (w->batch == NULL) {
+      // Memtable compactions and ingestions need the front of the queue
+      // to themselves.
+      break;
+    }
+
+    size += WriteBatchInternal::ByteSize(w->batch);
+    if (size > max_size) {
+      // Do not make batch too big
+      break;
+    }
+
+    // Append to *reuslt
+    if (result == first->batch) {
+      // Switch to temporary batch instead of disturbing caller's batch
+      result = tmp_batch_;
+      assert(WriteBatchInternal::Count(result) == 0);
+      WriteBatchInternal::Append(result, first->batch);
     }
+    WriteBatchInternal::Append(result, w->batch);
     *last_writer = w;
   }
   return result;
 }
 
+Status DBImpl::InsertWriteGroup(const std::vector<Writer*>& group,
+                                SequenceNumber first_sequence) {
+  mutex_.AssertHeld();
+  Writer* leader = group[0];
+
+  // Give each batch its part of the group's sequence numbers
+  SequenceNumber seq = first_sequence;
+  int batches = 0;
+  for (size_t i = 0; i < group.size(); i++) {
+    if (group[i]->batch != NULL) {
+      WriteBatchInternal::SetSequence(group[i]->batch, seq);
+      seq += WriteBatchInternal::Count(group[i]->batch);
+      batches++;
+    }
+  }
+
+  MemTable* mem = mem_;
+  Status s;
+  if (!options_.allow_concurrent_memtable_write || batches == 1) {
+    mutex_.Unlock();
+    for (size_t i = 0; s.ok() && i < group.size(); i++) {
+      if (group[i]->batch != NULL) {
+        s = WriteBatchInternal::InsertInto(group[i]->batch, mem);
+      }
+    }
+    mutex_.Lock();
+    return s;
+  }
+
+  // Wake the other writers to insert their own batches
+  pending_memtable_inserts_ = 0;
+  memtable_insert_status_ = Status::OK();
+  for (size_t i = 1; i < group.size(); i++) {
+    if (group[i]->batch != NULL) {
+      group[i]->insert = true;
+      pending_memtable_inserts_++;
+      group[i]->cv.Signal();
+    }
+  }
+  mutex_.Unlock();
+  s = WriteBatchInternal::InsertConcurrentlyInto(leader->batch, mem);
+  mutex_.Lock();
+  while (pending_memtable_inserts_ > 0) {
+    memtable_insert_cv_.Wait();
+  }
+  if (s.ok()) {
+    s = memtable_insert_status_;
+  }
+  return s;
+}
+
 // REQUIRES: mutex_ is held
 // REQUIRES: this thread is currently at the front of the writer queue
 Status DBImpl::MakeRoomForWrite(bool force) {
   mutex_.AssertHeld();
   assert(!writers_.empty());
   bool allow_delay = !force;
+  bool stopped = false;
   Status s;
+  UpdateWriteController();
   while (true) {
     if (!bg_error_.ok()) {
       // Yield previous error
       s = bg_error_;
       break;
-    } else if (
-        allow_delay &&
-        versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
-      // We are getting close to hitting a hard limit on the number of
-      // L0 files.  Rather than delaying a single write by several
-      // seconds when we hit the hard limit, start delaying each
-      // individual write by 1ms to reduce latency variance.  Also,
-      // this delay hands over some CPU to the compaction thread in
-      // case it is sharing the same core as the writer.
-      mutex_.Unlock();
-      env_->SleepForMicroseconds(1000);
+    } else if (allow_delay && write_controller_.delayed()) {
+      // We are getting close to the point where writes stop until
+      // compactions catch up.  Rather than delaying a single write by
+      // several seconds when we get there, pace writes at a rate that
+      // follows the compaction backlog to reduce latency variance.
+      // This also hands over some CPU to the compaction thread in case
+      // it is sharing the same core as the writer.
       allow_delay = false;  // Do not delay a single write more than once
-      mutex_.Lock();
+      const uint64_t delay = write_controller_.GetDelay(env_->NowMicros());
+      if (delay > 0) {
+        mutex_.Unlock();
+        env_->SleepForMicroseconds(delay);
+        mutex_.Lock();
+        stall_stats_.delayed_writes++;
+        stall_stats_.delay_micros += delay;
+      }
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
       break;
+    } else if (shutting_down_.Acquire_Load()) {
+      // Background work has stopped, so waiting for it would never end.
+      // Only the value log garbage collector can get here.
+      s = Status::IOError("Deleting DB during write");
+      break;
     } else if (imm_ != NULL) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      const uint64_t start_micros = env_->NowMicros();
       bg_cv_.Wait();
-    } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
-      // There are too many level-0 files.
-      Log(options_.info_log, "Too many L0 files; waiting...\n");
+      stall_stats_.stop_micros += env_->NowMicros() - start_micros;
+      if (!stopped) {
+        stopped = true;
+        stall_stats_.stopped_writes++;
+      }
+    } else if (WritesStopped()) {
+      // There are too many level-0 files or too many bytes waiting to be
+      // compacted.
+      Log(options_.info_log,
+          "Too many L0 files or pending compaction bytes; waiting...\n");
+      const uint64_t start_micros = env_->NowMicros();
       bg_cv_.Wait();
+      stall_stats_.stop_micros += env_->NowMicros() - start_micros;
+      if (!stopped) {
+        stopped = true;
+        stall_stats_.stopped_writes++;
+      }
+      UpdateWriteController();
+    } else if (!memtable_writers_.empty()) {
+      // Earlier pipelined writes are still inserting into mem_
+      memtable_insert_cv_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
       uint64_t new_log_number = versions_->NewFileNumber();
       WritableFile* lfile = NULL;
-      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
+      s = NewLogFile(new_log_number, &lfile);
       if (!s.ok()) {
         // Avoid chewing through file number space in a tight loop.
         versions_->ReuseFileNumber(new_log_number);
@@ -1334,9 +3002,9 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       delete logfile_;
       logfile_ = lfile;
       logfile_number_ = new_log_number;
-      log_ = new log::Writer(lfile);
+      log_ = new log::Writer(lfile, new_log_number,
+                             options_.recycle_log_file_num > 0);
       imm_ = mem_;
-      has_imm_.Release_Store(imm_);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
       force = false;   // Do not force another compaction if have room
@@ -1346,6 +3014,63 @@ Status DBImpl::MakeRoomForWrite(bool force) {
   return s;
 }
 
+double DBImpl::CompactionPressure() {
+  mutex_.AssertHeld();
+  double pressure = -1;
+  const int files = versions_->NumLevelFiles(0);
+  const int slowdown = options_.level0_slowdown_writes_trigger;
+  if (files >= slowdown) {
+    const int range =
+        std::max(options_.level0_stop_writes_trigger - slowdown, 1);
+    pressure = static_cast<double>(files - slowdown) / range;
+  }
+  const uint64_t soft = options_.soft_pending_compaction_bytes_limit;
+  const uint64_t hard = options_.hard_pending_compaction_bytes_limit;
+  const uint64_t pending = versions_->PendingCompactionBytes();
+  if (soft > 0 && pending >= soft) {
+    const uint64_t range = (hard > soft) ? hard - soft : soft;
+    pressure = std::max(pressure,
+                        static_cast<double>(pending - soft) / range);
+  }
+  return pressure;
+}
+
+bool DBImpl::WritesStopped() {
+  mutex_.AssertHeld();
+  const uint64_t hard = options_.hard_pending_compaction_bytes_limit;
+  return (versions_->NumLevelFiles(0) >= options_.level0_stop_writes_trigger ||
+          (hard > 0 && versions_->PendingCompactionBytes() >= hard));
+}
+
+void DBImpl::UpdateWriteController() {
+  mutex_.AssertHeld();
+  const double pressure = CompactionPressure();
+  if (pressure < 0) {
+    write_controller_.StopDelay();
+  } else if (!write_controller_.delayed()) {
+    write_controller_.StartDelay(env_->NowMicros(), BackgroundWriteRate(),
+                                 pressure);
+    Log(options_.info_log, "Delaying writes to %llu bytes/s\n",
+        static_cast<unsigned long long>(write_controller_.rate()));
+  } else {
+    write_controller_.Adjust(pressure);
+  }
+}
+
+uint64_t DBImpl::BackgroundWriteRate() {
+  mutex_.AssertHeld();
+  int64_t micros = 0;
+  int64_t bytes = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    micros += stats_[level].micros;
+    bytes += stats_[level].bytes_written;
+  }
+  if (micros <= 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(bytes * 1e6 / micros);
+}
+
 bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   value->clear();
 
@@ -1395,6 +3120,58 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "write-stalls") {
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "delayed-writes: %llu\n"
+             "delay-micros: %llu\n"
+             "stopped-writes: %llu\n"
+             "stop-micros: %llu\n"
+             "delayed-write-rate: %llu\n",
+             static_cast<unsigned long long>(stall_stats_.delayed_writes),
+             static_cast<unsigned long long>(stall_stats_.delay_micros),
+             static_cast<unsigned long long>(stall_stats_.stopped_writes),
+             static_cast<unsigned long long>(stall_stats_.stop_micros),
+             static_cast<unsigned long long>(
+                 write_controller_.delayed() ? write_controller_.rate() : 0));
+    *value = buf;
+    return true;
+  } else if (in == "rate-limiter") {
+    RateLimiter* limiter = options_.rate_limiter;
+    if (limiter == NULL) {
+      return false;
+    }
+    static const char* kNames[RateLimiter::kNumPriorities] = {
+      "flush", "compaction"
+    };
+    char buf[200];
+    for (int i = 0; i < RateLimiter::kNumPriorities; i++) {
+      const RateLimiter::IOPriority pri =
+          static_cast<RateLimiter::IOPriority>(i);
+      snprintf(buf, sizeof(buf),
+               "%s-rate: %lld\n"
+               "%s-bytes: %lld\n"
+               "%s-throttled-micros: %lld\n",
+               kNames[i], static_cast<long long>(limiter->GetRate(pri)),
+               kNames[i], static_cast<long long>(limiter->GetBytesThrough(pri)),
+               kNames[i],
+               static_cast<long long>(limiter->GetThrottledMicros(pri)));
+      value->append(buf);
+    }
+    return true;
+  } else if (in == "estimate-pending-compaction-bytes") {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(
+                 versions_->PendingCompactionBytes()));
+    *value = buf;
+    return true;
+  } else if (in == "num-value-log-files") {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%d",
+             static_cast<int>(versions_->current()->value_logs().size()));
+    *value = buf;
+    return true;
   }
 
   return false;
@@ -1440,6 +3217,59 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::Merge(const WriteOptions& opt, const Slice& key,
+                 const Slice& value) {
+  WriteBatch batch;
+  batch.Merge(key, value);
+  return Write(opt, &batch);
+}
+
+Status DB::IngestExternalFiles(const std::vector<std::string>& files) {
+  return Status::NotSupported("IngestExternalFiles");
+}
+
+Status DB::GetPinned(const ReadOptions& options, const Slice& key,
+                     PinnableSlice* value) {
+  value->Reset();
+  std::string tmp;
+  Status s = Get(options, key, &tmp);
+  if (s.ok()) {
+    value->PinSelf(tmp);
+  }
+  return s;
+}
+
+Status DB::GetMergeOperands(const ReadOptions& options, const Slice& key,
+                            PinnableSlice* value, uint64_t* value_size,
+                            bool* has_value,
+                            std::vector<std::string>* operands) {
+  std::string tmp;
+  Status s = Get(options, key, &tmp);
+  *has_value = s.ok();
+  *value_size = s.ok() ? tmp.size() : 0;
+  if (s.ok() && value != NULL) {
+    value->PinSelf(tmp);
+  }
+  operands->clear();
+  return s;
+}
+
+void DB::MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                  std::string* values, Status* statuses) {
+  ReadOptions read_options = options;
+  const Snapshot* snapshot = NULL;
+  if (read_options.snapshot == NULL) {
+    snapshot = GetSnapshot();
+    read_options.snapshot = snapshot;
+  }
+  for (int i = 0; i < n; i++) {
+    statuses[i] = Get(read_options, keys[i], &values[i]);
+  }
+  if (snapshot != NULL) {
+    ReleaseSnapshot(snapshot);
+  }
+}
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -1453,18 +3283,21 @@ Status DB::Open(const Options& options, const std::string& dbname,
   if (s.ok()) {
     uint64_t new_log_number = impl->versions_->NewFileNumber();
     WritableFile* lfile;
-    s = options.env->NewWritableFile(LogFileName(dbname, new_log_number),
-                                     &lfile);
+    s = impl->NewLogFile(new_log_number, &lfile);
     if (s.ok()) {
       edit.SetLogNumber(new_log_number);
       impl->logfile_ = lfile;
       impl->logfile_number_ = new_log_number;
-      impl->log_ = new log::Writer(lfile);
+      // Logs from before this one may not be in the recyclable format
+      impl->first_recyclable_log_ = new_log_number;
+      impl->log_ = new log::Writer(lfile, new_log_number,
+                                   impl->options_.recycle_log_file_num > 0);
       s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
     }
     if (s.ok()) {
       impl->DeleteObsoleteFiles();
       impl->MaybeScheduleCompaction();
+      impl->MaybeScheduleValueLogGC();
     }
   }
   impl->mutex_.Unlock();
@@ -7,9 +7,11 @@
 
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
+#include "db/write_controller.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "port/port.h"
@@ -19,9 +21,12 @@ namespace leveldb {
 
 class MemTable;
 class TableCache;
+class ValueLog;
 class Version;
 class VersionEdit;
 class VersionSet;
+struct FileMetaData;
+struct ValueLogMetaData;
 
 class DBImpl : public DB {
  public:
@@ -31,16 +36,28 @@ class DBImpl : public DB {
   // Implementations of the DB interface
   virtual Status Put(const WriteOptions&, const Slice& key, const Slice& value);
   virtual Status Delete(const WriteOptions&, const Slice& key);
+  virtual Status Merge(const WriteOptions&, const Slice& key,
+                       const Slice& value);
   virtual Status Write(const WriteOptions& options, WriteBatch* updates);
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual Status GetPinned(const ReadOptions& options,
+                           const Slice& key,
+                           PinnableSlice* value);
+  virtual Status GetMergeOperands(const ReadOptions& options,
+                                  const Slice& key, PinnableSlice* value,
+                                  uint64_t* value_size, bool* has_value,
+                                  std::vector<std::string>* operands);
+  virtual void MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                        std::string* values, Status* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
   virtual bool GetProperty(const Slice& property, std::string* value);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual Status IngestExternalFiles(const std::vector<std::string>& files);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -59,6 +76,9 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Return the number of the current log file.
+  uint64_t TEST_LogfileNumber();
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
@@ -67,6 +87,8 @@ class DBImpl : public DB {
  private:
   friend class DB;
   struct CompactionState;
+  struct Relocation;
+  struct SubcompactionTask;
   struct Writer;
 
   Iterator* NewInternalIterator(const ReadOptions&,
@@ -82,9 +104,15 @@ class DBImpl : public DB {
 
   void MaybeIgnoreError(Status* s) const;
 
-  // Delete any unneeded files and stale in-memory entries.
+  // Delete any unneeded files and stale in-memory entries.  Obsolete
+  // logs are kept for reuse up to options_.recycle_log_file_num.
   void DeleteObsoleteFiles();
 
+  // Create the file of log "number", reusing the file of an obsolete log
+  // if one has been kept.
+  Status NewLogFile(uint64_t number, WritableFile** file)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   // Compact the in-memory write buffer to disk.  Switches to a new
   // log-file/memtable and writes a new descriptor iff successful.
   // Errors are recorded in bg_error_.
@@ -95,29 +123,140 @@ class DBImpl : public DB {
                         SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  // Build a table from the contents of *mem and record it in *edit.
+  // The table's number is stored in *number, and the number of the
+  // value log file that receives its large values (or zero) in
+  // *value_log_number.  Both stay in pending_outputs_ until the caller
+  // has applied *edit and removed them.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+                          uint64_t* number, uint64_t* value_log_number)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
 
+  // How far compactions have fallen behind: negative while writes need
+  // not be slowed down, zero at the slowdown triggers and one at the stop
+  // triggers.
+  double CompactionPressure() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Must writes wait until compactions have caught up?
+  bool WritesStopped() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Start, stop or adjust the delaying of writes to the current
+  // compaction pressure.
+  void UpdateWriteController() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Bytes per second written by flushes and compactions so far, or zero
+  // if none have run.
+  uint64_t BackgroundWriteRate() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Insert the batches of a logged write group, led by group[0], into
+  // mem_.  With allow_concurrent_memtable_write each batch is inserted
+  // by the thread of its writer.
+  Status InsertWriteGroup(const std::vector<Writer*>& group,
+                          SequenceNumber first_sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Write() for "my_batch", to which the writer first adds the entries
+  // of *relocations that are still live if relocations is non-NULL.
+  Status WriteImpl(const WriteOptions& options, WriteBatch* my_batch,
+                   uint64_t relocate_from,
+                   std::vector<Relocation>* relocations);
+
   void RecordBackgroundError(const Status& s);
 
+  // Value log garbage collection runs on a thread of its own, since
+  // writing the live values back may have to wait for compactions.
+  void MaybeScheduleValueLogGC() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGWorkValueLogGC(void* db);
+  void BackgroundValueLogGCCall();
+  void CollectValueLog() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Write the live values of value log file "f" back to the database and
+  // store in *last_sequence the sequence number after which no key
+  // refers to the file.  Called without mutex_ held.
+  Status RelocateValueLog(const ValueLogMetaData& f,
+                          SequenceNumber* last_sequence);
+
+  // Remove from *relocations the values of value log file "number" that
+  // their keys no longer refer to.  Temporarily releases mutex_.
+  Status DropStaleRelocations(uint64_t number,
+                              std::vector<Relocation>* relocations)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
+  static void BGWorkFlush(void* db);
   void BackgroundCall();
+  void BackgroundFlushCall();
   void  BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Merge the inputs of compact->compaction that fall in the key range
+  // of *compact into new output files.  Called without mutex_ held.
+  Status DoCompactionRange(CompactionState* compact);
+
+  // Merge the key ranges separated by "boundaries" on this thread and
+  // threads of the LOW pool, and gather their output files in *compact.
+  // Called without mutex_ held.
+  Status DoSubcompactions(CompactionState* compact,
+                          const std::vector<std::string>& boundaries);
+  static void RunSubcompaction(void* arg);
+
+  // Options for building a table that will be placed in "level"
+  Options TableOptions(int level) const;
+
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
+
+  // Add key/value to the output of *compact, switching to a new output
+  // file when the current one is big enough.
+  Status AddCompactionOutput(CompactionState* compact, Iterator* input,
+                             const Slice& key, const Slice& value);
+
+  // Add an entry of type kTypeValue for ikey.user_key/value to the output
+  // of *compact.  Values of at least options_.value_log_threshold bytes
+  // go to the value log of *compact, and the table gets a pointer to
+  // them in an entry of type kTypeValueIndex.
+  Status AddCompactionValue(CompactionState* compact, Iterator* input,
+                            const ParsedInternalKey& ikey,
+                            const Slice& value);
+  Status FinishCompactionValueLog(CompactionState* compact);
+
+  // Combine the merge operand *input is positioned at with the older
+  // entries of its key, which every snapshot sees merged, and add the
+  // result to the output of *compact.  Leaves *input after the entries
+  // consumed and stores the sequence number of the oldest of them in
+  // *last_sequence_for_key.
+  Status MergeCompactionEntries(CompactionState* compact, Iterator* input,
+                                SequenceNumber* last_sequence_for_key);
+
+  // Store the first and last key of the ingested table meta->number in
+  // meta->smallest and meta->largest.
+  Status ReadIngestedKeyRange(FileMetaData* meta);
+
+  // Pass "value", the value of the entry "ikey" of type kTypeValue or
+  // kTypeValueIndex, through options_.compaction_filter.  Returns false
+  // if the entry is to be kept as it is.  Otherwise sets *drop if the
+  // entry can be left out of the output, and if not stores the entry to
+  // output in its place in *new_key and *new_value.
+  bool FilterCompactionEntry(CompactionState* compact,
+                             const ParsedInternalKey& ikey,
+                             const Slice& value, bool* drop,
+                             std::string* new_key, std::string* new_value);
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Apply *edit to the current version.  Memtable compactions and
+  // table compactions run on different threads, so this serializes
+  // their calls to VersionSet::LogAndApply().
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   // Constant after construction
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
@@ -127,8 +266,16 @@ class DBImpl : public DB {
   bool owns_cache_;
   const std::string dbname_;
 
-  // table_cache_ provides its own synchronization
+  // Envs through which flushes and compactions create their output
+  // files: env_, or wrappers that pass appends through
+  // options_.rate_limiter, open files for direct I/O, and preallocate
+  // and incrementally sync them as configured
+  Env* const flush_env_;
+  Env* const compaction_env_;
+
+  // table_cache_ and value_log_ provide their own synchronization
   TableCache* table_cache_;
+  ValueLog* value_log_;
 
   // Lock over the persistent DB state.  Non-NULL iff successfully acquired.
   FileLock* db_lock_;
@@ -139,16 +286,34 @@ class DBImpl : public DB {
   port::CondVar bg_cv_;          // Signalled when background work finishes
   MemTable* mem_;
   MemTable* imm_;                // Memtable being compacted
-  port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
+
+  // Obsolete logs kept for NewLogFile() to reuse, oldest first.  Only
+  // logs numbered first_recyclable_log_ or later were written in the
+  // recyclable format and may be reused.
+  std::deque<uint64_t> log_recycle_files_;
+  uint64_t first_recyclable_log_;
   uint32_t seed_;                // For sampling.
 
   // Queue of writers.
   std::deque<Writer*> writers_;
   WriteBatch* tmp_batch_;
 
+  // Memtable inserts of the current write group that have not finished,
+  // and the first error of those that have
+  int pending_memtable_inserts_;
+  Status memtable_insert_status_;
+  port::CondVar memtable_insert_cv_;  // Signalled when inserts finish
+
+  // Leaders of pipelined write groups that have been logged but not yet
+  // inserted into the memtable, in log order
+  std::deque<Writer*> memtable_writers_;
+
+  // Paces writes while compactions are falling behind
+  WriteController write_controller_;
+
   SnapshotList snapshots_;
 
   // Set of table files to protect from deletion because they are
@@ -158,6 +323,24 @@ class DBImpl : public DB {
   // Has a background compaction been scheduled or is running?
   bool bg_compaction_scheduled_;
 
+  // Has a background memtable compaction been scheduled or is running?
+  bool bg_flush_scheduled_;
+
+  // Is a call to versions_->LogAndApply() in progress?
+  bool logging_edit_;
+
+  // Has a value log garbage collection been scheduled or is running?
+  bool bg_gc_scheduled_;
+
+  // Value log file whose live values have been written back, but which
+  // snapshots older than gc_pending_sequence_ may still read; zero if
+  // none.
+  uint64_t gc_pending_number_;
+  SequenceNumber gc_pending_sequence_;
+
+  // Value log files the garbage collector failed on
+  std::set<uint64_t> gc_failed_;
+
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
@@ -190,6 +373,20 @@ class DBImpl : public DB {
   };
   CompactionStats stats_[config::kNumLevels];
 
+  // Writes that were slowed down by write_controller_ or stopped until
+  // background work made room, and the time they spent waiting
+  struct WriteStallStats {
+    uint64_t delayed_writes;
+    uint64_t delay_micros;
+    uint64_t stopped_writes;
+    uint64_t stop_micros;
+
+    WriteStallStats()
+        : delayed_writes(0), delay_micros(0),
+          stopped_writes(0), stop_micros(0) { }
+  };
+  WriteStallStats stall_stats_;
+
   // No copying allowed
   DBImpl(const DBImpl&);
   void operator=(const DBImpl&);
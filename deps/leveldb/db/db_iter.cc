@@ -7,6 +7,8 @@
 #include "db/filename.h"
 #include "db/db_impl.h"
 #include "db/dbformat.h"
+#include "db/merge_context.h"
+#include "db/value_log.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "port/port.h"
@@ -31,6 +33,21 @@ static void DumpInternalIter(Iterator* iter) {
 
 namespace {
 
+// Turn "*key" into the shortest string that sorts after every string
+// starting with "*key".  Returns false if there is no such string
+// (i.e. "*key" is empty or consists only of 0xff bytes).
+static bool PrefixSuccessor(std::string* key) {
+  while (!key->empty()) {
+    const uint8_t byte = (*key)[key->size() - 1];
+    if (byte != 0xff) {
+      (*key)[key->size() - 1] = byte + 1;
+      return true;
+    }
+    key->resize(key->size() - 1);
+  }
+  return false;
+}
+
 // Memtables and sstables that make the DB representation contain
 // (userkey,seq,type) => uservalue entries.  DBIter
 // combines multiple entries for the same userkey found in the DB
@@ -49,15 +66,33 @@ class DBIter: public Iterator {
   };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         uint32_t seed, const Slice* prefix, const Slice* upper_bound,
+         ValueLog* value_log, bool verify_checksums,
+         const MergeOperator* merge_operator, bool keys_only)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        has_prefix_(prefix != NULL),
+        has_upper_bound_(upper_bound != NULL),
+        value_log_(value_log),
+        verify_checksums_(verify_checksums),
+        merge_operator_(merge_operator),
+        keys_only_(keys_only),
         direction_(kForward),
         valid_(false),
+        merged_(false),
+        value_is_index_(false),
+        value_is_operand_(false),
+        value_resolved_(false),
         rnd_(seed),
         bytes_counter_(RandomPeriod()) {
+    if (has_prefix_) {
+      prefix_.assign(prefix->data(), prefix->size());
+    }
+    if (has_upper_bound_) {
+      upper_bound_.assign(upper_bound->data(), upper_bound->size());
+    }
   }
   virtual ~DBIter() {
     delete iter_;
@@ -65,17 +100,43 @@ class DBIter: public Iterator {
   virtual bool Valid() const { return valid_; }
   virtual Slice key() const {
     assert(valid_);
-    return (direction_ == kForward) ? ExtractUserKey(iter_->key()) : saved_key_;
+    return (direction_ == kForward && !merged_) ? ExtractUserKey(iter_->key())
+                                                : saved_key_;
   }
   virtual Slice value() const {
     assert(valid_);
-    return (direction_ == kForward) ? iter_->value() : saved_value_;
+    if (value_is_operand_) {
+      return Slice();  // Not merged in keys_only mode
+    }
+    Slice raw = (direction_ == kForward && !merged_) ? iter_->value()
+                                                     : saved_value_;
+    if (!value_is_index_) {
+      return raw;
+    }
+    // Read values kept in the value log only when asked for
+    if (!value_resolved_) {
+      Status s;
+      if (value_log_ == NULL) {
+        s = Status::Corruption("value log pointer without a value log");
+      } else {
+        ReadOptions options;
+        options.verify_checksums = verify_checksums_;
+        s = value_log_->Get(options, raw, &resolved_value_);
+      }
+      if (!s.ok() && value_status_.ok()) {
+        value_status_ = s;
+      }
+      value_resolved_ = true;
+    }
+    return resolved_value_;
   }
   virtual Status status() const {
-    if (status_.ok()) {
-      return iter_->status();
-    } else {
+    if (!status_.ok()) {
       return status_;
+    } else if (!value_status_.ok()) {
+      return value_status_;
+    } else {
+      return iter_->status();
     }
   }
 
@@ -88,12 +149,38 @@ class DBIter: public Iterator {
  private:
   void FindNextUserEntry(bool skipping, std::string* skip);
   void FindPrevUserEntry();
+  void MergeForward();
+  void FinishMerge(const MergeContext& merge, ValueType base_type,
+                   std::string* base);
   bool ParseKey(ParsedInternalKey* key);
 
+  // Returns <0, 0 or >0 if "user_key" sorts before, starts with or sorts
+  // after the iteration prefix.
+  int ComparePrefix(const Slice& user_key) const {
+    if (!has_prefix_ || user_key.starts_with(prefix_)) {
+      return 0;
+    }
+    return user_comparator_->Compare(user_key, prefix_);
+  }
+
+  // Returns true if "user_key" is at or after the upper bound.
+  bool PastUpperBound(const Slice& user_key) const {
+    return has_upper_bound_ &&
+        user_comparator_->Compare(user_key, upper_bound_) >= 0;
+  }
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
 
+  // Record whether the value of the current entry is a value log pointer
+  // or an operand left unmerged
+  inline void SetValueType(ValueType type) {
+    value_is_index_ = (type == kTypeValueIndex);
+    value_is_operand_ = (type == kTypeMerge);
+    value_resolved_ = false;
+  }
+
   inline void ClearSavedValue() {
     if (saved_value_.capacity() > 1048576) {
       std::string empty;
@@ -112,6 +199,14 @@ class DBIter: public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  const bool has_prefix_;
+  std::string prefix_;
+  const bool has_upper_bound_;
+  std::string upper_bound_;
+  ValueLog* const value_log_;
+  const bool verify_checksums_;
+  const MergeOperator* const merge_operator_;
+  const bool keys_only_;
 
   Status status_;
   std::string saved_key_;     // == current key when direction_==kReverse
@@ -119,6 +214,18 @@ class DBIter: public Iterator {
   Direction direction_;
   bool valid_;
 
+  // The current entry was merged from several entries.  When moving
+  // forward, saved_key_ and saved_value_ then hold the current key and
+  // value and iter_ is positioned after the entries that were merged.
+  bool merged_;
+
+  // The value of the current entry if it is kept in the value log
+  bool value_is_index_;
+  bool value_is_operand_;
+  mutable bool value_resolved_;
+  mutable std::string resolved_value_;
+  mutable Status value_status_;
+
   Random rnd_;
   ssize_t bytes_counter_;
 
@@ -162,6 +269,15 @@ void DBIter::Next() {
       return;
     }
     // saved_key_ already contains the key to skip past.
+  } else if (merged_) {
+    // saved_key_ already contains the key to skip past.
+    if (!iter_->Valid()) {
+      valid_ = false;
+      merged_ = false;
+      saved_key_.clear();
+      ClearSavedValue();
+      return;
+    }
   } else {
     // Store in saved_key_ the current key so we skip it below.
     SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
@@ -174,9 +290,18 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   // Loop until we hit an acceptable entry to yield
   assert(iter_->Valid());
   assert(direction_ == kForward);
+  merged_ = false;
   do {
     ParsedInternalKey ikey;
     if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      const int r = ComparePrefix(ikey.user_key);
+      if (r > 0 || PastUpperBound(ikey.user_key)) {
+        // Past the last key with the prefix or the upper bound.
+        break;
+      } else if (r < 0) {
+        iter_->Next();
+        continue;
+      }
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -185,13 +310,30 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
           skipping = true;
           break;
         case kTypeValue:
+        case kTypeValueIndex:
           if (skipping &&
               user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
             // Entry hidden
           } else {
+            SetValueType(ikey.type);
+            valid_ = true;
+            saved_key_.clear();
+            return;
+          }
+          break;
+        case kTypeMerge:
+          if (skipping &&
+              user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
+            // Entry hidden
+          } else if (keys_only_) {
+            // The key is there whatever its operands apply to
+            SetValueType(ikey.type);
             valid_ = true;
             saved_key_.clear();
             return;
+          } else {
+            MergeForward();
+            return;
           }
           break;
       }
@@ -208,10 +350,17 @@ void DBIter::Prev() {
   if (direction_ == kForward) {  // Switch directions?
     // iter_ is pointing at the current entry.  Scan backwards until
     // the key changes so we can use the normal reverse scanning code.
-    assert(iter_->Valid());  // Otherwise valid_ would have been false
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    if (merged_) {
+      // saved_key_ holds the current key; iter_ is past its entries
+      merged_ = false;
+      if (!iter_->Valid()) {
+        iter_->SeekToLast();
+      }
+    } else {
+      assert(iter_->Valid());  // Otherwise valid_ would have been false
+      SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    }
     while (true) {
-      iter_->Prev();
       if (!iter_->Valid()) {
         valid_ = false;
         saved_key_.clear();
@@ -222,6 +371,7 @@ void DBIter::Prev() {
                                     saved_key_) < 0) {
         break;
       }
+      iter_->Prev();
     }
     direction_ = kReverse;
   }
@@ -231,22 +381,44 @@ void DBIter::Prev() {
 
 void DBIter::FindPrevUserEntry() {
   assert(direction_ == kReverse);
+  merged_ = false;
 
   ValueType value_type = kTypeDeletion;
+  // Type of the newest entry under the merge operands of the key, and
+  // the operands themselves from oldest to newest
+  ValueType base_type = kTypeDeletion;
+  std::vector<std::string> operands;
   if (iter_->Valid()) {
     do {
       ParsedInternalKey ikey;
       if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+        const int r = ComparePrefix(ikey.user_key);
+        if (r < 0) {
+          // Before the first key with the prefix.
+          break;
+        } else if (r > 0 || PastUpperBound(ikey.user_key)) {
+          iter_->Prev();
+          continue;
+        }
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
           break;
         }
         value_type = ikey.type;
-        if (value_type == kTypeDeletion) {
+        if (value_type == kTypeMerge) {
+          SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+          if (!keys_only_) {
+            operands.push_back(iter_->value().ToString());
+          }
+        } else if (value_type == kTypeDeletion) {
+          base_type = kTypeDeletion;
+          operands.clear();
           saved_key_.clear();
           ClearSavedValue();
         } else {
+          base_type = value_type;
+          operands.clear();
           Slice raw_value = iter_->value();
           if (saved_value_.capacity() > raw_value.size() + 1048576) {
             std::string empty;
@@ -266,17 +438,98 @@ void DBIter::FindPrevUserEntry() {
     saved_key_.clear();
     ClearSavedValue();
     direction_ = kForward;
+  } else if (value_type == kTypeMerge && keys_only_) {
+    ClearSavedValue();
+    SetValueType(kTypeMerge);
+    valid_ = true;
+  } else if (value_type == kTypeMerge) {
+    MergeContext merge(merge_operator_, saved_key_);
+    for (size_t i = operands.size(); i > 0; i--) {
+      merge.AddOperand(operands[i - 1]);
+    }
+    FinishMerge(merge, base_type, &saved_value_);
   } else {
+    SetValueType(value_type);
+    valid_ = true;
+  }
+}
+
+// Applies the operands of the entries starting at the merge operand
+// iter_ is positioned at, and leaves iter_ after the entry they apply to.
+void DBIter::MergeForward() {
+  SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+  MergeContext merge(merge_operator_, saved_key_);
+  merge.AddOperand(iter_->value());
+  ValueType base_type = kTypeDeletion;
+  std::string base;
+  for (iter_->Next(); iter_->Valid(); iter_->Next()) {
+    ParsedInternalKey ikey;
+    if (!ParseKey(&ikey)) {
+      continue;
+    }
+    if (user_comparator_->Compare(ikey.user_key, saved_key_) != 0) {
+      break;
+    }
+    if (ikey.type == kTypeMerge) {
+      merge.AddOperand(iter_->value());
+    } else {
+      base_type = ikey.type;
+      if (base_type != kTypeDeletion) {
+        Slice v = iter_->value();
+        base.assign(v.data(), v.size());
+      }
+      iter_->Next();
+      break;
+    }
+  }
+  FinishMerge(merge, base_type, &base);
+  merged_ = valid_;
+}
+
+// Stores the result of applying "merge" to *base, the value of an entry
+// of type "base_type", in saved_value_ and makes it the current value.
+void DBIter::FinishMerge(const MergeContext& merge, ValueType base_type,
+                         std::string* base) {
+  Status s;
+  if (base_type == kTypeValueIndex) {
+    std::string pointer;
+    pointer.swap(*base);
+    if (value_log_ == NULL) {
+      s = Status::Corruption("value log pointer without a value log");
+    } else {
+      ReadOptions options;
+      options.verify_checksums = verify_checksums_;
+      s = value_log_->Get(options, pointer, base);
+    }
+  }
+  if (s.ok()) {
+    const Slice b(*base);
+    s = merge.Finish(base_type == kTypeDeletion ? NULL : &b, &saved_value_);
+  }
+  if (s.ok()) {
+    SetValueType(kTypeValue);
     valid_ = true;
+  } else {
+    status_ = s;
+    valid_ = false;
+    saved_key_.clear();
+    ClearSavedValue();
+    direction_ = kForward;
   }
 }
 
 void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
+  merged_ = false;
   ClearSavedValue();
   saved_key_.clear();
+  const Slice start = (ComparePrefix(target) < 0) ? Slice(prefix_) : target;
+  if (PastUpperBound(start)) {
+    valid_ = false;
+    return;
+  }
   AppendInternalKey(
-      &saved_key_, ParsedInternalKey(target, sequence_, kValueTypeForSeek));
+      &saved_key_, ParsedInternalKey(start, sequence_, kValueTypeForSeek));
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
@@ -286,7 +539,12 @@ void DBIter::Seek(const Slice& target) {
 }
 
 void DBIter::SeekToFirst() {
+  if (has_prefix_) {
+    Seek(prefix_);
+    return;
+  }
   direction_ = kForward;
+  merged_ = false;
   ClearSavedValue();
   iter_->SeekToFirst();
   if (iter_->Valid()) {
@@ -299,7 +557,28 @@ void DBIter::SeekToFirst() {
 void DBIter::SeekToLast() {
   direction_ = kReverse;
   ClearSavedValue();
-  iter_->SeekToLast();
+  std::string limit = prefix_;
+  bool has_limit = has_prefix_ && PrefixSuccessor(&limit);
+  if (has_upper_bound_ &&
+      (!has_limit || user_comparator_->Compare(upper_bound_, limit) < 0)) {
+    limit = upper_bound_;
+    has_limit = true;
+  }
+  if (has_limit) {
+    // Position just before the first key past the prefix or bound.
+    std::string seek_key;
+    AppendInternalKey(
+        &seek_key, ParsedInternalKey(limit, kMaxSequenceNumber,
+                                     kValueTypeForSeek));
+    iter_->Seek(seek_key);
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -310,8 +589,16 @@ Iterator* NewDBIterator(
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+    uint32_t seed,
+    const Slice* prefix,
+    const Slice* upper_bound,
+    ValueLog* value_log,
+    bool verify_checksums,
+    const MergeOperator* merge_operator,
+    bool keys_only) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed,
+                    prefix, upper_bound, value_log, verify_checksums,
+                    merge_operator, keys_only);
 }
 
 }  // namespace leveldb
@@ -12,16 +12,29 @@
 namespace leveldb {
 
 class DBImpl;
+class MergeOperator;
+class ValueLog;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  If "prefix" is non-NULL, only user keys
+// that start with *prefix are yielded.  If "upper_bound" is non-NULL,
+// only user keys before *upper_bound are yielded.  Values stored as
+// value log pointers are read from *value_log.  Merge operands are
+// applied with *merge_operator, unless "keys_only" is set (see
+// ReadOptions::keys_only).
 extern Iterator* NewDBIterator(
     DBImpl* db,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed);
+    uint32_t seed,
+    const Slice* prefix = NULL,
+    const Slice* upper_bound = NULL,
+    ValueLog* value_log = NULL,
+    bool verify_checksums = false,
+    const MergeOperator* merge_operator = NULL,
+    bool keys_only = false);
 
 }  // namespace leveldb
 
@@ -6,10 +6,15 @@
 #include "leveldb/filter_policy.h"
 #include "db/db_impl.h"
 #include "db/filename.h"
+#include "db/value_log.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/cache.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/env.h"
+#include "leveldb/merge_operator.h"
+#include "leveldb/rate_limiter.h"
+#include "leveldb/sst_file_writer.h"
 #include "leveldb/table.h"
 #include "util/hash.h"
 #include "util/logging.h"
@@ -52,6 +57,68 @@ class AtomicCounter {
 void DelayMilliseconds(int millis) {
   Env::Default()->SleepForMicroseconds(millis * 1000);
 }
+
+// Appends the operands to the value, separated by commas
+class AppendOperator : public MergeOperator {
+ public:
+  virtual const char* Name() const { return "leveldb.test.Append"; }
+
+  virtual bool FullMerge(const Slice& key, const Slice* existing_value,
+                         const std::vector<Slice>& operands,
+                         std::string* new_value) const {
+    new_value->clear();
+    if (existing_value != NULL) {
+      new_value->assign(existing_value->data(), existing_value->size());
+    }
+    for (size_t i = 0; i < operands.size(); i++) {
+      if (!new_value->empty()) {
+        new_value->push_back(',');
+      }
+      new_value->append(operands[i].data(), operands[i].size());
+    }
+    return true;
+  }
+
+  virtual bool PartialMerge(const Slice& key, const Slice& left_operand,
+                            const Slice& right_operand,
+                            std::string* new_operand) const {
+    *new_operand = left_operand.ToString() + "," + right_operand.ToString();
+    return true;
+  }
+};
+
+// Removes keys starting with "tmp/" and upper-cases the values of keys
+// starting with "up/"
+class PrefixFilter : public CompactionFilter {
+ public:
+  virtual const char* Name() const { return "leveldb.test.Prefix"; }
+
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const {
+    ASSERT_GT(level, 0);
+    ASSERT_TRUE(MayFilter(level, key));
+    if (key.starts_with("tmp/")) {
+      return true;
+    }
+    if (key.starts_with("up/")) {
+      new_value->assign(existing_value.data(), existing_value.size());
+      for (size_t i = 0; i < new_value->size(); i++) {
+        char& c = (*new_value)[i];
+        if (c >= 'a' && c <= 'z') {
+          c = c - 'a' + 'A';
+        }
+      }
+      *value_changed = true;
+    }
+    return false;
+  }
+
+  virtual bool MayFilter(int level, const Slice& key) const {
+    return key.starts_with("tmp/") || key.starts_with("up/");
+  }
+};
 }
 
 // Special Env used to delay background operations
@@ -78,12 +145,21 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // Number of MultiRead() calls and of the reads they carried
+  AtomicCounter multi_read_calls_;
+  AtomicCounter multi_read_counter_;
+
+  // Copy table reads out of mmap()ed files into the caller's buffer, so
+  // that the blocks read are eligible for the block cache.
+  bool copy_random_reads_;
+
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_data_sync_.Release_Store(NULL);
     data_sync_error_.Release_Store(NULL);
     no_space_.Release_Store(NULL);
     non_writable_.Release_Store(NULL);
     count_random_reads_ = false;
+    copy_random_reads_ = false;
     manifest_sync_error_.Release_Store(NULL);
     manifest_write_error_.Release_Store(NULL);
   }
@@ -178,12 +254,38 @@ class SpecialEnv : public EnvWrapper {
       }
     };
 
+    class CopyingFile : public RandomAccessFile {
+     private:
+      RandomAccessFile* target_;
+     public:
+      explicit CopyingFile(RandomAccessFile* target) : target_(target) { }
+      virtual ~CopyingFile() { delete target_; }
+      virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                          char* scratch) const {
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && result->data() != scratch) {
+          memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
+      }
+    };
+
     Status s = target()->NewRandomAccessFile(f, r);
+    if (s.ok() && copy_random_reads_) {
+      *r = new CopyingFile(*r);
+    }
     if (s.ok() && count_random_reads_) {
       *r = new CountingFile(*r, &random_read_counter_);
     }
     return s;
   }
+
+  virtual void MultiRead(ReadRequest* reqs, int n) {
+    multi_read_calls_.Increment();
+    multi_read_counter_.IncrementBy(n);
+    target()->MultiRead(reqs, n);
+  }
 };
 
 class DBTest {
@@ -195,6 +297,13 @@ class DBTest {
     kDefault,
     kFilter,
     kUncompressed,
+    kSubcompactions,
+    kCachedMetaBlocks,
+    kValueLog,
+    kParallelCompression,
+    kConcurrentMemTableWrites,
+    kPipelinedWrites,
+    kDirectIO,
     kEnd
   };
   int option_config_;
@@ -244,6 +353,41 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kSubcompactions:
+        options.max_subcompactions = 4;
+        break;
+      case kCachedMetaBlocks:
+        // Index and filter blocks in the block cache, with a partitioned
+        // index and pinned level-0 blocks
+        options.filter_policy = filter_policy_;
+        options.cache_index_and_filter_blocks = true;
+        options.pin_l0_filter_and_index_blocks_in_cache = true;
+        options.index_partition_size = 128;
+        options.env = env_;
+        env_->copy_random_reads_ = true;
+        break;
+      case kValueLog:
+        // Keep all but the smallest values out of the tables
+        options.value_log_threshold = 8;
+        break;
+      case kParallelCompression:
+        // Built-in codec, since Snappy may not be available
+        options.filter_policy = filter_policy_;
+        options.compression = kLZCompression;
+        options.compression_threads = 4;
+        options.compression_dict_size = 1024;
+        break;
+      case kConcurrentMemTableWrites:
+        options.allow_concurrent_memtable_write = true;
+        break;
+      case kPipelinedWrites:
+        options.enable_pipelined_write = true;
+        break;
+      case kDirectIO:
+        options.filter_policy = filter_policy_;
+        options.use_direct_io_for_flush_and_compaction = true;
+        options.use_direct_reads = true;
+        break;
       default:
         break;
     }
@@ -293,6 +437,10 @@ class DBTest {
     return db_->Delete(WriteOptions(), k);
   }
 
+  Status Merge(const std::string& k, const std::string& v) {
+    return db_->Merge(WriteOptions(), k, v);
+  }
+
   std::string Get(const std::string& k, const Snapshot* snapshot = NULL) {
     ReadOptions options;
     options.snapshot = snapshot;
@@ -359,9 +507,19 @@ class DBTest {
             case kTypeValue:
               result += iter->value().ToString();
               break;
+            case kTypeValueIndex: {
+              ValueLog value_log(dbname_, &last_options_, 0);
+              std::string value;
+              Status s = value_log.Get(ReadOptions(), iter->value(), &value);
+              result += s.ok() ? value : s.ToString();
+              break;
+            }
             case kTypeDeletion:
               result += "DEL";
               break;
+            case kTypeMerge:
+              result += "MERGE:" + iter->value().ToString();
+              break;
           }
         }
         iter->Next();
@@ -408,6 +566,24 @@ class DBTest {
     return result;
   }
 
+  int NumValueLogFiles() {
+    std::string property;
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-value-log-files", &property));
+    return atoi(property.c_str());
+  }
+
+  // Wait up to ten seconds for the value log garbage collector to leave
+  // "n" value log files behind.
+  bool WaitForValueLogFiles(int n) {
+    for (int i = 0; i < 1000; i++) {
+      if (NumValueLogFiles() == n) {
+        return true;
+      }
+      env_->SleepForMicroseconds(10000);
+    }
+    return false;
+  }
+
   int CountFiles() {
     std::vector<std::string> files;
     env_->GetChildren(dbname_, &files);
@@ -425,6 +601,17 @@ class DBTest {
     db_->CompactRange(&start, &limit);
   }
 
+  // Compact every level into the next one, so that the entries of a key
+  // are compacted together even if they already share the last level.
+  void CompactAllLevels() {
+    dbfull()->TEST_CompactMemTable();
+    for (int level = 0; level < config::kNumLevels - 1; level++) {
+      if (NumTableFilesAtLevel(level) > 0) {
+        dbfull()->TEST_CompactRange(level, NULL, NULL);
+      }
+    }
+  }
+
   // Do n memtable compactions, each of which produces an sstable
   // covering the range [small,large].
   void MakeTables(int n, const std::string& small, const std::string& large) {
@@ -993,8 +1180,9 @@ TEST(DBTest, RepeatedWritesToSameKey) {
   Reopen(&options);
 
   // We must have at most one file per level except for level-0,
-  // which may have up to kL0_StopWritesTrigger files.
-  const int kMaxFiles = config::kNumLevels + config::kL0_StopWritesTrigger;
+  // which may have up to level0_stop_writes_trigger files.
+  const int kMaxFiles =
+      config::kNumLevels + Options().level0_stop_writes_trigger;
 
   Random rnd(301);
   std::string value = RandomString(&rnd, 2 * options.write_buffer_size);
@@ -1045,6 +1233,104 @@ TEST(DBTest, SparseMerge) {
   ASSERT_LE(dbfull()->TEST_MaxNextLevelOverlappingBytes(), 20*1048576);
 }
 
+TEST(DBTest, CachedIndexAndFilterBlocks) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.cache_index_and_filter_blocks = true;
+  options.pin_l0_filter_and_index_blocks_in_cache = true;
+  options.index_partition_size = 128;
+  // Small enough that index partitions get evicted
+  options.block_cache = NewLRUCache(32 << 10);
+  env_->copy_random_reads_ = true;
+  Reopen(&options);
+
+  const int N = 5000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), Key(i) + std::string(50, 'v')));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < N; i++) {
+      ASSERT_EQ(Key(i) + std::string(50, 'v'), Get(Key(i)));
+    }
+    ASSERT_EQ("NOT_FOUND", Get(Key(N)));
+    ASSERT_EQ("NOT_FOUND", Get("missing"));
+
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      count++;
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(N, count);
+    iter->Seek(Key(N/2));
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(Key(N/2), iter->key().ToString());
+    delete iter;
+
+    // Second pass reads from tables outside of level 0
+    db_->CompactRange(NULL, NULL);
+  }
+
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
+TEST(DBTest, Subcompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  // Sequential inserts produce several non-overlapping tables, whose
+  // boundaries give the compaction places to split.
+  const int N = 2000;
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < N; i++) {
+    values.push_back(RandomString(&rnd, 100));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  // Overwrite and delete keys across the whole range so that entries
+  // get dropped when all tables are merged.
+  for (int i = 0; i < N; i += 7) {
+    if (i % 2 == 0) {
+      ASSERT_OK(Delete(Key(i)));
+      values[i] = "NOT_FOUND";
+    } else {
+      values[i] = RandomString(&rnd, 50);
+      ASSERT_OK(Put(Key(i), values[i]));
+    }
+  }
+  db_->CompactRange(NULL, NULL);
+
+  // A single thread would have merged everything into one small table
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_EQ(NumTableFilesAtLevel(1), 0);
+  ASSERT_GT(NumTableFilesAtLevel(2), 1);
+
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+  Reopen(&options);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  // Iteration sees every live key exactly once
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  delete iter;
+  ASSERT_EQ(N - (N + 13) / 14, count);
+}
+
 static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   bool result = (val >= low) && (val <= high);
   if (!result) {
@@ -1061,6 +1347,7 @@ TEST(DBTest, ApproximateSizes) {
     Options options = CurrentOptions();
     options.write_buffer_size = 100000000;        // Large write buffer
     options.compression = kNoCompression;
+    options.value_log_threshold = 0;  // Sizes only cover the tables
     DestroyAndReopen();
 
     ASSERT_TRUE(Between(Size("", "xyz"), 0, 0));
@@ -1110,6 +1397,7 @@ TEST(DBTest, ApproximateSizes_MixOfSmallAndLarge) {
   do {
     Options options = CurrentOptions();
     options.compression = kNoCompression;
+    options.value_log_threshold = 0;  // Sizes only cover the tables
     Reopen();
 
     Random rnd(301);
@@ -1144,6 +1432,39 @@ TEST(DBTest, ApproximateSizes_MixOfSmallAndLarge) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, CompressionPerLevel) {
+  Options options = CurrentOptions();
+  options.value_log_threshold = 0;  // Sizes only cover the tables
+  options.compression_per_level.push_back(kNoCompression);
+  options.compression_per_level.push_back(kLZCompression);
+  options.compression_dict_size = 4096;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 1000; i++) {
+    std::string value;
+    test::CompressibleString(&rnd, 0.25, 1000, &value);
+    values.push_back(value);
+    ASSERT_OK(Put(Key(i), value));
+  }
+  // Memtables are flushed with the level 0 setting, whatever level the
+  // table is placed at
+  dbfull()->TEST_CompactMemTable();
+  const uint64_t flushed_size = Size("", Key(1000));
+  ASSERT_GT(flushed_size, 1000000);
+
+  // Levels past the end of the list use its last entry
+  CompactAllLevels();
+  ASSERT_EQ(1, NumTableFilesAtLevel(config::kNumLevels - 1));
+  ASSERT_LT(Size("", Key(1000)), flushed_size / 2);
+
+  Reopen(&options);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+}
+
 TEST(DBTest, IteratorPinsRef) {
   Put("foo", "hello");
 
@@ -1211,7 +1532,9 @@ TEST(DBTest, HiddenValuesAreRemoved) {
     ASSERT_GT(NumTableFilesAtLevel(0), 0);
 
     ASSERT_EQ(big, Get("foo", snapshot));
-    ASSERT_TRUE(Between(Size("", "pastfoo"), 50000, 60000));
+    if (last_options_.value_log_threshold == 0) {  // Big value in a table
+      ASSERT_TRUE(Between(Size("", "pastfoo"), 50000, 60000));
+    }
     db_->ReleaseSnapshot(snapshot);
     ASSERT_EQ(AllEntriesFor("foo"), "[ tiny, " + big + " ]");
     Slice x("x");
@@ -1726,96 +2049,1298 @@ TEST(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
-// Multi-threaded test:
-namespace {
+static std::string PrefixScan(DB* db, const Slice& prefix, bool reverse) {
+  ReadOptions options;
+  options.prefix = &prefix;
+  Iterator* iter = db->NewIterator(options);
+  std::string result;
+  if (reverse) {
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      result += iter->key().ToString() + ";";
+    }
+  } else {
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      result += iter->key().ToString() + ";";
+    }
+  }
+  delete iter;
+  return result;
+}
 
-static const int kNumThreads = 4;
-static const int kTestSeconds = 10;
-static const int kNumKeys = 1000;
+TEST(DBTest, PrefixIterator) {
+  ASSERT_OK(Put("a", "v"));
+  ASSERT_OK(Put("b/", "v"));
+  ASSERT_OK(Put("b/1", "v"));
+  ASSERT_OK(Put("b/2", "v"));
+  ASSERT_OK(Put("b0", "v"));
+  ASSERT_OK(Put("c\xff", "v"));
+  ASSERT_OK(Put("c\xff\xff", "v"));
+  ASSERT_OK(Put("d", "v"));
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ("b/;b/1;b/2;", PrefixScan(db_, "b/", false));
+    ASSERT_EQ("b/2;b/1;b/;", PrefixScan(db_, "b/", true));
+    ASSERT_EQ("c\xff;c\xff\xff;", PrefixScan(db_, "c\xff", false));
+    ASSERT_EQ("c\xff\xff;c\xff;", PrefixScan(db_, "c\xff", true));
+    ASSERT_EQ("", PrefixScan(db_, "a/", false));
+    ASSERT_EQ("", PrefixScan(db_, "e", true));
+
+    Slice prefix("b/");
+    ReadOptions options;
+    options.prefix = &prefix;
+    Iterator* iter = db_->NewIterator(options);
+    iter->Seek("a");
+    ASSERT_EQ("b/->v", IterStatus(iter));
+    iter->Seek("b/15");
+    ASSERT_EQ("b/2->v", IterStatus(iter));
+    iter->Prev();
+    ASSERT_EQ("b/1->v", IterStatus(iter));
+    iter->Next();
+    iter->Next();
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+    iter->Seek("b0");
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+    delete iter;
 
-struct MTState {
-  DBTest* test;
-  port::AtomicPointer stop;
-  port::AtomicPointer counter[kNumThreads];
-  port::AtomicPointer thread_done[kNumThreads];
-};
+    ASSERT_OK(Delete("b/1"));
+    ASSERT_EQ("b/;b/2;", PrefixScan(db_, "b/", false));
+    ASSERT_OK(Put("b/1", "v"));
+    dbfull()->TEST_CompactMemTable();
+  }
+}
 
-struct MTThread {
-  MTState* state;
-  int id;
-};
+TEST(DBTest, PrefixIteratorSkipsFilteredTables) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewSublevelBloomFilterPolicy(10, "/");
+  Reopen(&options);
 
-static void MTThreadBody(void* arg) {
-  MTThread* t = reinterpret_cast<MTThread*>(arg);
-  int id = t->id;
-  DB* db = t->state->test->db_;
-  uintptr_t counter = 0;
-  fprintf(stderr, "... starting thread %d\n", id);
-  Random rnd(1000 + id);
-  std::string value;
-  char valbuf[1500];
-  while (t->state->stop.Acquire_Load() == NULL) {
-    t->state->counter[id].Release_Store(reinterpret_cast<void*>(counter));
+  // Populate multiple layers
+  const int N = 1000;
+  char buf[100];
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < 3; j++) {
+      snprintf(buf, sizeof(buf), "dir%06d/file%d", i, j);
+      ASSERT_OK(Put(buf, "v"));
+    }
+  }
+  Compact("a", "z");
+  for (int i = 0; i < N; i += 100) {
+    snprintf(buf, sizeof(buf), "dir%06d/file%d", i, 3);
+    ASSERT_OK(Put(buf, "v"));
+  }
+  dbfull()->TEST_CompactMemTable();
 
-    int key = rnd.Uniform(kNumKeys);
-    char keybuf[20];
-    snprintf(keybuf, sizeof(keybuf), "%016d", key);
+  // Prevent auto compactions triggered by seeks
+  env_->delay_data_sync_.Release_Store(env_);
 
-    if (rnd.OneIn(2)) {
-      // Write values of the form <key, my id, counter>.
-      // We add some padding for force compactions.
-      snprintf(valbuf, sizeof(valbuf), "%d.%d.%-1000d",
-               key, id, static_cast<int>(counter));
-      ASSERT_OK(db->Put(WriteOptions(), Slice(keybuf), Slice(valbuf)));
-    } else {
-      // Read a value and verify that it matches the pattern written above.
-      Status s = db->Get(ReadOptions(), Slice(keybuf), &value);
-      if (s.IsNotFound()) {
-        // Key has not yet been written
-      } else {
-        // Check that the writer thread counter is >= the counter in the value
-        ASSERT_OK(s);
-        int k, w, c;
-        ASSERT_EQ(3, sscanf(value.c_str(), "%d.%d.%d", &k, &w, &c)) << value;
-        ASSERT_EQ(k, key);
-        ASSERT_GE(w, 0);
-        ASSERT_LT(w, kNumThreads);
-        ASSERT_LE(static_cast<uintptr_t>(c), reinterpret_cast<uintptr_t>(
-            t->state->counter[w].Acquire_Load()));
-      }
+  // Existing directories list all of their entries.
+  for (int i = 0; i < N; i += 7) {
+    snprintf(buf, sizeof(buf), "dir%06d/", i);
+    std::string expected;
+    for (int j = 0; j < (i % 100 == 0 ? 4 : 3); j++) {
+      expected += buf;
+      expected += "file" + NumberToString(j) + ";";
     }
-    counter++;
+    ASSERT_EQ(expected, PrefixScan(db_, buf, false));
   }
-  t->state->thread_done[id].Release_Store(t);
-  fprintf(stderr, "... stopping thread %d after %d ops\n", id, int(counter));
-}
 
-}  // namespace
+  // Missing directories should rarely read a data block.
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    snprintf(buf, sizeof(buf), "dir%06d.missing/", i);
+    ASSERT_EQ("", PrefixScan(db_, buf, false));
+    snprintf(buf, sizeof(buf), "dir%06d/sub/", i);
+    ASSERT_EQ("", PrefixScan(db_, buf, false));
+  }
+  int reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d missing prefixes => %d reads\n", 2*N, reads);
+  ASSERT_LE(reads, 2*3*N/100);
 
-TEST(DBTest, MultiThreaded) {
-  do {
-    // Initialize state
-    MTState mt;
-    mt.test = this;
-    mt.stop.Release_Store(0);
-    for (int id = 0; id < kNumThreads; id++) {
-      mt.counter[id].Release_Store(0);
-      mt.thread_done[id].Release_Store(0);
-    }
+  // Prefixes the policy does not cover are read without the filter.
+  ASSERT_EQ("dir000001/file0;dir000001/file1;dir000001/file2;",
+            PrefixScan(db_, "dir000001/file", false));
 
-    // Start threads
-    MTThread thread[kNumThreads];
-    for (int id = 0; id < kNumThreads; id++) {
-      thread[id].state = &mt;
-      thread[id].id = id;
-      env_->StartThread(MTThreadBody, &thread[id]);
-    }
+  env_->delay_data_sync_.Release_Store(NULL);
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
 
-    // Let them run for a while
-    DelayMilliseconds(kTestSeconds * 1000);
+TEST(DBTest, IterateUpperBound) {
+  do {
+    ASSERT_OK(Put("a", "va"));
+    ASSERT_OK(Put("b", "vb"));
+    ASSERT_OK(Put("c", "vc"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("d", "vd"));
+    ASSERT_OK(Put("e", "ve"));
+    ASSERT_OK(Delete("c"));
 
-    // Stop the threads and wait for them to finish
-    mt.stop.Release_Store(&mt);
+    Slice bound("d");
+    ReadOptions options;
+    options.iterate_upper_bound = &bound;
+    Iterator* iter = db_->NewIterator(options);
+
+    iter->SeekToFirst();
+    ASSERT_EQ(IterStatus(iter), "a->va");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "a->va");
+    iter->Next();
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+    iter->SeekToLast();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+    iter->Seek("bb");
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+    iter->Seek("d");
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+    iter->Seek("0");
+    ASSERT_EQ(IterStatus(iter), "a->va");
+    delete iter;
+
+    // A bound before every key
+    bound = "0";
+    iter = db_->NewIterator(options);
+    iter->SeekToFirst();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+    iter->SeekToLast();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+    delete iter;
+
+    // A bound past every key
+    bound = "z";
+    iter = db_->NewIterator(options);
+    iter->SeekToLast();
+    ASSERT_EQ(IterStatus(iter), "e->ve");
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "d->vd");
+    delete iter;
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, IterateUpperBoundStopsReading) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  Reopen(&options);
+
+  // A short run of live keys followed by a long run of deleted ones
+  char buf[100];
+  const std::string value(100, 'x');
+  for (int i = 0; i < 100; i++) {
+    snprintf(buf, sizeof(buf), "a%04d", i);
+    ASSERT_OK(Put(buf, value));
+  }
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    snprintf(buf, sizeof(buf), "b%05d", i);
+    ASSERT_OK(Put(buf, value));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 0; i < N; i++) {
+    snprintf(buf, sizeof(buf), "b%05d", i);
+    ASSERT_OK(Delete(buf));
+  }
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_data_sync_.Release_Store(env_);
+
+  for (int bounded = 0; bounded < 2; bounded++) {
+    Slice bound("a9");
+    ReadOptions read_options;
+    if (bounded) {
+      read_options.iterate_upper_bound = &bound;
+    }
+    env_->random_read_counter_.Reset();
+    Iterator* iter = db_->NewIterator(read_options);
+    int count = 0;
+    for (iter->Seek("a"); iter->Valid() && iter->key().compare(bound) < 0;
+         iter->Next()) {
+      count++;
+    }
+    ASSERT_OK(iter->status());
+    delete iter;
+    ASSERT_EQ(100, count);
+    int reads = env_->random_read_counter_.Read();
+    fprintf(stderr, "%s scan => %d reads\n",
+            bounded ? "bounded" : "unbounded", reads);
+    if (bounded) {
+      ASSERT_LE(reads, 10);
+    } else {
+      ASSERT_GE(reads, 100);
+    }
+  }
+
+  env_->delay_data_sync_.Release_Store(NULL);
+  Close();
+  delete options.block_cache;
+}
+
+TEST(DBTest, MultiGet) {
+  do {
+    // Spread the keys over several levels, the memtable and deletions
+    char buf[100];
+    for (int i = 0; i < 200; i++) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Put(buf, std::string(buf) + ".v1"));
+    }
+    Compact("a", "z");
+    for (int i = 0; i < 200; i += 3) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Put(buf, std::string(buf) + ".v2"));
+    }
+    dbfull()->TEST_CompactMemTable();
+    const Snapshot* snapshot = db_->GetSnapshot();
+    for (int i = 0; i < 200; i += 5) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Delete(buf));
+    }
+    for (int i = 0; i < 200; i += 7) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Put(buf, std::string(buf) + ".v3"));
+    }
+
+    // Unsorted keys with duplicates and misses
+    std::vector<std::string> key_strings;
+    for (int i = 0; i < 250; i++) {
+      snprintf(buf, sizeof(buf), "key%04d", (i * 37) % 250);
+      key_strings.push_back(buf);
+    }
+    key_strings.push_back("key0007");
+    key_strings.push_back("");
+    std::vector<Slice> keys(key_strings.begin(), key_strings.end());
+
+    for (int snap = 0; snap < 2; snap++) {
+      ReadOptions options;
+      options.snapshot = snap ? snapshot : NULL;
+      const int n = keys.size();
+      std::vector<std::string> values(n);
+      std::vector<Status> statuses(n);
+      db_->MultiGet(options, n, &keys[0], &values[0], &statuses[0]);
+      for (int i = 0; i < n; i++) {
+        std::string expected;
+        Status s = db_->Get(options, keys[i], &expected);
+        ASSERT_EQ(s.ToString(), statuses[i].ToString()) << keys[i].ToString();
+        if (s.ok()) {
+          ASSERT_EQ(expected, values[i]);
+        }
+      }
+    }
+    db_->ReleaseSnapshot(snapshot);
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, BatchBlockReads) {
+  for (int uring = 0; uring < 2; uring++) {
+    Env* uring_env = uring ? NewIOUringEnv(env_) : NULL;
+    Options options = CurrentOptions();
+    options.env = uring ? uring_env : env_;
+    options.block_size = 256;  // Many blocks per table
+    options.create_if_missing = true;
+    env_->copy_random_reads_ = true;
+    DestroyAndReopen(&options);
+
+    // Spread the keys over several levels and the memtable
+    char buf[100];
+    for (int i = 0; i < 1000; i++) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Put(buf, std::string(buf) + ".v1" + std::string(100, 'x')));
+    }
+    Compact("a", "z");
+    for (int i = 0; i < 1000; i += 3) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Put(buf, std::string(buf) + ".v2"));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 1000; i += 7) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Put(buf, std::string(buf) + ".v3"));
+    }
+    Reopen(&options);  // Start with an empty block cache
+
+    ReadOptions batched;
+    batched.batch_block_reads = true;
+    env_->multi_read_calls_.Reset();
+    env_->multi_read_counter_.Reset();
+
+    // Seeks land on the same entries as without batching
+    Iterator* iter = db_->NewIterator(batched);
+    Iterator* plain = db_->NewIterator(ReadOptions());
+    for (int i = 0; i < 1000; i += 97) {
+      snprintf(buf, sizeof(buf), "key%04d!", i);
+      iter->Seek(buf);
+      plain->Seek(buf);
+      for (int j = 0; j < 3; j++) {
+        ASSERT_EQ(IterStatus(plain), IterStatus(iter));
+        if (!plain->Valid()) break;
+        iter->Next();
+        plain->Next();
+      }
+    }
+    delete iter;
+    delete plain;
+
+    // And so do batched lookups
+    std::vector<std::string> key_strings;
+    for (int i = 0; i < 300; i++) {
+      snprintf(buf, sizeof(buf), "key%04d", (i * 37) % 1100);
+      key_strings.push_back(buf);
+    }
+    std::vector<Slice> keys(key_strings.begin(), key_strings.end());
+    const int n = keys.size();
+    std::vector<std::string> values(n);
+    std::vector<Status> statuses(n);
+    db_->MultiGet(batched, n, &keys[0], &values[0], &statuses[0]);
+    for (int i = 0; i < n; i++) {
+      ASSERT_EQ(Get(keys[i].ToString()),
+                statuses[i].ok() ? values[i] : "NOT_FOUND");
+    }
+    if (!uring) {
+      // The blocks were read with few calls, several at a time
+      ASSERT_GT(env_->multi_read_counter_.Read(),
+                2 * env_->multi_read_calls_.Read());
+    }
+
+    Close();
+    env_->copy_random_reads_ = false;
+    delete uring_env;
+  }
+}
+
+TEST(DBTest, GetPinned) {
+  do {
+    const std::string big(100000, 'x');
+    ASSERT_OK(Put("mem", "v1"));
+    ASSERT_OK(Put("table", big));
+    ASSERT_OK(Put("gone", "v1"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Delete("gone"));
+
+    PinnableSlice mem, table, gone;
+    ASSERT_OK(Put("mem", "v2"));
+    ASSERT_OK(db_->GetPinned(ReadOptions(), "mem", &mem));
+    ASSERT_OK(db_->GetPinned(ReadOptions(), "table", &table));
+    ASSERT_TRUE(db_->GetPinned(ReadOptions(), "gone", &gone).IsNotFound());
+    ASSERT_TRUE(db_->GetPinned(ReadOptions(), "none", &gone).IsNotFound());
+    ASSERT_EQ(0, gone.size());
+    ASSERT_TRUE(mem.IsPinned());
+    ASSERT_TRUE(table.IsPinned());
+    ASSERT_TRUE(!gone.IsPinned());
+
+    // Pinned values stay valid across overwrites, flushes and compactions
+    ASSERT_OK(Put("mem", "v3"));
+    ASSERT_OK(Put("table", "small"));
+    dbfull()->TEST_CompactMemTable();
+    Compact("a", "z");
+    ASSERT_EQ("v2", mem.ToString());
+    ASSERT_TRUE(big == table.ToString());
+
+    table.Reset();
+    ASSERT_OK(db_->GetPinned(ReadOptions(), "table", &table));
+    ASSERT_EQ("small", table.ToString());
+    table.PinSelf("copy");
+    ASSERT_EQ("copy", table.ToString());
+    ASSERT_TRUE(!table.IsPinned());
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, ValueLog) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.value_log_threshold = 100;
+  DestroyAndReopen(&options);
+
+  const std::string big1(1000, 'a');
+  const std::string big2(100000, 'b');
+  ASSERT_OK(Put("k1", big1));
+  ASSERT_OK(Put("k2", "small"));
+  ASSERT_OK(Put("k3", big2));
+  ASSERT_OK(Put("k4", big1));
+  ASSERT_OK(Delete("k4"));
+  ASSERT_EQ(0, NumValueLogFiles());
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(1, NumValueLogFiles());
+  ASSERT_EQ(AllEntriesFor("k1"), "[ " + big1 + " ]");
+
+  for (int run = 0; run < 2; run++) {
+    ASSERT_EQ(big1, Get("k1"));
+    ASSERT_EQ("small", Get("k2"));
+    ASSERT_EQ(big2, Get("k3"));
+    ASSERT_EQ("NOT_FOUND", Get("k4"));
+
+    {
+      PinnableSlice pinned;  // Must not outlive the database
+      ASSERT_OK(db_->GetPinned(ReadOptions(), "k3", &pinned));
+      ASSERT_TRUE(big2 == pinned.ToString());
+    }
+
+    std::vector<Slice> keys;
+    keys.push_back("k3");
+    keys.push_back("k2");
+    keys.push_back("k1");
+    std::vector<std::string> values(keys.size());
+    std::vector<Status> statuses(keys.size());
+    db_->MultiGet(ReadOptions(), keys.size(), &keys[0], &values[0],
+                  &statuses[0]);
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_OK(statuses[i]);
+    }
+    ASSERT_TRUE(big2 == values[0]);
+    ASSERT_EQ("small", values[1]);
+    ASSERT_EQ(big1, values[2]);
+
+    ReadOptions verify;
+    verify.verify_checksums = true;
+    Iterator* iter = db_->NewIterator(verify);
+    iter->SeekToFirst();
+    ASSERT_EQ("k1", iter->key().ToString());
+    ASSERT_EQ(big1, iter->value().ToString());
+    iter->Next();
+    ASSERT_EQ("small", iter->value().ToString());
+    iter->Next();
+    ASSERT_TRUE(big2 == iter->value().ToString());
+    iter->Prev();
+    iter->Prev();
+    ASSERT_EQ(big1, iter->value().ToString());
+    iter->SeekToLast();
+    ASSERT_TRUE(big2 == iter->value().ToString());
+    ASSERT_OK(iter->status());
+    delete iter;
+
+    // Compactions keep the values where they are
+    Compact("a", "z");
+    ASSERT_EQ(big1, Get("k1"));
+    ASSERT_EQ(1, NumValueLogFiles());
+    Reopen(&options);
+  }
+
+  // The values stay readable without separation
+  options.value_log_threshold = 0;
+  Reopen(&options);
+  ASSERT_EQ(big2, Get("k3"));
+  ASSERT_EQ(1, NumValueLogFiles());
+}
+
+TEST(DBTest, ValueLogGarbageCollection) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.value_log_threshold = 100;
+  options.value_log_gc_ratio = 0.5;
+  DestroyAndReopen(&options);
+
+  char buf[100];
+  for (int i = 0; i < 10; i++) {
+    snprintf(buf, sizeof(buf), "key%d", i);
+    ASSERT_OK(Put(buf, std::string(1000, 'a' + i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(1, NumValueLogFiles());
+
+  // Leave too little live data in the first file
+  for (int i = 0; i < 6; i++) {
+    snprintf(buf, sizeof(buf), "key%d", i);
+    ASSERT_OK(Put(buf, std::string(2000, 'A' + i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(2, NumValueLogFiles());
+
+  // A snapshot that reads the moved values from the first file keeps it
+  const Snapshot* snapshot = db_->GetSnapshot();
+  Compact("a", "z");
+  env_->SleepForMicroseconds(100000);
+  ASSERT_EQ(2, NumValueLogFiles());
+  for (int i = 6; i < 10; i++) {
+    snprintf(buf, sizeof(buf), "key%d", i);
+    ASSERT_EQ(std::string(1000, 'a' + i), Get(buf, snapshot));
+  }
+  db_->ReleaseSnapshot(snapshot);
+  ASSERT_TRUE(WaitForValueLogFiles(1));
+
+  for (int run = 0; run < 2; run++) {
+    for (int i = 0; i < 10; i++) {
+      snprintf(buf, sizeof(buf), "key%d", i);
+      ASSERT_EQ(std::string(i < 6 ? 2000 : 1000, (i < 6 ? 'A' : 'a') + i),
+                Get(buf));
+    }
+    Reopen(&options);
+  }
+
+  // Deleting everything frees the rest without collection
+  for (int i = 0; i < 10; i++) {
+    snprintf(buf, sizeof(buf), "key%d", i);
+    ASSERT_OK(Delete(buf));
+  }
+  dbfull()->CompactRange(NULL, NULL);
+  ASSERT_TRUE(WaitForValueLogFiles(0));
+}
+
+TEST(DBTest, Merge) {
+  AppendOperator append;
+  do {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.merge_operator = &append;
+    DestroyAndReopen(&options);
+
+    ASSERT_OK(Merge("a", "1"));
+    ASSERT_EQ("1", Get("a"));
+    ASSERT_OK(Put("b", "x"));
+    ASSERT_OK(Merge("b", "1"));
+    ASSERT_OK(Merge("b", "2"));
+    ASSERT_EQ("x,1,2", Get("b"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Merge("b", "3"));
+    ASSERT_EQ("x,1,2,3", Get("b"));
+
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(Delete("a"));
+    ASSERT_OK(Merge("a", "2"));
+    ASSERT_OK(Merge("b", "4"));
+    ASSERT_OK(Merge("c", "1"));
+    for (int run = 0; run < 3; run++) {
+      ASSERT_EQ("2", Get("a"));
+      ASSERT_EQ("x,1,2,3,4", Get("b"));
+      ASSERT_EQ("1", Get("a", snapshot));
+      ASSERT_EQ("x,1,2,3", Get("b", snapshot));
+      ASSERT_EQ("NOT_FOUND", Get("c", snapshot));
+      ASSERT_EQ("(a->2)(b->x,1,2,3,4)(c->1)", Contents());
+      if (run == 0) {
+        dbfull()->TEST_CompactMemTable();
+      } else {
+        Compact("a", "z");
+      }
+    }
+    db_->ReleaseSnapshot(snapshot);
+
+    // Without snapshots compactions leave a single value per key
+    CompactAllLevels();
+    ASSERT_EQ("[ 2 ]", AllEntriesFor("a"));
+    ASSERT_EQ("[ x,1,2,3,4 ]", AllEntriesFor("b"));
+    Reopen(&options);
+    ASSERT_EQ("x,1,2,3,4", Get("b"));
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, MergeIterator) {
+  AppendOperator append;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.merge_operator = &append;
+  DestroyAndReopen(&options);
+
+  ASSERT_OK(Put("a", "x"));
+  ASSERT_OK(Put("b", "x"));
+  ASSERT_OK(Merge("c", "1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Merge("b", "1"));
+  ASSERT_OK(Merge("c", "2"));
+  ASSERT_OK(Put("d", "x"));
+
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->Seek("b");
+  ASSERT_EQ("b->x,1", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("c->1,2", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("b->x,1", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("a->x", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("b->x,1", IterStatus(iter));
+  iter->Next();
+  iter->Next();
+  ASSERT_EQ("d->x", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("c->1,2", IterStatus(iter));
+  iter->Next();
+  iter->Next();
+  ASSERT_EQ("(invalid)", IterStatus(iter));
+
+  // The last key merged when moving forward
+  iter->Seek("c");
+  ASSERT_OK(Delete("d"));
+  ASSERT_EQ("c->1,2", IterStatus(iter));
+  delete iter;
+  iter = db_->NewIterator(ReadOptions());
+  iter->Seek("c");
+  ASSERT_EQ("c->1,2", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("b->x,1", IterStatus(iter));
+  iter->Next();
+  iter->Next();
+  ASSERT_EQ("(invalid)", IterStatus(iter));
+  iter->SeekToLast();
+  ASSERT_EQ("c->1,2", IterStatus(iter));
+  ASSERT_OK(iter->status());
+  delete iter;
+}
+
+TEST(DBTest, MergeKeysOnlyIterator) {
+  AppendOperator append;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.merge_operator = &append;
+  DestroyAndReopen(&options);
+
+  ASSERT_OK(Put("a", "x"));
+  ASSERT_OK(Put("b", "x"));
+  ASSERT_OK(Merge("c", "1"));
+  ASSERT_OK(Put("d", "x"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Merge("b", "1"));
+  ASSERT_OK(Merge("c", "2"));
+  ASSERT_OK(Delete("d"));
+  ASSERT_OK(Merge("d", "1"));
+  ASSERT_OK(Merge("e", "1"));
+  ASSERT_OK(Delete("e"));
+
+  // Keys with operands are there, but their operands are left alone
+  ReadOptions ropts;
+  ropts.keys_only = true;
+  Iterator* iter = db_->NewIterator(ropts);
+  iter->SeekToFirst();
+  ASSERT_EQ("a->x", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("b->", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("c->", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("d->", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("(invalid)", IterStatus(iter));
+  iter->SeekToLast();
+  ASSERT_EQ("d->", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("c->", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("b->", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("a->x", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("b->", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("c->", IterStatus(iter));
+  ASSERT_OK(iter->status());
+  delete iter;
+
+  ASSERT_EQ("x,1", Get("b"));
+  ASSERT_EQ("1,2", Get("c"));
+  ASSERT_EQ("1", Get("d"));
+}
+
+TEST(DBTest, MergeCompaction) {
+  AppendOperator append;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.merge_operator = &append;
+  options.value_log_threshold = 100;
+  DestroyAndReopen(&options);
+
+  // Operands on top of a value in the value log are applied by
+  // compactions, which move the result to a new value log
+  const std::string big(200, 'v');
+  ASSERT_OK(Put("big", big));
+  ASSERT_OK(Put("other", big));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Merge("big", "1"));
+  ASSERT_OK(Merge("big", "2"));
+  ASSERT_OK(Merge("none", "1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Merge("big", "3"));
+  ASSERT_OK(Merge("none", "2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("[ MERGE:3, MERGE:2, MERGE:1, " + big + " ]",
+            AllEntriesFor("big"));
+  ASSERT_EQ("[ MERGE:2, MERGE:1 ]", AllEntriesFor("none"));
+  ASSERT_EQ(1, NumValueLogFiles());
+
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_OK(Merge("big", "4"));
+  CompactAllLevels();
+  ASSERT_EQ("[ MERGE:4, " + big + ",1,2,3 ]", AllEntriesFor("big"));
+  ASSERT_EQ("[ 1,2 ]", AllEntriesFor("none"));
+  ASSERT_EQ(big + ",1,2,3", Get("big", snapshot));
+  ASSERT_EQ(2, NumValueLogFiles());
+  db_->ReleaseSnapshot(snapshot);
+  ASSERT_OK(Merge("big", "5"));
+  CompactAllLevels();
+  ASSERT_EQ("[ " + big + ",1,2,3,4,5 ]", AllEntriesFor("big"));
+  ASSERT_EQ(big + ",1,2,3,4,5", Get("big"));
+
+  // The files whose values were all replaced are freed
+  ASSERT_OK(Delete("other"));
+  ASSERT_OK(Merge("big", "6"));
+  CompactAllLevels();
+  ASSERT_TRUE(WaitForValueLogFiles(1));
+  for (int run = 0; run < 2; run++) {
+    ASSERT_EQ(big + ",1,2,3,4,5,6", Get("big"));
+    ASSERT_EQ("NOT_FOUND", Get("other"));
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, MergeValueLog) {
+  AppendOperator append;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.merge_operator = &append;
+  options.value_log_threshold = 1000;
+  DestroyAndReopen(&options);
+
+  // A value built from small operands only reaches the threshold once
+  // compactions apply them
+  ASSERT_OK(Put("file", ""));
+  std::string expected;
+  for (int i = 0; i < 50; i++) {
+    const std::string chunk(50, 'a' + i % 26);
+    ASSERT_OK(Merge("file", chunk));
+    expected += (expected.empty() ? "" : ",") + chunk;
+  }
+  ASSERT_OK(Put("small", "x"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(0, NumValueLogFiles());
+  CompactAllLevels();
+  ASSERT_EQ(1, NumValueLogFiles());
+  for (int run = 0; run < 2; run++) {
+    ASSERT_TRUE(expected == Get("file"));
+    ASSERT_EQ("x", Get("small"));
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, GetMergeOperands) {
+  AppendOperator append;
+  do {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.merge_operator = &append;
+    options.value_log_threshold = 100;
+    DestroyAndReopen(&options);
+
+    const std::string big(200, 'v');
+    ASSERT_OK(Put("big", big));
+    ASSERT_OK(Put("small", "x"));
+    ASSERT_OK(Merge("none", "1"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Merge("big", "1"));
+    ASSERT_OK(Merge("small", "1"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Merge("big", "2"));
+    ASSERT_OK(Delete("gone"));
+    ASSERT_OK(Merge("gone", "1"));
+
+    for (int run = 0; run < 2; run++) {
+      std::vector<std::string> operands;
+      uint64_t size;
+      bool has_value;
+      PinnableSlice value;
+      ASSERT_OK(db_->GetMergeOperands(ReadOptions(), "big", NULL, &size,
+                                      &has_value, &operands));
+      ASSERT_TRUE(has_value);
+      ASSERT_EQ(big.size(), size);
+      ASSERT_EQ(2, operands.size());
+      ASSERT_EQ("1", operands[0]);
+      ASSERT_EQ("2", operands[1]);
+      ASSERT_OK(db_->GetMergeOperands(ReadOptions(), "big", &value, &size,
+                                      &has_value, &operands));
+      ASSERT_TRUE(big == value.ToString());
+      value.Reset();
+
+      ASSERT_OK(db_->GetMergeOperands(ReadOptions(), "small", &value, &size,
+                                      &has_value, &operands));
+      ASSERT_EQ("x", value.ToString());
+      ASSERT_EQ(1, size);
+      ASSERT_EQ(1, operands.size());
+      value.Reset();
+
+      ASSERT_OK(db_->GetMergeOperands(ReadOptions(), "none", &value, &size,
+                                      &has_value, &operands));
+      ASSERT_TRUE(!has_value);
+      ASSERT_EQ(0, size);
+      ASSERT_EQ(1, operands.size());
+      ASSERT_OK(db_->GetMergeOperands(ReadOptions(), "gone", &value, &size,
+                                      &has_value, &operands));
+      ASSERT_TRUE(!has_value);
+      ASSERT_EQ(1, operands.size());
+      ASSERT_TRUE(db_->GetMergeOperands(ReadOptions(), "missing", &value,
+                                        &size, &has_value,
+                                        &operands).IsNotFound());
+      ASSERT_TRUE(operands.empty());
+      value.Reset();
+      Reopen(&options);
+    }
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, MergeMultiGet) {
+  AppendOperator append;
+  do {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.merge_operator = &append;
+    DestroyAndReopen(&options);
+
+    char buf[100];
+    for (int i = 0; i < 100; i += 2) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Put(buf, "x"));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 100; i += 3) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Merge(buf, "1"));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 100; i += 5) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      ASSERT_OK(Merge(buf, "2"));
+    }
+
+    std::vector<std::string> key_strings;
+    for (int i = 0; i < 100; i++) {
+      snprintf(buf, sizeof(buf), "key%04d", i);
+      key_strings.push_back(buf);
+    }
+    std::vector<Slice> keys(key_strings.begin(), key_strings.end());
+    const int n = keys.size();
+    std::vector<std::string> values(n);
+    std::vector<Status> statuses(n);
+    db_->MultiGet(ReadOptions(), n, &keys[0], &values[0], &statuses[0]);
+    for (int i = 0; i < n; i++) {
+      std::string expected;
+      Status s = db_->Get(ReadOptions(), keys[i], &expected);
+      ASSERT_EQ(s.ToString(), statuses[i].ToString()) << keys[i].ToString();
+      if (s.ok()) {
+        ASSERT_EQ(expected, values[i]);
+      }
+      PinnableSlice pinned;
+      s = db_->GetPinned(ReadOptions(), keys[i], &pinned);
+      ASSERT_EQ(statuses[i].ToString(), s.ToString());
+      ASSERT_EQ(values[i], pinned.ToString());
+    }
+    ASSERT_EQ("x,1,2", values[30]);
+    ASSERT_EQ("1", values[3]);
+    ASSERT_EQ("2", values[5]);
+    ASSERT_TRUE(statuses[7].IsNotFound());
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, MergeWithoutOperator) {
+  ASSERT_TRUE(Merge("a", "1").IsNotSupported());
+  WriteBatch batch;
+  batch.Put("a", "x");
+  batch.Merge("a", "1");
+  ASSERT_OK(db_->Write(WriteOptions(), &batch));
+  std::string value;
+  ASSERT_TRUE(db_->Get(ReadOptions(), "a", &value).IsNotSupported());
+
+  // Compactions keep the entries the operand applies to
+  CompactAllLevels();
+  ASSERT_EQ("[ MERGE:1, x ]", AllEntriesFor("a"));
+
+  AppendOperator append;
+  Options options = CurrentOptions();
+  options.merge_operator = &append;
+  Reopen(&options);
+  ASSERT_EQ("x,1", Get("a"));
+}
+
+TEST(DBTest, CompactionFilter) {
+  PrefixFilter filter;
+  do {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+    ASSERT_OK(Put("tmp/a", "v1"));
+    CompactAllLevels();
+    ASSERT_EQ(1, NumTableFilesAtLevel(config::kNumLevels - 1));
+
+    options.compaction_filter = &filter;
+    Reopen(&options);
+    ASSERT_OK(Put("tmp/a", "v2"));
+    ASSERT_OK(Put("up/b", "value-in-log"));
+    ASSERT_OK(Put("keep", "x"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_EQ("v2", Get("tmp/a"));
+    ASSERT_EQ("value-in-log", Get("up/b"));
+
+    // The removed value leaves a deletion marker over the older one
+    dbfull()->TEST_CompactRange(2, NULL, NULL);
+    ASSERT_EQ("NOT_FOUND", Get("tmp/a"));
+    ASSERT_EQ("[ DEL, v1 ]", AllEntriesFor("tmp/a"));
+    ASSERT_EQ("VALUE-IN-LOG", Get("up/b"));
+    ASSERT_EQ("x", Get("keep"));
+    CompactAllLevels();
+    ASSERT_EQ("[ ]", AllEntriesFor("tmp/a"));
+
+    // Values that a snapshot sees are left alone
+    ASSERT_OK(Put("tmp/c", "x"));
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(Put("tmp/d", "y"));
+    CompactAllLevels();
+    ASSERT_EQ("x", Get("tmp/c", snapshot));
+    ASSERT_EQ("x", Get("tmp/c"));
+    ASSERT_EQ("NOT_FOUND", Get("tmp/d"));
+    db_->ReleaseSnapshot(snapshot);
+
+    Reopen(&options);
+    ASSERT_EQ("NOT_FOUND", Get("tmp/a"));
+    ASSERT_EQ("VALUE-IN-LOG", Get("up/b"));
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, CompactionFilterMerge) {
+  AppendOperator append;
+  PrefixFilter filter;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.merge_operator = &append;
+  options.compaction_filter = &filter;
+  DestroyAndReopen(&options);
+  ASSERT_OK(Put("up/a", "x"));
+  ASSERT_OK(Merge("up/a", "y"));
+  ASSERT_OK(Merge("tmp/b", "z"));
+  CompactAllLevels();
+  ASSERT_EQ("[ X,Y ]", AllEntriesFor("up/a"));
+  ASSERT_EQ("[ ]", AllEntriesFor("tmp/b"));
+}
+
+// Build a table of the keys prefix000 ... prefix<n-1> for ingestion
+static Status BuildExternalTable(const Options& options,
+                                 const std::string& fname,
+                                 const std::string& prefix, int n) {
+  SstFileWriter writer(options);
+  Status s = writer.Open(fname);
+  for (int i = 0; s.ok() && i < n; i++) {
+    char key[100];
+    snprintf(key, sizeof(key), "%s%03d", prefix.c_str(), i);
+    s = writer.Add(key, std::string(key) + "-value");
+  }
+  if (s.ok()) {
+    s = writer.Finish();
+  }
+  return s;
+}
+
+TEST(DBTest, IngestExternalFiles) {
+  do {
+    Options options = CurrentOptions();
+    const std::string dir = test::TmpDir() + "/db_test_ingest";
+    env_->CreateDir(dir);
+    const std::string a = dir + "/a.sst";
+    const std::string b = dir + "/b.sst";
+    ASSERT_OK(BuildExternalTable(options, a, "a", 100));
+    ASSERT_OK(BuildExternalTable(options, b, "b", 100));
+    ASSERT_OK(Put("c000", "v1"));
+
+    std::vector<std::string> files;
+    files.push_back(b);
+    files.push_back(a);
+    ASSERT_OK(db_->IngestExternalFiles(files));
+    ASSERT_EQ(2, NumTableFilesAtLevel(config::kNumLevels - 1));
+    ASSERT_TRUE(env_->FileExists(a));
+    ASSERT_EQ("a000-value", Get("a000"));
+    ASSERT_EQ("b099-value", Get("b099"));
+    ASSERT_EQ("NOT_FOUND", Get("b100"));
+    ASSERT_EQ("v1", Get("c000"));
+
+    // Later writes replace ingested values
+    ASSERT_OK(Put("a001", "new"));
+    ASSERT_OK(Delete("a002"));
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    iter->SeekToFirst();
+    ASSERT_EQ("a000->a000-value", IterStatus(iter));
+    iter->Next();
+    ASSERT_EQ("a001->new", IterStatus(iter));
+    iter->Next();
+    ASSERT_EQ("a003->a003-value", IterStatus(iter));
+    delete iter;
+    CompactAllLevels();
+    Reopen(&options);
+    ASSERT_EQ("new", Get("a001"));
+    ASSERT_EQ("NOT_FOUND", Get("a002"));
+    ASSERT_EQ("b050-value", Get("b050"));
+
+    // Files go on top of the keys the database holds in their range,
+    // in the tables or in the memtable
+    const std::string c = dir + "/c.sst";
+    ASSERT_OK(BuildExternalTable(options, c, "c", 1));
+    files.clear();
+    files.push_back(c);
+    ASSERT_OK(db_->IngestExternalFiles(files));
+    ASSERT_EQ("c000-value", Get("c000"));
+    ASSERT_OK(Put("f000", "v2"));
+    ASSERT_OK(env_->DeleteFile(c));  // Linked into the database
+    ASSERT_OK(BuildExternalTable(options, c, "f", 1));
+    ASSERT_OK(db_->IngestExternalFiles(files));
+    ASSERT_EQ("f000-value", Get("f000"));
+    Reopen(&options);
+    ASSERT_EQ("c000-value", Get("c000"));
+    ASSERT_EQ("f000-value", Get("f000"));
+
+    // Files that overlap each other are refused
+    ASSERT_OK(env_->DeleteFile(c));
+    const std::string d = dir + "/d.sst";
+    ASSERT_OK(BuildExternalTable(options, c, "d", 10));
+    ASSERT_OK(BuildExternalTable(options, d, "d00", 1));
+    files.push_back(d);
+    ASSERT_TRUE(db_->IngestExternalFiles(files).IsInvalidArgument());
+    ASSERT_EQ("NOT_FOUND", Get("d000"));
+
+    // So are files that are not tables of the database
+    ASSERT_OK(WriteStringToFile(env_, "garbage", d));
+    files.pop_back();
+    files.push_back(d);
+    files.erase(files.begin());
+    ASSERT_TRUE(db_->IngestExternalFiles(files).IsInvalidArgument());
+    SstFileWriter writer(options);
+    ASSERT_OK(writer.Open(d));
+    ASSERT_OK(writer.Finish());
+    ASSERT_TRUE(db_->IngestExternalFiles(files).IsInvalidArgument());
+
+    ASSERT_OK(writer.Open(d));
+    ASSERT_OK(writer.Add("e1", "x"));
+    ASSERT_TRUE(writer.Add("e1", "y").IsInvalidArgument());
+    ASSERT_TRUE(writer.Add("e0", "y").IsInvalidArgument());
+    ASSERT_OK(writer.Add("e2", "y"));
+    ASSERT_OK(writer.Finish());
+    ASSERT_OK(db_->IngestExternalFiles(files));
+    ASSERT_EQ("y", Get("e2"));
+
+    env_->DeleteFile(a);
+    env_->DeleteFile(b);
+    env_->DeleteFile(c);
+    env_->DeleteFile(d);
+    env_->DeleteDir(dir);
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, IngestExternalFilesBetweenKeys) {
+  do {
+    Options options = CurrentOptions();
+    const std::string dir = test::TmpDir() + "/db_test_ingest_between";
+    env_->CreateDir(dir);
+    const std::string m = dir + "/m.sst";
+    ASSERT_OK(BuildExternalTable(options, m, "/m/", 10));
+
+    // A single table spans the range of the file
+    ASSERT_OK(Put("/a/x", "1"));
+    ASSERT_OK(Put("/z/y", "2"));
+    CompactAllLevels();
+    ASSERT_OK(Put("/m/003", "old"));
+    const Snapshot* before = db_->GetSnapshot();
+
+    std::vector<std::string> files;
+    files.push_back(m);
+    ASSERT_OK(db_->IngestExternalFiles(files));
+    ASSERT_OK(Put("/m/005", "new"));
+    for (int run = 0; run < 3; run++) {
+      ASSERT_EQ("1", Get("/a/x"));
+      ASSERT_EQ("2", Get("/z/y"));
+      ASSERT_EQ("/m/000-value", Get("/m/000"));
+      ASSERT_EQ("/m/003-value", Get("/m/003"));
+      ASSERT_EQ("new", Get("/m/005"));
+      ASSERT_EQ("/m/009-value", Get("/m/009"));
+      if (before != NULL) {
+        ASSERT_EQ("old", Get("/m/003", before));
+        ASSERT_EQ("NOT_FOUND", Get("/m/000", before));
+      }
+
+      Iterator* iter = db_->NewIterator(ReadOptions());
+      int count = 0;
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        count++;
+      }
+      ASSERT_OK(iter->status());
+      delete iter;
+      ASSERT_EQ(12, count);
+
+      if (run == 0) {
+        CompactAllLevels();
+      } else {
+        if (before != NULL) {
+          db_->ReleaseSnapshot(before);
+          before = NULL;
+        }
+        Reopen(&options);
+      }
+    }
+
+    env_->DeleteFile(m);
+    env_->DeleteDir(dir);
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, IngestExternalFilesSnapshot) {
+  do {
+    Options options = CurrentOptions();
+    const std::string dir = test::TmpDir() + "/db_test_ingest_snapshot";
+    env_->CreateDir(dir);
+    const std::string a = dir + "/a.sst";
+    ASSERT_OK(BuildExternalTable(options, a, "a", 10));
+    ASSERT_OK(Put("b000", "v1"));
+    const Snapshot* before = db_->GetSnapshot();
+
+    std::vector<std::string> files;
+    files.push_back(a);
+    ASSERT_OK(db_->IngestExternalFiles(files));
+    const Snapshot* after = db_->GetSnapshot();
+    ASSERT_OK(Put("a005", "new"));
+
+    ASSERT_EQ("NOT_FOUND", Get("a000", before));
+    ASSERT_EQ("v1", Get("b000", before));
+    ASSERT_EQ("a000-value", Get("a000", after));
+    ASSERT_EQ("a005-value", Get("a005", after));
+    ASSERT_EQ("new", Get("a005"));
+
+    ReadOptions ropts;
+    ropts.snapshot = before;
+    PinnableSlice pinned;
+    ASSERT_TRUE(db_->GetPinned(ropts, "a001", &pinned).IsNotFound());
+    Slice keys[2] = { "a001", "b000" };
+    std::string values[2];
+    Status statuses[2];
+    db_->MultiGet(ropts, 2, keys, values, statuses);
+    ASSERT_TRUE(statuses[0].IsNotFound());
+    ASSERT_OK(statuses[1]);
+    ASSERT_EQ("v1", values[1]);
+    Iterator* iter = db_->NewIterator(ropts);
+    iter->Seek("a");
+    ASSERT_EQ("b000->v1", IterStatus(iter));
+    delete iter;
+
+    ropts.snapshot = after;
+    iter = db_->NewIterator(ropts);
+    iter->Seek("a005");
+    ASSERT_EQ("a005->a005-value", IterStatus(iter));
+    iter->Prev();
+    ASSERT_EQ("a004->a004-value", IterStatus(iter));
+    delete iter;
+
+    // Compactions keep the entries the snapshots need
+    CompactAllLevels();
+    ASSERT_EQ("NOT_FOUND", Get("a000", before));
+    ASSERT_EQ("a005-value", Get("a005", after));
+    ASSERT_EQ("new", Get("a005"));
+    db_->ReleaseSnapshot(before);
+    db_->ReleaseSnapshot(after);
+
+    // The sequence number of the files survives a reopen
+    const std::string b = dir + "/b.sst";
+    ASSERT_OK(BuildExternalTable(options, b, "c", 10));
+    files[0] = b;
+    ASSERT_OK(db_->IngestExternalFiles(files));
+    Reopen(&options);
+    ASSERT_EQ("c003-value", Get("c003"));
+    ASSERT_OK(Put("c003", "newer"));
+    Reopen(&options);
+    ASSERT_EQ("newer", Get("c003"));
+
+    env_->DeleteFile(a);
+    env_->DeleteFile(b);
+    env_->DeleteDir(dir);
+  } while (ChangeOptions());
+}
+
+// Multi-threaded test:
+namespace {
+
+static const int kNumThreads = 4;
+static const int kTestSeconds = 10;
+static const int kNumKeys = 1000;
+
+struct MTState {
+  DBTest* test;
+  port::AtomicPointer stop;
+  port::AtomicPointer counter[kNumThreads];
+  port::AtomicPointer thread_done[kNumThreads];
+};
+
+struct MTThread {
+  MTState* state;
+  int id;
+};
+
+static void MTThreadBody(void* arg) {
+  MTThread* t = reinterpret_cast<MTThread*>(arg);
+  int id = t->id;
+  DB* db = t->state->test->db_;
+  uintptr_t counter = 0;
+  fprintf(stderr, "... starting thread %d\n", id);
+  Random rnd(1000 + id);
+  std::string value;
+  char valbuf[1500];
+  while (t->state->stop.Acquire_Load() == NULL) {
+    t->state->counter[id].Release_Store(reinterpret_cast<void*>(counter));
+
+    int key = rnd.Uniform(kNumKeys);
+    char keybuf[20];
+    snprintf(keybuf, sizeof(keybuf), "%016d", key);
+
+    if (rnd.OneIn(2)) {
+      // Write values of the form <key, my id, counter>.
+      // We add some padding for force compactions.
+      snprintf(valbuf, sizeof(valbuf), "%d.%d.%-1000d",
+               key, id, static_cast<int>(counter));
+      ASSERT_OK(db->Put(WriteOptions(), Slice(keybuf), Slice(valbuf)));
+    } else {
+      // Read a value and verify that it matches the pattern written above.
+      Status s = db->Get(ReadOptions(), Slice(keybuf), &value);
+      if (s.IsNotFound()) {
+        // Key has not yet been written
+      } else {
+        // Check that the writer thread counter is >= the counter in the value
+        ASSERT_OK(s);
+        int k, w, c;
+        ASSERT_EQ(3, sscanf(value.c_str(), "%d.%d.%d", &k, &w, &c)) << value;
+        ASSERT_EQ(k, key);
+        ASSERT_GE(w, 0);
+        ASSERT_LT(w, kNumThreads);
+        ASSERT_LE(static_cast<uintptr_t>(c), reinterpret_cast<uintptr_t>(
+            t->state->counter[w].Acquire_Load()));
+      }
+    }
+    counter++;
+  }
+  t->state->thread_done[id].Release_Store(t);
+  fprintf(stderr, "... stopping thread %d after %d ops\n", id, int(counter));
+}
+
+}  // namespace
+
+TEST(DBTest, MultiThreaded) {
+  do {
+    // Initialize state
+    MTState mt;
+    mt.test = this;
+    mt.stop.Release_Store(0);
+    for (int id = 0; id < kNumThreads; id++) {
+      mt.counter[id].Release_Store(0);
+      mt.thread_done[id].Release_Store(0);
+    }
+
+    // Start threads
+    MTThread thread[kNumThreads];
+    for (int id = 0; id < kNumThreads; id++) {
+      thread[id].state = &mt;
+      thread[id].id = id;
+      env_->StartThread(MTThreadBody, &thread[id]);
+    }
+
+    // Let them run for a while
+    DelayMilliseconds(kTestSeconds * 1000);
+
+    // Stop the threads and wait for them to finish
+    mt.stop.Release_Store(&mt);
     for (int id = 0; id < kNumThreads; id++) {
       while (mt.thread_done[id].Acquire_Load() == NULL) {
         DelayMilliseconds(100);
@@ -1824,6 +3349,253 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+namespace {
+
+static const int kPipelinedThreads = 8;
+static const int kPipelinedWritesPerThread = 2000;
+
+struct PipelinedThread {
+  DB* db;
+  int id;
+  port::AtomicPointer done;
+};
+
+static std::string PipelinedKey(int id, int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "key%d.%06d", id, i);
+  return buf;
+}
+
+// Writes keys of its own and checks that each write is visible as soon
+// as it returns
+static void PipelinedThreadBody(void* arg) {
+  PipelinedThread* t = reinterpret_cast<PipelinedThread*>(arg);
+  std::string value;
+  for (int i = 0; i < kPipelinedWritesPerThread; i++) {
+    const std::string key = PipelinedKey(t->id, i);
+    ASSERT_OK(t->db->Put(WriteOptions(), key, key + std::string(100, 'v')));
+    ASSERT_OK(t->db->Get(ReadOptions(), key, &value));
+    ASSERT_EQ(key + std::string(100, 'v'), value);
+  }
+  t->done.Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, PipelinedConcurrentWrites) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Switch memtables under the writers
+  options.enable_pipelined_write = true;
+  options.allow_concurrent_memtable_write = true;
+  Reopen(&options);
+
+  PipelinedThread thread[kPipelinedThreads];
+  for (int id = 0; id < kPipelinedThreads; id++) {
+    thread[id].db = db_;
+    thread[id].id = id;
+    thread[id].done.Release_Store(NULL);
+    env_->StartThread(PipelinedThreadBody, &thread[id]);
+  }
+  for (int id = 0; id < kPipelinedThreads; id++) {
+    while (thread[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  // Recovery replays the log in the order the groups were written
+  Reopen(&options);
+  for (int id = 0; id < kPipelinedThreads; id++) {
+    for (int i = 0; i < kPipelinedWritesPerThread; i++) {
+      const std::string key = PipelinedKey(id, i);
+      ASSERT_EQ(key + std::string(100, 'v'), Get(key));
+    }
+  }
+}
+
+// Return the counter called "name" from the multi-line "property" of "db"
+static uint64_t PropertyCounter(DB* db, const std::string& property_name,
+                                const std::string& name) {
+  std::string property;
+  ASSERT_TRUE(db->GetProperty(property_name, &property));
+  const std::string prefix = name + ": ";
+  size_t pos = property.find(prefix);
+  ASSERT_TRUE(pos != std::string::npos);
+  return strtoull(property.c_str() + pos + prefix.size(), NULL, 10);
+}
+
+static uint64_t WriteStallCounter(DB* db, const std::string& name) {
+  return PropertyCounter(db, "leveldb.write-stalls", name);
+}
+
+static void ReleaseDataSync(void* arg) {
+  DelayMilliseconds(200);
+  reinterpret_cast<SpecialEnv*>(arg)->delay_data_sync_.Release_Store(NULL);
+}
+
+TEST(DBTest, WriteStalls) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.level0_file_num_compaction_trigger = 2;
+  options.level0_slowdown_writes_trigger = 2;
+  options.level0_stop_writes_trigger = 20;
+  options.delayed_write_rate = 1 << 20;
+  Reopen(&options);
+  ASSERT_EQ(0, WriteStallCounter(db_, "delayed-writes"));
+  ASSERT_EQ(0, WriteStallCounter(db_, "stopped-writes"));
+
+  // A write that finds both memtables full waits for the flush
+  env_->delay_data_sync_.Release_Store(env_);      // Block sync calls
+  ASSERT_OK(Put("k1", std::string(100000, 'x')));  // Fill memtable
+  ASSERT_OK(Put("k2", std::string(100000, 'y')));  // Trigger compaction
+  env_->StartThread(ReleaseDataSync, env_);
+  ASSERT_OK(Put("k3", std::string(100, 'z')));     // Stops until released
+  ASSERT_EQ(1, WriteStallCounter(db_, "stopped-writes"));
+  ASSERT_GE(WriteStallCounter(db_, "stop-micros"), 100000);
+
+  // Overwriting the same keys piles up overlapping level-0 files, and
+  // writes are paced while compactions merge them
+  Random rnd(301);
+  for (int i = 0; i < 5000 &&
+           WriteStallCounter(db_, "delayed-writes") == 0; i++) {
+    ASSERT_OK(Put(Key(i % 100), RandomString(&rnd, 10000)));
+  }
+  ASSERT_GT(WriteStallCounter(db_, "delayed-writes"), 0);
+  ASSERT_GT(WriteStallCounter(db_, "delay-micros"), 0);
+
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.estimate-pending-compaction-bytes",
+                               &property));
+  ASSERT_TRUE(!property.empty());
+}
+
+TEST(DBTest, RateLimiter) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.rate_limiter = NewGenericRateLimiter(0, 10 << 20, 10000, false);
+  Reopen(&options);
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.rate-limiter", &property));
+
+  Random rnd(301);
+  for (int i = 0; i < 500; i++) {
+    ASSERT_OK(Put(Key(i % 100), RandomString(&rnd, 1000)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  const uint64_t flushed =
+      PropertyCounter(db_, "leveldb.rate-limiter", "flush-bytes");
+  ASSERT_GT(flushed, 0);
+  ASSERT_EQ(0, PropertyCounter(db_, "leveldb.rate-limiter",
+                               "flush-throttled-micros"));
+
+  // Compactions are paced at 10MB/s
+  const uint64_t start = env_->NowMicros();
+  Compact("a", "z");
+  const uint64_t compacted =
+      PropertyCounter(db_, "leveldb.rate-limiter", "compaction-bytes");
+  ASSERT_GT(compacted, 100000);
+  ASSERT_GE(env_->NowMicros() - start, compacted * 1000000 / (10 << 20) / 2);
+  ASSERT_EQ(flushed,
+            PropertyCounter(db_, "leveldb.rate-limiter", "flush-bytes"));
+
+  Close();
+  delete options.rate_limiter;
+  options.rate_limiter = NULL;
+  Reopen(&options);
+  ASSERT_TRUE(!db_->GetProperty("leveldb.rate-limiter", &property));
+}
+
+TEST(DBTest, CompactionReadahead) {
+  int reads[2];
+  for (int i = 0; i < 2; i++) {
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.write_buffer_size = 100000;  // Small write buffer
+    options.level0_file_num_compaction_trigger = 100;
+    options.create_if_missing = true;
+    options.compaction_readahead_size = (i == 0) ? 0 : 1 << 20;
+    env_->count_random_reads_ = true;
+    DestroyAndReopen(&options);
+
+    Random rnd(301);
+    std::vector<std::string> values(500);
+    for (int j = 0; j < 500; j++) {
+      // Scattered keys, so that every flush overlaps the ones before
+      const int k = (j * 7) % 500;
+      values[k] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(Key(k), values[k]));
+    }
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_GT(NumTableFilesAtLevel(0), 1);
+
+    env_->random_read_counter_.Reset();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    reads[i] = env_->random_read_counter_.Read();
+    env_->count_random_reads_ = false;
+    ASSERT_EQ(0, NumTableFilesAtLevel(0));
+    for (int j = 0; j < 500; j++) {
+      ASSERT_EQ(values[j], Get(Key(j)));
+    }
+  }
+
+  // Inputs are read in large chunks rather than block by block
+  ASSERT_LT(reads[1] * 2, reads[0]);
+}
+
+TEST(DBTest, RecycleLog) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.recycle_log_file_num = 1;
+  options.bytes_per_sync = 1024;
+  DestroyAndReopen(&options);
+
+  // The first log is kept once its memtable has been flushed...
+  ASSERT_OK(Put("foo", std::string(10000, 'v')));
+  ASSERT_OK(Put("baz", "v1"));
+  const uint64_t first_log = dbfull()->TEST_LogfileNumber();
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_TRUE(env_->FileExists(LogFileName(dbname_, first_log)));
+
+  // ...and overwritten by the log after next
+  ASSERT_OK(Delete("foo"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_TRUE(!env_->FileExists(LogFileName(dbname_, first_log)));
+  ASSERT_TRUE(env_->FileExists(LogFileName(dbname_,
+                                           dbfull()->TEST_LogfileNumber())));
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+
+  // Recovery stops where the new log ends, before the leftovers of the
+  // old one could bring "foo" back
+  ASSERT_OK(Put("bar", "v2"));
+  Reopen(&options);
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+  ASSERT_EQ("v2", Get("bar"));
+  ASSERT_EQ("v1", Get("baz"));
+
+  // A reopened DB recycles its own logs again
+  for (int i = 0; i < 5; i++) {
+    ASSERT_OK(Put(Key(i), std::string(1000, 'a' + i)));
+    dbfull()->TEST_CompactMemTable();
+  }
+  Reopen(&options);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_EQ(std::string(1000, 'a' + i), Get(Key(i)));
+  }
+  std::vector<std::string> filenames;
+  ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+  int logs = 0;
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (ParseFileName(filenames[i], &number, &type) && type == kLogFile) {
+      logs++;
+    }
+  }
+  ASSERT_LE(logs, 2);
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -2083,7 +3855,7 @@ void BM_LogAndApply(int iters, int num_base_files) {
 
   InternalKeyComparator cmp(BytewiseComparator());
   Options options;
-  VersionSet vset(dbname, &options, NULL, &cmp);
+  VersionSet vset(dbname, &options, NULL, NULL, &cmp);
   ASSERT_OK(vset.Recover());
   VersionEdit vbase;
   uint64_t fnum = 1;
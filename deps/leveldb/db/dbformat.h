@@ -21,15 +21,6 @@ namespace leveldb {
 namespace config {
 static const int kNumLevels = 7;
 
-// Level-0 compaction is started when we hit this many files.
-static const int kL0_CompactionTrigger = 4;
-
-// Soft limit on number of level-0 files.  We slow down writes at this point.
-static const int kL0_SlowdownWritesTrigger = 8;
-
-// Maximum number of level-0 files.  We stop writes at this point.
-static const int kL0_StopWritesTrigger = 12;
-
 // Maximum level to which a new compacted memtable is pushed if it
 // does not create overlap.  We try to push to level 2 to avoid the
 // relatively expensive level 0=>1 compactions and to avoid some
@@ -41,6 +32,9 @@ static const int kMaxMemCompactLevel = 2;
 // Approximate gap in bytes between samples of data read during iteration.
 static const int kReadBytesPeriod = 1048576;
 
+// Size at which compactions start a new output file.
+static const int kTargetFileSize = 2 * 1048576;
+
 }  // namespace config
 
 class InternalKey;
@@ -50,7 +44,9 @@ class InternalKey;
 // data structures.
 enum ValueType {
   kTypeDeletion = 0x0,
-  kTypeValue = 0x1
+  kTypeValue = 0x1,
+  kTypeValueIndex = 0x2,  // Value is an encoded ValuePointer (value_log.h)
+  kTypeMerge = 0x3        // Value is an operand for Options::merge_operator
 };
 // kValueTypeForSeek defines the ValueType that should be passed when
 // constructing a ParsedInternalKey object for seeking to a particular
@@ -58,7 +54,7 @@ enum ValueType {
 // and the value type is embedded as the low 8 bits in the sequence
 // number in internal keys, we need to use the highest-numbered
 // ValueType, not the lowest).
-static const ValueType kValueTypeForSeek = kTypeValue;
+static const ValueType kValueTypeForSeek = kTypeMerge;
 
 typedef uint64_t SequenceNumber;
 
@@ -136,6 +132,7 @@ class InternalFilterPolicy : public FilterPolicy {
   virtual const char* Name() const;
   virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const;
   virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const;
+  virtual bool CoversPrefix(const Slice& prefix) const;
 };
 
 // Modules in this directory should keep internal keys wrapped inside
@@ -182,7 +179,7 @@ inline bool ParseInternalKey(const Slice& internal_key,
   result->sequence = num >> 8;
   result->type = static_cast<ValueType>(c);
   result->user_key = Slice(internal_key.data(), n - 8);
-  return (c <= static_cast<unsigned char>(kTypeValue));
+  return (c <= static_cast<unsigned char>(kTypeMerge));
 }
 
 // A helper class useful for DBImpl::Get()
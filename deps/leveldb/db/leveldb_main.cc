@@ -6,6 +6,7 @@
 #include "db/dbformat.h"
 #include "db/filename.h"
 #include "db/log_reader.h"
+#include "db/value_log.h"
 #include "db/version_edit.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/env.h"
@@ -20,7 +21,7 @@ namespace leveldb {
 
 namespace {
 
-bool GuessType(const std::string& fname, FileType* type) {
+bool GuessType(const std::string& fname, uint64_t* number, FileType* type) {
   size_t pos = fname.rfind('/');
   std::string basename;
   if (pos == std::string::npos) {
@@ -28,8 +29,7 @@ bool GuessType(const std::string& fname, FileType* type) {
   } else {
     basename = std::string(fname.data() + pos + 1, fname.size() - pos - 1);
   }
-  uint64_t ignored;
-  return ParseFileName(basename, &ignored, type);
+  return ParseFileName(basename, number, type);
 }
 
 // Notified when log reader encounters corruption.
@@ -51,8 +51,13 @@ bool PrintLogContents(Env* env, const std::string& fname,
     fprintf(stderr, "%s\n", s.ToString().c_str());
     return false;
   }
+  // Logs that overwrote a recycled file need their number to tell
+  // where they end
+  uint64_t number = 0;
+  FileType type;
+  GuessType(fname, &number, &type);
   CorruptionReporter reporter;
-  log::Reader reader(file, &reporter, true, 0);
+  log::Reader reader(file, &reporter, true, 0, number);
   Slice record;
   std::string scratch;
   while (reader.ReadRecord(&record, &scratch)) {
@@ -79,6 +84,11 @@ class WriteBatchItemPrinter : public WriteBatch::Handler {
     printf("  del '%s'\n",
            EscapeString(key).c_str());
   }
+  virtual void Merge(const Slice& key, const Slice& value) {
+    printf("  merge '%s' '%s'\n",
+           EscapeString(key).c_str(),
+           EscapeString(value).c_str());
+  }
 };
 
 
@@ -159,6 +169,10 @@ bool DumpTable(Env* env, const std::string& fname) {
         type = "del";
       } else if (key.type == kTypeValue) {
         type = "val";
+      } else if (key.type == kTypeValueIndex) {
+        type = "vlog";
+      } else if (key.type == kTypeMerge) {
+        type = "merge";
       } else {
         snprintf(kbuf, sizeof(kbuf), "%d", static_cast<int>(key.type));
         type = kbuf;
@@ -181,9 +195,39 @@ bool DumpTable(Env* env, const std::string& fname) {
   return true;
 }
 
+bool DumpValueLog(Env* env, const std::string& fname) {
+  uint64_t file_size;
+  RandomAccessFile* file = NULL;
+  Status s = env->GetFileSize(fname, &file_size);
+  if (s.ok()) {
+    s = env->NewRandomAccessFile(fname, &file);
+  }
+  if (!s.ok()) {
+    fprintf(stderr, "%s\n", s.ToString().c_str());
+    delete file;
+    return false;
+  }
+
+  // The file number only matters for the pointers, which are not printed
+  ValueLogReader reader(file, 0, file_size);
+  while (reader.Next()) {
+    printf("--- offset %llu; '%s' => '%s'\n",
+           static_cast<unsigned long long>(reader.pointer().offset),
+           EscapeString(reader.key()).c_str(),
+           EscapeString(reader.value()).c_str());
+  }
+  s = reader.status();
+  if (!s.ok()) {
+    printf("value log error: %s\n", s.ToString().c_str());
+  }
+  delete file;
+  return true;
+}
+
 bool DumpFile(Env* env, const std::string& fname) {
   FileType ftype;
-  if (!GuessType(fname, &ftype)) {
+  uint64_t ignored;
+  if (!GuessType(fname, &ignored, &ftype)) {
     fprintf(stderr, "%s: unknown file type\n", fname.c_str());
     return false;
   }
@@ -191,6 +235,7 @@ bool DumpFile(Env* env, const std::string& fname) {
     case kLogFile:         return DumpLog(env, fname);
     case kDescriptorFile:  return DumpDescriptor(env, fname);
     case kTableFile:       return DumpTable(env, fname);
+    case kValueLogFile:    return DumpValueLog(env, fname);
 
     default: {
       fprintf(stderr, "%s: not a dump-able file type\n", fname.c_str());
@@ -20,15 +20,25 @@ enum RecordType {
   // For fragments
   kFirstType = 2,
   kMiddleType = 3,
-  kLastType = 4
+  kLastType = 4,
+
+  // The same for logs that may overwrite an older log file, whose
+  // records also carry the number of the log they belong to
+  kRecyclableFullType = 5,
+  kRecyclableFirstType = 6,
+  kRecyclableMiddleType = 7,
+  kRecyclableLastType = 8
 };
-static const int kMaxRecordType = kLastType;
+static const int kMaxRecordType = kRecyclableLastType;
 
 static const int kBlockSize = 32768;
 
 // Header is checksum (4 bytes), type (1 byte), length (2 bytes).
 static const int kHeaderSize = 4 + 1 + 2;
 
+// Recyclable header adds the log number (4 bytes).
+static const int kRecyclableHeaderSize = kHeaderSize + 4;
+
 }  // namespace log
 }  // namespace leveldb
 
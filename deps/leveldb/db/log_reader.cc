@@ -16,7 +16,7 @@ Reader::Reporter::~Reporter() {
 }
 
 Reader::Reader(SequentialFile* file, Reporter* reporter, bool checksum,
-               uint64_t initial_offset)
+               uint64_t initial_offset, uint64_t log_number)
     : file_(file),
       reporter_(reporter),
       checksum_(checksum),
@@ -25,7 +25,9 @@ Reader::Reader(SequentialFile* file, Reporter* reporter, bool checksum,
       eof_(false),
       last_record_offset_(0),
       end_of_buffer_offset_(0),
-      initial_offset_(initial_offset) {
+      initial_offset_(initial_offset),
+      log_number_(log_number),
+      recycled_(false) {
 }
 
 Reader::~Reader() {
@@ -163,6 +165,12 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
   return false;
 }
 
+unsigned int Reader::EndOfRecycledLog() {
+  buffer_.clear();
+  eof_ = true;
+  return kEof;
+}
+
 uint64_t Reader::LastRecordOffset() {
   return last_record_offset_;
 }
@@ -211,9 +219,15 @@ unsigned int Reader::ReadPhysicalRecord(Slice* result) {
     const uint32_t b = static_cast<uint32_t>(header[5]) & 0xff;
     const unsigned int type = header[6];
     const uint32_t length = a | (b << 8);
-    if (kHeaderSize + length > buffer_.size()) {
+    const bool recyclable =
+        (type >= kRecyclableFullType && type <= kRecyclableLastType);
+    const int header_size = recyclable ? kRecyclableHeaderSize : kHeaderSize;
+    if (header_size + length > buffer_.size()) {
       size_t drop_size = buffer_.size();
       buffer_.clear();
+      if (recycled_) {
+        return EndOfRecycledLog();
+      }
       if (!eof_) {
         ReportCorruption(drop_size, "bad record length");
         return kBadRecord;
@@ -232,11 +246,19 @@ unsigned int Reader::ReadPhysicalRecord(Slice* result) {
       return kBadRecord;
     }
 
+    if (recycled_ && !recyclable) {
+      return EndOfRecycledLog();
+    }
+
     // Check crc
     if (checksum_) {
       uint32_t expected_crc = crc32c::Unmask(DecodeFixed32(header));
-      uint32_t actual_crc = crc32c::Value(header + 6, 1 + length);
+      uint32_t actual_crc = crc32c::Value(header + 6,
+                                          header_size - 6 + length);
       if (actual_crc != expected_crc) {
+        if (recycled_) {
+          return EndOfRecycledLog();
+        }
         // Drop the rest of the buffer since "length" itself may have
         // been corrupted and if we trust it, we could find some
         // fragment of a real log record that just happens to look
@@ -248,17 +270,25 @@ unsigned int Reader::ReadPhysicalRecord(Slice* result) {
       }
     }
 
-    buffer_.remove_prefix(kHeaderSize + length);
+    if (recyclable) {
+      const uint32_t log_number = DecodeFixed32(header + kHeaderSize);
+      if (log_number != static_cast<uint32_t>(log_number_)) {
+        return EndOfRecycledLog();
+      }
+      recycled_ = true;
+    }
+
+    buffer_.remove_prefix(header_size + length);
 
     // Skip physical record that started before initial_offset_
-    if (end_of_buffer_offset_ - buffer_.size() - kHeaderSize - length <
+    if (end_of_buffer_offset_ - buffer_.size() - header_size - length <
         initial_offset_) {
       result->clear();
       return kBadRecord;
     }
 
-    *result = Slice(header + kHeaderSize, length);
-    return type;
+    *result = Slice(header + header_size, length);
+    return recyclable ? type - kRecyclableFullType + kFullType : type;
   }
 }
 
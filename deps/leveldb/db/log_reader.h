@@ -40,8 +40,12 @@ class Reader {
   //
   // The Reader will start reading at the first record located at physical
   // position >= initial_offset within the file.
+  //
+  // "log_number" is the number of the log in "*file".  Records in the
+  // recyclable format that belong to another log are taken as the end
+  // of this one.
   Reader(SequentialFile* file, Reporter* reporter, bool checksum,
-         uint64_t initial_offset);
+         uint64_t initial_offset, uint64_t log_number);
 
   ~Reader();
 
@@ -73,6 +77,13 @@ class Reader {
   // Offset at which to start looking for the first record to return
   uint64_t const initial_offset_;
 
+  uint64_t const log_number_;
+
+  // True once a recyclable record of this log has been read.  From then
+  // on, anything but another such record is left over from the log the
+  // file held before, and ends this one.
+  bool recycled_;
+
   // Extend record types with the following special values
   enum {
     kEof = kMaxRecordType + 1,
@@ -92,6 +103,10 @@ class Reader {
   // Return type, or one of the preceding special values
   unsigned int ReadPhysicalRecord(Slice* result);
 
+  // Stop at the leftovers of the log a recycled file held before;
+  // returns kEof.
+  unsigned int EndOfRecycledLog();
+
   // Reports dropped bytes to the reporter.
   // buffer_ must be updated to remove the dropped bytes prior to invocation.
   void ReportCorruption(size_t bytes, const char* reason);
@@ -3,6 +3,9 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "db/log_reader.h"
+
+#include <algorithm>
+#include <string.h>
 #include "db/log_writer.h"
 #include "leveldb/env.h"
 #include "util/coding.h"
@@ -88,6 +91,26 @@ class LogTest {
     }
   };
 
+  // Overwrites *contents from the start, like a reused file
+  class OverwritingDest : public WritableFile {
+   public:
+    std::string* contents_;
+    size_t pos_;
+    explicit OverwritingDest(std::string* contents)
+        : contents_(contents), pos_(0) { }
+
+    virtual Status Close() { return Status::OK(); }
+    virtual Status Flush() { return Status::OK(); }
+    virtual Status Sync() { return Status::OK(); }
+    virtual Status Append(const Slice& slice) {
+      const size_t n = std::min(slice.size(), contents_->size() - pos_);
+      contents_->replace(pos_, n, slice.data(), n);
+      contents_->append(slice.data() + n, slice.size() - n);
+      pos_ += slice.size();
+      return Status::OK();
+    }
+  };
+
   class ReportCollector : public Reader::Reporter {
    public:
     size_t dropped_bytes_;
@@ -115,7 +138,7 @@ class LogTest {
   LogTest() : reading_(false),
               writer_(&dest_),
               reader_(&source_, &report_, true/*checksum*/,
-                      0/*initial_offset*/) {
+                      0/*initial_offset*/, 0/*log_number*/) {
   }
 
   void Write(const std::string& msg) {
@@ -141,6 +164,36 @@ class LogTest {
     }
   }
 
+  // Overwrite what has been written so far with "records" of log
+  // "log_number" in the recyclable format, as if its file were reused
+  void WriteRecycled(uint64_t log_number, const std::string& records) {
+    ASSERT_TRUE(!reading_) << "Write() after starting to read";
+    OverwritingDest dest(&dest_.contents_);
+    Writer writer(&dest, log_number, true);
+    Slice rest = records;
+    while (!rest.empty()) {
+      const char* sep = strchr(rest.data(), ' ');
+      const size_t n = (sep == NULL) ? rest.size() : sep - rest.data();
+      writer.AddRecord(Slice(rest.data(), n));
+      rest.remove_prefix(sep == NULL ? n : n + 1);
+    }
+  }
+
+  // Read all records as log "log_number", separated by spaces
+  std::string ReadRecycled(uint64_t log_number) {
+    reading_ = true;
+    source_.contents_ = Slice(dest_.contents_);
+    Reader reader(&source_, &report_, true/*checksum*/, 0, log_number);
+    std::string result;
+    std::string scratch;
+    Slice record;
+    while (reader.ReadRecord(&record, &scratch)) {
+      if (!result.empty()) result.push_back(' ');
+      result.append(record.data(), record.size());
+    }
+    return result;
+  }
+
   void IncrementByte(int offset, int delta) {
     dest_.contents_[offset] += delta;
   }
@@ -194,7 +247,7 @@ class LogTest {
     reading_ = true;
     source_.contents_ = Slice(dest_.contents_);
     Reader* offset_reader = new Reader(&source_, &report_, true/*checksum*/,
-                                       WrittenBytes() + offset_past_end);
+                                       WrittenBytes() + offset_past_end, 0);
     Slice record;
     std::string scratch;
     ASSERT_TRUE(!offset_reader->ReadRecord(&record, &scratch));
@@ -207,7 +260,7 @@ class LogTest {
     reading_ = true;
     source_.contents_ = Slice(dest_.contents_);
     Reader* offset_reader = new Reader(&source_, &report_, true/*checksum*/,
-                                       initial_offset);
+                                       initial_offset, 0);
     Slice record;
     std::string scratch;
     ASSERT_TRUE(offset_reader->ReadRecord(&record, &scratch));
@@ -522,6 +575,43 @@ TEST(LogTest, ReadPastEnd) {
   CheckOffsetPastEndReturnsNoRecords(5);
 }
 
+TEST(LogTest, RecycledLog) {
+  // A shorter log over a longer one whose records span blocks
+  const std::string old_records = BigString("old", 20000) + " " +
+      BigString("older", 50000) + " " + BigString("oldest", 30000);
+  WriteRecycled(1, old_records);
+  const std::string new_records = BigString("new", 15000) + " foo";
+  WriteRecycled(2, new_records);
+  ASSERT_EQ(new_records, ReadRecycled(2));
+  ASSERT_EQ(0, DroppedBytes());
+}
+
+TEST(LogTest, RecycledLogEmpty) {
+  WriteRecycled(1, "foo bar " + BigString("baz", 40000));
+  WriteRecycled(2, "");
+  ASSERT_EQ("", ReadRecycled(2));
+  ASSERT_EQ(0, DroppedBytes());
+}
+
+TEST(LogTest, RecycledLogTrailer) {
+  // Leaves eight bytes at the end of the first block, which are too
+  // few for a recyclable header and so form its trailer
+  const std::string records = BigString("a", kBlockSize - 19) + " foo";
+  WriteRecycled(1, records);
+  ASSERT_EQ(kBlockSize + kRecyclableHeaderSize + 3, WrittenBytes());
+  ASSERT_EQ(records, ReadRecycled(1));
+  ASSERT_EQ(0, DroppedBytes());
+}
+
+TEST(LogTest, RecycledLogTornRecord) {
+  WriteRecycled(1, BigString("old", 40000));
+  WriteRecycled(2, "foo " + BigString("bar", 1000));
+  // Corrupt the last record of the new log
+  IncrementByte(kRecyclableHeaderSize + 3 + kRecyclableHeaderSize + 10, 1);
+  ASSERT_EQ("foo", ReadRecycled(2));
+  ASSERT_EQ(0, DroppedBytes());
+}
+
 }  // namespace log
 }  // namespace leveldb
 
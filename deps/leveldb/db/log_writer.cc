@@ -14,7 +14,22 @@ namespace log {
 
 Writer::Writer(WritableFile* dest)
     : dest_(dest),
-      block_offset_(0) {
+      block_offset_(0),
+      log_number_(0),
+      recycle_log_files_(false) {
+  InitTypeCrc();
+}
+
+Writer::Writer(WritableFile* dest, uint64_t log_number,
+               bool recycle_log_files)
+    : dest_(dest),
+      block_offset_(0),
+      log_number_(log_number),
+      recycle_log_files_(recycle_log_files) {
+  InitTypeCrc();
+}
+
+void Writer::InitTypeCrc() {
   for (int i = 0; i <= kMaxRecordType; i++) {
     char t = static_cast<char>(i);
     type_crc_[i] = crc32c::Value(&t, 1);
@@ -33,35 +48,39 @@ Status Writer::AddRecord(const Slice& slice) {
   // zero-length record
   Status s;
   bool begin = true;
+  const int header_size =
+      recycle_log_files_ ? kRecyclableHeaderSize : kHeaderSize;
   do {
     const int leftover = kBlockSize - block_offset_;
     assert(leftover >= 0);
-    if (leftover < kHeaderSize) {
+    if (leftover < header_size) {
       // Switch to a new block
       if (leftover > 0) {
-        // Fill the trailer (literal below relies on kHeaderSize being 7)
-        assert(kHeaderSize == 7);
-        dest_->Append(Slice("\x00\x00\x00\x00\x00\x00", leftover));
+        // Fill the trailer (literal below relies on header_size being
+        // at most 11)
+        assert(kRecyclableHeaderSize == 11);
+        dest_->Append(Slice("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+                            leftover));
       }
       block_offset_ = 0;
     }
 
-    // Invariant: we never leave < kHeaderSize bytes in a block.
-    assert(kBlockSize - block_offset_ - kHeaderSize >= 0);
+    // Invariant: we never leave < header_size bytes in a block.
+    assert(kBlockSize - block_offset_ - header_size >= 0);
 
-    const size_t avail = kBlockSize - block_offset_ - kHeaderSize;
+    const size_t avail = kBlockSize - block_offset_ - header_size;
     const size_t fragment_length = (left < avail) ? left : avail;
 
     RecordType type;
     const bool end = (left == fragment_length);
     if (begin && end) {
-      type = kFullType;
+      type = recycle_log_files_ ? kRecyclableFullType : kFullType;
     } else if (begin) {
-      type = kFirstType;
+      type = recycle_log_files_ ? kRecyclableFirstType : kFirstType;
     } else if (end) {
-      type = kLastType;
+      type = recycle_log_files_ ? kRecyclableLastType : kLastType;
     } else {
-      type = kMiddleType;
+      type = recycle_log_files_ ? kRecyclableMiddleType : kMiddleType;
     }
 
     s = EmitPhysicalRecord(type, ptr, fragment_length);
@@ -73,29 +92,37 @@ Status Writer::AddRecord(const Slice& slice) {
 }
 
 Status Writer::EmitPhysicalRecord(RecordType t, const char* ptr, size_t n) {
+  const int header_size =
+      (t >= kRecyclableFullType) ? kRecyclableHeaderSize : kHeaderSize;
   assert(n <= 0xffff);  // Must fit in two bytes
-  assert(block_offset_ + kHeaderSize + n <= kBlockSize);
+  assert(block_offset_ + header_size + n <= kBlockSize);
 
   // Format the header
-  char buf[kHeaderSize];
+  char buf[kRecyclableHeaderSize];
   buf[4] = static_cast<char>(n & 0xff);
   buf[5] = static_cast<char>(n >> 8);
   buf[6] = static_cast<char>(t);
 
-  // Compute the crc of the record type and the payload.
-  uint32_t crc = crc32c::Extend(type_crc_[t], ptr, n);
+  // Compute the crc of the record type, the log number if any, and the
+  // payload.
+  uint32_t crc = type_crc_[t];
+  if (header_size == kRecyclableHeaderSize) {
+    EncodeFixed32(buf + kHeaderSize, static_cast<uint32_t>(log_number_));
+    crc = crc32c::Extend(crc, buf + kHeaderSize, 4);
+  }
+  crc = crc32c::Extend(crc, ptr, n);
   crc = crc32c::Mask(crc);                 // Adjust for storage
   EncodeFixed32(buf, crc);
 
   // Write the header and the payload
-  Status s = dest_->Append(Slice(buf, kHeaderSize));
+  Status s = dest_->Append(Slice(buf, header_size));
   if (s.ok()) {
     s = dest_->Append(Slice(ptr, n));
     if (s.ok()) {
       s = dest_->Flush();
     }
   }
-  block_offset_ += kHeaderSize + n;
+  block_offset_ += header_size + n;
   return s;
 }
 
@@ -22,6 +22,11 @@ class Writer {
   // "*dest" must be initially empty.
   // "*dest" must remain live while this Writer is in use.
   explicit Writer(WritableFile* dest);
+
+  // Like Writer(dest), but if "recycle_log_files" is true the records are
+  // written in the recyclable format, tagged with "log_number", so that
+  // "*dest" may be a reused file that still holds an older log.
+  Writer(WritableFile* dest, uint64_t log_number, bool recycle_log_files);
   ~Writer();
 
   Status AddRecord(const Slice& slice);
@@ -29,12 +34,15 @@ class Writer {
  private:
   WritableFile* dest_;
   int block_offset_;       // Current offset in block
+  const uint64_t log_number_;
+  const bool recycle_log_files_;
 
   // crc32c values for all supported record types.  These are
   // pre-computed to reduce the overhead of computing the crc of the
   // record type stored in the header.
   uint32_t type_crc_[kMaxRecordType + 1];
 
+  void InitTypeCrc();
   Status EmitPhysicalRecord(RecordType type, const char* ptr, size_t length);
 
   // No copying allowed
@@ -79,37 +79,70 @@ Iterator* MemTable::NewIterator() {
   return new MemTableIterator(&table_);
 }
 
-void MemTable::Add(SequenceNumber s, ValueType type,
-                   const Slice& key,
-                   const Slice& value) {
-  // Format of an entry is concatenation of:
-  //  key_size     : varint32 of internal_key.size()
-  //  key bytes    : char[internal_key.size()]
-  //  value_size   : varint32 of value.size()
-  //  value bytes  : char[value.size()]
+// Format of an entry is concatenation of:
+//  key_size     : varint32 of internal_key.size()
+//  key bytes    : char[internal_key.size()]
+//  value_size   : varint32 of value.size()
+//  value bytes  : char[value.size()]
+static size_t EncodedEntryLength(const Slice& key, const Slice& value) {
+  const size_t internal_key_size = key.size() + 8;
+  return VarintLength(internal_key_size) + internal_key_size +
+      VarintLength(value.size()) + value.size();
+}
+
+static void EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                        const Slice& key, const Slice& value) {
   size_t key_size = key.size();
   size_t val_size = value.size();
-  size_t internal_key_size = key_size + 8;
-  const size_t encoded_len =
-      VarintLength(internal_key_size) + internal_key_size +
-      VarintLength(val_size) + val_size;
-  char* buf = arena_.Allocate(encoded_len);
-  char* p = EncodeVarint32(buf, internal_key_size);
+  char* p = EncodeVarint32(buf, key_size + 8);
   memcpy(p, key.data(), key_size);
   p += key_size;
   EncodeFixed64(p, (s << 8) | type);
   p += 8;
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
-  assert((p + val_size) - buf == encoded_len);
+  assert((p + val_size) - buf == EncodedEntryLength(key, value));
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type,
+                   const Slice& key,
+                   const Slice& value) {
+  char* buf = arena_.Allocate(EncodedEntryLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
   table_.Insert(buf);
 }
 
-bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+void MemTable::AddConcurrently(SequenceNumber s, ValueType type,
+                               const Slice& key,
+                               const Slice& value) {
+  char* buf = arena_.AllocateConcurrently(EncodedEntryLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  table_.InsertConcurrently(buf);
+}
+
+bool MemTable::Get(const LookupKey& key, std::string* value, Status* s,
+                   MergeContext* merge) {
+  Slice v;
+  Status status;
+  if (!Get(key, &v, &status, merge)) {
+    return false;
+  }
+  if (!merge->empty()) {
+    *s = merge->Finish(status.ok() ? &v : NULL, value);
+  } else if (status.ok()) {
+    value->assign(v.data(), v.size());
+  } else {
+    *s = status;
+  }
+  return true;
+}
+
+bool MemTable::Get(const LookupKey& key, Slice* value, Status* s,
+                   MergeContext* merge) {
   Slice memkey = key.memtable_key();
   Table::Iterator iter(&table_);
   iter.Seek(memkey.data());
-  if (iter.Valid()) {
+  for (; iter.Valid(); iter.Next()) {
     // entry format is:
     //    klength  varint32
     //    userkey  char[klength]
@@ -124,19 +157,25 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
     if (comparator_.comparator.user_comparator()->Compare(
             Slice(key_ptr, key_length - 8),
-            key.user_key()) == 0) {
-      // Correct user key
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
-          return true;
-        }
-        case kTypeDeletion:
-          *s = Status::NotFound(Slice());
-          return true;
+            key.user_key()) != 0) {
+      break;
+    }
+    // Correct user key
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    switch (static_cast<ValueType>(tag & 0xff)) {
+      case kTypeValue: {
+        *value = GetLengthPrefixedSlice(key_ptr + key_length);
+        return true;
       }
+      case kTypeDeletion:
+        *s = Status::NotFound(Slice());
+        return true;
+      case kTypeMerge:
+        // Keep looking for the entry the operand applies to
+        merge->AddOperand(GetLengthPrefixedSlice(key_ptr + key_length));
+        break;
+      default:
+        return false;
     }
   }
   return false;
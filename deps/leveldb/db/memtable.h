@@ -8,6 +8,7 @@
 #include <string>
 #include "leveldb/db.h"
 #include "db/dbformat.h"
+#include "db/merge_context.h"
 #include "db/skiplist.h"
 #include "util/arena.h"
 
@@ -57,11 +58,26 @@ class MemTable {
            const Slice& key,
            const Slice& value);
 
+  // Like Add(), but safe to call from several threads at once.
+  // REQUIRES: no Add() is running.
+  void AddConcurrently(SequenceNumber seq, ValueType type,
+                       const Slice& key,
+                       const Slice& value);
+
   // If memtable contains a value for key, store it in *value and return true.
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
   // Else, return false.
-  bool Get(const LookupKey& key, std::string* value, Status* s);
+  // Merge operands found on the way are added to *merge; if a value or
+  // deletion is found under them, they are applied to it.
+  bool Get(const LookupKey& key, std::string* value, Status* s,
+           MergeContext* merge);
+
+  // Like Get(), but points *value at the value stored in the memtable,
+  // which stays valid for as long as the memtable is referenced.  Does
+  // not apply the operands added to *merge.
+  bool Get(const LookupKey& key, Slice* value, Status* s,
+           MergeContext* merge);
 
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
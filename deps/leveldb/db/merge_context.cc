@@ -0,0 +1,28 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/merge_context.h"
+
+#include "leveldb/merge_operator.h"
+
+namespace leveldb {
+
+Status MergeContext::Finish(const Slice* base, std::string* value) const {
+  if (op_ == NULL) {
+    return Status::NotSupported("no merge operator for ", user_key_);
+  }
+  std::vector<Slice> operands;
+  operands.reserve(operands_.size());
+  for (size_t i = operands_.size(); i > 0; i--) {
+    operands.push_back(operands_[i - 1]);
+  }
+  std::string result;
+  if (!op_->FullMerge(user_key_, base, operands, &result)) {
+    return Status::Corruption("merge operator failed for ", user_key_);
+  }
+  value->swap(result);
+  return Status::OK();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,58 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_MERGE_CONTEXT_H_
+#define STORAGE_LEVELDB_DB_MERGE_CONTEXT_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class MergeOperator;
+
+// Collects the merge operands found for a key while it is looked up,
+// newest first, until the entry they were written on top of is found.
+class MergeContext {
+ public:
+  // "user_key" must remain live while this object is in use.
+  MergeContext(const MergeOperator* op, const Slice& user_key)
+      : op_(op), user_key_(user_key) { }
+
+  bool empty() const { return operands_.empty(); }
+
+  // Record an operand that is older than all recorded so far.
+  void AddOperand(const Slice& operand) {
+    operands_.push_back(operand.ToString());
+  }
+
+  void Clear() { operands_.clear(); }
+
+  // Move the recorded operands to *operands, oldest first.
+  void TakeOperands(std::vector<std::string>* operands) {
+    operands->clear();
+    operands->swap(operands_);
+    std::reverse(operands->begin(), operands->end());
+  }
+
+  // Apply the operands to *base, or to no value at all if base is NULL,
+  // and store the result in *value.  *base may point into *value.
+  Status Finish(const Slice* base, std::string* value) const;
+
+ private:
+  const MergeOperator* op_;
+  Slice user_key_;
+  std::vector<std::string> operands_;
+
+  // No copying allowed
+  MergeContext(const MergeContext&);
+  void operator=(const MergeContext&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_MERGE_CONTEXT_H_
@@ -110,6 +110,7 @@ class Repairer {
   std::vector<std::string> manifests_;
   std::vector<uint64_t> table_numbers_;
   std::vector<uint64_t> logs_;
+  std::vector<uint64_t> value_logs_;
   std::vector<TableInfo> tables_;
   uint64_t next_file_number_;
 
@@ -137,6 +138,8 @@ class Repairer {
             logs_.push_back(number);
           } else if (type == kTableFile) {
             table_numbers_.push_back(number);
+          } else if (type == kValueLogFile) {
+            value_logs_.push_back(number);
           } else {
             // Ignore other files
           }
@@ -191,7 +194,7 @@ class Repairer {
     // propagating bad information (like overly large sequence
     // numbers).
     log::Reader reader(lfile, &reporter, false/*do not checksum*/,
-                       0/*initial_offset*/);
+                       0/*initial_offset*/, log);
 
     // Read all the records and add to a memtable
     std::string scratch;
@@ -399,6 +402,17 @@ class Repairer {
                     t.meta.smallest, t.meta.largest);
     }
 
+    // Keep every value log file since the tables may refer to it.  How
+    // much of it is garbage is unknown, so it is only collected once
+    // compactions have found enough dropped records.
+    for (size_t i = 0; i < value_logs_.size(); i++) {
+      uint64_t file_size;
+      if (env_->GetFileSize(ValueLogFileName(dbname_, value_logs_[i]),
+                            &file_size).ok() && file_size > 0) {
+        edit_.AddValueLog(value_logs_[i], file_size, 0);
+      }
+    }
+
     //fprintf(stderr, "NewDescriptor:\n%s\n", edit_.DebugString().c_str());
     {
       log::Writer log(file);
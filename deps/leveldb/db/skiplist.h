@@ -5,7 +5,8 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
+// Writes require external synchronization, most likely a mutex, except
+// that several threads may InsertConcurrently() at once.
 // Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
 // without any internal locking or synchronization.
@@ -49,6 +50,10 @@ class SkipList {
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Like Insert(), but safe to call from several threads at once.
+  // REQUIRES: no Insert() is running.
+  void InsertConcurrently(const Key& key);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -112,8 +117,12 @@ class SkipList {
   // Read/written only by Insert().
   Random rnd_;
 
-  Node* NewNode(const Key& key, int height);
+  // Xorshift state for the heights of concurrently inserted nodes
+  port::AtomicPointer concurrent_rnd_;
+
+  Node* NewNode(const Key& key, int height, bool concurrent);
   int RandomHeight();
+  int RandomHeightConcurrently();
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
   // Return true if key is greater than the data stored in "n"
@@ -126,6 +135,11 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting at "before", which must come before key, find the nodes
+  // at "level" that key goes between and store them in *prev and *next.
+  void FindSpliceForLevel(const Key& key, Node* before, int level,
+                          Node** prev, Node** next) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -171,6 +185,13 @@ struct SkipList<Key,Comparator>::Node {
     next_[n].NoBarrier_Store(x);
   }
 
+  // Link x in as the next node if the next node is still "expected".
+  // Publishes x like SetNext().
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].CompareAndSwap(expected, x);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   port::AtomicPointer next_[1];
@@ -178,9 +199,12 @@ struct SkipList<Key,Comparator>::Node {
 
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
-SkipList<Key,Comparator>::NewNode(const Key& key, int height) {
-  char* mem = arena_->AllocateAligned(
-      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+SkipList<Key,Comparator>::NewNode(const Key& key, int height,
+                                  bool concurrent) {
+  const size_t size =
+      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1);
+  char* mem = concurrent ? arena_->AllocateAlignedConcurrently(size)
+                         : arena_->AllocateAligned(size);
   return new (mem) Node(key);
 }
 
@@ -249,6 +273,30 @@ int SkipList<Key,Comparator>::RandomHeight() {
   return height;
 }
 
+template<typename Key, class Comparator>
+int SkipList<Key,Comparator>::RandomHeightConcurrently() {
+  // A thread that loses the race for the state retries with the state
+  // the winner stored, so no two inserts use the same state.
+  void* old_state;
+  uint32_t x;
+  do {
+    old_state = concurrent_rnd_.NoBarrier_Load();
+    x = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(old_state));
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+  } while (!concurrent_rnd_.CompareAndSwap(
+               old_state, reinterpret_cast<void*>(static_cast<uintptr_t>(x))));
+
+  // Same distribution as RandomHeight(), two bits per level
+  int height = 1;
+  while (height < kMaxHeight && (x & 3) == 0) {
+    height++;
+    x >>= 2;
+  }
+  return height;
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
   // NULL n is considered infinite
@@ -277,6 +325,25 @@ typename SkipList<Key,Comparator>::Node* SkipList<Key,Comparator>::FindGreaterOr
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::FindSpliceForLevel(const Key& key,
+                                                  Node* before, int level,
+                                                  Node** prev,
+                                                  Node** next) const {
+  Node* x = before;
+  while (true) {
+    Node* n = x->Next(level);
+    if (!KeyIsAfterNode(key, n)) {
+      // Our data structure does not allow duplicate insertion
+      assert(n == NULL || !Equal(key, n->key));
+      *prev = x;
+      *next = n;
+      return;
+    }
+    x = n;
+  }
+}
+
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
 SkipList<Key,Comparator>::FindLessThan(const Key& key) const {
@@ -322,9 +389,10 @@ template<typename Key, class Comparator>
 SkipList<Key,Comparator>::SkipList(Comparator cmp, Arena* arena)
     : compare_(cmp),
       arena_(arena),
-      head_(NewNode(0 /* any key will do */, kMaxHeight)),
+      head_(NewNode(0 /* any key will do */, kMaxHeight, false)),
       max_height_(reinterpret_cast<void*>(1)),
-      rnd_(0xdeadbeef) {
+      rnd_(0xdeadbeef),
+      concurrent_rnd_(reinterpret_cast<void*>(0xdeadbeef)) {
   for (int i = 0; i < kMaxHeight; i++) {
     head_->SetNext(i, NULL);
   }
@@ -357,7 +425,7 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
     max_height_.NoBarrier_Store(reinterpret_cast<void*>(height));
   }
 
-  x = NewNode(key, height);
+  x = NewNode(key, height, false);
   for (int i = 0; i < height; i++) {
     // NoBarrier_SetNext() suffices since we will add a barrier when
     // we publish a pointer to "x" in prev[i].
@@ -366,6 +434,45 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertConcurrently(const Key& key) {
+  const int height = RandomHeightConcurrently();
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    // Readers cope with a max_height_ above the height of every linked
+    // node as explained in Insert().
+    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                   reinterpret_cast<void*>(height))) {
+      max_height = height;
+    } else {
+      max_height = GetMaxHeight();
+    }
+  }
+
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int i = max_height - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, before, i, &prev[i], &next[i]);
+    before = prev[i];
+  }
+
+  // Link the node in from the bottom up, so that it is in the lower
+  // lists whenever it is in a higher one.  If another thread links a
+  // node in between prev[i] and next[i] first, search again from
+  // prev[i], which still comes before key.
+  Node* x = NewNode(key, height, true);
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+    }
+  }
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
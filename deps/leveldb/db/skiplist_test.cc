@@ -3,7 +3,9 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "db/skiplist.h"
+#include <algorithm>
 #include <set>
+#include <vector>
 #include "leveldb/env.h"
 #include "util/arena.h"
 #include "util/hash.h"
@@ -371,6 +373,86 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Several threads inserting into the same list at once
+class ConcurrentInsertState {
+ public:
+  static const int kThreads = 4;
+  static const int kKeysPerThread = 20000;
+
+  Arena arena_;
+  SkipList<Key, Comparator> list_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int next_thread_;
+  int done_;
+
+  ConcurrentInsertState()
+      : list_(Comparator(), &arena_), cv_(&mu_), next_thread_(0), done_(0) { }
+};
+
+static void ConcurrentInserter(void* arg) {
+  ConcurrentInsertState* state = reinterpret_cast<ConcurrentInsertState*>(arg);
+  state->mu_.Lock();
+  const int t = state->next_thread_++;
+  state->mu_.Unlock();
+
+  // Interleave the keys of the threads, in a different order per thread
+  Random rnd(t + 1);
+  std::vector<Key> keys;
+  for (int i = 0; i < ConcurrentInsertState::kKeysPerThread; i++) {
+    keys.push_back(static_cast<Key>(i) * ConcurrentInsertState::kThreads + t);
+  }
+  for (size_t i = keys.size(); i > 1; i--) {
+    std::swap(keys[i - 1], keys[rnd.Uniform(i)]);
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    state->list_.InsertConcurrently(keys[i]);
+  }
+
+  state->mu_.Lock();
+  state->done_++;
+  state->cv_.Signal();
+  state->mu_.Unlock();
+}
+
+TEST(SkipTest, ConcurrentInserts) {
+  ConcurrentInsertState state;
+  for (int i = 0; i < ConcurrentInsertState::kThreads; i++) {
+    Env::Default()->StartThread(ConcurrentInserter, &state);
+  }
+
+  // Readers always see a sorted list
+  state.mu_.Lock();
+  while (state.done_ < ConcurrentInsertState::kThreads) {
+    state.mu_.Unlock();
+    SkipList<Key, Comparator>::Iterator iter(&state.list_);
+    iter.SeekToFirst();
+    Key last = 0;
+    bool first = true;
+    for (; iter.Valid(); iter.Next()) {
+      ASSERT_TRUE(first || last < iter.key());
+      last = iter.key();
+      first = false;
+    }
+    state.mu_.Lock();
+  }
+  state.mu_.Unlock();
+
+  const Key n = static_cast<Key>(ConcurrentInsertState::kThreads) *
+                ConcurrentInsertState::kKeysPerThread;
+  SkipList<Key, Comparator>::Iterator iter(&state.list_);
+  iter.SeekToFirst();
+  for (Key k = 0; k < n; k++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+  for (Key k = 0; k < n; k += 997) {
+    ASSERT_TRUE(state.list_.Contains(k));
+  }
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -0,0 +1,115 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/sst_file_writer.h"
+
+#include "db/dbformat.h"
+#include "leveldb/env.h"
+#include "leveldb/table_builder.h"
+
+namespace leveldb {
+
+// Entries are stored under internal keys with sequence number zero, so
+// that the table has the format of the tables of the database.  The
+// database reads them with the sequence number it assigns the table on
+// ingestion (see FileMetaData::global_seqno).
+struct SstFileWriter::Rep {
+  const InternalKeyComparator icmp;
+  InternalFilterPolicy ipolicy;
+  Options options;
+  std::string fname;
+  WritableFile* file;
+  TableBuilder* builder;
+  std::string last_key;
+  std::string internal_key;
+
+  explicit Rep(const Options& raw)
+      : icmp(raw.comparator),
+        ipolicy(raw.filter_policy),
+        options(raw),
+        file(NULL),
+        builder(NULL) {
+    options.comparator = &icmp;
+    options.filter_policy = (raw.filter_policy != NULL) ? &ipolicy : NULL;
+  }
+
+  void Abandon() {
+    if (builder != NULL) {
+      builder->Abandon();
+      delete builder;
+      builder = NULL;
+    }
+    if (file != NULL) {
+      delete file;
+      file = NULL;
+      options.env->DeleteFile(fname);
+    }
+  }
+};
+
+SstFileWriter::SstFileWriter(const Options& options)
+    : rep_(new Rep(options)) {
+}
+
+SstFileWriter::~SstFileWriter() {
+  rep_->Abandon();
+  delete rep_;
+}
+
+Status SstFileWriter::Open(const std::string& fname) {
+  Rep* r = rep_;
+  assert(r->builder == NULL);
+  Status s = r->options.env->NewWritableFile(fname, &r->file);
+  if (s.ok()) {
+    r->fname = fname;
+    r->builder = new TableBuilder(r->options, r->file);
+    r->last_key.clear();
+  }
+  return s;
+}
+
+Status SstFileWriter::Add(const Slice& key, const Slice& value) {
+  Rep* r = rep_;
+  assert(r->builder != NULL);
+  if (r->builder->NumEntries() > 0 &&
+      r->icmp.user_comparator()->Compare(key, r->last_key) <= 0) {
+    return Status::InvalidArgument("keys must be added in increasing order",
+                                   key);
+  }
+  r->last_key.assign(key.data(), key.size());
+  r->internal_key.clear();
+  AppendInternalKey(&r->internal_key, ParsedInternalKey(key, 0, kTypeValue));
+  r->builder->Add(r->internal_key, value);
+  return r->builder->status();
+}
+
+Status SstFileWriter::Finish() {
+  Rep* r = rep_;
+  assert(r->builder != NULL);
+  Status s = r->builder->Finish();
+  delete r->builder;
+  r->builder = NULL;
+  if (s.ok()) {
+    s = r->file->Sync();
+  }
+  if (s.ok()) {
+    s = r->file->Close();
+  }
+  delete r->file;
+  r->file = NULL;
+  if (!s.ok()) {
+    r->options.env->DeleteFile(r->fname);
+  }
+  return s;
+}
+
+uint64_t SstFileWriter::NumEntries() const {
+  return rep_->builder != NULL ? rep_->builder->NumEntries() : 0;
+}
+
+uint64_t SstFileWriter::FileSize() const {
+  return rep_->builder != NULL ? rep_->builder->FileSize() : 0;
+}
+
+}  // namespace leveldb
@@ -6,8 +6,10 @@
 
 #include "db/filename.h"
 #include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/table.h"
 #include "util/coding.h"
+#include "util/readahead_file.h"
 
 namespace leveldb {
 
@@ -29,6 +31,99 @@ static void UnrefEntry(void* arg1, void* arg2) {
   cache->Release(h);
 }
 
+static void DeleteUncachedTable(void* arg1, void* arg2) {
+  RandomAccessFile* file = reinterpret_cast<RandomAccessFile*>(arg2);
+  delete reinterpret_cast<Table*>(arg1);
+  // The compaction is done with the file, which is obsolete once its
+  // output is installed.
+  file->Hint(RandomAccessFile::kDontNeed);
+  delete file;
+}
+
+// Rewrites the trailer of internal key "key", stored with sequence number
+// zero, to carry sequence number "seq" instead.
+static void SetGlobalSeqno(const Slice& key, SequenceNumber seq,
+                           std::string* result) {
+  result->assign(key.data(), key.size() - 8);
+  AppendInternalKey(result, ParsedInternalKey(Slice(), seq,
+                                              ExtractValueType(key)));
+}
+
+namespace {
+// Iterator over an ingested table that yields its entries with the
+// table's global sequence number.  All entries of such a table carry the
+// same sequence number, so their order is that of the table itself.
+class GlobalSeqnoIterator : public Iterator {
+ public:
+  GlobalSeqnoIterator(Iterator* iter, const Comparator* icmp,
+                      SequenceNumber seq)
+      : iter_(iter), icmp_(icmp), seq_(seq) { }
+  virtual ~GlobalSeqnoIterator() { delete iter_; }
+
+  virtual bool Valid() const { return iter_->Valid(); }
+  virtual void SeekToFirst() { iter_->SeekToFirst(); Update(); }
+  virtual void SeekToLast() { iter_->SeekToLast(); Update(); }
+  virtual void Next() { iter_->Next(); Update(); }
+  virtual void Prev() { iter_->Prev(); Update(); }
+  virtual void Seek(const Slice& target) {
+    // The stored entry of target's user key sorts at or after target,
+    // but with the global sequence number it may sort before it.
+    iter_->Seek(target);
+    Update();
+    while (iter_->Valid() && icmp_->Compare(key_, target) < 0) {
+      iter_->Next();
+      Update();
+    }
+  }
+  virtual Slice key() const { return key_; }
+  virtual Slice value() const { return iter_->value(); }
+  virtual Status status() const { return iter_->status(); }
+
+ private:
+  void Update() {
+    if (iter_->Valid()) {
+      SetGlobalSeqno(iter_->key(), seq_, &key_);
+    }
+  }
+
+  Iterator* const iter_;
+  const Comparator* const icmp_;
+  const SequenceNumber seq_;
+  std::string key_;
+};
+
+// Passes the entries an ingested table finds for a lookup on to
+// (*saver)(arg, ...) with the table's global sequence number, unless
+// they are newer than the lookup.
+struct GlobalSeqnoSaver {
+  void* arg;
+  void (*saver)(void*, const Slice&, const Slice&);
+  SequenceNumber seq;
+  SequenceNumber lookup_seq;
+  std::string key;
+};
+}  // namespace
+
+static void SaveWithGlobalSeqno(void* arg, const Slice& k, const Slice& v) {
+  GlobalSeqnoSaver* s = reinterpret_cast<GlobalSeqnoSaver*>(arg);
+  if (k.size() < 8) {
+    (*s->saver)(s->arg, k, v);  // Let the saver report the corruption
+  } else if (s->seq <= s->lookup_seq) {
+    SetGlobalSeqno(k, s->seq, &s->key);
+    (*s->saver)(s->arg, s->key, v);
+  }
+}
+
+static void InitGlobalSeqnoSaver(GlobalSeqnoSaver* s, SequenceNumber seq,
+                                 const Slice& lookup, void* arg,
+                                 void (*saver)(void*, const Slice&,
+                                               const Slice&)) {
+  s->arg = arg;
+  s->saver = saver;
+  s->seq = seq;
+  s->lookup_seq = DecodeFixed64(lookup.data() + lookup.size() - 8) >> 8;
+}
+
 TableCache::TableCache(const std::string& dbname,
                        const Options* options,
                        int entries)
@@ -42,23 +137,35 @@ TableCache::~TableCache() {
   delete cache_;
 }
 
+Status TableCache::OpenTableFile(uint64_t file_number, bool direct,
+                                 RandomAccessFile** file) {
+  std::string fname = TableFileName(dbname_, file_number);
+  Status s = direct ? env_->NewDirectRandomAccessFile(fname, file)
+                    : env_->NewRandomAccessFile(fname, file);
+  if (!s.ok()) {
+    std::string old_fname = SSTTableFileName(dbname_, file_number);
+    Status old_s = direct ? env_->NewDirectRandomAccessFile(old_fname, file)
+                          : env_->NewRandomAccessFile(old_fname, file);
+    if (old_s.ok()) {
+      s = Status::OK();
+    }
+  }
+  return s;
+}
+
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
-                             Cache::Handle** handle) {
+                             int level, Cache::Handle** handle) {
   Status s;
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   Slice key(buf, sizeof(buf));
   *handle = cache_->Lookup(key);
   if (*handle == NULL) {
-    std::string fname = TableFileName(dbname_, file_number);
     RandomAccessFile* file = NULL;
     Table* table = NULL;
-    s = env_->NewRandomAccessFile(fname, &file);
-    if (!s.ok()) {
-      std::string old_fname = SSTTableFileName(dbname_, file_number);
-      if (env_->NewRandomAccessFile(old_fname, &file).ok()) {
-        s = Status::OK();
-      }
+    s = OpenTableFile(file_number, options_->use_direct_reads, &file);
+    if (s.ok() && options_->advise_random_on_open) {
+      file->Hint(RandomAccessFile::kRandom);
     }
     if (s.ok()) {
       s = Table::Open(*options_, file, file_size, &table);
@@ -76,25 +183,37 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
   }
+  if (s.ok() && level == 0 &&
+      options_->cache_index_and_filter_blocks &&
+      options_->pin_l0_filter_and_index_blocks_in_cache) {
+    reinterpret_cast<TableAndFile*>(cache_->Value(*handle))->table->
+        PinMetaBlocks();
+  }
   return s;
 }
 
 Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number,
                                   uint64_t file_size,
-                                  Table** tableptr) {
+                                  Table** tableptr,
+                                  int level,
+                                  SequenceNumber global_seqno) {
   if (tableptr != NULL) {
     *tableptr = NULL;
   }
 
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (!s.ok()) {
     return NewErrorIterator(s);
   }
 
   Table* table = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
   Iterator* result = table->NewIterator(options);
+  if (global_seqno != 0) {
+    result = new GlobalSeqnoIterator(result, options_->comparator,
+                                     global_seqno);
+  }
   result->RegisterCleanup(&UnrefEntry, cache_, handle);
   if (tableptr != NULL) {
     *tableptr = table;
@@ -102,22 +221,155 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+Iterator* TableCache::NewCompactionIterator(const ReadOptions& options,
+                                            uint64_t file_number,
+                                            uint64_t file_size,
+                                            SequenceNumber global_seqno) {
+  if (options_->compaction_readahead_size == 0) {
+    return NewIterator(options, file_number, file_size, NULL, -1,
+                       global_seqno);
+  }
+
+  RandomAccessFile* file = NULL;
+  Table* table = NULL;
+  Status s = OpenTableFile(file_number,
+                           options_->use_direct_io_for_flush_and_compaction,
+                           &file);
+  if (s.ok()) {
+    file->Hint(RandomAccessFile::kSequential);
+    file = NewReadaheadRandomAccessFile(file, file_size,
+                                       options_->compaction_readahead_size);
+    // Neither the blocks nor the filter of a table opened just for one
+    // pass are worth keeping around.
+    Options table_options = *options_;
+    table_options.block_cache = NULL;
+    table_options.filter_policy = NULL;
+    s = Table::Open(table_options, file, file_size, &table);
+  }
+  if (!s.ok()) {
+    delete file;
+    return NewErrorIterator(s);
+  }
+
+  Iterator* result = table->NewIterator(options);
+  if (global_seqno != 0) {
+    result = new GlobalSeqnoIterator(result, options_->comparator,
+                                     global_seqno);
+  }
+  result->RegisterCleanup(&DeleteUncachedTable, table, file);
+  return result;
+}
+
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
+                       int level,
+                       SequenceNumber global_seqno,
                        const Slice& k,
                        void* arg,
-                       void (*saver)(void*, const Slice&, const Slice&)) {
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       PinnableSlice* pinned) {
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, saver);
-    cache_->Release(handle);
+    if (global_seqno != 0) {
+      GlobalSeqnoSaver g;
+      InitGlobalSeqnoSaver(&g, global_seqno, k, arg, saver);
+      s = t->InternalGet(options, k, &g, &SaveWithGlobalSeqno, pinned);
+    } else {
+      s = t->InternalGet(options, k, arg, saver, pinned);
+    }
+    if (pinned != NULL && pinned->IsPinned()) {
+      // Blocks read through mmap point into the table's file
+      pinned->RegisterCleanup(&UnrefEntry, cache_, handle);
+    } else {
+      cache_->Release(handle);
+    }
   }
   return s;
 }
 
+void TableCache::MultiGet(const ReadOptions& options,
+                          uint64_t file_number,
+                          uint64_t file_size,
+                          int level,
+                          SequenceNumber global_seqno,
+                          int n,
+                          const Slice* keys,
+                          void* const* args,
+                          Status* statuses,
+                          void (*saver)(void*, const Slice&, const Slice&)) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, level, &handle);
+  if (!s.ok()) {
+    for (int i = 0; i < n; i++) {
+      statuses[i] = s;
+    }
+    return;
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  if (global_seqno != 0) {
+    std::vector<GlobalSeqnoSaver> g(n);
+    std::vector<void*> g_args(n);
+    for (int i = 0; i < n; i++) {
+      InitGlobalSeqnoSaver(&g[i], global_seqno, keys[i], args[i], saver);
+      g_args[i] = &g[i];
+    }
+    t->InternalMultiGet(options, n, keys, &g_args[0], statuses,
+                        &SaveWithGlobalSeqno);
+  } else {
+    t->InternalMultiGet(options, n, keys, args, statuses, saver);
+  }
+  cache_->Release(handle);
+}
+
+void TableCache::PrefetchBlocks(const ReadOptions& options,
+                                const std::vector<BlockLookup>& lookups,
+                                bool use_filter) {
+  std::vector<Cache::Handle*> handles;
+  std::vector<Table*> tables;        // The table of each read
+  std::vector<ReadRequest> reads;
+  for (size_t i = 0; i < lookups.size(); i++) {
+    const BlockLookup& l = lookups[i];
+    Cache::Handle* handle = NULL;
+    if (!FindTable(l.file_number, l.file_size, l.level, &handle).ok()) {
+      continue;
+    }
+    handles.push_back(handle);
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    t->AddBlockReads(options, l.n, l.keys, use_filter, &reads);
+    tables.resize(reads.size(), t);
+  }
+
+  if (!reads.empty()) {
+    env_->MultiRead(&reads[0], reads.size());
+  }
+  for (size_t i = 0; i < reads.size(); i++) {
+    tables[i]->InsertBlockRead(options, reads[i]);
+  }
+  for (size_t i = 0; i < handles.size(); i++) {
+    cache_->Release(handles[i]);
+  }
+}
+
+bool TableCache::PrefixMayMatch(const ReadOptions& options,
+                                uint64_t file_number,
+                                uint64_t file_size,
+                                int level,
+                                const Slice& k) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, level, &handle);
+  if (!s.ok()) {
+    // Let the iterator surface the error.
+    return true;
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  bool result = t->PrefixMayMatch(options, k);
+  cache_->Release(handle);
+  return result;
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
@@ -8,6 +8,7 @@
 #define STORAGE_LEVELDB_DB_TABLE_CACHE_H_
 
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include "db/dbformat.h"
 #include "leveldb/cache.h"
@@ -30,19 +31,88 @@ class TableCache {
   // the returned iterator.  The returned "*tableptr" object is owned by
   // the cache and should not be deleted, and is valid for as long as the
   // returned iterator is live.
+  //
+  // "level" is the level of the file, or -1 if unknown.  It is used to
+  // pin the index and filter blocks of level-0 tables in the block cache
+  // if Options::pin_l0_filter_and_index_blocks_in_cache is set.
+  //
+  // A non-zero "global_seqno" marks an ingested table: its entries are
+  // stored with sequence number zero and are read as having sequence
+  // number global_seqno instead (see FileMetaData::global_seqno).
   Iterator* NewIterator(const ReadOptions& options,
                         uint64_t file_number,
                         uint64_t file_size,
-                        Table** tableptr = NULL);
+                        Table** tableptr = NULL,
+                        int level = -1,
+                        SequenceNumber global_seqno = 0);
+
+  // Like NewIterator(), for a compaction that reads the file once, in
+  // order.  If Options::compaction_readahead_size is set, the file is
+  // opened outside the cache, for direct I/O if
+  // Options::use_direct_io_for_flush_and_compaction is set, and read
+  // ahead in chunks of that size.
+  Iterator* NewCompactionIterator(const ReadOptions& options,
+                                  uint64_t file_number,
+                                  uint64_t file_size,
+                                  SequenceNumber global_seqno = 0);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  If "pinned" is
+  // non-NULL and an entry is found, the table and data block holding it
+  // stay alive until pinned->Reset().  An entry of an ingested table
+  // (see NewIterator()) that is newer than the sequence number of "k"
+  // is not passed on.
+  // REQUIRES: pinned is NULL or holds no pin
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
+             int level,
+             SequenceNumber global_seqno,
              const Slice& k,
              void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             PinnableSlice* pinned = NULL);
+
+  // Like Get() for each of the sorted internal keys keys[0,n-1], calling
+  // (*handle_result)(args[i], ...) for key i and setting statuses[i].
+  void MultiGet(const ReadOptions& options,
+                uint64_t file_number,
+                uint64_t file_size,
+                int level,
+                SequenceNumber global_seqno,
+                int n,
+                const Slice* keys,
+                void* const* args,
+                Status* statuses,
+                void (*handle_result)(void*, const Slice&, const Slice&));
+
+  // Lookups of the sorted internal keys keys[0,n-1] in a file, for
+  // PrefetchBlocks()
+  struct BlockLookup {
+    uint64_t file_number;
+    uint64_t file_size;
+    int level;
+    const Slice* keys;
+    int n;
+  };
+
+  // Read the data blocks that the lookups land in and that are not in
+  // the block cache into it, all with a single Env::MultiRead() call.
+  // If "use_filter" is true, blocks that the filter of their file rules
+  // out for the key are left out.  Errors are ignored: the lookups run
+  // into them again when they read the blocks themselves.
+  void PrefetchBlocks(const ReadOptions& options,
+                      const std::vector<BlockLookup>& lookups,
+                      bool use_filter);
+
+  // Returns false if the filter of the specified file proves that it
+  // holds no key with the user key prefix of internal key "k".  Errors
+  // opening the file are reported as a possible match.
+  bool PrefixMayMatch(const ReadOptions& options,
+                      uint64_t file_number,
+                      uint64_t file_size,
+                      int level,
+                      const Slice& k);
 
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
@@ -53,7 +123,10 @@ class TableCache {
   const Options* options_;
   Cache* cache_;
 
-  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  Status OpenTableFile(uint64_t file_number, bool direct,
+                       RandomAccessFile** file);
+  Status FindTable(uint64_t file_number, uint64_t file_size, int level,
+                   Cache::Handle**);
 };
 
 }  // namespace leveldb
@@ -0,0 +1,259 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/value_log.h"
+
+#include "db/filename.h"
+#include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+
+namespace leveldb {
+
+void ValuePointer::EncodeTo(std::string* dst) const {
+  PutVarint64(dst, number);
+  PutVarint64(dst, offset);
+  PutVarint64(dst, size);
+  PutFixed32(dst, crc);
+}
+
+bool ValuePointer::DecodeFrom(const Slice& input) {
+  Slice in = input;
+  if (GetVarint64(&in, &number) &&
+      GetVarint64(&in, &offset) &&
+      GetVarint64(&in, &size) &&
+      in.size() == 4) {
+    crc = DecodeFixed32(in.data());
+    return true;
+  }
+  return false;
+}
+
+ValueLogBuilder::ValueLogBuilder(uint64_t number, WritableFile* file)
+    : number_(number),
+      file_(file),
+      offset_(0) {
+}
+
+Status ValueLogBuilder::Add(const Slice& key, const Slice& value,
+                            ValuePointer* ptr) {
+  char header[kValueLogHeaderSize];
+  const uint32_t value_crc = crc32c::Mask(crc32c::Value(value.data(),
+                                                        value.size()));
+  EncodeFixed32(header + 4, value_crc);
+  EncodeFixed32(header + 8, key.size());
+  EncodeFixed32(header + 12, value.size());
+  uint32_t header_crc = crc32c::Value(header + 4, 12);
+  header_crc = crc32c::Extend(header_crc, key.data(), key.size());
+  EncodeFixed32(header, crc32c::Mask(header_crc));
+
+  Status s = file_->Append(Slice(header, sizeof(header)));
+  if (s.ok()) {
+    s = file_->Append(key);
+  }
+  if (s.ok()) {
+    s = file_->Append(value);
+  }
+  if (s.ok()) {
+    ptr->number = number_;
+    ptr->offset = offset_ + kValueLogHeaderSize + key.size();
+    ptr->size = value.size();
+    ptr->crc = value_crc;
+    offset_ = ptr->offset + value.size();
+  }
+  return s;
+}
+
+ValueLogReader::ValueLogReader(RandomAccessFile* file, uint64_t number,
+                               uint64_t file_size)
+    : file_(file),
+      file_size_(file_size),
+      offset_(0) {
+  pointer_.number = number;
+}
+
+bool ValueLogReader::Next() {
+  if (!status_.ok() || offset_ >= file_size_) {
+    return false;
+  }
+  if (file_size_ - offset_ < kValueLogHeaderSize) {
+    status_ = Status::Corruption("truncated value log record");
+    return false;
+  }
+
+  char header[kValueLogHeaderSize];
+  Slice result;
+  status_ = file_->Read(offset_, kValueLogHeaderSize, &result, header);
+  if (!status_.ok()) {
+    return false;
+  }
+  if (result.size() != kValueLogHeaderSize) {
+    status_ = Status::Corruption("truncated value log record");
+    return false;
+  }
+  const char* h = result.data();
+  const uint32_t header_crc = crc32c::Unmask(DecodeFixed32(h));
+  const uint32_t value_crc = DecodeFixed32(h + 4);
+  const uint32_t key_size = DecodeFixed32(h + 8);
+  const uint32_t value_size = DecodeFixed32(h + 12);
+  const uint64_t n = static_cast<uint64_t>(key_size) + value_size;
+  if (file_size_ - offset_ - kValueLogHeaderSize < n) {
+    status_ = Status::Corruption("bad value log record length");
+    return false;
+  }
+
+  scratch_.resize(n);
+  status_ = file_->Read(offset_ + kValueLogHeaderSize, n, &result,
+                        n > 0 ? &scratch_[0] : NULL);
+  if (!status_.ok()) {
+    return false;
+  }
+  if (result.size() != n) {
+    status_ = Status::Corruption("truncated value log record");
+    return false;
+  }
+  key_ = Slice(result.data(), key_size);
+  value_ = Slice(result.data() + key_size, value_size);
+  if (crc32c::Extend(crc32c::Value(h + 4, 12), key_.data(), key_.size()) !=
+      header_crc) {
+    status_ = Status::Corruption("value log record header checksum mismatch");
+    return false;
+  }
+  if (crc32c::Unmask(value_crc) != crc32c::Value(value_.data(),
+                                                 value_.size())) {
+    status_ = Status::Corruption("value log checksum mismatch");
+    return false;
+  }
+
+  pointer_.offset = offset_ + kValueLogHeaderSize + key_size;
+  pointer_.size = value_size;
+  pointer_.crc = value_crc;
+  offset_ = pointer_.offset + value_size;
+  return true;
+}
+
+static void DeleteEntry(const Slice& key, void* value) {
+  delete reinterpret_cast<RandomAccessFile*>(value);
+}
+
+static void UnrefEntry(void* arg1, void* arg2) {
+  Cache* cache = reinterpret_cast<Cache*>(arg1);
+  Cache::Handle* h = reinterpret_cast<Cache::Handle*>(arg2);
+  cache->Release(h);
+}
+
+ValueLog::ValueLog(const std::string& dbname,
+                   const Options* options,
+                   int entries)
+    : env_(options->env),
+      dbname_(dbname),
+      options_(options),
+      cache_(NewLRUCache(entries)) {
+}
+
+ValueLog::~ValueLog() {
+  delete cache_;
+}
+
+Status ValueLog::FindFile(uint64_t number, Cache::Handle** handle) {
+  Status s;
+  char buf[sizeof(number)];
+  EncodeFixed64(buf, number);
+  Slice key(buf, sizeof(buf));
+  *handle = cache_->Lookup(key);
+  if (*handle == NULL) {
+    RandomAccessFile* file = NULL;
+    s = env_->NewRandomAccessFile(ValueLogFileName(dbname_, number), &file);
+    if (s.ok()) {
+      *handle = cache_->Insert(key, file, 1, &DeleteEntry);
+    }
+    // Errors are not cached so that a transient error is retried.
+  }
+  return s;
+}
+
+Status ValueLog::Read(const ReadOptions& options, const ValuePointer& ptr,
+                      char* scratch, Slice* result, Cache::Handle** handle) {
+  Status s = FindFile(ptr.number, handle);
+  if (!s.ok()) {
+    return s;
+  }
+  RandomAccessFile* file =
+      reinterpret_cast<RandomAccessFile*>(cache_->Value(*handle));
+  s = file->Read(ptr.offset, ptr.size, result, scratch);
+  if (s.ok() && result->size() != ptr.size) {
+    s = Status::Corruption("truncated value log read");
+  }
+  if (s.ok() && options.verify_checksums &&
+      crc32c::Unmask(ptr.crc) != crc32c::Value(result->data(),
+                                               result->size())) {
+    s = Status::Corruption("value log checksum mismatch");
+  }
+  if (!s.ok()) {
+    cache_->Release(*handle);
+    *handle = NULL;
+  }
+  return s;
+}
+
+Status ValueLog::Get(const ReadOptions& options, const Slice& pointer,
+                     std::string* value) {
+  ValuePointer ptr;
+  if (!ptr.DecodeFrom(pointer)) {
+    value->clear();
+    return Status::Corruption("bad value log pointer");
+  }
+  value->resize(ptr.size);
+  char* scratch = ptr.size > 0 ? &(*value)[0] : NULL;
+  Slice result;
+  Cache::Handle* handle;
+  Status s = Read(options, ptr, scratch, &result, &handle);
+  if (s.ok()) {
+    if (result.data() != scratch) {
+      // Memory-mapped file
+      value->assign(result.data(), result.size());
+    }
+    cache_->Release(handle);
+  } else {
+    value->clear();
+  }
+  return s;
+}
+
+Status ValueLog::Get(const ReadOptions& options, const Slice& pointer,
+                     PinnableSlice* value) {
+  assert(!value->IsPinned());
+  ValuePointer ptr;
+  if (!ptr.DecodeFrom(pointer)) {
+    value->Reset();
+    return Status::Corruption("bad value log pointer");
+  }
+  std::string* buf = value->GetSelf();
+  buf->resize(ptr.size);
+  char* scratch = ptr.size > 0 ? &(*buf)[0] : NULL;
+  Slice result;
+  Cache::Handle* handle;
+  Status s = Read(options, ptr, scratch, &result, &handle);
+  if (!s.ok()) {
+    value->Reset();
+  } else if (result.data() == scratch) {
+    value->PinSelf();
+    cache_->Release(handle);
+  } else {
+    // Memory-mapped file: the open file keeps the mapping alive
+    buf->clear();
+    value->PinSlice(result);
+    value->RegisterCleanup(&UnrefEntry, cache_, handle);
+  }
+  return s;
+}
+
+void ValueLog::Evict(uint64_t number) {
+  char buf[sizeof(number)];
+  EncodeFixed64(buf, number);
+  cache_->Erase(Slice(buf, sizeof(buf)));
+}
+
+}  // namespace leveldb
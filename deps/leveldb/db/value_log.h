@@ -0,0 +1,161 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A value log keeps large values out of the tables so that compactions
+// do not have to rewrite them.  When a memtable is compacted, values of
+// at least Options::value_log_threshold bytes are appended to a new value
+// log file, and the table stores an encoded ValuePointer under the
+// kTypeValueIndex value type instead.  Table compactions only move the
+// pointers around, except for the values they create by applying merge
+// operands or the compaction filter, which go to value log files of
+// their own when they reach the threshold.
+//
+// A value log file is a sequence of records:
+//    header_crc: fixed32      masked crc32c of the rest of the header
+//                             and the key
+//    value_crc: fixed32       masked crc32c of the value
+//    key_length: fixed32
+//    value_length: fixed32
+//    key: uint8[key_length]
+//    value: uint8[value_length]
+//
+// The MANIFEST lists the value log files of a version together with the
+// number of bytes of their records that no table refers to anymore (see
+// VersionEdit::AddValueLogGarbage).
+
+#ifndef STORAGE_LEVELDB_DB_VALUE_LOG_H_
+#define STORAGE_LEVELDB_DB_VALUE_LOG_H_
+
+#include <string>
+#include <stdint.h>
+#include "leveldb/cache.h"
+#include "leveldb/options.h"
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Env;
+class PinnableSlice;
+class RandomAccessFile;
+class WritableFile;
+
+static const int kValueLogHeaderSize = 16;
+
+// Location of a value in a value log file
+struct ValuePointer {
+  uint64_t number;    // Value log file number
+  uint64_t offset;    // Offset of the value in the file
+  uint64_t size;      // Size of the value
+  uint32_t crc;       // Masked crc32c of the value
+
+  ValuePointer() : number(0), offset(0), size(0), crc(0) { }
+
+  void EncodeTo(std::string* dst) const;
+  bool DecodeFrom(const Slice& input);
+
+  // Size of the record that holds the value for a key of "key_size"
+  // bytes.
+  uint64_t RecordSize(size_t key_size) const {
+    return kValueLogHeaderSize + key_size + size;
+  }
+};
+
+// Appends records to a new value log file.
+class ValueLogBuilder {
+ public:
+  // Create a builder that stores the contents of the value log file
+  // "number" in *file.  Does not close or delete *file.
+  ValueLogBuilder(uint64_t number, WritableFile* file);
+
+  // Append a record for key/value and store the location of the value
+  // in *ptr.
+  Status Add(const Slice& key, const Slice& value, ValuePointer* ptr);
+
+  // Size of the file generated so far.
+  uint64_t FileSize() const { return offset_; }
+
+ private:
+  const uint64_t number_;
+  WritableFile* file_;
+  uint64_t offset_;
+
+  // No copying allowed
+  ValueLogBuilder(const ValueLogBuilder&);
+  void operator=(const ValueLogBuilder&);
+};
+
+// Reads the records of a value log file in order.
+class ValueLogReader {
+ public:
+  // Read the value log file "number" of "file_size" bytes from *file.
+  // Does not delete *file.
+  ValueLogReader(RandomAccessFile* file, uint64_t number,
+                 uint64_t file_size);
+
+  // Advance to the next record.  Returns false at the end of the file
+  // or if an error was found (see status()).
+  bool Next();
+
+  // The current record.  REQUIRES: Next() returned true
+  Slice key() const { return key_; }
+  Slice value() const { return value_; }
+  const ValuePointer& pointer() const { return pointer_; }
+
+  Status status() const { return status_; }
+
+ private:
+  RandomAccessFile* file_;
+  const uint64_t file_size_;
+  uint64_t offset_;
+  std::string scratch_;
+  Slice key_;
+  Slice value_;
+  ValuePointer pointer_;
+  Status status_;
+
+  // No copying allowed
+  ValueLogReader(const ValueLogReader&);
+  void operator=(const ValueLogReader&);
+};
+
+// Reads values through a cache of open value log files.
+// Thread-safe (provides internal synchronization)
+class ValueLog {
+ public:
+  ValueLog(const std::string& dbname, const Options* options, int entries);
+  ~ValueLog();
+
+  // Read the value that "pointer", an encoded ValuePointer, refers to.
+  Status Get(const ReadOptions& options, const Slice& pointer,
+             std::string* value);
+
+  // Like Get(), but points *value at the value without copying it when
+  // the file is memory-mapped, and reads it into the buffer of *value
+  // otherwise.
+  // REQUIRES: value holds no pin
+  Status Get(const ReadOptions& options, const Slice& pointer,
+             PinnableSlice* value);
+
+  // Evict any entry for the specified file number
+  void Evict(uint64_t number);
+
+ private:
+  Env* const env_;
+  const std::string dbname_;
+  const Options* options_;
+  Cache* cache_;
+
+  Status FindFile(uint64_t number, Cache::Handle** handle);
+
+  // Read the value of "ptr" into "scratch" (or anywhere if the file
+  // is memory-mapped), storing the result in *result.  On success the
+  // caller must release *handle, which keeps *result alive.
+  Status Read(const ReadOptions& options, const ValuePointer& ptr,
+              char* scratch, Slice* result, Cache::Handle** handle);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_VALUE_LOG_H_
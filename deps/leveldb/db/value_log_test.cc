@@ -0,0 +1,225 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/value_log.h"
+
+#include <vector>
+#include "db/filename.h"
+#include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
+#include "util/random.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class ValueLogTest {
+ public:
+  Env* env_;
+  std::string dbname_;
+  Options options_;
+  std::vector<std::string> keys_;
+  std::vector<std::string> values_;
+  std::vector<ValuePointer> pointers_;
+
+  ValueLogTest() : env_(Env::Default()) {
+    dbname_ = test::TmpDir() + "/value_log_test";
+    options_.env = env_;
+    env_->CreateDir(dbname_);
+    env_->DeleteFile(FileName());
+  }
+
+  ~ValueLogTest() {
+    env_->DeleteFile(FileName());
+    env_->DeleteDir(dbname_);
+  }
+
+  std::string FileName() const {
+    return ValueLogFileName(dbname_, 7);
+  }
+
+  // Write a value log file with "n" records of random sizes
+  void Build(int n) {
+    Random rnd(301);
+    WritableFile* file;
+    ASSERT_OK(env_->NewWritableFile(FileName(), &file));
+    ValueLogBuilder builder(7, file);
+    for (int i = 0; i < n; i++) {
+      std::string key, value;
+      test::RandomString(&rnd, 1 + rnd.Uniform(20), &key);
+      test::RandomString(&rnd, (i == 0) ? 0 : rnd.Skewed(14), &value);
+      ValuePointer ptr;
+      ASSERT_OK(builder.Add(key, value, &ptr));
+      keys_.push_back(key);
+      values_.push_back(value);
+      pointers_.push_back(ptr);
+    }
+    ASSERT_OK(file->Close());
+    delete file;
+
+    uint64_t size;
+    ASSERT_OK(env_->GetFileSize(FileName(), &size));
+    ASSERT_EQ(builder.FileSize(), size);
+  }
+
+  // Overwrite the byte at "offset" of the file with its complement
+  void FlipByte(uint64_t offset) {
+    std::string contents;
+    ASSERT_OK(ReadFileToString(env_, FileName(), &contents));
+    contents[offset] ^= 0xff;
+    ASSERT_OK(WriteStringToFile(env_, contents, FileName()));
+  }
+
+  void Truncate(uint64_t size) {
+    std::string contents;
+    ASSERT_OK(ReadFileToString(env_, FileName(), &contents));
+    contents.resize(size);
+    ASSERT_OK(WriteStringToFile(env_, contents, FileName()));
+  }
+
+  // Read every record of the file; returns the reader's final status
+  Status Scan(int* count) {
+    uint64_t size;
+    Status s = env_->GetFileSize(FileName(), &size);
+    RandomAccessFile* file;
+    if (s.ok()) {
+      s = env_->NewRandomAccessFile(FileName(), &file);
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    ValueLogReader reader(file, 7, size);
+    *count = 0;
+    while (reader.Next()) {
+      const int i = *count;
+      ASSERT_LT(i, keys_.size());
+      ASSERT_EQ(keys_[i], reader.key().ToString());
+      ASSERT_EQ(values_[i], reader.value().ToString());
+      ASSERT_EQ(pointers_[i].number, reader.pointer().number);
+      ASSERT_EQ(pointers_[i].offset, reader.pointer().offset);
+      ASSERT_EQ(pointers_[i].size, reader.pointer().size);
+      ASSERT_EQ(pointers_[i].crc, reader.pointer().crc);
+      (*count)++;
+    }
+    s = reader.status();
+    delete file;
+    return s;
+  }
+
+  std::string Encode(const ValuePointer& ptr) {
+    std::string result;
+    ptr.EncodeTo(&result);
+    return result;
+  }
+};
+
+TEST(ValueLogTest, PointerEncoding) {
+  ValuePointer ptr;
+  ptr.number = 12345678901ull;
+  ptr.offset = 1ull << 40;
+  ptr.size = 300;
+  ptr.crc = 0xdeadbeef;
+  std::string encoded = Encode(ptr);
+
+  ValuePointer decoded;
+  ASSERT_TRUE(decoded.DecodeFrom(encoded));
+  ASSERT_EQ(ptr.number, decoded.number);
+  ASSERT_EQ(ptr.offset, decoded.offset);
+  ASSERT_EQ(ptr.size, decoded.size);
+  ASSERT_EQ(ptr.crc, decoded.crc);
+  ASSERT_EQ(kValueLogHeaderSize + 10 + 300, decoded.RecordSize(10));
+
+  ASSERT_TRUE(!decoded.DecodeFrom(Slice(encoded.data(), encoded.size() - 1)));
+  ASSERT_TRUE(!decoded.DecodeFrom(encoded + "x"));
+  ASSERT_TRUE(!decoded.DecodeFrom(""));
+}
+
+TEST(ValueLogTest, Scan) {
+  Build(200);
+  int count;
+  ASSERT_OK(Scan(&count));
+  ASSERT_EQ(200, count);
+}
+
+TEST(ValueLogTest, Get) {
+  Build(50);
+  ValueLog value_log(dbname_, &options_, 10);
+  ReadOptions options;
+  options.verify_checksums = true;
+  for (size_t i = 0; i < keys_.size(); i++) {
+    std::string value;
+    ASSERT_OK(value_log.Get(options, Encode(pointers_[i]), &value));
+    ASSERT_EQ(values_[i], value);
+
+    PinnableSlice pinned;
+    ASSERT_OK(value_log.Get(options, Encode(pointers_[i]), &pinned));
+    ASSERT_EQ(values_[i], pinned.ToString());
+  }
+
+  std::string value;
+  ASSERT_TRUE(value_log.Get(options, "bad", &value).IsCorruption());
+
+  // Evicting the open file must not affect later reads
+  value_log.Evict(7);
+  ASSERT_OK(value_log.Get(options, Encode(pointers_[1]), &value));
+  ASSERT_EQ(values_[1], value);
+}
+
+TEST(ValueLogTest, MissingFile) {
+  ValueLog value_log(dbname_, &options_, 10);
+  ValuePointer ptr;
+  ptr.number = 7;
+  ptr.size = 10;
+  std::string value;
+  ASSERT_TRUE(!value_log.Get(ReadOptions(), Encode(ptr), &value).ok());
+}
+
+TEST(ValueLogTest, CorruptValue) {
+  Build(10);
+  FlipByte(pointers_[5].offset);
+
+  int count;
+  ASSERT_TRUE(Scan(&count).IsCorruption());
+  ASSERT_EQ(5, count);
+
+  // Point reads only check the value when asked to
+  ValueLog value_log(dbname_, &options_, 10);
+  ReadOptions options;
+  std::string value;
+  ASSERT_OK(value_log.Get(options, Encode(pointers_[5]), &value));
+  ASSERT_NE(values_[5], value);
+  options.verify_checksums = true;
+  ASSERT_TRUE(value_log.Get(options, Encode(pointers_[5]), &value)
+              .IsCorruption());
+  ASSERT_OK(value_log.Get(options, Encode(pointers_[6]), &value));
+  ASSERT_EQ(values_[6], value);
+}
+
+TEST(ValueLogTest, CorruptHeader) {
+  Build(10);
+  // The key length of record 3
+  FlipByte(pointers_[3].offset - keys_[3].size() - kValueLogHeaderSize + 8);
+  int count;
+  ASSERT_TRUE(Scan(&count).IsCorruption());
+  ASSERT_EQ(3, count);
+}
+
+TEST(ValueLogTest, Truncated) {
+  Build(10);
+  Truncate(pointers_[8].offset - 1);
+  int count;
+  ASSERT_TRUE(Scan(&count).IsCorruption());
+  ASSERT_EQ(8, count);
+
+  // A partial header
+  Truncate(pointers_[2].offset + pointers_[2].size + 3);
+  ASSERT_TRUE(Scan(&count).IsCorruption());
+  ASSERT_EQ(3, count);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -20,7 +20,11 @@ enum Tag {
   kDeletedFile          = 6,
   kNewFile              = 7,
   // 8 was used for large value refs
-  kPrevLogNumber        = 9
+  kPrevLogNumber        = 9,
+  kNewValueLog          = 10,
+  kDeletedValueLog      = 11,
+  kValueLogGarbage      = 12,
+  kIngestedFile         = 13
 };
 
 void VersionEdit::Clear() {
@@ -36,6 +40,9 @@ void VersionEdit::Clear() {
   has_last_sequence_ = false;
   deleted_files_.clear();
   new_files_.clear();
+  deleted_value_logs_.clear();
+  new_value_logs_.clear();
+  value_log_garbage_.clear();
 }
 
 void VersionEdit::EncodeTo(std::string* dst) const {
@@ -76,12 +83,39 @@ void VersionEdit::EncodeTo(std::string* dst) const {
 
   for (size_t i = 0; i < new_files_.size(); i++) {
     const FileMetaData& f = new_files_[i].second;
-    PutVarint32(dst, kNewFile);
+    // Ingested tables get a tag of their own so that older versions,
+    // which would read their entries as sequence number zero, refuse
+    // the descriptor instead.
+    PutVarint32(dst, f.global_seqno != 0 ? kIngestedFile : kNewFile);
     PutVarint32(dst, new_files_[i].first);  // level
     PutVarint64(dst, f.number);
     PutVarint64(dst, f.file_size);
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
+    if (f.global_seqno != 0) {
+      PutVarint64(dst, f.global_seqno);
+    }
+  }
+
+  for (std::set<uint64_t>::const_iterator iter = deleted_value_logs_.begin();
+       iter != deleted_value_logs_.end();
+       ++iter) {
+    PutVarint32(dst, kDeletedValueLog);
+    PutVarint64(dst, *iter);
+  }
+
+  for (size_t i = 0; i < new_value_logs_.size(); i++) {
+    const ValueLogMetaData& f = new_value_logs_[i];
+    PutVarint32(dst, kNewValueLog);
+    PutVarint64(dst, f.number);
+    PutVarint64(dst, f.file_size);
+    PutVarint64(dst, f.garbage);
+  }
+
+  for (size_t i = 0; i < value_log_garbage_.size(); i++) {
+    PutVarint32(dst, kValueLogGarbage);
+    PutVarint64(dst, value_log_garbage_[i].first);   // file number
+    PutVarint64(dst, value_log_garbage_[i].second);  // bytes
   }
 }
 
@@ -115,7 +149,9 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   // Temporary storage for parsing
   int level;
   uint64_t number;
+  uint64_t bytes;
   FileMetaData f;
+  ValueLogMetaData vf;
   Slice str;
   InternalKey key;
 
@@ -181,17 +217,47 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         break;
 
       case kNewFile:
+      case kIngestedFile:
+        f.global_seqno = 0;
         if (GetLevel(&input, &level) &&
             GetVarint64(&input, &f.number) &&
             GetVarint64(&input, &f.file_size) &&
             GetInternalKey(&input, &f.smallest) &&
-            GetInternalKey(&input, &f.largest)) {
+            GetInternalKey(&input, &f.largest) &&
+            (tag == kNewFile || GetVarint64(&input, &f.global_seqno))) {
           new_files_.push_back(std::make_pair(level, f));
         } else {
           msg = "new-file entry";
         }
         break;
 
+      case kDeletedValueLog:
+        if (GetVarint64(&input, &number)) {
+          deleted_value_logs_.insert(number);
+        } else {
+          msg = "deleted value log";
+        }
+        break;
+
+      case kNewValueLog:
+        if (GetVarint64(&input, &vf.number) &&
+            GetVarint64(&input, &vf.file_size) &&
+            GetVarint64(&input, &vf.garbage)) {
+          new_value_logs_.push_back(vf);
+        } else {
+          msg = "new value log entry";
+        }
+        break;
+
+      case kValueLogGarbage:
+        if (GetVarint64(&input, &number) &&
+            GetVarint64(&input, &bytes)) {
+          value_log_garbage_.push_back(std::make_pair(number, bytes));
+        } else {
+          msg = "value log garbage";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -258,6 +324,31 @@ std::string VersionEdit::DebugString() const {
     r.append(f.smallest.DebugString());
     r.append(" .. ");
     r.append(f.largest.DebugString());
+    if (f.global_seqno != 0) {
+      r.append(" @ ");
+      AppendNumberTo(&r, f.global_seqno);
+    }
+  }
+  for (std::set<uint64_t>::const_iterator iter = deleted_value_logs_.begin();
+       iter != deleted_value_logs_.end();
+       ++iter) {
+    r.append("\n  DeleteValueLog: ");
+    AppendNumberTo(&r, *iter);
+  }
+  for (size_t i = 0; i < new_value_logs_.size(); i++) {
+    const ValueLogMetaData& f = new_value_logs_[i];
+    r.append("\n  AddValueLog: ");
+    AppendNumberTo(&r, f.number);
+    r.append(" ");
+    AppendNumberTo(&r, f.file_size);
+    r.append(" ");
+    AppendNumberTo(&r, f.garbage);
+  }
+  for (size_t i = 0; i < value_log_garbage_.size(); i++) {
+    r.append("\n  ValueLogGarbage: ");
+    AppendNumberTo(&r, value_log_garbage_[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, value_log_garbage_[i].second);
   }
   r.append("\n}\n");
   return r;
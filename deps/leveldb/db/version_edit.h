@@ -22,7 +22,20 @@ struct FileMetaData {
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
 
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) { }
+  // Sequence number of all entries of an ingested table, which stores
+  // them with sequence number zero, or zero for any other table
+  SequenceNumber global_seqno;
+
+  FileMetaData()
+      : refs(0), allowed_seeks(1 << 30), file_size(0), global_seqno(0) { }
+};
+
+struct ValueLogMetaData {
+  uint64_t number;
+  uint64_t file_size;         // File size in bytes
+  uint64_t garbage;           // Bytes of records no table refers to
+
+  ValueLogMetaData() : number(0), file_size(0), garbage(0) { }
 };
 
 class VersionEdit {
@@ -59,15 +72,18 @@ class VersionEdit {
   // Add the specified file at the specified number.
   // REQUIRES: This version has not been saved (see VersionSet::SaveTo)
   // REQUIRES: "smallest" and "largest" are smallest and largest keys in file
+  // A non-zero "global_seqno" marks an ingested table (see FileMetaData).
   void AddFile(int level, uint64_t file,
                uint64_t file_size,
                const InternalKey& smallest,
-               const InternalKey& largest) {
+               const InternalKey& largest,
+               SequenceNumber global_seqno = 0) {
     FileMetaData f;
     f.number = file;
     f.file_size = file_size;
     f.smallest = smallest;
     f.largest = largest;
+    f.global_seqno = global_seqno;
     new_files_.push_back(std::make_pair(level, f));
   }
 
@@ -76,6 +92,27 @@ class VersionEdit {
     deleted_files_.insert(std::make_pair(level, file));
   }
 
+  // Add the specified value log file, of which "garbage" bytes are
+  // already unreferenced.
+  void AddValueLog(uint64_t file, uint64_t file_size, uint64_t garbage) {
+    ValueLogMetaData f;
+    f.number = file;
+    f.file_size = file_size;
+    f.garbage = garbage;
+    new_value_logs_.push_back(f);
+  }
+
+  // Delete the specified value log file.
+  void DeleteValueLog(uint64_t file) {
+    deleted_value_logs_.insert(file);
+  }
+
+  // Record that "bytes" more bytes of the specified value log file are
+  // no longer referenced by any table.
+  void AddValueLogGarbage(uint64_t file, uint64_t bytes) {
+    value_log_garbage_.push_back(std::make_pair(file, bytes));
+  }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
 
@@ -100,6 +137,9 @@ class VersionEdit {
   std::vector< std::pair<int, InternalKey> > compact_pointers_;
   DeletedFileSet deleted_files_;
   std::vector< std::pair<int, FileMetaData> > new_files_;
+  std::set<uint64_t> deleted_value_logs_;
+  std::vector<ValueLogMetaData> new_value_logs_;
+  std::vector< std::pair<uint64_t, uint64_t> > value_log_garbage_;
 };
 
 }  // namespace leveldb
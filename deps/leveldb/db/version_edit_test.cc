@@ -28,8 +28,15 @@ TEST(VersionEditTest, EncodeDecode) {
     edit.AddFile(3, kBig + 300 + i, kBig + 400 + i,
                  InternalKey("foo", kBig + 500 + i, kTypeValue),
                  InternalKey("zoo", kBig + 600 + i, kTypeDeletion));
+    edit.AddFile(6, kBig + 800 + i, kBig + 400 + i,
+                 InternalKey("bar", kBig + 1600 + i, kTypeValue),
+                 InternalKey("baz", kBig + 1600 + i, kTypeValue),
+                 kBig + 1600 + i);
     edit.DeleteFile(4, kBig + 700 + i);
     edit.SetCompactPointer(i, InternalKey("x", kBig + 900 + i, kTypeValue));
+    edit.AddValueLog(kBig + 1100 + i, kBig + 1200 + i, 1300 + i);
+    edit.DeleteValueLog(kBig + 1400 + i);
+    edit.AddValueLogGarbage(kBig + 1100 + i, 1500 + i);
   }
 
   edit.SetComparatorName("foo");
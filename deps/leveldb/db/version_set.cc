@@ -10,8 +10,12 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/merge_context.h"
 #include "db/table_cache.h"
+#include "db/value_log.h"
 #include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/table_builder.h"
 #include "table/merger.h"
 #include "table/two_level_iterator.h"
@@ -20,16 +24,16 @@
 
 namespace leveldb {
 
-static const int kTargetFileSize = 2 * 1048576;
-
 // Maximum bytes of overlaps in grandparent (i.e., level+2) before we
 // stop building a single file in a level->level+1 compaction.
-static const int64_t kMaxGrandParentOverlapBytes = 10 * kTargetFileSize;
+static const int64_t kMaxGrandParentOverlapBytes =
+    10 * config::kTargetFileSize;
 
 // Maximum number of bytes in all compacted files.  We avoid expanding
 // the lower level file set of a compaction if it would make the
 // total compaction cover more than this many bytes.
-static const int64_t kExpandedCompactionByteSizeLimit = 25 * kTargetFileSize;
+static const int64_t kExpandedCompactionByteSizeLimit =
+    25 * config::kTargetFileSize;
 
 static double MaxBytesForLevel(int level) {
   // Note: the result for level zero is not really used since we set
@@ -43,7 +47,8 @@ static double MaxBytesForLevel(int level) {
 }
 
 static uint64_t MaxFileSizeForLevel(int level) {
-  return kTargetFileSize;  // We could vary per level to reduce number of files?
+  // We could vary per level to reduce number of files?
+  return config::kTargetFileSize;
 }
 
 static int64_t TotalFileSize(const std::vector<FileMetaData*>& files) {
@@ -149,8 +154,8 @@ bool SomeFileOverlapsRange(
 // An internal iterator.  For a given version/level pair, yields
 // information about the files in the level.  For a given entry, key()
 // is the largest key that occurs in the file, and value() is an
-// 16-byte value containing the file number and file size, both
-// encoded using EncodeFixed64.
+// 24-byte value containing the file number, the file size and the
+// global sequence number of the file, all encoded using EncodeFixed64.
 class Version::LevelFileNumIterator : public Iterator {
  public:
   LevelFileNumIterator(const InternalKeyComparator& icmp,
@@ -189,6 +194,7 @@ class Version::LevelFileNumIterator : public Iterator {
     assert(Valid());
     EncodeFixed64(value_buf_, (*flist_)[index_]->number);
     EncodeFixed64(value_buf_+8, (*flist_)[index_]->file_size);
+    EncodeFixed64(value_buf_+16, (*flist_)[index_]->global_seqno);
     return Slice(value_buf_, sizeof(value_buf_));
   }
   virtual Status status() const { return Status::OK(); }
@@ -197,21 +203,39 @@ class Version::LevelFileNumIterator : public Iterator {
   const std::vector<FileMetaData*>* const flist_;
   uint32_t index_;
 
-  // Backing store for value().  Holds the file number and size.
-  mutable char value_buf_[16];
+  // Backing store for value().  Holds the file number, size and global
+  // sequence number.
+  mutable char value_buf_[24];
 };
 
 static Iterator* GetFileIterator(void* arg,
                                  const ReadOptions& options,
                                  const Slice& file_value) {
   TableCache* cache = reinterpret_cast<TableCache*>(arg);
-  if (file_value.size() != 16) {
+  if (file_value.size() != 24) {
     return NewErrorIterator(
         Status::Corruption("FileReader invoked with unexpected value"));
   } else {
     return cache->NewIterator(options,
                               DecodeFixed64(file_value.data()),
-                              DecodeFixed64(file_value.data() + 8));
+                              DecodeFixed64(file_value.data() + 8),
+                              NULL, -1,
+                              DecodeFixed64(file_value.data() + 16));
+  }
+}
+
+static Iterator* GetCompactionFileIterator(void* arg,
+                                           const ReadOptions& options,
+                                           const Slice& file_value) {
+  TableCache* cache = reinterpret_cast<TableCache*>(arg);
+  if (file_value.size() != 24) {
+    return NewErrorIterator(
+        Status::Corruption("FileReader invoked with unexpected value"));
+  } else {
+    return cache->NewCompactionIterator(options,
+                                        DecodeFixed64(file_value.data()),
+                                        DecodeFixed64(file_value.data() + 8),
+                                        DecodeFixed64(file_value.data() + 16));
   }
 }
 
@@ -219,25 +243,59 @@ Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
   return NewTwoLevelIterator(
       new LevelFileNumIterator(vset_->icmp_, &files_[level]),
-      &GetFileIterator, vset_->table_cache_, options);
+      &GetFileIterator, vset_->table_cache_, options, &vset_->icmp_);
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
+  // When the read is restricted to a prefix the filters cover, leave out
+  // the files that cannot hold any key with that prefix.
+  const FilterPolicy* policy = vset_->options_->filter_policy;
+  const bool check_prefix = (options.prefix != NULL && policy != NULL &&
+                             policy->CoversPrefix(*options.prefix));
+  InternalKey prefix_key;
+  if (check_prefix) {
+    prefix_key = InternalKey(*options.prefix, kMaxSequenceNumber,
+                             kValueTypeForSeek);
+  }
+
   // Merge all level zero files together since they may overlap
   for (size_t i = 0; i < files_[0].size(); i++) {
+    FileMetaData* f = files_[0][i];
+    if (check_prefix &&
+        !vset_->table_cache_->PrefixMayMatch(options, f->number, f->file_size,
+                                             0, prefix_key.Encode())) {
+      continue;
+    }
     iters->push_back(
         vset_->table_cache_->NewIterator(
-            options, files_[0][i]->number, files_[0][i]->file_size));
+            options, f->number, f->file_size, NULL, 0, f->global_seqno));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
   // walks through the non-overlapping files in the level, opening them
   // lazily.
   for (int level = 1; level < config::kNumLevels; level++) {
-    if (!files_[level].empty()) {
-      iters->push_back(NewConcatenatingIterator(options, level));
+    if (files_[level].empty()) {
+      continue;
+    }
+    if (check_prefix) {
+      // Only the first file that may contain the prefix needs checking:
+      // if it holds no key with the prefix, its largest key sorts after
+      // all such keys and so do the keys of every later file.
+      uint32_t index = FindFile(vset_->icmp_, files_[level],
+                                prefix_key.Encode());
+      if (index >= files_[level].size()) {
+        continue;
+      }
+      FileMetaData* f = files_[level][index];
+      if (!vset_->table_cache_->PrefixMayMatch(options, f->number,
+                                               f->file_size, level,
+                                               prefix_key.Encode())) {
+        continue;
+      }
     }
+    iters->push_back(NewConcatenatingIterator(options, level));
   }
 }
 
@@ -248,12 +306,17 @@ enum SaverState {
   kFound,
   kDeleted,
   kCorrupt,
+  kMerge,
 };
 struct Saver {
   SaverState state;
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  PinnableSlice* pinned;  // Used instead of "value" if non-NULL
+  bool value_index;       // The value found is a value log pointer
+  MergeContext* merge;    // Receives merge operands if non-NULL
+  SequenceNumber seq;     // Sequence number of the entry found
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -263,9 +326,22 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
-      s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
+      s->seq = parsed_key.sequence;
+      if (parsed_key.type == kTypeMerge) {
+        s->state = kMerge;
+        if (s->merge != NULL) {
+          s->merge->AddOperand(v);
+        }
+        return;
+      }
+      s->state = (parsed_key.type == kTypeDeletion) ? kDeleted : kFound;
+      s->value_index = (parsed_key.type == kTypeValueIndex);
       if (s->state == kFound) {
-        s->value->assign(v.data(), v.size());
+        if (s->pinned != NULL) {
+          s->pinned->PinSlice(v);
+        } else {
+          s->value->assign(v.data(), v.size());
+        }
       }
     }
   }
@@ -323,7 +399,45 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
 Status Version::Get(const ReadOptions& options,
                     const LookupKey& k,
                     std::string* value,
+                    MergeContext* merge,
                     GetStats* stats) {
+  return GetValue(options, k, value, NULL, NULL, true, merge, stats);
+}
+
+Status Version::Get(const ReadOptions& options,
+                    const LookupKey& k,
+                    PinnableSlice* value,
+                    MergeContext* merge,
+                    GetStats* stats) {
+  return GetValue(options, k, NULL, value, NULL, true, merge, stats);
+}
+
+Status Version::GetIndex(const ReadOptions& options,
+                         const LookupKey& k,
+                         std::string* value,
+                         bool* is_index,
+                         MergeContext* merge,
+                         GetStats* stats) {
+  return GetValue(options, k, value, NULL, is_index, true, merge, stats);
+}
+
+Status Version::GetUnmerged(const ReadOptions& options,
+                            const LookupKey& k,
+                            PinnableSlice* value,
+                            bool* is_index,
+                            MergeContext* merge,
+                            GetStats* stats) {
+  return GetValue(options, k, NULL, value, is_index, false, merge, stats);
+}
+
+Status Version::GetValue(const ReadOptions& options,
+                         const LookupKey& k,
+                         std::string* value,
+                         PinnableSlice* pinned,
+                         bool* is_index,
+                         bool apply_merge,
+                         MergeContext* merge,
+                         GetStats* stats) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
@@ -331,15 +445,22 @@ Status Version::Get(const ReadOptions& options,
 
   stats->seek_file = NULL;
   stats->seek_file_level = -1;
+  if (is_index != NULL) {
+    *is_index = false;
+  }
   FileMetaData* last_file_read = NULL;
   int last_file_read_level = -1;
 
+  // After a merge operand is found, the search goes on for the older
+  // entries of the key from just below the operand.
+  std::string merge_key;
+  bool exhausted = false;
+
   // We can search level-by-level since entries never hop across
   // levels.  Therefore we are guaranteed that if we find data
   // in an smaller level, later levels are irrelevant.
   std::vector<FileMetaData*> tmp;
-  FileMetaData* tmp2;
-  for (int level = 0; level < config::kNumLevels; level++) {
+  for (int level = 0; level < config::kNumLevels && !exhausted; level++) {
     size_t num_files = files_[level].size();
     if (num_files == 0) continue;
 
@@ -348,6 +469,7 @@ Status Version::Get(const ReadOptions& options,
     if (level == 0) {
       // Level-0 files may overlap each other.  Find all files that
       // overlap user_key and process them in order from newest to oldest.
+      tmp.clear();
       tmp.reserve(num_files);
       for (uint32_t i = 0; i < num_files; i++) {
         FileMetaData* f = files[i];
@@ -363,50 +485,102 @@ Status Version::Get(const ReadOptions& options,
       num_files = tmp.size();
     } else {
       // Binary search to find earliest index whose largest key >= ikey.
+      // The older entries of a key may continue in the following files.
       uint32_t index = FindFile(vset_->icmp_, files_[level], ikey);
-      if (index >= num_files) {
-        files = NULL;
-        num_files = 0;
-      } else {
-        tmp2 = files[index];
-        if (ucmp->Compare(user_key, tmp2->smallest.user_key()) < 0) {
-          // All of "tmp2" is past any data for user_key
-          files = NULL;
-          num_files = 0;
-        } else {
-          files = &tmp2;
-          num_files = 1;
-        }
-      }
+      files += index;
+      num_files -= index;
     }
 
-    for (uint32_t i = 0; i < num_files; ++i) {
+    for (uint32_t i = 0; i < num_files && !exhausted; ++i) {
+      FileMetaData* f = files[i];
+      if (level > 0 && ucmp->Compare(user_key, f->smallest.user_key()) < 0) {
+        // All of "f" is past any data for user_key
+        break;
+      }
       if (last_file_read != NULL && stats->seek_file == NULL) {
         // We have had more than one seek for this read.  Charge the 1st file.
         stats->seek_file = last_file_read;
         stats->seek_file_level = last_file_read_level;
       }
-
-      FileMetaData* f = files[i];
       last_file_read = f;
       last_file_read_level = level;
 
       Saver saver;
-      saver.state = kNotFound;
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
-      s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+      saver.pinned = pinned;
+      saver.merge = merge;
+      do {
+        saver.state = kNotFound;
+        saver.value_index = false;
+        s = vset_->table_cache_->Get(options, f->number, f->file_size, level,
+                                     f->global_seqno, ikey, &saver, SaveValue,
+                                     pinned);
+        if (s.ok() && saver.state == kMerge) {
+          if (saver.seq == 0) {
+            exhausted = true;  // No older entries can exist
+          } else {
+            merge_key.clear();
+            AppendInternalKey(&merge_key, ParsedInternalKey(
+                user_key, saver.seq - 1, kValueTypeForSeek));
+            ikey = merge_key;
+          }
+        }
+      } while (s.ok() && saver.state == kMerge && !exhausted);
+      if (pinned != NULL && saver.state != kFound) {
+        // Drop the block holding a non-matching entry
+        pinned->Reset();
+      }
       if (!s.ok()) {
         return s;
       }
       switch (saver.state) {
         case kNotFound:
+        case kMerge:
           break;      // Keep searching in other files
         case kFound:
+          if (saver.value_index && is_index != NULL) {
+            *is_index = true;
+          } else if (!apply_merge) {
+            // Leave the operands to the caller
+          } else if (!merge->empty()) {
+            std::string base;
+            if (pinned != NULL) {
+              base.assign(pinned->data(), pinned->size());
+              pinned->Reset();
+            } else {
+              base.swap(*value);
+            }
+            if (saver.value_index) {
+              std::string pointer;
+              pointer.swap(base);
+              s = vset_->value_log_->Get(options, pointer, &base);
+            }
+            if (s.ok()) {
+              const Slice b(base);
+              s = merge->Finish(&b, pinned != NULL ? pinned->GetSelf() : value);
+              if (s.ok() && pinned != NULL) {
+                pinned->PinSelf();
+              }
+            }
+          } else if (!saver.value_index) {
+            // Done
+          } else if (pinned != NULL) {
+            const std::string pointer(pinned->data(), pinned->size());
+            pinned->Reset();
+            s = vset_->value_log_->Get(options, pointer, pinned);
+          } else {
+            std::string pointer;
+            pointer.swap(*value);
+            s = vset_->value_log_->Get(options, pointer, value);
+          }
           return s;
         case kDeleted:
+          if (apply_merge && !merge->empty()) {
+            exhausted = true;  // Apply the operands to no value
+            break;
+          }
           s = Status::NotFound(Slice());  // Use empty error message for speed
           return s;
         case kCorrupt:
@@ -416,9 +590,272 @@ Status Version::Get(const ReadOptions& options,
     }
   }
 
+  if (apply_merge && !merge->empty()) {
+    s = merge->Finish(NULL, pinned != NULL ? pinned->GetSelf() : value);
+    if (s.ok() && pinned != NULL) {
+      pinned->PinSelf();
+    }
+    return s;
+  }
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+namespace {
+// Search state shared by the lookups of one Version::MultiGet() call
+struct MultiGetState {
+  const LookupKey* const* keys;
+  Status* const* statuses;
+  Version::GetStats* stats;
+  std::vector<Saver> savers;
+  std::vector<FileMetaData*> last_file_read;
+  std::vector<int> last_file_read_level;
+  std::vector<bool> done;
+  std::vector<bool> merge;  // Merge operands were found for the key
+};
+}
+
+// Look up the lookups listed in "batch" (in key order) in file "f".
+static void MultiGetFromFile(TableCache* table_cache,
+                             ValueLog* value_log,
+                             const ReadOptions& options,
+                             FileMetaData* f, int level,
+                             const std::vector<int>& batch,
+                             MultiGetState* state) {
+  if (batch.empty()) {
+    return;
+  }
+  const int n = batch.size();
+  std::vector<Slice> ikeys(n);
+  std::vector<void*> args(n);
+  std::vector<Status> statuses(n);
+  for (int b = 0; b < n; b++) {
+    const int i = batch[b];
+    Version::GetStats* stats = &state->stats[i];
+    if (state->last_file_read[i] != NULL && stats->seek_file == NULL) {
+      // We have had more than one seek for this read.  Charge the 1st file.
+      stats->seek_file = state->last_file_read[i];
+      stats->seek_file_level = state->last_file_read_level[i];
+    }
+    state->last_file_read[i] = f;
+    state->last_file_read_level[i] = level;
+    ikeys[b] = state->keys[i]->internal_key();
+    args[b] = &state->savers[i];
+  }
+
+  table_cache->MultiGet(options, f->number, f->file_size, level,
+                        f->global_seqno, n, &ikeys[0], &args[0],
+                        &statuses[0], SaveValue);
+
+  for (int b = 0; b < n; b++) {
+    const int i = batch[b];
+    const Saver& saver = state->savers[i];
+    Status* s = state->statuses[i];
+    if (!statuses[b].ok()) {
+      *s = statuses[b];
+    } else {
+      switch (saver.state) {
+        case kNotFound:
+          continue;   // Keep searching in other files
+        case kFound:
+          if (saver.value_index) {
+            std::string pointer;
+            pointer.swap(*saver.value);
+            *s = value_log->Get(options, pointer, saver.value);
+          } else {
+            *s = Status::OK();
+          }
+          break;
+        case kDeleted:
+          *s = Status::NotFound(Slice());  // Use empty error message for speed
+          break;
+        case kCorrupt:
+          *s = Status::Corruption("corrupted key for ", saver.user_key);
+          break;
+        case kMerge:
+          state->merge[i] = true;
+          break;
+      }
+    }
+    state->done[i] = true;
+  }
+}
+
+void Version::PrefetchBatches(const ReadOptions& options, int level,
+                              const std::vector<FileMetaData*>& files,
+                              const std::vector<std::vector<int> >& batches,
+                              const LookupKey* const* keys) {
+  // Level-0 files are left out: most lookups end in the newest of them,
+  // so reading ahead in the older ones would mostly be wasted.
+  std::vector<std::vector<Slice> > ikeys(batches.size());
+  std::vector<TableCache::BlockLookup> lookups(batches.size());
+  for (size_t b = 0; b < batches.size(); b++) {
+    for (size_t i = 0; i < batches[b].size(); i++) {
+      ikeys[b].push_back(keys[batches[b][i]]->internal_key());
+    }
+    lookups[b].file_number = files[b]->number;
+    lookups[b].file_size = files[b]->file_size;
+    lookups[b].level = level;
+    lookups[b].keys = &ikeys[b][0];
+    lookups[b].n = ikeys[b].size();
+  }
+  vset_->table_cache_->PrefetchBlocks(options, lookups, true);
+}
+
+void Version::PrefetchSeekBlocks(const ReadOptions& options,
+                                 const Slice& ikey) {
+  std::vector<TableCache::BlockLookup> lookups;
+  TableCache::BlockLookup lookup;
+  lookup.keys = &ikey;
+  lookup.n = 1;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    const std::vector<FileMetaData*>& files = files_[level];
+    lookup.level = level;
+    if (level == 0) {
+      for (size_t i = 0; i < files.size(); i++) {
+        if (vset_->icmp_.Compare(ikey, files[i]->largest.Encode()) <= 0) {
+          lookup.file_number = files[i]->number;
+          lookup.file_size = files[i]->file_size;
+          lookups.push_back(lookup);
+        }
+      }
+    } else {
+      // A concatenating iterator only seeks in the file the key is in
+      uint32_t index = FindFile(vset_->icmp_, files, ikey);
+      if (index < files.size()) {
+        lookup.file_number = files[index]->number;
+        lookup.file_size = files[index]->file_size;
+        lookups.push_back(lookup);
+      }
+    }
+  }
+  vset_->table_cache_->PrefetchBlocks(options, lookups, false);
+}
+
+void Version::MultiGet(const ReadOptions& options, int n,
+                       const LookupKey* const* keys,
+                       std::string* const* values,
+                       Status* const* statuses,
+                       GetStats* stats) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+
+  MultiGetState state;
+  state.keys = keys;
+  state.statuses = statuses;
+  state.stats = stats;
+  state.savers.resize(n);
+  state.last_file_read.resize(n, NULL);
+  state.last_file_read_level.resize(n, -1);
+  state.done.resize(n, false);
+  state.merge.resize(n, false);
+
+  // Lookups that are still searching, in key order
+  std::vector<int> pending;
+  for (int i = 0; i < n; i++) {
+    stats[i].seek_file = NULL;
+    stats[i].seek_file_level = -1;
+    Saver* saver = &state.savers[i];
+    saver->state = kNotFound;
+    saver->ucmp = ucmp;
+    saver->user_key = keys[i]->user_key();
+    saver->value = values[i];
+    saver->pinned = NULL;
+    saver->value_index = false;
+    saver->merge = NULL;
+    pending.push_back(i);
+  }
+
+  // As in Get(), levels are searched in order and a lookup stops at the
+  // first level that has an entry for its key.
+  std::vector<FileMetaData*> tmp;
+  std::vector<int> batch;
+  for (int level = 0; level < config::kNumLevels && !pending.empty();
+       level++) {
+    const size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+
+    if (level == 0) {
+      // Level-0 files may overlap each other.  Visit them from newest to
+      // oldest, each with the lookups that fall in its range.
+      tmp = files_[0];
+      std::sort(tmp.begin(), tmp.end(), NewestFirst);
+      for (size_t f = 0; f < tmp.size(); f++) {
+        batch.clear();
+        for (size_t p = 0; p < pending.size(); p++) {
+          const int i = pending[p];
+          const Slice user_key = keys[i]->user_key();
+          if (!state.done[i] &&
+              ucmp->Compare(user_key, tmp[f]->smallest.user_key()) >= 0 &&
+              ucmp->Compare(user_key, tmp[f]->largest.user_key()) <= 0) {
+            batch.push_back(i);
+          }
+        }
+        MultiGetFromFile(vset_->table_cache_, vset_->value_log_, options,
+                         tmp[f], 0, batch, &state);
+      }
+    } else {
+      // Files do not overlap, so walking the sorted lookups visits each
+      // file at most once.
+      std::vector<FileMetaData*> batch_files;
+      std::vector<std::vector<int> > batches;
+      size_t p = 0;
+      while (p < pending.size()) {
+        // Binary search to find earliest index whose largest key >= ikey.
+        uint32_t index = FindFile(vset_->icmp_, files_[level],
+                                  keys[pending[p]]->internal_key());
+        if (index >= num_files) {
+          break;  // This and all later lookups are past the level
+        }
+        FileMetaData* f = files_[level][index];
+        batch.clear();
+        for (; p < pending.size(); p++) {
+          const int i = pending[p];
+          if (vset_->icmp_.Compare(keys[i]->internal_key(),
+                                   f->largest.Encode()) > 0) {
+            break;
+          }
+          if (ucmp->Compare(keys[i]->user_key(),
+                            f->smallest.user_key()) >= 0) {
+            batch.push_back(i);
+          }
+        }
+        if (!batch.empty()) {
+          batch_files.push_back(f);
+          batches.push_back(batch);
+        }
+      }
+      if (options.batch_block_reads && options.fill_cache) {
+        PrefetchBatches(options, level, batch_files, batches, keys);
+      }
+      for (size_t b = 0; b < batches.size(); b++) {
+        MultiGetFromFile(vset_->table_cache_, vset_->value_log_, options,
+                         batch_files[b], level, batches[b], &state);
+      }
+    }
+
+    // Drop the lookups that are finished
+    size_t remaining = 0;
+    for (size_t p = 0; p < pending.size(); p++) {
+      if (!state.done[pending[p]]) {
+        pending[remaining++] = pending[p];
+      }
+    }
+    pending.resize(remaining);
+  }
+
+  for (size_t p = 0; p < pending.size(); p++) {
+    *statuses[pending[p]] = Status::NotFound(Slice());
+  }
+
+  // Start over for the keys that need their operands collected
+  for (int i = 0; i < n; i++) {
+    if (state.merge[i]) {
+      MergeContext merge(vset_->options_->merge_operator, keys[i]->user_key());
+      *statuses[i] = GetValue(options, *keys[i], values[i], NULL, NULL, true,
+                              &merge, &stats[i]);
+    }
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != NULL) {
@@ -585,9 +1022,45 @@ std::string Version::DebugString() const {
       r.append("]\n");
     }
   }
+  if (!value_logs_.empty()) {
+    // E.g.,
+    //   --- value logs ---
+    //   21:1048576 (garbage 4096)
+    r.append("--- value logs ---\n");
+    for (std::map<uint64_t, ValueLogMetaData>::const_iterator it =
+             value_logs_.begin();
+         it != value_logs_.end(); ++it) {
+      r.push_back(' ');
+      AppendNumberTo(&r, it->first);
+      r.push_back(':');
+      AppendNumberTo(&r, it->second.file_size);
+      r.append(" (garbage ");
+      AppendNumberTo(&r, it->second.garbage);
+      r.append(")\n");
+    }
+  }
   return r;
 }
 
+bool Version::PickValueLogToCollect(double ratio,
+                                    const std::set<uint64_t>& exclude,
+                                    ValueLogMetaData* f) const {
+  double best = 0;
+  bool found = false;
+  for (std::map<uint64_t, ValueLogMetaData>::const_iterator it =
+           value_logs_.begin();
+       it != value_logs_.end(); ++it) {
+    const ValueLogMetaData& v = it->second;
+    const double r = static_cast<double>(v.garbage) / v.file_size;
+    if (r >= ratio && (!found || r > best) && exclude.count(v.number) == 0) {
+      best = r;
+      *f = v;
+      found = true;
+    }
+  }
+  return found;
+}
+
 // A helper class so we can efficiently apply a whole sequence
 // of edits to a particular state without creating intermediate
 // Versions that contain full copies of the intermediate state.
@@ -617,12 +1090,14 @@ class VersionSet::Builder {
   VersionSet* vset_;
   Version* base_;
   LevelState levels_[config::kNumLevels];
+  std::map<uint64_t, ValueLogMetaData> value_logs_;
 
  public:
   // Initialize a builder with the files from *base and other info from *vset
   Builder(VersionSet* vset, Version* base)
       : vset_(vset),
-        base_(base) {
+        base_(base),
+        value_logs_(base->value_logs_) {
     base_->Ref();
     BySmallestKey cmp;
     cmp.internal_comparator = &vset_->icmp_;
@@ -696,10 +1171,36 @@ class VersionSet::Builder {
       levels_[level].deleted_files.erase(f->number);
       levels_[level].added_files->insert(f);
     }
+
+    // Apply value log changes
+    for (std::set<uint64_t>::const_iterator iter =
+             edit->deleted_value_logs_.begin();
+         iter != edit->deleted_value_logs_.end();
+         ++iter) {
+      value_logs_.erase(*iter);
+    }
+    for (size_t i = 0; i < edit->new_value_logs_.size(); i++) {
+      const ValueLogMetaData& f = edit->new_value_logs_[i];
+      value_logs_[f.number] = f;
+    }
+    for (size_t i = 0; i < edit->value_log_garbage_.size(); i++) {
+      std::map<uint64_t, ValueLogMetaData>::iterator it =
+          value_logs_.find(edit->value_log_garbage_[i].first);
+      if (it == value_logs_.end()) {
+        // Already deleted by the garbage collector
+        continue;
+      }
+      it->second.garbage += edit->value_log_garbage_[i].second;
+      if (it->second.garbage >= it->second.file_size) {
+        // No table refers to the file anymore
+        value_logs_.erase(it);
+      }
+    }
   }
 
   // Save the current state in *v.
   void SaveTo(Version* v) {
+    v->value_logs_ = value_logs_;
     BySmallestKey cmp;
     cmp.internal_comparator = &vset_->icmp_;
     for (int level = 0; level < config::kNumLevels; level++) {
@@ -766,11 +1267,13 @@ class VersionSet::Builder {
 VersionSet::VersionSet(const std::string& dbname,
                        const Options* options,
                        TableCache* table_cache,
+                       ValueLog* value_log,
                        const InternalKeyComparator* cmp)
     : env_(options->env),
       dbname_(dbname),
       options_(options),
       table_cache_(table_cache),
+      value_log_(value_log),
       icmp_(*cmp),
       next_file_number_(2),
       manifest_file_number_(0),  // Filled by Recover()
@@ -821,7 +1324,11 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
-  edit->SetLastSequence(last_sequence_);
+  // An ingestion records the sequence number of its files before it
+  // makes them visible by raising last_sequence_.
+  if (!edit->has_last_sequence_ || edit->last_sequence_ < last_sequence_) {
+    edit->SetLastSequence(last_sequence_);
+  }
 
   Version* v = new Version(this);
   {
@@ -932,7 +1439,8 @@ Status VersionSet::Recover() {
   {
     LogReporter reporter;
     reporter.status = &s;
-    log::Reader reader(file, &reporter, true/*checksum*/, 0/*initial_offset*/);
+    log::Reader reader(file, &reporter, true/*checksum*/, 0/*initial_offset*/,
+                       0/*log_number*/);
     Slice record;
     std::string scratch;
     while (reader.ReadRecord(&record, &scratch) && s.ok()) {
@@ -1034,7 +1542,7 @@ void VersionSet::Finalize(Version* v) {
       // setting, or very high compression ratios, or lots of
       // overwrites/deletions).
       score = v->files_[level].size() /
-          static_cast<double>(config::kL0_CompactionTrigger);
+          static_cast<double>(options_->level0_file_num_compaction_trigger);
     } else {
       // Compute the ratio of current size to size limit.
       const uint64_t level_bytes = TotalFileSize(v->files_[level]);
@@ -1049,6 +1557,30 @@ void VersionSet::Finalize(Version* v) {
 
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
+
+  // Follow the bytes that overflow each level down the tree.  Level-0
+  // files usually overlap all of level 1, and merging bytes from a level
+  // into the next rewrites about as many bytes of the next level as its
+  // size is a multiple of the size of this one.
+  uint64_t pending = 0;
+  double incoming = 0;
+  if (v->files_[0].size() >=
+      static_cast<size_t>(options_->level0_file_num_compaction_trigger)) {
+    incoming = TotalFileSize(v->files_[0]);
+    pending += TotalFileSize(v->files_[0]) + TotalFileSize(v->files_[1]);
+  }
+  for (int level = 1; level < config::kNumLevels - 1; level++) {
+    const double level_bytes = TotalFileSize(v->files_[level]) + incoming;
+    const double excess = level_bytes - MaxBytesForLevel(level);
+    if (excess <= 0) {
+      incoming = 0;
+      continue;
+    }
+    const double next_bytes = TotalFileSize(v->files_[level + 1]);
+    pending += static_cast<uint64_t>(excess * (1 + next_bytes / level_bytes));
+    incoming = excess;
+  }
+  v->pending_compaction_bytes_ = pending;
 }
 
 Status VersionSet::WriteSnapshot(log::Writer* log) {
@@ -1072,10 +1604,19 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest,
+                   f->global_seqno);
     }
   }
 
+  // Save value log files
+  for (std::map<uint64_t, ValueLogMetaData>::const_iterator it =
+           current_->value_logs_.begin();
+       it != current_->value_logs_.end(); ++it) {
+    const ValueLogMetaData& f = it->second;
+    edit.AddValueLog(f.number, f.file_size, f.garbage);
+  }
+
   std::string record;
   edit.EncodeTo(&record);
   return log->AddRecord(record);
@@ -1144,6 +1685,11 @@ void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
         live->insert(files[i]->number);
       }
     }
+    for (std::map<uint64_t, ValueLogMetaData>::const_iterator it =
+             v->value_logs_.begin();
+         it != v->value_logs_.end(); ++it) {
+      live->insert(it->first);
+    }
   }
 }
 
@@ -1223,14 +1769,15 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
       if (c->level() + which == 0) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
-          list[num++] = table_cache_->NewIterator(
-              options, files[i]->number, files[i]->file_size);
+          list[num++] = table_cache_->NewCompactionIterator(
+              options, files[i]->number, files[i]->file_size,
+              files[i]->global_seqno);
         }
       } else {
         // Create concatenating iterator for the files from this level
         list[num++] = NewTwoLevelIterator(
             new Version::LevelFileNumIterator(icmp_, &c->inputs_[which]),
-            &GetFileIterator, table_cache_, options);
+            &GetCompactionFileIterator, table_cache_, options);
       }
     }
   }
@@ -1396,16 +1943,19 @@ Compaction* VersionSet::CompactRange(
   return c;
 }
 
+CompactionCursor::CompactionCursor()
+    : grandparent_index(0),
+      seen_key(false),
+      overlapped_bytes(0) {
+  for (int i = 0; i < config::kNumLevels; i++) {
+    level_ptrs[i] = 0;
+  }
+}
+
 Compaction::Compaction(int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(level)),
-      input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
-  for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
-  }
+      input_version_(NULL) {
 }
 
 Compaction::~Compaction() {
@@ -1431,13 +1981,14 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key,
+                                   CompactionCursor* cursor) {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
   for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; cursor->level_ptrs[lvl] < files.size(); ) {
+      FileMetaData* f = files[cursor->level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1446,34 +1997,82 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      cursor->level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key,
+                                  CompactionCursor* cursor) {
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &input_version_->vset_->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
+  while (cursor->grandparent_index < grandparents_.size() &&
       icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+                    grandparents_[cursor->grandparent_index]->largest.Encode())
+      > 0) {
+    if (cursor->seen_key) {
+      cursor->overlapped_bytes +=
+          grandparents_[cursor->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    cursor->grandparent_index++;
   }
-  seen_key_ = true;
+  cursor->seen_key = true;
 
-  if (overlapped_bytes_ > kMaxGrandParentOverlapBytes) {
+  if (cursor->overlapped_bytes > kMaxGrandParentOverlapBytes) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    cursor->overlapped_bytes = 0;
     return true;
   } else {
     return false;
   }
 }
 
+namespace {
+struct UserKeyLess {
+  const Comparator* cmp;
+  explicit UserKeyLess(const Comparator* c) : cmp(c) { }
+  bool operator()(const std::string& a, const std::string& b) const {
+    return cmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+void Compaction::GetSplitPoints(int n,
+                                std::vector<std::string>* boundaries) const {
+  boundaries->clear();
+  if (n <= 1) {
+    return;
+  }
+
+  // Candidate split points are the largest keys of the input files
+  const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
+  std::vector<std::string> keys;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      keys.push_back(inputs_[which][i]->largest.user_key().ToString());
+    }
+  }
+  std::sort(keys.begin(), keys.end(), UserKeyLess(user_cmp));
+  std::vector<std::string> unique;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (unique.empty() || user_cmp->Compare(unique.back(), keys[i]) != 0) {
+      unique.push_back(keys[i]);
+    }
+  }
+  if (unique.size() <= 1) {
+    return;
+  }
+  // Nothing follows the largest key, so it is never a useful split point
+  unique.pop_back();
+
+  // Pick evenly spaced split points among the candidates
+  const size_t ranges = std::min(static_cast<size_t>(n), unique.size() + 1);
+  for (size_t i = 1; i < ranges; i++) {
+    boundaries->push_back(unique[i * unique.size() / ranges]);
+  }
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != NULL) {
     input_version_->Unref();
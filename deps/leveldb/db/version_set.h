@@ -30,8 +30,11 @@ namespace log { class Writer; }
 class Compaction;
 class Iterator;
 class MemTable;
+class MergeContext;
+class PinnableSlice;
 class TableBuilder;
 class TableCache;
+class ValueLog;
 class Version;
 class VersionSet;
 class WritableFile;
@@ -64,14 +67,55 @@ class Version {
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
   // Lookup the value for key.  If found, store it in *val and
-  // return OK.  Else return a non-OK status.  Fills *stats.
+  // return OK.  Else return a non-OK status.  Fills *stats.  Values
+  // kept in a value log are read from it.  Merge operands found for key
+  // are added to *merge and applied to the value they were written on.
   // REQUIRES: lock is not held
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
   };
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
-             GetStats* stats);
+             MergeContext* merge, GetStats* stats);
+
+  // Like Get(), but points *val at the value in the table's data block,
+  // which *val keeps pinned, instead of copying it.
+  // REQUIRES: lock is not held
+  Status Get(const ReadOptions&, const LookupKey& key, PinnableSlice* val,
+             MergeContext* merge, GetStats* stats);
+
+  // Like Get(), but does not read values kept in a value log: sets
+  // *is_index to whether the entry found is a value log pointer, in
+  // which case *val holds the encoded ValuePointer and the operands in
+  // *merge are left for the caller to apply.
+  // REQUIRES: lock is not held
+  Status GetIndex(const ReadOptions&, const LookupKey& key, std::string* val,
+                  bool* is_index, MergeContext* merge, GetStats* stats);
+
+  // Like Get(), but applies none of the merge operands, which are left
+  // in *merge, and does not read values kept in a value log.  Returns OK
+  // if the operands were written on top of a value, which *val holds as
+  // it is stored (an encoded ValuePointer if *is_index is set), and
+  // NotFound if they were written on a deletion or on nothing.
+  // REQUIRES: lock is not held
+  Status GetUnmerged(const ReadOptions&, const LookupKey& key,
+                     PinnableSlice* val, bool* is_index, MergeContext* merge,
+                     GetStats* stats);
+
+  // Like Get() for each of keys[0,n-1], which must be sorted by user key,
+  // storing the results in *values[i], *statuses[i] and stats[i].  Each
+  // level is walked once for the whole batch and lookups that fall in
+  // the same file are handed to the table cache together.  Keys that
+  // have merge operands in the tables are looked up one at a time.
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, int n, const LookupKey* const* keys,
+                std::string* const* values, Status* const* statuses,
+                GetStats* stats);
+
+  // Read the blocks a Seek() to "internal_key" in each file will land
+  // in into the block cache with a single Env::MultiRead() call.
+  // REQUIRES: lock is not held
+  void PrefetchSeekBlocks(const ReadOptions&, const Slice& internal_key);
 
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
@@ -110,6 +154,17 @@ class Version {
 
   int NumFiles(int level) const { return files_[level].size(); }
 
+  // Return the value log files of this version, by file number.
+  const std::map<uint64_t, ValueLogMetaData>& value_logs() const {
+    return value_logs_;
+  }
+
+  // Store in *f the value log file with the largest fraction of
+  // unreferenced bytes and return true, if that fraction is at least
+  // "ratio".  Files in "exclude" are not considered.
+  bool PickValueLogToCollect(double ratio, const std::set<uint64_t>& exclude,
+                             ValueLogMetaData* f) const;
+
   // Return a human readable string that describes this version's contents.
   std::string DebugString() const;
 
@@ -120,6 +175,22 @@ class Version {
   class LevelFileNumIterator;
   Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
 
+  // Shared implementation of the Get() variants: exactly one of "value"
+  // and "pinned" is non-NULL.  Value log pointers are returned as they
+  // are iff "is_index" is non-NULL.  Merge operands are applied iff
+  // "apply_merge" is true.
+  Status GetValue(const ReadOptions&, const LookupKey& key,
+                  std::string* value, PinnableSlice* pinned,
+                  bool* is_index, bool apply_merge, MergeContext* merge,
+                  GetStats* stats);
+
+  // Read the blocks the lookups in batches[b] need from files[b] of
+  // "level" into the block cache with a single Env::MultiRead() call.
+  void PrefetchBatches(const ReadOptions&, int level,
+                       const std::vector<FileMetaData*>& files,
+                       const std::vector<std::vector<int> >& batches,
+                       const LookupKey* const* keys);
+
   // Call func(arg, level, f) for every file that overlaps user_key in
   // order from newest to oldest.  If an invocation of func returns
   // false, makes no more calls.
@@ -137,6 +208,9 @@ class Version {
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
+  // Value log files that tables of this version may refer to
+  std::map<uint64_t, ValueLogMetaData> value_logs_;
+
   // Next file to compact based on seek stats.
   FileMetaData* file_to_compact_;
   int file_to_compact_level_;
@@ -147,12 +221,17 @@ class Version {
   double compaction_score_;
   int compaction_level_;
 
+  // Estimate of the bytes compactions have to write to bring all levels
+  // within their limits.  Initialized by Finalize().
+  uint64_t pending_compaction_bytes_;
+
   explicit Version(VersionSet* vset)
       : vset_(vset), next_(this), prev_(this), refs_(0),
         file_to_compact_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1) {
+        compaction_level_(-1),
+        pending_compaction_bytes_(0) {
   }
 
   ~Version();
@@ -167,6 +246,7 @@ class VersionSet {
   VersionSet(const std::string& dbname,
              const Options* options,
              TableCache* table_cache,
+             ValueLog* value_log,
              const InternalKeyComparator*);
   ~VersionSet();
 
@@ -205,6 +285,12 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
+  // Return an estimate of the bytes that compactions have to write
+  // before every level of the current version is within its limit.
+  uint64_t PendingCompactionBytes() const {
+    return current_->pending_compaction_bytes_;
+  }
+
   // Return the last sequence number.
   uint64_t LastSequence() const { return last_sequence_; }
 
@@ -253,7 +339,8 @@ class VersionSet {
     return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL);
   }
 
-  // Add all files listed in any live version to *live.
+  // Add all table and value log files listed in any live version to
+  // *live.
   // May also mutate some internal state.
   void AddLiveFiles(std::set<uint64_t>* live);
 
@@ -296,6 +383,7 @@ class VersionSet {
   const std::string dbname_;
   const Options* const options_;
   TableCache* const table_cache_;
+  ValueLog* const value_log_;
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
@@ -319,6 +407,29 @@ class VersionSet {
 };
 
 // A Compaction encapsulates information about a compaction.
+// Compaction::IsBaseLevelForKey() and Compaction::ShouldStopBefore()
+// keep state that assumes they are called with increasing keys.  Each
+// thread that works on a disjoint key range of the same compaction
+// needs its own cursor.
+struct CompactionCursor {
+  // State used to check for number of of overlapping grandparent files
+  // (parent == level_ + 1, grandparent == level_ + 2)
+  size_t grandparent_index;  // Index in grandparent_starts_
+  bool seen_key;             // Some output key has been seen
+  int64_t overlapped_bytes;  // Bytes of overlap between current output
+                             // and grandparent files
+
+  // State for implementing IsBaseLevelForKey
+
+  // level_ptrs holds indices into input_version_->levels_: our state
+  // is that we are positioned at one of the file ranges for each
+  // higher level than the ones involved in this compaction (i.e. for
+  // all L >= level_ + 2).
+  size_t level_ptrs[config::kNumLevels];
+
+  CompactionCursor();
+};
+
 class Compaction {
  public:
   ~Compaction();
@@ -350,11 +461,23 @@ class Compaction {
   // Returns true if the information we have available guarantees that
   // the compaction is producing data in "level+1" for which no data exists
   // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  bool IsBaseLevelForKey(const Slice& user_key) {
+    return IsBaseLevelForKey(user_key, &cursor_);
+  }
+  bool IsBaseLevelForKey(const Slice& user_key, CompactionCursor* cursor);
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key) {
+    return ShouldStopBefore(internal_key, &cursor_);
+  }
+  bool ShouldStopBefore(const Slice& internal_key, CompactionCursor* cursor);
+
+  // Store in *boundaries up to "n-1" user keys, taken from the input
+  // file boundaries in increasing order, that split the compaction into
+  // at most "n" disjoint key ranges of similar size.  Every version of a
+  // user key falls in the same range.
+  void GetSplitPoints(int n, std::vector<std::string>* boundaries) const;
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -374,21 +497,12 @@ class Compaction {
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];      // The two sets of inputs
 
-  // State used to check for number of of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // Grandparent files (level_ + 2) that overlap this compaction
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
 
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
+  // Cursor used by the single-threaded IsBaseLevelForKey() and
+  // ShouldStopBefore() calls
+  CompactionCursor cursor_;
 };
 
 }  // namespace leveldb
@@ -40,6 +40,11 @@ class WriteBatchInternal {
 
   static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
 
+  // Like InsertInto(), but other threads may insert into memtable at
+  // the same time with this method.
+  static Status InsertConcurrentlyInto(const WriteBatch* batch,
+                                       MemTable* memtable);
+
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
 
@@ -0,0 +1,87 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include <algorithm>
+
+namespace leveldb {
+
+// The rate is never lowered below this many bytes per second, so that
+// writes keep trickling in while the backlog is worked off.
+static const uint64_t kMinRate = 16 << 10;
+
+// At most this many microseconds worth of writes may burst through at
+// once after a pause.
+static const uint64_t kMaxBurstMicros = 1000;
+
+// Factors by which the rate is lowered while the backlog grows and
+// raised while it shrinks.
+static const double kSlowdownFactor = 0.8;
+static const double kSpeedupFactor = 1.25;
+
+WriteController::WriteController(uint64_t max_rate)
+    : max_rate_(std::max(max_rate, kMinRate)),
+      delayed_(false),
+      rate_(max_rate_),
+      pressure_(0),
+      tokens_(0),
+      last_refill_micros_(0) {
+}
+
+void WriteController::StartDelay(uint64_t now_micros,
+                                 uint64_t background_rate,
+                                 double pressure) {
+  if (delayed_) {
+    return;
+  }
+  delayed_ = true;
+  rate_ = max_rate_;
+  if (background_rate > 0) {
+    rate_ = std::max(std::min(background_rate, max_rate_), kMinRate);
+  }
+  pressure_ = pressure;
+  tokens_ = 0;
+  last_refill_micros_ = now_micros;
+}
+
+void WriteController::StopDelay() {
+  delayed_ = false;
+}
+
+void WriteController::Adjust(double pressure) {
+  if (pressure > pressure_) {
+    rate_ = std::max(static_cast<uint64_t>(rate_ * kSlowdownFactor),
+                     kMinRate);
+  } else if (pressure < pressure_) {
+    rate_ = std::min(static_cast<uint64_t>(rate_ * kSpeedupFactor),
+                     max_rate_);
+  }
+  pressure_ = pressure;
+}
+
+void WriteController::Refill(uint64_t now_micros) {
+  if (now_micros > last_refill_micros_) {
+    const double burst = static_cast<double>(rate_) * kMaxBurstMicros / 1e6;
+    tokens_ += static_cast<double>(rate_) *
+        (now_micros - last_refill_micros_) / 1e6;
+    tokens_ = std::min(tokens_, burst);
+    last_refill_micros_ = now_micros;
+  }
+}
+
+uint64_t WriteController::GetDelay(uint64_t now_micros) {
+  Refill(now_micros);
+  if (tokens_ >= 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(-tokens_ * 1e6 / rate_) + 1;
+}
+
+void WriteController::Consume(uint64_t now_micros, uint64_t bytes) {
+  Refill(now_micros);
+  tokens_ -= bytes;
+}
+
+}  // namespace leveldb
@@ -0,0 +1,77 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// WriteController limits the rate of writes while compactions are falling
+// behind, so that writers slow down gradually as the backlog grows
+// instead of running at full speed until they are stopped outright.
+//
+// Writes are paced by a token bucket: written bytes are taken out of the
+// bucket, which refills at the delayed write rate, and a writer that
+// finds the bucket in debt waits until the debt has been paid off.  The
+// rate starts at the measured throughput of background work and is then
+// adjusted to the compaction backlog: lowered while it grows and raised
+// while it shrinks.
+//
+// Not thread-safe; DBImpl calls it with its mutex held.
+
+#ifndef STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+#define STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+
+#include <stdint.h>
+
+namespace leveldb {
+
+class WriteController {
+ public:
+  // The delayed write rate never exceeds max_rate bytes per second.
+  explicit WriteController(uint64_t max_rate);
+
+  // Start delaying writes, at background_rate bytes per second (the
+  // measured throughput of flushes and compactions, or zero if unknown)
+  // limited to the maximum rate.  "pressure" measures the compaction
+  // backlog; see Adjust().  Does nothing if writes are already delayed.
+  void StartDelay(uint64_t now_micros, uint64_t background_rate,
+                  double pressure);
+
+  // Stop delaying writes.
+  void StopDelay();
+
+  bool delayed() const { return delayed_; }
+
+  // Current delayed write rate in bytes per second.
+  uint64_t rate() const { return rate_; }
+
+  // Adapt the rate to a new measure of the compaction backlog: lower it
+  // if the backlog has grown since the last call, raise it if it has
+  // shrunk.
+  void Adjust(double pressure);
+
+  // Microseconds a writer has to wait before it may write.
+  // REQUIRES: delayed()
+  uint64_t GetDelay(uint64_t now_micros);
+
+  // Account for "bytes" that were just written.
+  void Consume(uint64_t now_micros, uint64_t bytes);
+
+ private:
+  void Refill(uint64_t now_micros);
+
+  const uint64_t max_rate_;
+  bool delayed_;
+  uint64_t rate_;
+  double pressure_;
+
+  // Bytes that may be written without waiting.  Negative when writes
+  // have run ahead of the rate.
+  double tokens_;
+  uint64_t last_refill_micros_;
+
+  // No copying allowed
+  WriteController(const WriteController&);
+  void operator=(const WriteController&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
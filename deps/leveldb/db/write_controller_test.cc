@@ -0,0 +1,78 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class WriteControllerTest { };
+
+TEST(WriteControllerTest, Pacing) {
+  WriteController c(1 << 20);
+  ASSERT_TRUE(!c.delayed());
+  c.StartDelay(1000000, 0, 0);
+  ASSERT_TRUE(c.delayed());
+  ASSERT_EQ(1 << 20, c.rate());
+  ASSERT_EQ(0, c.GetDelay(1000000));
+
+  // A write of a second's worth of bytes has to be paid off first
+  c.Consume(1000000, 1 << 20);
+  const uint64_t delay = c.GetDelay(1000000);
+  ASSERT_GE(delay, 999000);
+  ASSERT_LE(delay, 1001000);
+  ASSERT_GT(c.GetDelay(1500000), 0);
+  ASSERT_EQ(0, c.GetDelay(1000000 + delay));
+
+  // Idle time does not build up more than a small burst
+  ASSERT_EQ(0, c.GetDelay(100000000));
+  c.Consume(100000000, 1 << 20);
+  ASSERT_GE(c.GetDelay(100000000), 990000);
+
+  c.StopDelay();
+  ASSERT_TRUE(!c.delayed());
+}
+
+TEST(WriteControllerTest, Adjust) {
+  WriteController c(64 << 20);
+
+  // Starts at the background throughput, within limits
+  c.StartDelay(0, 8 << 20, 0.5);
+  ASSERT_EQ(8 << 20, c.rate());
+  c.StartDelay(0, 1, 0.5);  // Already delayed
+  ASSERT_EQ(8 << 20, c.rate());
+
+  c.Adjust(0.5);
+  ASSERT_EQ(8 << 20, c.rate());
+  c.Adjust(0.6);
+  ASSERT_LT(c.rate(), 8 << 20);
+  const uint64_t lowered = c.rate();
+  c.Adjust(0.4);
+  ASSERT_GT(c.rate(), lowered);
+
+  // The rate stays within its bounds
+  for (int i = 0; i < 1000; i++) {
+    c.Adjust(i);
+  }
+  ASSERT_GT(c.rate(), 0);
+  const uint64_t min_rate = c.rate();
+  for (int i = 1000; i > 0; i--) {
+    c.Adjust(i);
+  }
+  ASSERT_EQ(64 << 20, c.rate());
+
+  c.StopDelay();
+  c.StartDelay(0, 1 << 30, 0);
+  ASSERT_EQ(64 << 20, c.rate());
+  c.StopDelay();
+  c.StartDelay(0, 1, 0);
+  ASSERT_EQ(min_rate, c.rate());
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
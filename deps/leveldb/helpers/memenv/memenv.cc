@@ -348,6 +348,21 @@ class InMemoryEnv : public EnvWrapper {
     return Status::OK();
   }
 
+  virtual Status LinkFile(const std::string& src,
+                          const std::string& target) {
+    MutexLock lock(&mutex_);
+    if (file_map_.find(src) == file_map_.end()) {
+      return Status::IOError(src, "File not found");
+    }
+    if (file_map_.find(target) != file_map_.end()) {
+      return Status::IOError(target, "File exists");
+    }
+
+    file_map_[target] = file_map_[src];
+    file_map_[target]->Ref();
+    return Status::OK();
+  }
+
   virtual Status LockFile(const std::string& fname, FileLock** lock) {
     *lock = new FileLock;
     return Status::OK();
@@ -149,6 +149,25 @@ TEST(MemEnvTest, Misc) {
   delete writable_file;
 }
 
+TEST(MemEnvTest, LinkFile) {
+  ASSERT_OK(env_->CreateDir("/dir"));
+  ASSERT_OK(WriteStringToFile(env_, "contents", "/dir/a"));
+
+  ASSERT_OK(env_->LinkFile("/dir/a", "/dir/b"));
+  ASSERT_TRUE(!env_->LinkFile("/dir/a", "/dir/b").ok());
+  ASSERT_OK(env_->DeleteFile("/dir/a"));
+  std::string data;
+  ASSERT_OK(ReadFileToString(env_, "/dir/b", &data));
+  ASSERT_EQ("contents", data);
+  ASSERT_TRUE(!env_->LinkFile("/dir/a", "/dir/c").ok());
+  ASSERT_TRUE(!env_->FileExists("/dir/c"));
+
+  // The default implementation copies the file
+  ASSERT_OK(env_->Env::LinkFile("/dir/b", "/dir/c"));
+  ASSERT_OK(ReadFileToString(env_, "/dir/c", &data));
+  ASSERT_EQ("contents", data);
+}
+
 TEST(MemEnvTest, LargeWrite) {
   const size_t kWriteSize = 300 * 1024;
   char* scratch = new char[kWriteSize * 2];
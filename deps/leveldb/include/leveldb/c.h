@@ -52,17 +52,23 @@ extern "C" {
 
 typedef struct leveldb_t               leveldb_t;
 typedef struct leveldb_cache_t         leveldb_cache_t;
+typedef struct leveldb_compactionfilter_t leveldb_compactionfilter_t;
 typedef struct leveldb_comparator_t    leveldb_comparator_t;
 typedef struct leveldb_env_t           leveldb_env_t;
 typedef struct leveldb_filelock_t      leveldb_filelock_t;
 typedef struct leveldb_filterpolicy_t  leveldb_filterpolicy_t;
 typedef struct leveldb_iterator_t      leveldb_iterator_t;
 typedef struct leveldb_logger_t        leveldb_logger_t;
+typedef struct leveldb_mergeoperands_t leveldb_mergeoperands_t;
+typedef struct leveldb_mergeoperator_t leveldb_mergeoperator_t;
 typedef struct leveldb_options_t       leveldb_options_t;
+typedef struct leveldb_pinnableslice_t leveldb_pinnableslice_t;
 typedef struct leveldb_randomfile_t    leveldb_randomfile_t;
+typedef struct leveldb_ratelimiter_t   leveldb_ratelimiter_t;
 typedef struct leveldb_readoptions_t   leveldb_readoptions_t;
 typedef struct leveldb_seqfile_t       leveldb_seqfile_t;
 typedef struct leveldb_snapshot_t      leveldb_snapshot_t;
+typedef struct leveldb_sstfilewriter_t leveldb_sstfilewriter_t;
 typedef struct leveldb_writablefile_t  leveldb_writablefile_t;
 typedef struct leveldb_writebatch_t    leveldb_writebatch_t;
 typedef struct leveldb_writeoptions_t  leveldb_writeoptions_t;
@@ -89,6 +95,14 @@ extern void leveldb_delete(
     const char* key, size_t keylen,
     char** errptr);
 
+/* Requires a merge operator to be set in the options of db. */
+extern void leveldb_merge(
+    leveldb_t* db,
+    const leveldb_writeoptions_t* options,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr);
+
 extern void leveldb_write(
     leveldb_t* db,
     const leveldb_writeoptions_t* options,
@@ -104,6 +118,57 @@ extern char* leveldb_get(
     size_t* vallen,
     char** errptr);
 
+/* Returns NULL if not found.  Otherwise a handle whose value refers to
+   storage pinned inside the db, without a copy; see
+   leveldb_pinnableslice_value().  The handle must be destroyed before
+   the db is closed. */
+extern leveldb_pinnableslice_t* leveldb_get_pinned(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    const char* key, size_t keylen,
+    char** errptr);
+
+extern const char* leveldb_pinnableslice_value(
+    const leveldb_pinnableslice_t* v, size_t* vallen);
+extern void leveldb_pinnableslice_destroy(leveldb_pinnableslice_t* v);
+
+/* Returns NULL if not found.  Otherwise a handle on the entry for key
+   with its merge operands left unapplied; see DB::GetMergeOperands().
+   The value the operands apply to is only read if read_value is
+   nonzero, but its size is available either way.  The handle must be
+   destroyed before the db is closed. */
+extern leveldb_mergeoperands_t* leveldb_get_merge_operands(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    const char* key, size_t keylen,
+    unsigned char read_value,
+    char** errptr);
+
+extern unsigned char leveldb_mergeoperands_has_value(
+    const leveldb_mergeoperands_t* m);
+extern uint64_t leveldb_mergeoperands_value_size(
+    const leveldb_mergeoperands_t* m);
+/* Returns NULL unless the value was read */
+extern const char* leveldb_mergeoperands_value(
+    const leveldb_mergeoperands_t* m, size_t* vallen);
+extern size_t leveldb_mergeoperands_count(const leveldb_mergeoperands_t* m);
+/* Operands are numbered from the oldest */
+extern const char* leveldb_mergeoperands_operand(
+    const leveldb_mergeoperands_t* m, size_t i, size_t* len);
+extern void leveldb_mergeoperands_destroy(leveldb_mergeoperands_t* m);
+
+/* Looks up num_keys keys against one snapshot.  For each key i sets
+   values_list[i] as leveldb_get() would return it (with its length in
+   values_list_sizes[i]) and, on error, errs[i] as leveldb_get() would
+   set *errptr. */
+extern void leveldb_multi_get(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    size_t num_keys,
+    const char* const* keys_list, const size_t* keys_list_sizes,
+    char** values_list, size_t* values_list_sizes,
+    char** errs);
+
 extern leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db,
     const leveldb_readoptions_t* options);
@@ -133,6 +198,13 @@ extern void leveldb_compact_range(
     const char* start_key, size_t start_key_len,
     const char* limit_key, size_t limit_key_len);
 
+/* Adds tables built with a leveldb_sstfilewriter_t to db.  The key
+   ranges of the files must not overlap each other or the keys of db. */
+extern void leveldb_ingest_external_files(
+    leveldb_t* db,
+    const char* const* files, size_t num_files,
+    char** errptr);
+
 /* Management operations */
 
 extern void leveldb_destroy_db(
@@ -170,6 +242,10 @@ extern void leveldb_writebatch_put(
 extern void leveldb_writebatch_delete(
     leveldb_writebatch_t*,
     const char* key, size_t klen);
+extern void leveldb_writebatch_merge(
+    leveldb_writebatch_t*,
+    const char* key, size_t klen,
+    const char* val, size_t vlen);
 extern void leveldb_writebatch_iterate(
     leveldb_writebatch_t*,
     void* state,
@@ -186,6 +262,12 @@ extern void leveldb_options_set_comparator(
 extern void leveldb_options_set_filter_policy(
     leveldb_options_t*,
     leveldb_filterpolicy_t*);
+extern void leveldb_options_set_merge_operator(
+    leveldb_options_t*,
+    leveldb_mergeoperator_t*);
+extern void leveldb_options_set_compaction_filter(
+    leveldb_options_t*,
+    leveldb_compactionfilter_t*);
 extern void leveldb_options_set_create_if_missing(
     leveldb_options_t*, unsigned char);
 extern void leveldb_options_set_error_if_exists(
@@ -195,16 +277,61 @@ extern void leveldb_options_set_paranoid_checks(
 extern void leveldb_options_set_env(leveldb_options_t*, leveldb_env_t*);
 extern void leveldb_options_set_info_log(leveldb_options_t*, leveldb_logger_t*);
 extern void leveldb_options_set_write_buffer_size(leveldb_options_t*, size_t);
+extern void leveldb_options_set_allow_concurrent_memtable_write(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_enable_pipelined_write(leveldb_options_t*,
+                                                       unsigned char);
+extern void leveldb_options_set_level0_file_num_compaction_trigger(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_level0_slowdown_writes_trigger(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_level0_stop_writes_trigger(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_soft_pending_compaction_bytes_limit(
+    leveldb_options_t*, uint64_t);
+extern void leveldb_options_set_hard_pending_compaction_bytes_limit(
+    leveldb_options_t*, uint64_t);
+extern void leveldb_options_set_delayed_write_rate(leveldb_options_t*,
+                                                   uint64_t);
+extern void leveldb_options_set_rate_limiter(leveldb_options_t*,
+                                             leveldb_ratelimiter_t*);
+extern void leveldb_options_set_use_direct_io_for_flush_and_compaction(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_use_direct_reads(leveldb_options_t*,
+                                                 unsigned char);
+extern void leveldb_options_set_compaction_readahead_size(leveldb_options_t*,
+                                                          size_t);
+extern void leveldb_options_set_advise_random_on_open(leveldb_options_t*,
+                                                      unsigned char);
+extern void leveldb_options_set_bytes_per_sync(leveldb_options_t*, uint64_t);
+extern void leveldb_options_set_allow_fallocate(leveldb_options_t*,
+                                                unsigned char);
+extern void leveldb_options_set_recycle_log_file_num(leveldb_options_t*,
+                                                     size_t);
 extern void leveldb_options_set_max_open_files(leveldb_options_t*, int);
+extern void leveldb_options_set_max_subcompactions(leveldb_options_t*, int);
 extern void leveldb_options_set_cache(leveldb_options_t*, leveldb_cache_t*);
 extern void leveldb_options_set_block_size(leveldb_options_t*, size_t);
 extern void leveldb_options_set_block_restart_interval(leveldb_options_t*, int);
+extern void leveldb_options_set_cache_index_and_filter_blocks(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_pin_l0_filter_and_index_blocks_in_cache(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_index_partition_size(leveldb_options_t*, size_t);
+extern void leveldb_options_set_value_log_threshold(leveldb_options_t*, size_t);
+extern void leveldb_options_set_value_log_gc_ratio(leveldb_options_t*, double);
 
 enum {
   leveldb_no_compression = 0,
-  leveldb_snappy_compression = 1
+  leveldb_snappy_compression = 1,
+  leveldb_lz_compression = 2
 };
 extern void leveldb_options_set_compression(leveldb_options_t*, int);
+extern void leveldb_options_set_compression_threads(leveldb_options_t*, int);
+extern void leveldb_options_set_compression_per_level(
+    leveldb_options_t*, const int* level_values, size_t num_levels);
+extern void leveldb_options_set_compression_dict_size(leveldb_options_t*,
+                                                      size_t);
 
 /* Comparator */
 
@@ -237,6 +364,65 @@ extern void leveldb_filterpolicy_destroy(leveldb_filterpolicy_t*);
 
 extern leveldb_filterpolicy_t* leveldb_filterpolicy_create_bloom(
     int bits_per_key);
+extern leveldb_filterpolicy_t* leveldb_filterpolicy_create_sublevel_bloom(
+    int bits_per_key, const char* separator, size_t separator_len);
+
+/* Merge operator */
+
+/* full_merge applies the operands, oldest first, to the existing value
+   (NULL if there is none).  It returns the result as a malloc()ed array
+   of *new_value_length bytes and stores 1 in *success, or stores 0 in
+   *success if the operands cannot be applied.  partial_merge may be
+   NULL; otherwise it combines two consecutive operands, left_operand
+   being the older one, in the same way. */
+extern leveldb_mergeoperator_t* leveldb_mergeoperator_create(
+    void* state,
+    void (*destructor)(void*),
+    char* (*full_merge)(
+        void*,
+        const char* key, size_t key_length,
+        const char* existing_value, size_t existing_value_length,
+        const char* const* operands_list, const size_t* operands_list_length,
+        int num_operands,
+        unsigned char* success, size_t* new_value_length),
+    char* (*partial_merge)(
+        void*,
+        const char* key, size_t key_length,
+        const char* left_operand, size_t left_operand_length,
+        const char* right_operand, size_t right_operand_length,
+        unsigned char* success, size_t* new_value_length),
+    const char* (*name)(void*));
+extern void leveldb_mergeoperator_destroy(leveldb_mergeoperator_t*);
+
+/* Compaction filter */
+
+/* filter is called with a value that a compaction into level copies.
+   It returns 1 to remove the key.  Otherwise it may replace the value
+   by storing a malloc()ed array of *new_value_length bytes in
+   *new_value and 1 in *value_changed. */
+extern leveldb_compactionfilter_t* leveldb_compactionfilter_create(
+    void* state,
+    void (*destructor)(void*),
+    unsigned char (*filter)(
+        void*,
+        int level,
+        const char* key, size_t key_length,
+        const char* existing_value, size_t value_length,
+        char** new_value, size_t* new_value_length,
+        unsigned char* value_changed),
+    const char* (*name)(void*));
+
+/* may_filter returns 0 if filter keeps every value of key as it is when
+   compacted into level, which spares compactions the call, and reading
+   the value if it is kept in a value log.  Without it filter sees every
+   key. */
+extern void leveldb_compactionfilter_set_may_filter(
+    leveldb_compactionfilter_t*,
+    unsigned char (*may_filter)(
+        void*,
+        int level,
+        const char* key, size_t key_length));
+extern void leveldb_compactionfilter_destroy(leveldb_compactionfilter_t*);
 
 /* Read options */
 
@@ -247,9 +433,24 @@ extern void leveldb_readoptions_set_verify_checksums(
     unsigned char);
 extern void leveldb_readoptions_set_fill_cache(
     leveldb_readoptions_t*, unsigned char);
+/* Read the blocks of a Seek() or MultiGet() with one Env::MultiRead(). */
+extern void leveldb_readoptions_set_batch_block_reads(
+    leveldb_readoptions_t*, unsigned char);
+/* Iterators only yield keys; merge operands are not applied and the
+   value of a key that has some is empty. */
+extern void leveldb_readoptions_set_keys_only(
+    leveldb_readoptions_t*, unsigned char);
 extern void leveldb_readoptions_set_snapshot(
     leveldb_readoptions_t*,
     const leveldb_snapshot_t*);
+/* Restrict iterators to keys starting with prefix; NULL clears it. */
+extern void leveldb_readoptions_set_prefix(
+    leveldb_readoptions_t*,
+    const char* prefix, size_t prefix_len);
+/* Stop iterators before the first key >= key; NULL clears it. */
+extern void leveldb_readoptions_set_iterate_upper_bound(
+    leveldb_readoptions_t*,
+    const char* key, size_t keylen);
 
 /* Write options */
 
@@ -258,16 +459,60 @@ extern void leveldb_writeoptions_destroy(leveldb_writeoptions_t*);
 extern void leveldb_writeoptions_set_sync(
     leveldb_writeoptions_t*, unsigned char);
 
+/* Table file writer */
+
+/* Writes tables that a db opened with options can ingest.  Keys must be
+   added in increasing order. */
+extern leveldb_sstfilewriter_t* leveldb_sstfilewriter_create(
+    const leveldb_options_t* options);
+extern void leveldb_sstfilewriter_destroy(leveldb_sstfilewriter_t*);
+extern void leveldb_sstfilewriter_open(
+    leveldb_sstfilewriter_t*, const char* name, char** errptr);
+extern void leveldb_sstfilewriter_add(
+    leveldb_sstfilewriter_t*,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr);
+extern void leveldb_sstfilewriter_finish(
+    leveldb_sstfilewriter_t*, char** errptr);
+extern uint64_t leveldb_sstfilewriter_file_size(leveldb_sstfilewriter_t*);
+
 /* Cache */
 
 extern leveldb_cache_t* leveldb_cache_create_lru(size_t capacity);
+extern leveldb_cache_t* leveldb_cache_create_lru_protected(
+    size_t capacity, double protected_ratio);
+extern leveldb_cache_t* leveldb_cache_create_clock(
+    size_t capacity, int num_shard_bits, size_t estimated_entry_charge);
 extern void leveldb_cache_destroy(leveldb_cache_t* cache);
 
+/* Rate limiter */
+
+extern leveldb_ratelimiter_t* leveldb_ratelimiter_create(
+    int64_t flush_bytes_per_sec, int64_t compaction_bytes_per_sec,
+    int64_t burst_micros, unsigned char auto_tuned);
+extern void leveldb_ratelimiter_destroy(leveldb_ratelimiter_t*);
+
 /* Env */
 
 extern leveldb_env_t* leveldb_create_default_env();
+/* The default env, with reads batched through io_uring where available. */
+extern leveldb_env_t* leveldb_create_io_uring_env();
 extern void leveldb_env_destroy(leveldb_env_t*);
 
+enum {
+  leveldb_env_low_priority = 0,
+  leveldb_env_high_priority = 1
+};
+extern void leveldb_env_set_background_threads(
+    leveldb_env_t*, int number, int priority);
+extern void leveldb_env_lower_thread_pool_io_priority(leveldb_env_t*,
+                                                      int priority);
+extern void leveldb_env_lower_thread_pool_cpu_priority(leveldb_env_t*,
+                                                       int priority);
+extern void leveldb_env_set_thread_pool_cpu_affinity(
+    leveldb_env_t*, const int* cpus, size_t num_cpus, int priority);
+
 /* Utility */
 
 /* Calls free(ptr).
@@ -29,6 +29,26 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Like NewLRUCache(capacity), but scan resistant.  New entries are
+// inserted at the midpoint of the LRU list instead of its head, and only
+// move to a protected segment that holds up to protected_ratio of the
+// capacity once they are looked up again.  Entries that are used only
+// once, like the blocks read by a long scan, are evicted first.  HIGH
+// priority entries are placed in the protected segment directly.
+extern Cache* NewLRUCache(size_t capacity, double protected_ratio);
+
+// Create a new cache with a fixed size capacity that uses a CLOCK
+// eviction policy.  Lookups and releases do not take any locks, which
+// makes this cache a better fit than NewLRUCache() when many threads
+// read through the same cache.  The cache is split into
+// 2^num_shard_bits shards.  estimated_entry_charge is the expected
+// average charge of an entry (for a block cache, roughly
+// Options::block_size) and is used to size the hash tables up front;
+// entries that do not fit in a full table are still returned to the
+// caller but are not cached.
+extern Cache* NewClockCache(size_t capacity, int num_shard_bits,
+                            size_t estimated_entry_charge);
+
 class Cache {
  public:
   Cache() { }
@@ -40,6 +60,10 @@ class Cache {
   // Opaque handle to an entry stored in the cache.
   struct Handle { };
 
+  // Hint for the eviction policy.  HIGH priority entries, e.g. index and
+  // filter blocks, are kept in preference to LOW priority ones.
+  enum Priority { HIGH, LOW };
+
   // Insert a mapping from key->value into the cache and assign it
   // the specified charge against the total cache capacity.
   //
@@ -52,6 +76,12 @@ class Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  // Same as above, with a priority hint for the eviction policy.  The
+  // default implementation ignores the priority.
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority);
+
   // If the cache has no mapping for "key", returns NULL.
   //
   // Else return a handle that corresponds to the mapping.  The caller
@@ -0,0 +1,51 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a custom CompactionFilter object.
+// Compactions show it the values they copy, and it may remove them or
+// replace them with new values.  This lets an application expire or
+// trim data as a side effect of compactions instead of deleting it key
+// by key.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+#define STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+
+#include <string>
+
+namespace leveldb {
+
+class Slice;
+
+class CompactionFilter {
+ public:
+  virtual ~CompactionFilter();
+
+  // The name of the filter.  Used only for logging.
+  virtual const char* Name() const = 0;
+
+  // Called when a compaction into "level" copies "existing_value", the
+  // value of "key" that the oldest live snapshot sees.  Return true to
+  // remove the key, which then reads as deleted.  Otherwise the value
+  // is kept unless the filter stores a replacement in *new_value and
+  // sets *value_changed to true.
+  //
+  // Compactions run in the background, possibly several at a time, so
+  // Filter() must be thread-safe.  It is not called for values that are
+  // still in the memtable or that are only hidden by a snapshot.
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const = 0;
+
+  // Return false if Filter() keeps every value of "key" as it is when
+  // compacted into "level", so that compactions can skip the call, and
+  // reading the value if it is kept in a value log.
+  //
+  // The default implementation returns true.
+  virtual bool MayFilter(int level, const Slice& key) const;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
@@ -7,8 +7,11 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 
 namespace leveldb {
 
@@ -68,6 +71,14 @@ class DB {
   // Note: consider setting options.sync = true.
   virtual Status Delete(const WriteOptions& options, const Slice& key) = 0;
 
+  // Combine "value" with the existing value of "key" using
+  // Options::merge_operator.  The operand is stored as is, and the
+  // operator is applied when the key is read or compacted.  Returns
+  // NotSupported if the database has no merge operator.
+  // Note: consider setting options.sync = true.
+  virtual Status Merge(const WriteOptions& options, const Slice& key,
+                       const Slice& value);
+
   // Apply the specified updates to the database.
   // Returns OK on success, non-OK on failure.
   // Note: consider setting options.sync = true.
@@ -83,6 +94,44 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Like Get(), but when possible *value refers to the value where it
+  // is stored (in the block cache, a memtable or a mapped table file)
+  // and keeps that storage pinned until value->Reset() instead of
+  // copying it.  Any pin *value held before the call is released.
+  // All pinned slices must be released before the DB is deleted.
+  //
+  // The default implementation copies the result of Get() into *value.
+  virtual Status GetPinned(const ReadOptions& options,
+                           const Slice& key, PinnableSlice* value);
+
+  // Like GetPinned(), but without applying the merge operands written
+  // on top of the entry for "key": stores them in *operands, oldest
+  // first, and sets *has_value to whether they apply to a value (and not
+  // to a deletion or to nothing).  If so, *value_size is set to the size
+  // of that value, and unless "value" is NULL the value is stored in
+  // *value.  A value kept in a value log is only read if "value" is
+  // non-NULL, which makes the call cheap for a caller that only needs
+  // to know how large the merged value will be.
+  //
+  // Returns OK if there is a value or at least one operand.
+  //
+  // The default implementation stores the result of Get() as the value
+  // with no operands.
+  virtual Status GetMergeOperands(const ReadOptions& options,
+                                  const Slice& key, PinnableSlice* value,
+                                  uint64_t* value_size, bool* has_value,
+                                  std::vector<std::string>* operands);
+
+  // Look up keys[0,n-1] as if by calling Get() for each of them against
+  // the same snapshot, storing the result for keys[i] in values[i] and
+  // statuses[i].  The keys need not be sorted, but lookups for keys that
+  // are close together share file and block reads, so a batch of nearby
+  // keys is much cheaper than the same number of Get() calls.
+  //
+  // The default implementation calls Get() for each key.
+  virtual void MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                        std::string* values, Status* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -115,6 +164,18 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.num-value-log-files" - return the number of value log files
+  //     holding large values (see Options::value_log_threshold).
+  //  "leveldb.write-stalls" - returns a multi-line string with the number
+  //     of writes that were slowed down or stopped to let compactions catch
+  //     up, the microseconds they waited, and the current delayed write
+  //     rate in bytes per second (zero if writes are not slowed down).
+  //  "leveldb.rate-limiter" - returns a multi-line string with the current
+  //     rate, the bytes written and the microseconds writes were held back
+  //     for flushes and for compactions (see Options::rate_limiter).
+  //  "leveldb.estimate-pending-compaction-bytes" - return the estimated
+  //     number of bytes compactions have to write to bring every level
+  //     within its size limit.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -140,6 +201,19 @@ class DB {
   //    db->CompactRange(NULL, NULL);
   virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+  // Add the tables in "files", built with SstFileWriter, to the database
+  // without passing their entries through the write path.  The files
+  // are linked into the database (see Env::LinkFile) and their entries
+  // replace those the database holds for the same keys: each file goes
+  // to the level just above the first one with keys in its range, and
+  // the memtable is flushed first if it has such keys.  The key ranges
+  // of the files must not overlap each other; otherwise InvalidArgument
+  // is returned and nothing is added.  Snapshots taken before the call
+  // do not see the new keys.
+  //
+  // The default implementation returns NotSupported.
+  virtual Status IngestExternalFiles(const std::vector<std::string>& files);
+
  private:
   // No copying allowed
   DB(const DB&);
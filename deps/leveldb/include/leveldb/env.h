@@ -28,8 +28,24 @@ class SequentialFile;
 class Slice;
 class WritableFile;
 
+// A read of "n" bytes at "offset" of *file, for Env::MultiRead().  Like
+// RandomAccessFile::Read(), the read may use scratch[0,n-1] and sets
+// "result" to the data read, and "status" to its outcome.
+struct ReadRequest {
+  RandomAccessFile* file;
+  uint64_t offset;
+  size_t n;
+  char* scratch;
+  Slice result;
+  Status status;
+};
+
 class Env {
  public:
+  // Background work is run on one of several thread pools.  Work
+  // scheduled on the HIGH pool never waits behind work on the LOW pool.
+  enum Priority { LOW, HIGH, TOTAL };
+
   Env() { }
   virtual ~Env();
 
@@ -69,6 +85,36 @@ class Env {
   virtual Status NewWritableFile(const std::string& fname,
                                  WritableFile** result) = 0;
 
+  // Like NewRandomAccessFile(), but reads of the returned file bypass the
+  // operating system's page cache where the platform supports it, so
+  // that the caller's own caching is the only one.  The default
+  // implementation calls NewRandomAccessFile().
+  virtual Status NewDirectRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result);
+
+  // Like NewWritableFile(), but the data appended to the returned file
+  // bypasses the operating system's page cache where the platform
+  // supports it.  Meant for large files that are written once and will
+  // not be read back soon.  The default implementation calls
+  // NewWritableFile().
+  virtual Status NewDirectWritableFile(const std::string& fname,
+                                       WritableFile** result);
+
+  // Rename old_fname to fname and open it for writing like
+  // NewWritableFile(), except that its contents are overwritten from the
+  // start rather than truncated first.  Reusing a file this way saves
+  // the file system from allocating its storage again.  The default
+  // implementation renames the file and calls NewWritableFile().
+  virtual Status ReuseWritableFile(const std::string& fname,
+                                   const std::string& old_fname,
+                                   WritableFile** result);
+
+  // Perform the reads reqs[0,n-1], which may be of different files.  An
+  // Env may issue them all at once and wait for them together, so that
+  // the device can serve them in parallel.  The default implementation
+  // reads them one after another.
+  virtual void MultiRead(ReadRequest* reqs, int n);
+
   // Returns true iff the named file exists.
   virtual bool FileExists(const std::string& fname) = 0;
 
@@ -94,6 +140,13 @@ class Env {
   virtual Status RenameFile(const std::string& src,
                             const std::string& target) = 0;
 
+  // Make target, which must not exist, a file with the contents of src
+  // while leaving src in place.  Sharing the storage of src is
+  // preferred, but src must not be modified afterwards either way.
+  //
+  // The default implementation copies src and syncs the copy.
+  virtual Status LinkFile(const std::string& src, const std::string& target);
+
   // Lock the specified file.  Used to prevent concurrent access to
   // the same db by multiple processes.  On failure, stores NULL in
   // *lock and returns non-OK.
@@ -125,6 +178,34 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Like Schedule(function, arg), but run the work on the thread pool
+  // for priority "pri".  The default implementation ignores "pri" and
+  // forwards to Schedule(function, arg).
+  virtual void Schedule(
+      void (*function)(void* arg),
+      void* arg,
+      Priority pri);
+
+  // Allow up to "number" threads to run concurrently in the thread
+  // pool for priority "pri".  The number of threads in a pool can only
+  // grow.  The default implementation does nothing.
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
+  // Lower the I/O priority of the threads in the pool for "pri", so that
+  // the reads and writes of their work yield to those of other threads,
+  // such as foreground reads.  The default implementation does nothing.
+  virtual void LowerThreadPoolIOPriority(Priority pri);
+
+  // Lower the CPU scheduling priority of the threads in the pool for
+  // "pri".  The default implementation does nothing.
+  virtual void LowerThreadPoolCPUPriority(Priority pri);
+
+  // Run the threads in the pool for "pri" only on the CPUs numbered in
+  // "cpus", or on any CPU if "cpus" is empty.  The default implementation
+  // does nothing.
+  virtual void SetThreadPoolCPUAffinity(const std::vector<int>& cpus,
+                                        Priority pri);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -200,6 +281,20 @@ class RandomAccessFile {
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
 
+  // The ways in which a file may be read
+  enum AccessPattern {
+    kNormal,        // No particular pattern
+    kRandom,        // Small reads at scattered offsets
+    kSequential,    // In order, from start to end
+    kDontNeed       // Not again soon
+  };
+
+  // Advise the operating system of the way the file will be read from
+  // now on, so that it can adjust its readahead and caching.  kDontNeed
+  // lets it drop the cached contents of the file.  Hints are advisory
+  // and their errors ignored.  The default implementation does nothing.
+  virtual void Hint(AccessPattern pattern);
+
  private:
   // No copying allowed
   RandomAccessFile(const RandomAccessFile&);
@@ -219,6 +314,18 @@ class WritableFile {
   virtual Status Flush() = 0;
   virtual Status Sync() = 0;
 
+  // Reserve storage for bytes [offset,offset+len) of the file ahead of
+  // the appends that will fill them, without changing its size.  Storage
+  // reserved past the end of the file is released when it is closed.
+  // The default implementation does nothing.
+  virtual Status Allocate(uint64_t offset, uint64_t len);
+
+  // Start writing bytes [offset,offset+len) of the file back to storage
+  // without waiting for them to get there, so that a later Sync() has
+  // less left to do.  Data that has not been appended yet is ignored.
+  // The default implementation does nothing.
+  virtual Status RangeSync(uint64_t offset, uint64_t len);
+
  private:
   // No copying allowed
   WritableFile(const WritableFile&);
@@ -289,6 +396,20 @@ class EnvWrapper : public Env {
   Status NewWritableFile(const std::string& f, WritableFile** r) {
     return target_->NewWritableFile(f, r);
   }
+  Status NewDirectRandomAccessFile(const std::string& f,
+                                   RandomAccessFile** r) {
+    return target_->NewDirectRandomAccessFile(f, r);
+  }
+  Status NewDirectWritableFile(const std::string& f, WritableFile** r) {
+    return target_->NewDirectWritableFile(f, r);
+  }
+  Status ReuseWritableFile(const std::string& f, const std::string& old_f,
+                           WritableFile** r) {
+    return target_->ReuseWritableFile(f, old_f, r);
+  }
+  void MultiRead(ReadRequest* reqs, int n) {
+    return target_->MultiRead(reqs, n);
+  }
   bool FileExists(const std::string& f) { return target_->FileExists(f); }
   Status GetChildren(const std::string& dir, std::vector<std::string>* r) {
     return target_->GetChildren(dir, r);
@@ -302,6 +423,9 @@ class EnvWrapper : public Env {
   Status RenameFile(const std::string& s, const std::string& t) {
     return target_->RenameFile(s, t);
   }
+  Status LinkFile(const std::string& s, const std::string& t) {
+    return target_->LinkFile(s, t);
+  }
   Status LockFile(const std::string& f, FileLock** l) {
     return target_->LockFile(f, l);
   }
@@ -309,6 +433,21 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void Schedule(void (*f)(void*), void* a, Priority pri) {
+    return target_->Schedule(f, a, pri);
+  }
+  void SetBackgroundThreads(int number, Priority pri) {
+    return target_->SetBackgroundThreads(number, pri);
+  }
+  void LowerThreadPoolIOPriority(Priority pri) {
+    return target_->LowerThreadPoolIOPriority(pri);
+  }
+  void LowerThreadPoolCPUPriority(Priority pri) {
+    return target_->LowerThreadPoolCPUPriority(pri);
+  }
+  void SetThreadPoolCPUAffinity(const std::vector<int>& cpus, Priority pri) {
+    return target_->SetThreadPoolCPUAffinity(cpus, pri);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
@@ -328,6 +467,16 @@ class EnvWrapper : public Env {
   Env* target_;
 };
 
+// Return an Env that forwards all calls to *base, except that it opens
+// random access files itself, as plain POSIX files, and serves the
+// MultiRead() calls for them through a Linux io_uring, submitting the
+// reads of a call together and reaping them as they complete.  Where
+// io_uring is not available the reads are done one after another with
+// pread().  Reads of direct I/O files and of files from other Envs are
+// passed to *base.  The caller must delete the result when it is no
+// longer needed; *base must remain live while the result is in use.
+extern Env* NewIOUringEnv(Env* base);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_INCLUDE_ENV_H_
@@ -47,6 +47,14 @@ class FilterPolicy {
   // This method may return true or false if the key was not on the
   // list, but it should aim to return false with a high probability.
   virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const = 0;
+
+  // Return true if, whenever CreateFilter() is passed a key that starts
+  // with "prefix", it also adds "prefix" itself to the filter.  For such
+  // prefixes KeyMayMatch(prefix, filter) returning false proves that no
+  // key in the filter starts with "prefix", which lets reads restricted
+  // to a prefix (see ReadOptions::prefix) skip whole tables.
+  // The default implementation returns false.
+  virtual bool CoversPrefix(const Slice& prefix) const;
 };
 
 // Return a new filter policy that uses a bloom filter with approximately
@@ -65,6 +73,19 @@ class FilterPolicy {
 // trailing spaces in keys.
 extern const FilterPolicy* NewBloomFilterPolicy(int bits_per_key);
 
+// Return a new bloom filter policy that, in addition to every key,
+// inserts each prefix of a key that ends with "separator".  With a
+// separator of "/" the key "a/b/c" adds "a/b/c", "a/" and "a/b/" to
+// the filter, so a read restricted to the prefix "a/b/" can rule out
+// tables that hold nothing below "a/b/" without reading any data block.
+// Filters built by this policy are not compatible with those built by
+// NewBloomFilterPolicy() and are stored under a different name.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern const FilterPolicy* NewSublevelBloomFilterPolicy(
+    int bits_per_key, const Slice& separator);
+
 }
 
 #endif  // STORAGE_LEVELDB_INCLUDE_FILTER_POLICY_H_
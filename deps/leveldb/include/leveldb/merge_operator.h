@@ -0,0 +1,51 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a custom MergeOperator object.
+// DB::Merge() then records an operand for a key instead of a new value,
+// and the operator combines the operands with the value they were
+// written on top of whenever the key is read or compacted.  This turns
+// read-modify-write cycles such as appends or counters into blind
+// writes.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+#define STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+
+#include <string>
+#include <vector>
+
+namespace leveldb {
+
+class Slice;
+
+class MergeOperator {
+ public:
+  virtual ~MergeOperator();
+
+  // The name of the operator.  Used only for logging; the operator of a
+  // database must not change in a way that reinterprets its existing
+  // operands.
+  virtual const char* Name() const = 0;
+
+  // Apply "operands", oldest first, to *existing_value, or to no value
+  // at all if existing_value is NULL, and store the result in
+  // *new_value.  Return false if the operands cannot be applied, which
+  // is reported to readers as a corruption.
+  virtual bool FullMerge(const Slice& key, const Slice* existing_value,
+                         const std::vector<Slice>& operands,
+                         std::string* new_value) const = 0;
+
+  // Combine two consecutive operands of "key", "left_operand" being the
+  // older one, into a single operand stored in *new_operand, so that
+  // compactions can shrink a run of operands before the value they
+  // apply to is known.  Return false if they cannot be combined.
+  // The default implementation returns false.
+  virtual bool PartialMerge(const Slice& key, const Slice& left_operand,
+                            const Slice& right_operand,
+                            std::string* new_operand) const;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
@@ -6,14 +6,20 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include <vector>
 
 namespace leveldb {
 
 class Cache;
+class CompactionFilter;
 class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class MergeOperator;
+class RateLimiter;
+class Slice;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -24,7 +30,9 @@ enum CompressionType {
   // NOTE: do not change the values of existing entries, as these are
   // part of the persistent format on disk.
   kNoCompression     = 0x0,
-  kSnappyCompression = 0x1
+  kSnappyCompression = 0x1,
+  kLZCompression     = 0x2
+  // 0x3 marks blocks compressed with a dictionary (see table/format.h)
 };
 
 // Options to control the behavior of a database (passed to DB::Open)
@@ -82,6 +90,127 @@ struct Options {
   // Default: 4MB
   size_t write_buffer_size;
 
+  // If true, the writes that are committed together as a group are
+  // inserted into the memtable by their own threads in parallel, once
+  // the group has been appended to the log.  Otherwise the thread that
+  // appends the group inserts all of it.  Helps with many concurrent
+  // writers, whose memtable inserts would otherwise queue up behind one
+  // thread.
+  //
+  // Default: false
+  bool allow_concurrent_memtable_write;
+
+  // If true, a write group that has been appended to the log inserts
+  // into the memtable while the next group is appended, instead of
+  // holding up the log until its inserts are done.  Groups still become
+  // visible to reads in the order they were logged.
+  //
+  // Default: false
+  bool enable_pipelined_write;
+
+  // Number of level-0 files at which a compaction of level 0 starts.
+  //
+  // Default: 4
+  int level0_file_num_compaction_trigger;
+
+  // Number of level-0 files at which writes are slowed down to the
+  // delayed write rate (see delayed_write_rate).
+  //
+  // Default: 8
+  int level0_slowdown_writes_trigger;
+
+  // Number of level-0 files at which writes stop until a compaction has
+  // reduced their number.
+  //
+  // Default: 12
+  int level0_stop_writes_trigger;
+
+  // Estimated number of bytes compactions have to write to bring every
+  // level within its size limit at which writes are slowed down (soft)
+  // or stopped (hard).  Zero disables a limit.
+  //
+  // Default: 64GB and 256GB
+  uint64_t soft_pending_compaction_bytes_limit;
+  uint64_t hard_pending_compaction_bytes_limit;
+
+  // Highest rate in bytes per second at which writes go through while
+  // they are slowed down.  When writes start to be slowed down, the rate
+  // is set to the measured throughput of memtable flushes and
+  // compactions.  It is then lowered while compactions keep falling
+  // behind and raised while they catch up, so that writers slow down
+  // gradually well before they would be stopped.
+  //
+  // Default: 16MB
+  uint64_t delayed_write_rate;
+
+  // If non-NULL, limit the rate at which memtable flushes and compactions
+  // write to their output files (see rate_limiter.h).
+  //
+  // Default: NULL
+  RateLimiter* rate_limiter;
+
+  // If true, memtable flushes and compactions write their output files
+  // with direct I/O, and compactions read their input files with direct
+  // I/O through a buffer of compaction_readahead_size bytes, where the
+  // platform and file system support it.  Background work then no longer evicts the pages
+  // that user reads depend on from the operating system's page cache.
+  //
+  // Default: false
+  bool use_direct_io_for_flush_and_compaction;
+
+  // If true, user reads of tables bypass the operating system's page
+  // cache (and mmap()), where the platform and file system support it,
+  // so that block_cache is the only cache of table data.  Size
+  // block_cache accordingly.
+  //
+  // Default: false
+  bool use_direct_reads;
+
+  // Compactions read each input table through a buffer of this many
+  // bytes, filled with one large read at a time instead of one read per
+  // block, from a file of their own that is advised to the operating
+  // system as read sequentially and dropped from its cache once the
+  // compaction is done with it.  Zero reads compaction inputs block by
+  // block through the table cache, unless
+  // use_direct_io_for_flush_and_compaction is set, which needs a buffer.
+  //
+  // Default: 2MB
+  size_t compaction_readahead_size;
+
+  // If true, the operating system is advised that the tables opened for
+  // user reads will be read at random, which keeps it from reading ahead
+  // of the small blocks that point lookups need.
+  //
+  // Default: true
+  bool advise_random_on_open;
+
+  // If non-zero, the write-back of table, value log and write-ahead log
+  // files is started every time this many bytes have been appended to
+  // them, instead of being left to the Sync() at the end of the file,
+  // which would otherwise flush megabytes at once and stall the syncs of
+  // concurrent writers behind it.
+  //
+  // Default: 0
+  uint64_t bytes_per_sync;
+
+  // If true, the storage of table and write-ahead log files is reserved
+  // ahead of their writes, for as much as they are expected to hold, and
+  // what is left unused is released when they are closed.  This keeps
+  // the file system from extending them a little at a time.
+  //
+  // Default: true
+  bool allow_fallocate;
+
+  // If non-zero, up to this many write-ahead log files that are no longer
+  // needed are kept and overwritten by new logs instead of being deleted.
+  // Overwriting a file of the right size spares the file system the
+  // block allocations and size updates that make syncing appends to a
+  // fresh file expensive.  Logs are written in a format that tells the
+  // records of the current log from those left by the previous one.
+  //
+  // Default: 0
+  size_t recycle_log_file_num;
+
   // Number of open files that can be used by the DB.  You may need to
   // increase this if your database has a large working set (budget
   // one open file per 2MB of working set).
@@ -89,6 +218,18 @@ struct Options {
   // Default: 1000
   int max_open_files;
 
+  // Maximum number of threads that may work on a single compaction.
+  // A large compaction is split into disjoint key ranges at the
+  // boundaries of its input files, and each range is merged into its
+  // own output files.  The compaction thread merges one range and queues
+  // the others for threads of the LOW pool of "env", taking on any that
+  // no pool thread gets to.  The outputs of all ranges are installed
+  // together, so the result is the same as with a single thread.  A DB
+  // grows its LOW pool to have room for these threads.
+  //
+  // Default: 1
+  int max_subcompactions;
+
   // Control over blocks (user data is stored in a set of blocks, and
   // a block is the unit of reading from disk).
 
@@ -97,6 +238,23 @@ struct Options {
   // Default: NULL
   Cache* block_cache;
 
+  // If true, the index and filter blocks of a table are kept in
+  // block_cache, charged against its capacity with HIGH priority, instead
+  // of being held in memory for as long as the table is open.  This
+  // bounds the memory used by the index and filters of a large database.
+  // Tables that are read through mmap() keep using the mapped blocks.
+  //
+  // Default: false
+  bool cache_index_and_filter_blocks;
+
+  // If true, and cache_index_and_filter_blocks is set, the index and
+  // filter blocks of level-0 tables hold a reference in block_cache for as
+  // long as the table is open, so that reads of the most recently written
+  // tables never miss on them.
+  //
+  // Default: false
+  bool pin_l0_filter_and_index_blocks_in_cache;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -112,6 +270,16 @@ struct Options {
   // Default: 16
   int block_restart_interval;
 
+  // If non-zero, the index of each new table is split into partitions of
+  // approximately this many bytes, and a small top-level index maps keys
+  // to partitions.  Only the partitions that a read needs are loaded, and
+  // they go through block_cache like data blocks, so the index of a huge
+  // table does not have to be resident in memory.  Older versions of
+  // leveldb cannot read tables with a partitioned index.
+  //
+  // Default: 0
+  size_t index_partition_size;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
@@ -126,8 +294,50 @@ struct Options {
   // worth switching to kNoCompression.  Even if the input data is
   // incompressible, the kSnappyCompression implementation will
   // efficiently detect that and will switch to uncompressed mode.
+  //
+  // kLZCompression uses a codec built into leveldb (see util/lz.h), so
+  // it is available where leveldb was built without Snappy.  It is
+  // about as fast as Snappy and compresses slightly less.  Older
+  // versions of leveldb cannot read tables compressed with it.
   CompressionType compression;
 
+  // Number of threads that compress and checksum the data blocks of a
+  // table while it is written by a memtable flush or a compaction.  If
+  // greater than one, full blocks are queued for up to
+  // compression_threads-1 threads of the LOW pool of "env" (see
+  // Env::Schedule()), which the writing thread helps, and written out in
+  // order as they complete.  This spreads the CPU cost of writing a
+  // table over several cores.  The resulting table is the same as with
+  // a single thread.  A DB grows its LOW pool to have room for these
+  // threads (see Env::SetBackgroundThreads()).
+  //
+  // Default: 1
+  int compression_threads;
+
+  // If non-empty, tables written to level L are compressed with
+  // compression_per_level[L], or with its last entry if L is past its
+  // end, instead of with "compression".  Tables written by a memtable
+  // flush use the entry of level 0.  This allows cheap or no compression
+  // for the short-lived tables of the first levels and more thorough
+  // compression for the bulk of the data in the last levels.
+  //
+  // Default: empty
+  std::vector<CompressionType> compression_per_level;
+
+  // If non-zero, each table whose data blocks are compressed with
+  // kLZCompression gets a dictionary of up to this many bytes (at most
+  // 64KB), trained from the first data blocks of the table and stored
+  // in it.  All data blocks of the table are compressed against the
+  // dictionary, so that content that recurs across blocks, such as long
+  // common key prefixes, is compressed even in small blocks.  The first
+  // 16 times this many bytes of each table are buffered in memory until
+  // the dictionary has been trained; tables with less data than that get
+  // no dictionary.  Older versions of leveldb cannot read tables with a
+  // dictionary.
+  //
+  // Default: 0
+  size_t compression_dict_size;
+
   // If non-NULL, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -135,6 +345,41 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If non-NULL, DB::Merge() may be used, and this operator combines
+  // the merge operands of a key with its value (see merge_operator.h).
+  // A database that holds merge operands must always be opened with the
+  // same operator.
+  //
+  // Default: NULL
+  const MergeOperator* merge_operator;
+
+  // If non-NULL, compactions pass the values they copy through this
+  // filter, which may remove them or change them (see
+  // compaction_filter.h).
+  //
+  // Default: NULL
+  const CompactionFilter* compaction_filter;
+
+  // If non-zero, values of at least this many bytes are moved out of the
+  // tables into a value log when the memtable is written to disk, and
+  // the tables only keep a small pointer to them.  Compactions then no
+  // longer rewrite large values, at the cost of one extra random read
+  // per lookup of such a value.  Older versions of leveldb cannot open
+  // a database that has used a value log.
+  //
+  // Default: 0
+  size_t value_log_threshold;
+
+  // A value log file is garbage collected once at least this fraction of
+  // its bytes belongs to values that have been overwritten or deleted:
+  // a background thread writes its live values back to the database,
+  // from where they move to a new value log file, and removes the file.
+  // Files that hold no live value at all are removed without collection,
+  // so a ratio of 1 turns the collector off.
+  //
+  // Default: 0.5
+  double value_log_gc_ratio;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -158,10 +403,55 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If "prefix" is non-NULL, iterators created with these options only
+  // yield keys that start with *prefix: Seek() targets before the prefix
+  // are moved up to it and iteration ends at the first key outside it.
+  // When the filter policy covers the prefix (see
+  // FilterPolicy::CoversPrefix), tables whose filter rules out the
+  // prefix are skipped without reading any of their data blocks.
+  // The comparator must order all keys that share a prefix contiguously
+  // (as BytewiseComparator() does).  *prefix must outlive the iterator.
+  // Default: NULL
+  const Slice* prefix;
+
+  // If "iterate_upper_bound" is non-NULL, iterators created with these
+  // options stop before the first key that is >= *iterate_upper_bound.
+  // Beyond ending the iteration early this lets the engine stop reading
+  // data blocks and skipping deletion markers past the bound instead of
+  // discovering the end of a range one key too late.  Only forward
+  // iteration stops early; SeekToLast() starts at the last key before
+  // the bound.  *iterate_upper_bound must outlive the iterator.
+  // Default: NULL
+  const Slice* iterate_upper_bound;
+
+  // If true, reads that need data blocks from several places at once
+  // issue them together through Env::MultiRead() and wait for all of
+  // them, instead of one after another: an iterator Seek() reads the
+  // block it lands in from each level, and MultiGet() the blocks of all
+  // its lookups in a level.  The blocks go through the block cache, so
+  // this has no effect unless fill_cache is set, and Seek() does not
+  // batch while "prefix" is set, since the prefix filter might rule out
+  // some of the reads.  Worthwhile with an Env that serves batched reads
+  // in parallel (see NewIOUringEnv() in env.h).
+  // Default: false
+  bool batch_block_reads;
+
+  // If true, iterators created with these options are only used for
+  // their keys: a key with merge operands is yielded without applying
+  // them, or reading the value they apply to, and its value() is empty.
+  // Such a key is there whatever its operands apply to, so this does
+  // not change which keys are yielded.
+  // Default: false
+  bool keys_only;
+
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        snapshot(NULL),
+        prefix(NULL),
+        iterate_upper_bound(NULL),
+        batch_block_reads(false),
+        keys_only(false) {
   }
 };
 
@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PinnableSlice is a Slice that can keep the storage it refers to
+// alive, so that a value read from the DB can be handed out without
+// copying it out of the block cache or memtable.  DB::GetPinned() either
+// pins the memory holding the value or, when that is not possible,
+// copies the value into a buffer owned by the PinnableSlice.
+//
+// Pinned memory is released by Reset() or when the PinnableSlice is
+// destroyed, which must happen before the DB it was read from is closed.
+//
+// A PinnableSlice is not thread-safe; concurrent users need external
+// synchronization.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+#define STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+
+#include <string>
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class PinnableSlice : public Slice {
+ public:
+  PinnableSlice();
+  ~PinnableSlice();
+
+  // Make this slice refer to "s", whose storage stays valid until the
+  // cleanup functions registered with RegisterCleanup() have run.
+  void PinSlice(const Slice& s);
+
+  // Make this slice refer to a private copy of "s".
+  void PinSelf(const Slice& s);
+
+  // Return the private buffer, so that a value can be read into it in
+  // place.  Call PinSelf() afterwards to make this slice refer to it.
+  // REQUIRES: this slice holds no pin
+  std::string* GetSelf() { return &buf_; }
+
+  // Make this slice refer to the contents of GetSelf().
+  void PinSelf();
+
+  // Release any pinned storage and make this slice empty.
+  void Reset();
+
+  // Return true iff this slice refers to storage it does not own.
+  bool IsPinned() const { return cleanup_.function != NULL; }
+
+  // Clients are allowed to register function/arg1/arg2 triples that
+  // will be invoked by Reset() or when this slice is destroyed.
+  typedef void (*CleanupFunction)(void* arg1, void* arg2);
+  void RegisterCleanup(CleanupFunction function, void* arg1, void* arg2);
+
+ private:
+  struct Cleanup {
+    CleanupFunction function;
+    void* arg1;
+    void* arg2;
+    Cleanup* next;
+  };
+  Cleanup cleanup_;
+  std::string buf_;
+
+  // No copying allowed
+  PinnableSlice(const PinnableSlice&);
+  void operator=(const PinnableSlice&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
@@ -0,0 +1,77 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a RateLimiter object that limits the
+// rate at which memtable flushes and compactions write to their output
+// files, so that background work leaves enough of the device's bandwidth
+// to foreground reads.  Flushes and compactions have separate budgets:
+// flushes free the memtable that writers wait for, so they are usually
+// given more room than compactions.
+//
+// Most people will want to use the builtin limiter (see
+// NewGenericRateLimiter() below).
+
+#ifndef STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+
+#include <stdint.h>
+
+namespace leveldb {
+
+class Env;
+
+class RateLimiter {
+ public:
+  // The kinds of background writes, each with a budget of its own
+  enum IOPriority {
+    kFlush = 0,
+    kCompaction = 1,
+    kNumPriorities = 2
+  };
+
+  virtual ~RateLimiter();
+
+  // Block until "bytes" may be written within the budget of "pri".
+  // Safe to call from several threads at once.
+  virtual void Request(int64_t bytes, IOPriority pri) = 0;
+
+  // Current rate of "pri" in bytes per second, or zero if unlimited.
+  virtual int64_t GetRate(IOPriority pri) = 0;
+
+  // Bytes requested at "pri" so far.
+  virtual int64_t GetBytesThrough(IOPriority pri) = 0;
+
+  // Microseconds requests at "pri" have been held back so far.
+  virtual int64_t GetThrottledMicros(IOPriority pri) = 0;
+};
+
+// Return a new rate limiter that lets through at most flush_bytes_per_sec
+// bytes per second of flush writes and compaction_bytes_per_sec bytes per
+// second of compaction writes.  A rate of zero leaves that kind of write
+// unlimited.  After a pause, writes may burst through at full speed for
+// up to burst_micros microseconds worth of the rate.
+//
+// If "auto_tuned" is true, the rates given are upper bounds: each rate
+// is lowered, down to a twentieth of its bound, while its writes rarely
+// have to wait, and raised again while they mostly do.  This keeps
+// bursts of background writes from hogging the device while little
+// background work is pending, and still lets a backlog be worked off.
+//
+// Callers must delete the result after any database that is using it
+// has been closed.
+extern RateLimiter* NewGenericRateLimiter(int64_t flush_bytes_per_sec,
+                                          int64_t compaction_bytes_per_sec,
+                                          int64_t burst_micros,
+                                          bool auto_tuned);
+
+// Return an Env that forwards all calls to *base, except that appends to
+// the files it creates are passed through limiter->Request() at "pri"
+// first.  The caller must delete the result when it is no longer needed.
+// *base and *limiter must remain live while the result is in use.
+extern Env* NewRateLimitedEnv(Env* base, RateLimiter* limiter,
+                              RateLimiter::IOPriority pri);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
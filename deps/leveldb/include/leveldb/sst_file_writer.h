@@ -0,0 +1,66 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// SstFileWriter builds a table file outside of a database that the
+// database can then take over with DB::IngestExternalFiles(), without
+// passing the entries through its write path.  Several writers may run
+// in parallel on different files.
+//
+// A writer is not thread-safe: a single thread must make all calls.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_SST_FILE_WRITER_H_
+#define STORAGE_LEVELDB_INCLUDE_SST_FILE_WRITER_H_
+
+#include <stdint.h>
+#include <string>
+#include "leveldb/options.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Slice;
+
+class SstFileWriter {
+ public:
+  // Create a writer for tables that a database opened with "options"
+  // can ingest.  The comparator, filter policy and table format options
+  // must be those of the database.
+  explicit SstFileWriter(const Options& options);
+
+  // Deletes an unfinished file.
+  ~SstFileWriter();
+
+  // Start writing a new file named "fname".
+  // REQUIRES: no file is open, i.e. Open() was not called yet or
+  // Finish() was called since
+  Status Open(const std::string& fname);
+
+  // Add key,value to the file.  Returns InvalidArgument unless key is
+  // after all previously added keys according to the comparator.
+  // REQUIRES: Open() succeeded and Finish() was not called since
+  Status Add(const Slice& key, const Slice& value);
+
+  // Finish and sync the file.  After this the writer can Open() another
+  // file.  A file without entries cannot be ingested.
+  // REQUIRES: Open() succeeded and Finish() was not called since
+  Status Finish();
+
+  // Number of calls to Add() for the current file.
+  uint64_t NumEntries() const;
+
+  // Size of the file generated so far.
+  uint64_t FileSize() const;
+
+ private:
+  struct Rep;
+  Rep* rep_;
+
+  // No copying allowed
+  SstFileWriter(const SstFileWriter&);
+  void operator=(const SstFileWriter&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_SST_FILE_WRITER_H_
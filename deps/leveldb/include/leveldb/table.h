@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_INCLUDE_TABLE_H_
 
 #include <stdint.h>
+#include <vector>
 #include "leveldb/iterator.h"
 
 namespace leveldb {
@@ -13,9 +14,11 @@ namespace leveldb {
 class Block;
 class BlockHandle;
 class Footer;
+class PinnableSlice;
 struct Options;
 class RandomAccessFile;
 struct ReadOptions;
+struct ReadRequest;
 class TableCache;
 
 // A Table is a sorted map from strings to strings.  Tables are
@@ -45,6 +48,8 @@ class Table {
   // Returns a new iterator over the table contents.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
+  // If options.iterate_upper_bound is set it is compared with the keys
+  // of the table using the table's comparator.
   Iterator* NewIterator(const ReadOptions&) const;
 
   // Given a key, return an approximate byte offset in the file where
@@ -61,19 +66,53 @@ class Table {
 
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* PartitionReader(void*, const ReadOptions&, const Slice&);
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
-  // that key is not present.
+  // that key is not present.  If "pinned" is non-NULL and such a call
+  // is made, the data block holding the entry is kept alive until
+  // pinned->Reset(), so handle_result may keep pointers into it.
   friend class TableCache;
   Status InternalGet(
       const ReadOptions&, const Slice& key,
       void* arg,
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v),
+      PinnableSlice* pinned = NULL);
+
+  // Like InternalGet() for each of keys[0,n-1], which must be sorted.
+  // Calls (*handle_result)(args[i], ...) for key i and stores the status
+  // of its lookup in statuses[i].  Lookups that land in the same data
+  // block share a single read of it.
+  void InternalMultiGet(
+      const ReadOptions&, int n, const Slice* keys,
+      void* const* args, Status* statuses,
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
+  // Append to *reads a read of each data block that a lookup of one of
+  // keys[0,n-1], which must be sorted, lands in and that is not in the
+  // block cache.  If "use_filter" is true, blocks that the filter rules
+  // out for the key are left out.  Each read has a scratch buffer
+  // allocated with new[], which InsertBlockRead() takes over.
+  void AddBlockReads(const ReadOptions&, int n, const Slice* keys,
+                     bool use_filter, std::vector<ReadRequest>* reads);
 
-  void ReadMeta(const Footer& footer);
+  // Insert the block of *read, one of those added by AddBlockReads() that
+  // has been performed, into the block cache.  Deletes read->scratch.
+  void InsertBlockRead(const ReadOptions&, const ReadRequest& read);
+
+  // Returns false if the filter proves that no key in the table has the
+  // user key prefix of internal key "k".  Only meaningful when the
+  // table's filter policy covers that prefix.
+  bool PrefixMayMatch(const ReadOptions&, const Slice& k);
+
+  // If the index and filter blocks live in the block cache, keep a
+  // reference to them for the lifetime of the table.
+  void PinMetaBlocks();
+
+  Status ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
+  Status ReadCompressionDict(const Slice& dict_handle_value);
 
   // No copying allowed
   Table(const Table&);
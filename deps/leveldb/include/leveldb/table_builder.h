@@ -72,12 +72,21 @@ class TableBuilder {
 
   // Size of the file generated so far.  If invoked after a successful
   // Finish() call, returns the size of the final generated file.
+  // Blocks that are still being compressed by options.compression_threads
+  // are not included.
   uint64_t FileSize() const;
 
  private:
   bool ok() const { return status().ok(); }
+  void AddIndexEntry(const Slice& key, const Slice& handle);
+  void FlushIndexPartition();
   void WriteBlock(BlockBuilder* block, BlockHandle* handle);
   void WriteRawBlock(const Slice& data, CompressionType, BlockHandle* handle);
+  void AppendBlock(const Slice& data, const char* trailer, BlockHandle* handle);
+  void SubmitBlock();
+  void FinishSampling();
+  void WritePendingBlocks(bool finish);
+  void StopCompression();
 
   struct Rep;
   Rep* rep_;
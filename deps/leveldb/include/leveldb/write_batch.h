@@ -39,6 +39,10 @@ class WriteBatch {
   // If the database contains a mapping for "key", erase it.  Else do nothing.
   void Delete(const Slice& key);
 
+  // Combine "value" with the existing value of "key" using the database's
+  // merge operator (see DB::Merge()).
+  void Merge(const Slice& key, const Slice& value);
+
   // Clear all updates buffered in this batch.
   void Clear();
 
@@ -48,6 +52,8 @@ class WriteBatch {
     virtual ~Handler();
     virtual void Put(const Slice& key, const Slice& value) = 0;
     virtual void Delete(const Slice& key) = 0;
+    // The default implementation ignores merge operands.
+    virtual void Merge(const Slice& key, const Slice& value);
   };
   Status Iterate(Handler* handler) const;
 
@@ -97,6 +97,11 @@ class AtomicPointer {
 
   // Set va as the stored pointer with no ordering guarantees.
   void NoBarrier_Store(void* v);
+
+  // If the stored pointer is old_value, atomically replace it with
+  // new_value and return true.  Else return false.  Orders memory
+  // accesses like both Acquire_Load() and Release_Store().
+  bool CompareAndSwap(void* old_value, void* new_value);
 };
 
 // ------------------ Compression -------------------
@@ -9,6 +9,7 @@
 #include "table/block.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/lz.h"
 
 namespace leveldb {
 
@@ -66,7 +67,8 @@ Status Footer::DecodeFrom(Slice* input) {
 Status ReadBlock(RandomAccessFile* file,
                  const ReadOptions& options,
                  const BlockHandle& handle,
-                 BlockContents* result) {
+                 BlockContents* result,
+                 const Slice& compression_dict) {
   result->data = Slice();
   result->cachable = false;
   result->heap_allocated = false;
@@ -81,6 +83,20 @@ Status ReadBlock(RandomAccessFile* file,
     delete[] buf;
     return s;
   }
+  return DecodeBlock(options, handle, buf, contents, result, compression_dict);
+}
+
+Status DecodeBlock(const ReadOptions& options,
+                   const BlockHandle& handle,
+                   char* buf,
+                   const Slice& contents,
+                   BlockContents* result,
+                   const Slice& compression_dict) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  size_t n = static_cast<size_t>(handle.size());
   if (contents.size() != n + kBlockTrailerSize) {
     delete[] buf;
     return Status::Corruption("truncated block read");
@@ -93,8 +109,7 @@ Status ReadBlock(RandomAccessFile* file,
     const uint32_t actual = crc32c::Value(data, n + 1);
     if (actual != crc) {
       delete[] buf;
-      s = Status::Corruption("block checksum mismatch");
-      return s;
+      return Status::Corruption("block checksum mismatch");
     }
   }
 
@@ -134,6 +149,33 @@ Status ReadBlock(RandomAccessFile* file,
       result->cachable = true;
       break;
     }
+    case kLZCompression:
+    case kLZDictBlockType: {
+      Slice dict;
+      if (data[n] == kLZDictBlockType) {
+        if (compression_dict.empty()) {
+          delete[] buf;
+          return Status::Corruption("missing compression dictionary");
+        }
+        dict = compression_dict;
+      }
+      size_t ulength = 0;
+      if (!lz::GetUncompressedLength(data, n, &ulength)) {
+        delete[] buf;
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      char* ubuf = new char[ulength];
+      if (!lz::Uncompress(data, n, dict, ubuf)) {
+        delete[] buf;
+        delete[] ubuf;
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      delete[] buf;
+      result->data = Slice(ubuf, ulength);
+      result->heap_allocated = true;
+      result->cachable = true;
+      break;
+    }
     default:
       delete[] buf;
       return Status::Corruption("bad block type");
@@ -75,6 +75,19 @@ class Footer {
   BlockHandle index_handle_;
 };
 
+// Metaindex key present in tables whose index block is a top-level
+// index over index partitions (see Options::index_partition_size).
+static const char kPartitionedIndexMetaKey[] = "index.partitioned";
+
+// Metaindex key of the dictionary that the data blocks of a table are
+// compressed against (see Options::compression_dict_size).
+static const char kCompressionDictMetaKey[] = "compression.dict";
+
+// Block type of data blocks compressed with kLZCompression against the
+// table's dictionary.  It is not a CompressionType since it can only be
+// chosen together with a dictionary.
+static const char kLZDictBlockType = 0x3;
+
 // kTableMagicNumber was picked by running
 //    echo http://code.google.com/p/leveldb/ | sha1sum
 // and taking the leading 64 bits.
@@ -91,10 +104,31 @@ struct BlockContents {
 
 // Read the block identified by "handle" from "file".  On failure
 // return non-OK.  On success fill *result and return OK.
+// "compression_dict" is the dictionary of the table the block belongs
+// to, if it has one.
 extern Status ReadBlock(RandomAccessFile* file,
                         const ReadOptions& options,
                         const BlockHandle& handle,
-                        BlockContents* result);
+                        BlockContents* result,
+                        const Slice& compression_dict);
+
+// Finish a read of the block identified by "handle" whose raw contents,
+// trailer included, are "contents": verify and decompress them into
+// *result.  "buf" is the scratch buffer of the read, allocated with
+// new[]; it is deleted unless *result ends up pointing into it.
+extern Status DecodeBlock(const ReadOptions& options,
+                          const BlockHandle& handle,
+                          char* buf,
+                          const Slice& contents,
+                          BlockContents* result,
+                          const Slice& compression_dict);
+
+inline Status ReadBlock(RandomAccessFile* file,
+                        const ReadOptions& options,
+                        const BlockHandle& handle,
+                        BlockContents* result) {
+  return ReadBlock(file, options, handle, result, Slice());
+}
 
 // Implementation details follow.  Clients should ignore,
 
@@ -9,16 +9,27 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 #include "table/block.h"
 #include "table/filter_block.h"
 #include "table/format.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
 struct Table::Rep {
   ~Rep() {
+    Cache::Handle* h;
+    if ((h = reinterpret_cast<Cache::Handle*>(pinned_index.NoBarrier_Load()))
+        != NULL) {
+      options.block_cache->Release(h);
+    }
+    if ((h = reinterpret_cast<Cache::Handle*>(pinned_filter.NoBarrier_Load()))
+        != NULL) {
+      options.block_cache->Release(h);
+    }
     delete filter;
     delete [] filter_data;
     delete index_block;
@@ -28,13 +39,198 @@ struct Table::Rep {
   Status status;
   RandomAccessFile* file;
   uint64_t cache_id;
-  FilterBlockReader* filter;
+  FilterBlockReader* filter;     // NULL if there is none or it is cached
   const char* filter_data;
+  bool filter_in_cache;          // Filter lives in options.block_cache
+  BlockHandle filter_handle;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
-  Block* index_block;
+  BlockHandle index_handle;
+  Block* index_block;            // NULL if the index lives in the block cache
+  bool partitioned_index;        // Index entries point at index partitions
+  std::string compression_dict;  // Data blocks are compressed against it
+
+  // Block cache handles held by PinMetaBlocks() for the table's lifetime
+  port::Mutex pin_mutex;
+  port::AtomicPointer pin_done;
+  port::AtomicPointer pinned_index;
+  port::AtomicPointer pinned_filter;
+
+  Status ReadCachedBlock(const ReadOptions& read_options,
+                         const BlockHandle& handle, Cache::Priority priority,
+                         Block** block, Cache::Handle** cache_handle);
+  Iterator* BlockIterator(const ReadOptions& read_options,
+                          const Slice& index_value, Cache::Priority priority);
+  Iterator* NewIndexIterator(Table* table, const ReadOptions& read_options);
+  FilterBlockReader* GetFilter(Cache::Handle** cache_handle);
+};
+
+// A filter block kept in the block cache
+struct CachedFilter {
+  FilterBlockReader* reader;
+  const char* data;
 };
 
+static void DeleteBlock(void* arg, void* ignored) {
+  delete reinterpret_cast<Block*>(arg);
+}
+
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  Block* block = reinterpret_cast<Block*>(value);
+  delete block;
+}
+
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  CachedFilter* filter = reinterpret_cast<CachedFilter*>(value);
+  delete filter->reader;
+  delete [] filter->data;
+  delete filter;
+}
+
+static void ReleaseBlock(void* arg, void* h) {
+  Cache* cache = reinterpret_cast<Cache*>(arg);
+  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
+  cache->Release(handle);
+}
+
+static Slice BlockCacheKey(uint64_t cache_id, const BlockHandle& handle,
+                           char* buf) {
+  EncodeFixed64(buf, cache_id);
+  EncodeFixed64(buf+8, handle.offset());
+  return Slice(buf, 16);
+}
+
+// Read the block at "handle", through the block cache if there is one.
+// If *cache_handle is set on return, *block is owned by the cache and the
+// caller must release the handle; otherwise the caller owns *block.
+Status Table::Rep::ReadCachedBlock(const ReadOptions& read_options,
+                                   const BlockHandle& handle,
+                                   Cache::Priority priority,
+                                   Block** block,
+                                   Cache::Handle** cache_handle) {
+  Cache* block_cache = options.block_cache;
+  *block = NULL;
+  *cache_handle = NULL;
+
+  Status s;
+  BlockContents contents;
+  if (block_cache != NULL) {
+    char cache_key_buffer[16];
+    Slice key = BlockCacheKey(cache_id, handle, cache_key_buffer);
+    *cache_handle = block_cache->Lookup(key);
+    if (*cache_handle != NULL) {
+      *block = reinterpret_cast<Block*>(block_cache->Value(*cache_handle));
+    } else {
+      s = ReadBlock(file, read_options, handle, &contents, compression_dict);
+      if (s.ok()) {
+        *block = new Block(contents);
+        // Index partitions are cached even when scans ask not to fill
+        // the cache, since every read goes through them.
+        if (contents.cachable &&
+            (read_options.fill_cache || priority == Cache::HIGH)) {
+          *cache_handle = block_cache->Insert(
+              key, *block, (*block)->size(), &DeleteCachedBlock, priority);
+        }
+      }
+    }
+  } else {
+    s = ReadBlock(file, read_options, handle, &contents, compression_dict);
+    if (s.ok()) {
+      *block = new Block(contents);
+    }
+  }
+  return s;
+}
+
+// Convert an index iterator value (i.e., an encoded BlockHandle)
+// into an iterator over the contents of the corresponding block.
+Iterator* Table::Rep::BlockIterator(const ReadOptions& read_options,
+                                    const Slice& index_value,
+                                    Cache::Priority priority) {
+  Block* block = NULL;
+  Cache::Handle* cache_handle = NULL;
+
+  BlockHandle handle;
+  Slice input = index_value;
+  Status s = handle.DecodeFrom(&input);
+  // We intentionally allow extra stuff in index_value so that we
+  // can add more features in the future.
+
+  if (s.ok()) {
+    s = ReadCachedBlock(read_options, handle, priority, &block, &cache_handle);
+  }
+
+  Iterator* iter;
+  if (block != NULL) {
+    iter = block->NewIterator(options.comparator);
+    if (cache_handle == NULL) {
+      iter->RegisterCleanup(&DeleteBlock, block, NULL);
+    } else {
+      iter->RegisterCleanup(&ReleaseBlock, options.block_cache, cache_handle);
+    }
+  } else {
+    iter = NewErrorIterator(s);
+  }
+  return iter;
+}
+
+// Return an iterator whose values are the handles of the data blocks.
+Iterator* Table::Rep::NewIndexIterator(Table* table,
+                                       const ReadOptions& read_options) {
+  Iterator* iter;
+  Cache::Handle* pinned =
+      reinterpret_cast<Cache::Handle*>(pinned_index.Acquire_Load());
+  if (index_block != NULL) {
+    iter = index_block->NewIterator(options.comparator);
+  } else if (pinned != NULL) {
+    Block* block = reinterpret_cast<Block*>(options.block_cache->Value(pinned));
+    iter = block->NewIterator(options.comparator);
+  } else {
+    std::string encoding;
+    index_handle.EncodeTo(&encoding);
+    iter = BlockIterator(read_options, encoding, Cache::HIGH);
+  }
+  if (partitioned_index) {
+    iter = NewTwoLevelIterator(iter, &Table::PartitionReader, table,
+                               read_options);
+  }
+  return iter;
+}
+
+// Return the filter of the table, or NULL if it has none.  If the filter
+// lives in the block cache, *cache_handle holds a reference to it that
+// the caller must release.
+FilterBlockReader* Table::Rep::GetFilter(Cache::Handle** cache_handle) {
+  *cache_handle = NULL;
+  if (!filter_in_cache) {
+    return filter;
+  }
+  Cache* block_cache = options.block_cache;
+  Cache::Handle* pinned =
+      reinterpret_cast<Cache::Handle*>(pinned_filter.Acquire_Load());
+  if (pinned != NULL) {
+    return reinterpret_cast<CachedFilter*>(block_cache->Value(pinned))->reader;
+  }
+
+  char cache_key_buffer[16];
+  Slice key = BlockCacheKey(cache_id, filter_handle, cache_key_buffer);
+  *cache_handle = block_cache->Lookup(key);
+  if (*cache_handle == NULL) {
+    BlockContents block;
+    if (!ReadBlock(file, ReadOptions(), filter_handle, &block).ok()) {
+      return NULL;  // Reads can still be served without the filter
+    }
+    assert(block.heap_allocated);
+    CachedFilter* f = new CachedFilter;
+    f->data = block.data.data();
+    f->reader = new FilterBlockReader(options.filter_policy, block.data);
+    *cache_handle = block_cache->Insert(key, f, block.data.size(),
+                                        &DeleteCachedFilter, Cache::HIGH);
+  }
+  return reinterpret_cast<CachedFilter*>(
+      block_cache->Value(*cache_handle))->reader;
+}
+
 Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
@@ -71,12 +267,34 @@ Status Table::Open(const Options& options,
     rep->options = options;
     rep->file = file;
     rep->metaindex_handle = footer.metaindex_handle();
+    rep->index_handle = footer.index_handle();
     rep->index_block = index_block;
+    rep->partitioned_index = false;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = NULL;
     rep->filter = NULL;
+    rep->filter_in_cache = false;
+    rep->pin_done.NoBarrier_Store(NULL);
+    rep->pinned_index.NoBarrier_Store(NULL);
+    rep->pinned_filter.NoBarrier_Store(NULL);
+    if (options.cache_index_and_filter_blocks &&
+        options.block_cache != NULL && contents.cachable) {
+      // Hand the index block over to the block cache.  Blocks that are
+      // not cachable point into a mmap()ed file and stay with the table.
+      char cache_key_buffer[16];
+      Slice key = BlockCacheKey(rep->cache_id, rep->index_handle,
+                                cache_key_buffer);
+      options.block_cache->Release(options.block_cache->Insert(
+          key, index_block, index_block->size(), &DeleteCachedBlock,
+          Cache::HIGH));
+      rep->index_block = NULL;
+    }
     *table = new Table(rep);
-    (*table)->ReadMeta(footer);
+    s = (*table)->ReadMeta(footer);
+    if (!s.ok()) {
+      delete *table;
+      *table = NULL;
+    }
   } else {
     if (index_block) delete index_block;
   }
@@ -84,30 +302,59 @@ Status Table::Open(const Options& options,
   return s;
 }
 
-void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == NULL) {
-    return;  // Do not need any metadata
-  }
-
+Status Table::ReadMeta(const Footer& footer) {
   // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
   // it is an empty block.
   ReadOptions opt;
   BlockContents contents;
-  if (!ReadBlock(rep_->file, opt, footer.metaindex_handle(), &contents).ok()) {
-    // Do not propagate errors since meta info is not needed for operation
-    return;
+  Status s = ReadBlock(rep_->file, opt, footer.metaindex_handle(), &contents);
+  if (!s.ok()) {
+    // The metaindex tells us how to interpret the index, so a table whose
+    // metaindex cannot be read is unusable.
+    return s;
   }
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
-  iter->Seek(key);
-  if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+  if (rep_->options.filter_policy != NULL) {
+    std::string key = "filter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadFilter(iter->value());
+    }
+  }
+  iter->Seek(kPartitionedIndexMetaKey);
+  if (iter->Valid() && iter->key() == Slice(kPartitionedIndexMetaKey)) {
+    rep_->partitioned_index = true;
+  }
+  iter->Seek(kCompressionDictMetaKey);
+  if (iter->Valid() && iter->key() == Slice(kCompressionDictMetaKey)) {
+    // Without its dictionary no data block of the table can be read
+    s = ReadCompressionDict(iter->value());
   }
   delete iter;
   delete meta;
+  return s;
+}
+
+Status Table::ReadCompressionDict(const Slice& dict_handle_value) {
+  Slice v = dict_handle_value;
+  BlockHandle dict_handle;
+  Status s = dict_handle.DecodeFrom(&v);
+  BlockContents block;
+  if (s.ok()) {
+    ReadOptions opt;
+    opt.verify_checksums = true;
+    s = ReadBlock(rep_->file, opt, dict_handle, &block);
+  }
+  if (s.ok()) {
+    rep_->compression_dict.assign(block.data.data(), block.data.size());
+    if (block.heap_allocated) {
+      delete[] block.data.data();
+    }
+  }
+  return s;
 }
 
 void Table::ReadFilter(const Slice& filter_handle_value) {
@@ -124,6 +371,20 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
     return;
   }
+  if (rep_->options.cache_index_and_filter_blocks &&
+      rep_->options.block_cache != NULL && block.heap_allocated) {
+    CachedFilter* f = new CachedFilter;
+    f->data = block.data.data();
+    f->reader = new FilterBlockReader(rep_->options.filter_policy, block.data);
+    char cache_key_buffer[16];
+    Slice key = BlockCacheKey(rep_->cache_id, filter_handle, cache_key_buffer);
+    Cache* block_cache = rep_->options.block_cache;
+    block_cache->Release(block_cache->Insert(
+        key, f, block.data.size(), &DeleteCachedFilter, Cache::HIGH));
+    rep_->filter_in_cache = true;
+    rep_->filter_handle = filter_handle;
+    return;
+  }
   if (block.heap_allocated) {
     rep_->filter_data = block.data.data();     // Will need to delete later
   }
@@ -134,94 +395,74 @@ Table::~Table() {
   delete rep_;
 }
 
-static void DeleteBlock(void* arg, void* ignored) {
-  delete reinterpret_cast<Block*>(arg);
-}
-
-static void DeleteCachedBlock(const Slice& key, void* value) {
-  Block* block = reinterpret_cast<Block*>(value);
-  delete block;
-}
-
-static void ReleaseBlock(void* arg, void* h) {
-  Cache* cache = reinterpret_cast<Cache*>(arg);
-  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
-  cache->Release(handle);
+void Table::PinMetaBlocks() {
+  Rep* r = rep_;
+  if (r->pin_done.Acquire_Load() != NULL) {
+    return;
+  }
+  MutexLock l(&r->pin_mutex);
+  if (r->pin_done.NoBarrier_Load() != NULL) {
+    return;
+  }
+  if (r->index_block == NULL) {
+    Block* block;
+    Cache::Handle* handle;
+    Status s = r->ReadCachedBlock(ReadOptions(), r->index_handle, Cache::HIGH,
+                                  &block, &handle);
+    if (handle != NULL) {
+      r->pinned_index.Release_Store(handle);
+    } else {
+      delete block;
+    }
+  }
+  if (r->filter_in_cache) {
+    Cache::Handle* handle;
+    r->GetFilter(&handle);
+    if (handle != NULL) {
+      r->pinned_filter.Release_Store(handle);
+    }
+  }
+  r->pin_done.Release_Store(r);
 }
 
-// Convert an index iterator value (i.e., an encoded BlockHandle)
-// into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
                              const ReadOptions& options,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
-  Cache* block_cache = table->rep_->options.block_cache;
-  Block* block = NULL;
-  Cache::Handle* cache_handle = NULL;
-
-  BlockHandle handle;
-  Slice input = index_value;
-  Status s = handle.DecodeFrom(&input);
-  // We intentionally allow extra stuff in index_value so that we
-  // can add more features in the future.
-
-  if (s.ok()) {
-    BlockContents contents;
-    if (block_cache != NULL) {
-      char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
-      EncodeFixed64(cache_key_buffer+8, handle.offset());
-      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
-      cache_handle = block_cache->Lookup(key);
-      if (cache_handle != NULL) {
-        block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
-      } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
-        if (s.ok()) {
-          block = new Block(contents);
-          if (contents.cachable && options.fill_cache) {
-            cache_handle = block_cache->Insert(
-                key, block, block->size(), &DeleteCachedBlock);
-          }
-        }
-      }
-    } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
-      if (s.ok()) {
-        block = new Block(contents);
-      }
-    }
-  }
+  return table->rep_->BlockIterator(options, index_value, Cache::LOW);
+}
 
-  Iterator* iter;
-  if (block != NULL) {
-    iter = block->NewIterator(table->rep_->options.comparator);
-    if (cache_handle == NULL) {
-      iter->RegisterCleanup(&DeleteBlock, block, NULL);
-    } else {
-      iter->RegisterCleanup(&ReleaseBlock, block_cache, cache_handle);
-    }
-  } else {
-    iter = NewErrorIterator(s);
-  }
-  return iter;
+// Convert a top-level index value into an iterator over the corresponding
+// index partition.
+Iterator* Table::PartitionReader(void* arg,
+                                 const ReadOptions& options,
+                                 const Slice& index_value) {
+  Table* table = reinterpret_cast<Table*>(arg);
+  return table->rep_->BlockIterator(options, index_value, Cache::HIGH);
 }
 
 Iterator* Table::NewIterator(const ReadOptions& options) const {
+  Table* table = const_cast<Table*>(this);
   return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+      rep_->NewIndexIterator(table, options),
+      &Table::BlockReader, table, options, rep_->options.comparator);
+}
+
+static void DeleteIterator(void* arg, void* ignored) {
+  delete reinterpret_cast<Iterator*>(arg);
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
-                          void (*saver)(void*, const Slice&, const Slice&)) {
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          PinnableSlice* pinned) {
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter = rep_->NewIndexIterator(this, options);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
+    Cache::Handle* filter_handle;
+    FilterBlockReader* filter = rep_->GetFilter(&filter_handle);
     BlockHandle handle;
     if (filter != NULL &&
         handle.DecodeFrom(&handle_value).ok() &&
@@ -234,7 +475,15 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
         (*saver)(arg, block_iter->key(), block_iter->value());
       }
       s = block_iter->status();
-      delete block_iter;
+      if (pinned != NULL && block_iter->Valid()) {
+        // The iterator holds the block (or its cache handle)
+        pinned->RegisterCleanup(&DeleteIterator, block_iter, NULL);
+      } else {
+        delete block_iter;
+      }
+    }
+    if (filter_handle != NULL) {
+      rep_->options.block_cache->Release(filter_handle);
     }
   }
   if (s.ok()) {
@@ -244,10 +493,165 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
   return s;
 }
 
+void Table::InternalMultiGet(
+    const ReadOptions& options, int n, const Slice* keys,
+    void* const* args, Status* statuses,
+    void (*saver)(void*, const Slice&, const Slice&)) {
+  Iterator* iiter = rep_->NewIndexIterator(this, options);
+  Cache::Handle* filter_handle;
+  FilterBlockReader* filter = rep_->GetFilter(&filter_handle);
+
+  // The keys are sorted, so lookups that land in the same data block
+  // are adjacent and can share one read of it.
+  Iterator* block_iter = NULL;
+  std::string block_handle;
+  for (int i = 0; i < n; i++) {
+    const Slice& k = keys[i];
+    Status s;
+    iiter->Seek(k);
+    if (iiter->Valid()) {
+      Slice handle_value = iiter->value();
+      BlockHandle handle;
+      if (filter != NULL &&
+          handle.DecodeFrom(&handle_value).ok() &&
+          !filter->KeyMayMatch(handle.offset(), k)) {
+        // Not found
+      } else {
+        if (block_iter == NULL || iiter->value() != Slice(block_handle)) {
+          delete block_iter;
+          block_iter = BlockReader(this, options, iiter->value());
+          block_handle = iiter->value().ToString();
+        }
+        block_iter->Seek(k);
+        if (block_iter->Valid()) {
+          (*saver)(args[i], block_iter->key(), block_iter->value());
+        }
+        s = block_iter->status();
+      }
+    }
+    if (s.ok()) {
+      s = iiter->status();
+    }
+    statuses[i] = s;
+  }
+
+  delete block_iter;
+  if (filter_handle != NULL) {
+    rep_->options.block_cache->Release(filter_handle);
+  }
+  delete iiter;
+}
+
+void Table::AddBlockReads(const ReadOptions& options, int n,
+                          const Slice* keys, bool use_filter,
+                          std::vector<ReadRequest>* reads) {
+  Cache* block_cache = rep_->options.block_cache;
+  if (block_cache == NULL) {
+    return;
+  }
+  Iterator* iiter = rep_->NewIndexIterator(this, options);
+  Cache::Handle* filter_handle = NULL;
+  FilterBlockReader* filter =
+      use_filter ? rep_->GetFilter(&filter_handle) : NULL;
+
+  // The keys are sorted, so lookups that land in the same data block
+  // are adjacent.
+  std::string last_handle;
+  for (int i = 0; i < n; i++) {
+    iiter->Seek(keys[i]);
+    if (!iiter->Valid()) {
+      break;
+    }
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    if (!handle.DecodeFrom(&handle_value).ok() ||
+        (filter != NULL && !filter->KeyMayMatch(handle.offset(), keys[i])) ||
+        iiter->value() == Slice(last_handle)) {
+      continue;
+    }
+    last_handle = iiter->value().ToString();
+
+    char cache_key_buffer[16];
+    Cache::Handle* cache_handle = block_cache->Lookup(
+        BlockCacheKey(rep_->cache_id, handle, cache_key_buffer));
+    if (cache_handle != NULL) {
+      block_cache->Release(cache_handle);
+      continue;
+    }
+    ReadRequest read;
+    read.file = rep_->file;
+    read.offset = handle.offset();
+    read.n = static_cast<size_t>(handle.size()) + kBlockTrailerSize;
+    read.scratch = new char[read.n];
+    reads->push_back(read);
+  }
+
+  if (filter_handle != NULL) {
+    block_cache->Release(filter_handle);
+  }
+  delete iiter;
+}
+
+void Table::InsertBlockRead(const ReadOptions& options,
+                            const ReadRequest& read) {
+  if (!read.status.ok()) {
+    // The lookup that needs the block will run into the error again
+    delete[] read.scratch;
+    return;
+  }
+  BlockHandle handle;
+  handle.set_offset(read.offset);
+  handle.set_size(read.n - kBlockTrailerSize);
+  BlockContents contents;
+  Status s = DecodeBlock(options, handle, read.scratch, read.result,
+                         &contents, rep_->compression_dict);
+  if (!s.ok()) {
+    return;
+  }
+  Block* block = new Block(contents);
+  if (contents.cachable) {
+    Cache* block_cache = rep_->options.block_cache;
+    char cache_key_buffer[16];
+    Slice key = BlockCacheKey(rep_->cache_id, handle, cache_key_buffer);
+    block_cache->Release(block_cache->Insert(
+        key, block, block->size(), &DeleteCachedBlock, Cache::LOW));
+  } else {
+    delete block;
+  }
+}
+
+bool Table::PrefixMayMatch(const ReadOptions& options, const Slice& k) {
+  // Keys sharing a prefix are contiguous and the prefix sorts before
+  // all of them, so if any key in the table has the prefix then the
+  // first of them lives in the data block that a seek to "k" lands in,
+  // and the prefix was added to that block's filter.
+  bool may_match = true;
+  Iterator* iiter = rep_->NewIndexIterator(this, options);
+  iiter->Seek(k);
+  if (iiter->Valid()) {
+    Slice handle_value = iiter->value();
+    Cache::Handle* filter_handle;
+    FilterBlockReader* filter = rep_->GetFilter(&filter_handle);
+    BlockHandle handle;
+    if (filter != NULL &&
+        handle.DecodeFrom(&handle_value).ok() &&
+        !filter->KeyMayMatch(handle.offset(), k)) {
+      may_match = false;
+    }
+    if (filter_handle != NULL) {
+      rep_->options.block_cache->Release(filter_handle);
+    }
+  } else if (iiter->status().ok()) {
+    // Every key in the table sorts before the prefix.
+    may_match = false;
+  }
+  delete iiter;
+  return may_match;
+}
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
   Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+      rep_->NewIndexIterator(const_cast<Table*>(this), ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -5,6 +5,7 @@
 #include "leveldb/table_builder.h"
 
 #include <assert.h>
+#include <deque>
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
@@ -14,9 +15,127 @@
 #include "table/format.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/lz.h"
+#include "util/mutexlock.h"
+#include "util/work_queue.h"
 
 namespace leveldb {
 
+namespace {
+
+// Tables are sampled for a dictionary until their data blocks hold this
+// many times options.compression_dict_size bytes.  Smaller tables are
+// not worth a dictionary.
+static const size_t kDictSampleRatio = 16;
+
+// A data block that is compressed apart from the call to Add() that
+// filled it
+struct PendingBlock {
+  std::string raw;            // Uncompressed contents
+  std::string keys;           // Length-prefixed keys, for the filter block
+  CompressionType type;       // Requested compression
+  const lz::Dictionary* dict; // Dictionary for kLZCompression, or NULL
+  char block_type;            // Actual compression, valid when done
+  std::string compressed;     // Valid if block_type != kNoCompression
+  char trailer[kBlockTrailerSize];
+  bool done;                  // Compressed and checksummed; guarded by *mu
+  port::Mutex* mu;
+  port::CondVar* done_cv;     // Signalled once done is set
+
+  // Set once the block has been written to the file
+  bool written;
+  BlockHandle handle;
+
+  // Set once the first key of the next block, or the end of the table,
+  // determines the key of the block's index entry
+  bool has_index_key;
+  std::string index_key;
+
+  Slice contents() const {
+    return block_type == kNoCompression ? Slice(raw) : Slice(compressed);
+  }
+};
+
+// Compress "raw" with "*type".  Falls back to storing the block
+// uncompressed (and sets *type to kNoCompression) if the compression
+// is not supported or does not save enough space.
+Slice CompressBlock(const Slice& raw, CompressionType* type,
+                    std::string* compressed) {
+  switch (*type) {
+    case kNoCompression:
+      break;
+
+    case kSnappyCompression: {
+      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
+          compressed->size() < raw.size() - (raw.size() / 8u)) {
+        return *compressed;
+      }
+      // Snappy not supported, or compressed less than 12.5%, so just
+      // store uncompressed form
+      break;
+    }
+
+    case kLZCompression: {
+      if (lz::Compress(raw.data(), raw.size(), compressed) &&
+          compressed->size() < raw.size() - (raw.size() / 8u)) {
+        return *compressed;
+      }
+      break;
+    }
+  }
+  *type = kNoCompression;
+  return raw;
+}
+
+void BuildTrailer(const Slice& block_contents, char type, char* trailer) {
+  trailer[0] = type;
+  uint32_t crc = crc32c::Value(block_contents.data(), block_contents.size());
+  crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
+  EncodeFixed32(trailer+1, crc32c::Mask(crc));
+}
+
+void CompressPendingBlock(PendingBlock* b) {
+  Slice contents;
+  if (b->dict != NULL && b->type == kLZCompression) {
+    const size_t n = b->raw.size();
+    if (lz::Compress(b->raw.data(), n, b->dict, &b->compressed) &&
+        b->compressed.size() < n - (n / 8u)) {
+      b->block_type = kLZDictBlockType;
+      contents = b->compressed;
+    } else {
+      b->block_type = kNoCompression;
+      contents = b->raw;
+    }
+  } else {
+    CompressionType type = b->type;
+    contents = CompressBlock(b->raw, &type, &b->compressed);
+    b->block_type = type;
+  }
+  BuildTrailer(contents, b->block_type, b->trailer);
+}
+
+// WorkQueue task that compresses a PendingBlock
+void CompressTask(void* arg) {
+  PendingBlock* b = reinterpret_cast<PendingBlock*>(arg);
+  CompressPendingBlock(b);
+  MutexLock l(b->mu);
+  b->done = true;
+  b->done_cv->SignalAll();
+}
+
+// Queue "b" for compression on "*queue", which is created on first use
+void QueueBlock(const Options& options, WorkQueue** queue, PendingBlock* b) {
+  if (*queue == NULL) {
+    // The thread calling Add() compresses blocks as well while it waits
+    // for one, so ask the pool for one thread less than requested.
+    *queue = new WorkQueue(options.env, Env::LOW,
+                           options.compression_threads - 1);
+  }
+  (*queue)->Add(&CompressTask, b);
+}
+
+}  // namespace
+
 struct TableBuilder::Rep {
   Options options;
   Options index_block_options;
@@ -24,7 +143,9 @@ struct TableBuilder::Rep {
   uint64_t offset;
   Status status;
   BlockBuilder data_block;
-  BlockBuilder index_block;
+  BlockBuilder index_block;     // Current partition if partitioning index
+  BlockBuilder top_index_block; // Maps last key of a partition to its handle
+  std::string last_index_key;   // Last key added to index_block
   std::string last_key;
   int64_t num_entries;
   bool closed;          // Either Finish() or Abandon() has been called.
@@ -44,24 +165,51 @@ struct TableBuilder::Rep {
 
   std::string compressed_output;
 
-  Rep(const Options& opt, WritableFile* f)
+  // If options.compression_threads > 1, full data blocks are compressed
+  // by threads of the LOW pool of options.env as well as by the thread
+  // calling Add(), which writes them to the file in order.  The same is done with a single thread to hold
+  // back the first blocks of a table until its compression dictionary
+  // has been trained from them.  pending_index_entry then means that the
+  // last block in "blocks" still waits for the key of its index entry.
+  bool deferred;
+  port::Mutex mu;
+  port::CondVar done_cv;              // Signalled when a block is done
+  WorkQueue* queue;                   // Blocks to compress, or NULL
+  std::deque<PendingBlock*> blocks;  // Blocks not yet written and indexed
+  std::string block_keys;             // Keys of data_block for the filter
+
+  // Set while the data blocks in "blocks" are samples for the dictionary
+  bool sampling;
+  size_t sample_bytes;
+  lz::Dictionary* dict;               // NULL if there is none
+
+  Rep(const Options& opt, WritableFile* f, bool use_dict)
       : options(opt),
         index_block_options(opt),
         file(f),
         offset(0),
         data_block(&options),
         index_block(&index_block_options),
+        top_index_block(&index_block_options),
         num_entries(0),
         closed(false),
         filter_block(opt.filter_policy == NULL ? NULL
                      : new FilterBlockBuilder(opt.filter_policy)),
-        pending_index_entry(false) {
+        pending_index_entry(false),
+        deferred(opt.compression_threads > 1 || use_dict),
+        done_cv(&mu),
+        queue(NULL),
+        sampling(use_dict),
+        sample_bytes(0),
+        dict(NULL) {
     index_block_options.block_restart_interval = 1;
   }
 };
 
 TableBuilder::TableBuilder(const Options& options, WritableFile* file)
-    : rep_(new Rep(options, file)) {
+    : rep_(new Rep(options, file,
+                   options.compression == kLZCompression &&
+                   options.compression_dict_size > 0)) {
   if (rep_->filter_block != NULL) {
     rep_->filter_block->StartBlock(0);
   }
@@ -70,6 +218,7 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
   delete rep_->filter_block;
+  delete rep_->dict;
   delete rep_;
 }
 
@@ -80,6 +229,18 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.index_partition_size != rep_->options.index_partition_size) {
+    return Status::InvalidArgument(
+        "changing index partitioning while building table");
+  }
+  if (options.compression_threads != rep_->options.compression_threads) {
+    return Status::InvalidArgument(
+        "changing compression threads while building table");
+  }
+  if (options.compression_dict_size != rep_->options.compression_dict_size) {
+    return Status::InvalidArgument(
+        "changing compression dictionary while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -100,14 +261,27 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
     r->options.comparator->FindShortestSeparator(&r->last_key, key);
-    std::string handle_encoding;
-    r->pending_handle.EncodeTo(&handle_encoding);
-    r->index_block.Add(r->last_key, Slice(handle_encoding));
+    if (r->deferred) {
+      // The entry is added once the block has been written
+      PendingBlock* b = r->blocks.back();
+      b->index_key = r->last_key;
+      b->has_index_key = true;
+    } else {
+      std::string handle_encoding;
+      r->pending_handle.EncodeTo(&handle_encoding);
+      AddIndexEntry(r->last_key, Slice(handle_encoding));
+    }
     r->pending_index_entry = false;
   }
 
   if (r->filter_block != NULL) {
-    r->filter_block->AddKey(key);
+    if (r->deferred) {
+      // The filter needs the offset of the block, which is not known
+      // until the blocks before it have been compressed.
+      PutLengthPrefixedSlice(&r->block_keys, key);
+    } else {
+      r->filter_block->AddKey(key);
+    }
   }
 
   r->last_key.assign(key.data(), key.size());
@@ -126,6 +300,12 @@ void TableBuilder::Flush() {
   if (!ok()) return;
   if (r->data_block.empty()) return;
   assert(!r->pending_index_entry);
+  if (r->deferred) {
+    SubmitBlock();
+    r->pending_index_entry = true;
+    WritePendingBlocks(false);
+    return;
+  }
   WriteBlock(&r->data_block, &r->pending_handle);
   if (ok()) {
     r->pending_index_entry = true;
@@ -136,6 +316,153 @@ void TableBuilder::Flush() {
   }
 }
 
+void TableBuilder::SubmitBlock() {
+  Rep* r = rep_;
+  PendingBlock* b = new PendingBlock;
+  Slice raw = r->data_block.Finish();
+  b->raw.assign(raw.data(), raw.size());
+  b->keys.swap(r->block_keys);
+  b->type = r->options.compression;
+  b->dict = r->dict;
+  b->done = false;
+  b->mu = &r->mu;
+  b->done_cv = &r->done_cv;
+  b->written = false;
+  b->has_index_key = false;
+  r->data_block.Reset();
+  r->blocks.push_back(b);
+
+  if (r->sampling) {
+    r->sample_bytes += b->raw.size();
+    if (r->sample_bytes >=
+        kDictSampleRatio * r->options.compression_dict_size) {
+      FinishSampling();
+    }
+  } else {
+    QueueBlock(r->options, &r->queue, b);
+  }
+}
+
+void TableBuilder::FinishSampling() {
+  Rep* r = rep_;
+  assert(r->sampling);
+  r->sampling = false;
+  if (r->sample_bytes >= kDictSampleRatio * r->options.compression_dict_size) {
+    std::string samples;
+    samples.reserve(r->sample_bytes);
+    for (size_t i = 0; i < r->blocks.size(); i++) {
+      samples.append(r->blocks[i]->raw);
+    }
+    std::string contents;
+    lz::TrainDictionary(samples, r->options.compression_dict_size, &contents);
+    if (!contents.empty()) {
+      r->dict = new lz::Dictionary(contents);
+    }
+  }
+
+  // Every block so far is a sample that has not been compressed yet
+  for (size_t i = 0; i < r->blocks.size(); i++) {
+    r->blocks[i]->dict = r->dict;
+    QueueBlock(r->options, &r->queue, r->blocks[i]);
+  }
+}
+
+void TableBuilder::WritePendingBlocks(bool finish) {
+  Rep* r = rep_;
+  // Bounds the memory held by blocks waiting to be written
+  const size_t max_blocks = 4 * r->options.compression_threads;
+  while (ok() && !r->blocks.empty()) {
+    PendingBlock* b = r->blocks.front();
+    if (!b->written) {
+      {
+        MutexLock l(&r->mu);
+        while (!b->done) {
+          if (!finish && (r->sampling || r->blocks.size() <= max_blocks)) {
+            return;
+          }
+          r->mu.Unlock();
+          const bool ran = r->queue->RunOne();
+          r->mu.Lock();
+          if (!ran && !b->done) {
+            // A pool thread is compressing the block
+            r->done_cv.Wait();
+          }
+        }
+      }
+
+      if (r->filter_block != NULL) {
+        r->filter_block->StartBlock(r->offset);
+        Slice keys = b->keys;
+        Slice key;
+        while (GetLengthPrefixedSlice(&keys, &key)) {
+          r->filter_block->AddKey(key);
+        }
+      }
+      AppendBlock(b->contents(), b->trailer, &b->handle);
+      if (!ok()) {
+        break;
+      }
+      b->written = true;
+      r->status = r->file->Flush();
+      if (r->filter_block != NULL) {
+        r->filter_block->StartBlock(r->offset);
+      }
+    }
+
+    if (!b->has_index_key) {
+      // Only the last block can still wait for its index key
+      assert(r->blocks.size() == 1);
+      break;
+    }
+    std::string handle_encoding;
+    b->handle.EncodeTo(&handle_encoding);
+    AddIndexEntry(b->index_key, Slice(handle_encoding));
+    r->blocks.pop_front();
+    delete b;
+  }
+}
+
+void TableBuilder::StopCompression() {
+  Rep* r = rep_;
+  if (r->queue != NULL) {
+    r->queue->Close();
+    r->queue = NULL;
+  }
+  for (size_t i = 0; i < r->blocks.size(); i++) {
+    delete r->blocks[i];
+  }
+  r->blocks.clear();
+}
+
+void TableBuilder::AddIndexEntry(const Slice& key, const Slice& handle) {
+  Rep* r = rep_;
+  r->index_block.Add(key, handle);
+  if (r->options.index_partition_size > 0) {
+    r->last_index_key.assign(key.data(), key.size());
+    if (r->index_block.CurrentSizeEstimate() >=
+        r->options.index_partition_size) {
+      FlushIndexPartition();
+    }
+  }
+}
+
+void TableBuilder::FlushIndexPartition() {
+  Rep* r = rep_;
+  if (!ok() || r->index_block.empty()) return;
+  BlockHandle handle;
+  WriteBlock(&r->index_block, &handle);
+  if (ok()) {
+    std::string handle_encoding;
+    handle.EncodeTo(&handle_encoding);
+    r->top_index_block.Add(r->last_index_key, Slice(handle_encoding));
+  }
+  if (r->filter_block != NULL && !r->closed) {
+    // Keys of the next data block belong to the filter for the offset
+    // it will be written at, which is past this partition.
+    r->filter_block->StartBlock(r->offset);
+  }
+}
+
 void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   // File format contains a sequence of blocks where each block has:
   //    block_data: uint8[n]
@@ -145,28 +472,8 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   Rep* r = rep_;
   Slice raw = block->Finish();
 
-  Slice block_contents;
   CompressionType type = r->options.compression;
-  // TODO(postrelease): Support more compression options: zlib?
-  switch (type) {
-    case kNoCompression:
-      block_contents = raw;
-      break;
-
-    case kSnappyCompression: {
-      std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
-          compressed->size() < raw.size() - (raw.size() / 8u)) {
-        block_contents = *compressed;
-      } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
-        // store uncompressed form
-        block_contents = raw;
-        type = kNoCompression;
-      }
-      break;
-    }
-  }
+  Slice block_contents = CompressBlock(raw, &type, &r->compressed_output);
   WriteRawBlock(block_contents, type, handle);
   r->compressed_output.clear();
   block->Reset();
@@ -175,16 +482,19 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
 void TableBuilder::WriteRawBlock(const Slice& block_contents,
                                  CompressionType type,
                                  BlockHandle* handle) {
+  char trailer[kBlockTrailerSize];
+  BuildTrailer(block_contents, type, trailer);
+  AppendBlock(block_contents, trailer, handle);
+}
+
+void TableBuilder::AppendBlock(const Slice& block_contents,
+                               const char* trailer,
+                               BlockHandle* handle) {
   Rep* r = rep_;
   handle->set_offset(r->offset);
   handle->set_size(block_contents.size());
   r->status = r->file->Append(block_contents);
   if (r->status.ok()) {
-    char trailer[kBlockTrailerSize];
-    trailer[0] = type;
-    uint32_t crc = crc32c::Value(block_contents.data(), block_contents.size());
-    crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
-    EncodeFixed32(trailer+1, crc32c::Mask(crc));
     r->status = r->file->Append(Slice(trailer, kBlockTrailerSize));
     if (r->status.ok()) {
       r->offset += block_contents.size() + kBlockTrailerSize;
@@ -199,10 +509,23 @@ Status TableBuilder::status() const {
 Status TableBuilder::Finish() {
   Rep* r = rep_;
   Flush();
+  if (r->deferred) {
+    if (r->sampling) {
+      FinishSampling();
+    }
+    // Write all data blocks, but add the index entry of the last one
+    // below like the single-threaded builder does.
+    WritePendingBlocks(true);
+    if (ok() && r->pending_index_entry) {
+      r->pending_handle = r->blocks.back()->handle;
+    }
+    StopCompression();
+  }
   assert(!r->closed);
   r->closed = true;
 
   BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+  BlockHandle dict_block_handle;
 
   // Write filter block
   if (ok() && r->filter_block != NULL) {
@@ -210,9 +533,19 @@ Status TableBuilder::Finish() {
                   &filter_block_handle);
   }
 
+  // Write compression dictionary
+  if (ok() && r->dict != NULL) {
+    WriteRawBlock(r->dict->contents(), kNoCompression, &dict_block_handle);
+  }
+
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
+    if (r->dict != NULL) {
+      std::string handle_encoding;
+      dict_block_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add(kCompressionDictMetaKey, handle_encoding);
+    }
     if (r->filter_block != NULL) {
       // Add mapping from "filter.Name" to location of filter data
       std::string key = "filter.";
@@ -221,6 +554,10 @@ Status TableBuilder::Finish() {
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
     }
+    if (r->options.index_partition_size > 0) {
+      // Readers must know that index entries point at index partitions
+      meta_index_block.Add(kPartitionedIndexMetaKey, Slice());
+    }
 
     // TODO(postrelease): Add stats and other meta blocks
     WriteBlock(&meta_index_block, &metaindex_block_handle);
@@ -232,10 +569,17 @@ Status TableBuilder::Finish() {
       r->options.comparator->FindShortSuccessor(&r->last_key);
       std::string handle_encoding;
       r->pending_handle.EncodeTo(&handle_encoding);
-      r->index_block.Add(r->last_key, Slice(handle_encoding));
+      AddIndexEntry(r->last_key, Slice(handle_encoding));
       r->pending_index_entry = false;
     }
-    WriteBlock(&r->index_block, &index_block_handle);
+    if (r->options.index_partition_size > 0) {
+      FlushIndexPartition();
+      if (ok()) {
+        WriteBlock(&r->top_index_block, &index_block_handle);
+      }
+    } else {
+      WriteBlock(&r->index_block, &index_block_handle);
+    }
   }
 
   // Write footer
@@ -256,6 +600,9 @@ Status TableBuilder::Finish() {
 void TableBuilder::Abandon() {
   Rep* r = rep_;
   assert(!r->closed);
+  if (r->deferred) {
+    StopCompression();
+  }
   r->closed = true;
 }
 
@@ -9,8 +9,10 @@
 #include "db/dbformat.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
 #include "leveldb/iterator.h"
 #include "leveldb/table_builder.h"
 #include "table/block.h"
@@ -247,6 +249,9 @@ class TableConstructor: public Constructor {
     source_ = new StringSource(sink.contents());
     Options table_options;
     table_options.comparator = options.comparator;
+    table_options.block_cache = options.block_cache;
+    table_options.cache_index_and_filter_blocks =
+        options.cache_index_and_filter_blocks;
     return Table::Open(table_options, source_, sink.contents().size(), &table_);
   }
 
@@ -398,6 +403,9 @@ class DBConstructor: public Constructor {
 
 enum TestType {
   TABLE_TEST,
+  PARTITIONED_TABLE_TEST,
+  PARALLEL_TABLE_TEST,
+  DICT_TABLE_TEST,
   BLOCK_TEST,
   MEMTABLE_TEST,
   DB_TEST
@@ -417,6 +425,19 @@ static const TestArgs kTestArgList[] = {
   { TABLE_TEST, true, 1 },
   { TABLE_TEST, true, 1024 },
 
+  // Partitioned index read through a small block cache
+  { PARTITIONED_TABLE_TEST, false, 16 },
+  { PARTITIONED_TABLE_TEST, false, 1 },
+  { PARTITIONED_TABLE_TEST, true, 16 },
+
+  // Data blocks compressed by background threads
+  { PARALLEL_TABLE_TEST, false, 16 },
+  { PARALLEL_TABLE_TEST, true, 16 },
+
+  // Data blocks compressed against a dictionary trained on the table
+  { DICT_TABLE_TEST, false, 16 },
+  { DICT_TABLE_TEST, true, 16 },
+
   { BLOCK_TEST, false, 16 },
   { BLOCK_TEST, false, 1 },
   { BLOCK_TEST, false, 1024 },
@@ -436,7 +457,7 @@ static const int kNumTestArgs = sizeof(kTestArgList) / sizeof(kTestArgList[0]);
 
 class Harness {
  public:
-  Harness() : constructor_(NULL) { }
+  Harness() : constructor_(NULL), cache_(NewLRUCache(4096)) { }
 
   void Init(const TestArgs& args) {
     delete constructor_;
@@ -454,6 +475,21 @@ class Harness {
       case TABLE_TEST:
         constructor_ = new TableConstructor(options_.comparator);
         break;
+      case PARTITIONED_TABLE_TEST:
+        options_.index_partition_size = 64;
+        options_.cache_index_and_filter_blocks = true;
+        options_.block_cache = cache_;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
+      case PARALLEL_TABLE_TEST:
+        options_.compression_threads = 4;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
+      case DICT_TABLE_TEST:
+        options_.compression = kLZCompression;
+        options_.compression_dict_size = 64;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
       case BLOCK_TEST:
         constructor_ = new BlockConstructor(options_.comparator);
         break;
@@ -468,6 +504,7 @@ class Harness {
 
   ~Harness() {
     delete constructor_;
+    delete cache_;
   }
 
   void Add(const std::string& key, const std::string& value) {
@@ -642,6 +679,7 @@ class Harness {
  private:
   Options options_;
   Constructor* constructor_;
+  Cache* cache_;
 };
 
 // Test empty table/block.
@@ -827,6 +865,41 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
 
 }
 
+TEST(TableTest, ApproximateOffsetOfPartitionedIndex) {
+  TableConstructor c(BytewiseComparator());
+  c.Add("k01", "hello");
+  c.Add("k02", "hello2");
+  c.Add("k03", std::string(10000, 'x'));
+  c.Add("k04", std::string(200000, 'x'));
+  c.Add("k05", std::string(300000, 'x'));
+  c.Add("k06", "hello3");
+  c.Add("k07", std::string(100000, 'x'));
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  options.index_partition_size = 1;  // One index entry per partition
+  c.Finish(options, &keys, &kvmap);
+
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("abc"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k01"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k03"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k04"),   10000,  11000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k05"),  210000, 211000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k07"),  510000, 511000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),  610000, 612000));
+
+  Iterator* iter = c.NewIterator();
+  iter->Seek("k05");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("k05", iter->key().ToString());
+  iter->Next();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("k06", iter->key().ToString());
+  delete iter;
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
@@ -861,6 +934,146 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),    4000,   6000));
 }
 
+TEST(TableTest, ApproximateOffsetOfLZCompressed) {
+  Random rnd(301);
+  TableConstructor c(BytewiseComparator());
+  std::string tmp;
+  c.Add("k01", "hello");
+  c.Add("k02", test::CompressibleString(&rnd, 0.25, 10000, &tmp));
+  c.Add("k03", "hello3");
+  c.Add("k04", test::CompressibleString(&rnd, 0.25, 10000, &tmp));
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kLZCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("abc"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k01"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k02"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k03"),    2000,   4000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k04"),    2000,   4000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),    4000,   8000));
+
+  Iterator* iter = c.NewIterator();
+  iter->Seek("k04");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(tmp, iter->value().ToString());
+  delete iter;
+}
+
+// Build a table of "n" random entries with "options" into "*contents"
+static void BuildRandomTable(const Options& options, int n,
+                             std::string* contents) {
+  Random rnd(301);
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  std::string value;
+  for (int i = 0; i < n; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "key%08d", i);
+    test::CompressibleString(&rnd, 0.5, rnd.Skewed(12), &value);
+    builder.Add(key, value);
+  }
+  ASSERT_OK(builder.Finish());
+  ASSERT_EQ(sink.contents().size(), builder.FileSize());
+  *contents = sink.contents();
+}
+
+TEST(TableTest, ParallelCompression) {
+  const FilterPolicy* filter_policy = NewBloomFilterPolicy(10);
+  Options options;
+  options.filter_policy = filter_policy;
+  options.index_partition_size = 256;
+  std::string serial;
+  BuildRandomTable(options, 20000, &serial);
+
+  // Blocks are compressed out of order, but the table must be the same
+  for (int threads = 2; threads <= 8; threads *= 2) {
+    options.compression_threads = threads;
+    std::string parallel;
+    BuildRandomTable(options, 20000, &parallel);
+    ASSERT_EQ(serial.size(), parallel.size());
+    ASSERT_TRUE(serial == parallel) << threads << " threads";
+  }
+
+  // Abandoning a table stops the threads
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  for (int i = 0; i < 1000; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "key%08d", i);
+    builder.Add(key, std::string(100, 'x'));
+  }
+  builder.Abandon();
+  delete filter_policy;
+}
+
+// Entries shaped like levelfs ones: long shared path prefixes in the
+// keys and small values full of the same names.
+static void AddPathEntries(TableConstructor* c, int n) {
+  Random rnd(301);
+  static const char* kDirs[] = { "src", "include", "lib", "docs", "tests" };
+  for (int i = 0; i < n; i++) {
+    char key[100];
+    snprintf(key, sizeof(key), "/home/user/projects/repo%02d/%s/file%06d.c",
+             static_cast<int>(rnd.Uniform(20)), kDirs[rnd.Uniform(5)], i);
+    char value[100];
+    snprintf(value, sizeof(value), "uid=1000 gid=1000 mode=0644 size=%d "
+             "owner=user group=user", static_cast<int>(rnd.Uniform(100000)));
+    c->Add(key, value);
+  }
+}
+
+TEST(TableTest, DictionaryCompression) {
+  Options options;
+  options.block_size = 1024;
+  options.compression = kLZCompression;
+  std::vector<std::string> keys;
+  KVMap kvmap;
+
+  TableConstructor plain(BytewiseComparator());
+  AddPathEntries(&plain, 5000);
+  plain.Finish(options, &keys, &kvmap);
+
+  options.compression_dict_size = 4096;
+  TableConstructor dict(BytewiseComparator());
+  AddPathEntries(&dict, 5000);
+  dict.Finish(options, &keys, &kvmap);
+  ASSERT_LT(dict.ApproximateOffsetOf("xyz"),
+            plain.ApproximateOffsetOf("xyz") * 9 / 10);
+
+  Iterator* iter = dict.NewIterator();
+  iter->SeekToFirst();
+  for (KVMap::const_iterator it = kvmap.begin(); it != kvmap.end(); ++it) {
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(it->first, iter->key().ToString());
+    ASSERT_EQ(it->second, iter->value().ToString());
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+
+  // Compression threads produce the same table
+  std::string serial, parallel;
+  BuildRandomTable(options, 20000, &serial);
+  options.compression_threads = 4;
+  BuildRandomTable(options, 20000, &parallel);
+  ASSERT_TRUE(serial == parallel);
+
+  // A table too small to sample gets no dictionary
+  options.compression_dict_size = 65535;
+  TableConstructor small(BytewiseComparator());
+  AddPathEntries(&small, 100);
+  small.Finish(options, &keys, &kvmap);
+  iter = small.NewIterator();
+  iter->Seek(keys.back());
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(kvmap[keys.back()], iter->value().ToString());
+  delete iter;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -4,6 +4,7 @@
 
 #include "table/two_level_iterator.h"
 
+#include "leveldb/comparator.h"
 #include "leveldb/table.h"
 #include "table/block.h"
 #include "table/format.h"
@@ -21,7 +22,8 @@ class TwoLevelIterator: public Iterator {
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    const Comparator* comparator);
 
   virtual ~TwoLevelIterator();
 
@@ -57,7 +59,7 @@ class TwoLevelIterator: public Iterator {
   void SaveError(const Status& s) {
     if (status_.ok() && !s.ok()) status_ = s;
   }
-  void SkipEmptyDataBlocksForward();
+  void SkipEmptyDataBlocksForward(bool bounded);
   void SkipEmptyDataBlocksBackward();
   void SetDataIterator(Iterator* data_iter);
   void InitDataBlock();
@@ -65,6 +67,7 @@ class TwoLevelIterator: public Iterator {
   BlockFunction block_function_;
   void* arg_;
   const ReadOptions options_;
+  const Comparator* const comparator_;
   Status status_;
   IteratorWrapper index_iter_;
   IteratorWrapper data_iter_; // May be NULL
@@ -77,10 +80,12 @@ TwoLevelIterator::TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options)
+    const ReadOptions& options,
+    const Comparator* comparator)
     : block_function_(block_function),
       arg_(arg),
       options_(options),
+      comparator_(options.iterate_upper_bound != NULL ? comparator : NULL),
       index_iter_(index_iter),
       data_iter_(NULL) {
 }
@@ -92,14 +97,14 @@ void TwoLevelIterator::Seek(const Slice& target) {
   index_iter_.Seek(target);
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.Seek(target);
-  SkipEmptyDataBlocksForward();
+  SkipEmptyDataBlocksForward(false);
 }
 
 void TwoLevelIterator::SeekToFirst() {
   index_iter_.SeekToFirst();
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
-  SkipEmptyDataBlocksForward();
+  SkipEmptyDataBlocksForward(false);
 }
 
 void TwoLevelIterator::SeekToLast() {
@@ -112,7 +117,7 @@ void TwoLevelIterator::SeekToLast() {
 void TwoLevelIterator::Next() {
   assert(Valid());
   data_iter_.Next();
-  SkipEmptyDataBlocksForward();
+  SkipEmptyDataBlocksForward(true);
 }
 
 void TwoLevelIterator::Prev() {
@@ -122,13 +127,23 @@ void TwoLevelIterator::Prev() {
 }
 
 
-void TwoLevelIterator::SkipEmptyDataBlocksForward() {
+// Seeks leave "bounded" false: a seek must only report the iterator as
+// exhausted if no key >= the target exists, which the merging iterator
+// relies on when it changes direction.
+void TwoLevelIterator::SkipEmptyDataBlocksForward(bool bounded) {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
     if (!index_iter_.Valid()) {
       SetDataIterator(NULL);
       return;
     }
+    if (bounded && comparator_ != NULL &&
+        comparator_->Compare(index_iter_.key(),
+                             *options_.iterate_upper_bound) >= 0) {
+      // The remaining blocks only hold keys past the upper bound
+      SetDataIterator(NULL);
+      return;
+    }
     index_iter_.Next();
     InitDataBlock();
     if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
@@ -175,8 +190,10 @@ Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+    const ReadOptions& options,
+    const Comparator* comparator) {
+  return new TwoLevelIterator(index_iter, block_function, arg, options,
+                              comparator);
 }
 
 }  // namespace leveldb
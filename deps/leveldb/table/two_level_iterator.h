@@ -9,6 +9,7 @@
 
 namespace leveldb {
 
+class Comparator;
 struct ReadOptions;
 
 // Return a new two level iterator.  A two-level iterator contains an
@@ -20,6 +21,12 @@ struct ReadOptions;
 //
 // Uses a supplied function to convert an index_iter value into
 // an iterator over the contents of the corresponding block.
+//
+// If "comparator" is non-NULL and options.iterate_upper_bound is set,
+// Next() does not move on to the block after one whose index key is
+// >= *options.iterate_upper_bound, since every key in the later blocks
+// is beyond the bound.  This requires that index keys are >= every key
+// in their block and < every key in the following block.
 extern Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     Iterator* (*block_function)(
@@ -27,7 +34,8 @@ extern Iterator* NewTwoLevelIterator(
         const ReadOptions& options,
         const Slice& index_value),
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    const Comparator* comparator = NULL);
 
 }  // namespace leveldb
 
@@ -4,13 +4,13 @@
 
 #include "util/arena.h"
 #include <assert.h>
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
 static const int kBlockSize = 4096;
 
-Arena::Arena() {
-  blocks_memory_ = 0;
+Arena::Arena() : memory_usage_(0) {
   alloc_ptr_ = NULL;  // First allocation will allocate a block
   alloc_bytes_remaining_ = 0;
 }
@@ -58,10 +58,21 @@ char* Arena::AllocateAligned(size_t bytes) {
   return result;
 }
 
+char* Arena::AllocateConcurrently(size_t bytes) {
+  MutexLock l(&mu_);
+  return Allocate(bytes);
+}
+
+char* Arena::AllocateAlignedConcurrently(size_t bytes) {
+  MutexLock l(&mu_);
+  return AllocateAligned(bytes);
+}
+
 char* Arena::AllocateNewBlock(size_t block_bytes) {
   char* result = new char[block_bytes];
-  blocks_memory_ += block_bytes;
   blocks_.push_back(result);
+  memory_usage_.NoBarrier_Store(reinterpret_cast<void*>(
+      MemoryUsage() + block_bytes + sizeof(char*)));
   return result;
 }
 
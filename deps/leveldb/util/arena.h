@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "port/port.h"
 
 namespace leveldb {
 
@@ -23,11 +24,16 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc
   char* AllocateAligned(size_t bytes);
 
+  // Like Allocate() and AllocateAligned(), but safe to call from several
+  // threads at once.  REQUIRES: no other allocation method is running.
+  char* AllocateConcurrently(size_t bytes);
+  char* AllocateAlignedConcurrently(size_t bytes);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena (including space allocated but not yet used for user
-  // allocations).
+  // allocations).  May be called while another thread allocates.
   size_t MemoryUsage() const {
-    return blocks_memory_ + blocks_.capacity() * sizeof(char*);
+    return reinterpret_cast<uintptr_t>(memory_usage_.NoBarrier_Load());
   }
 
  private:
@@ -41,8 +47,11 @@ class Arena {
   // Array of new[] allocated memory blocks
   std::vector<char*> blocks_;
 
-  // Bytes of memory in blocks allocated so far
-  size_t blocks_memory_;
+  // Total memory usage of the arena
+  port::AtomicPointer memory_usage_;
+
+  // Serializes the concurrent allocation methods
+  port::Mutex mu_;
 
   // No copying allowed
   Arena(const Arena&);
@@ -4,6 +4,9 @@
 
 #include "leveldb/filter_policy.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <vector>
 #include "leveldb/slice.h"
 #include "util/hash.h"
 
@@ -86,10 +89,69 @@ class BloomFilterPolicy : public FilterPolicy {
     return true;
   }
 };
+
+class SublevelBloomFilterPolicy : public FilterPolicy {
+ private:
+  BloomFilterPolicy bloom_;
+  std::string separator_;
+  std::string name_;
+
+ public:
+  SublevelBloomFilterPolicy(int bits_per_key, const Slice& separator)
+      : bloom_(bits_per_key),
+        separator_(separator.data(), separator.size()) {
+    // The separator is part of the name so that filters built with a
+    // different separator are never consulted for prefixes.
+    name_ = "leveldb.SublevelBloomFilter.";
+    for (size_t i = 0; i < separator_.size(); i++) {
+      char buf[3];
+      snprintf(buf, sizeof(buf), "%02x",
+               static_cast<unsigned char>(separator_[i]));
+      name_.append(buf);
+    }
+  }
+
+  virtual const char* Name() const {
+    return name_.c_str();
+  }
+
+  virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+    std::vector<Slice> all(keys, keys + n);
+    const size_t sep = separator_.size();
+    if (sep > 0) {
+      for (int i = 0; i < n; i++) {
+        const Slice& key = keys[i];
+        for (size_t pos = 0; pos + sep <= key.size(); pos++) {
+          if (memcmp(key.data() + pos, separator_.data(), sep) == 0) {
+            all.push_back(Slice(key.data(), pos + sep));
+            pos += sep - 1;
+          }
+        }
+      }
+    }
+    bloom_.CreateFilter(all.empty() ? NULL : &all[0],
+                        static_cast<int>(all.size()), dst);
+  }
+
+  virtual bool KeyMayMatch(const Slice& key, const Slice& bloom_filter) const {
+    return bloom_.KeyMayMatch(key, bloom_filter);
+  }
+
+  virtual bool CoversPrefix(const Slice& prefix) const {
+    return !separator_.empty() && prefix.size() >= separator_.size() &&
+        memcmp(prefix.data() + prefix.size() - separator_.size(),
+               separator_.data(), separator_.size()) == 0;
+  }
+};
 }
 
 const FilterPolicy* NewBloomFilterPolicy(int bits_per_key) {
   return new BloomFilterPolicy(bits_per_key);
 }
 
+const FilterPolicy* NewSublevelBloomFilterPolicy(int bits_per_key,
+                                                 const Slice& separator) {
+  return new SublevelBloomFilterPolicy(bits_per_key, separator);
+}
+
 }  // namespace leveldb
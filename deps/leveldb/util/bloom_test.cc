@@ -154,6 +154,60 @@ TEST(BloomTest, VaryingLengths) {
 
 // Different bits-per-byte
 
+class SublevelBloomTest {
+ public:
+  const FilterPolicy* policy_;
+  std::string filter_;
+
+  SublevelBloomTest()
+      : policy_(NewSublevelBloomFilterPolicy(10, "\xc3\xbf")) { }
+
+  ~SublevelBloomTest() {
+    delete policy_;
+  }
+
+  void Build(const char** keys, int n) {
+    std::vector<Slice> key_slices;
+    for (int i = 0; i < n; i++) {
+      key_slices.push_back(Slice(keys[i]));
+    }
+    filter_.clear();
+    policy_->CreateFilter(&key_slices[0], n, &filter_);
+  }
+
+  bool Matches(const Slice& s) {
+    return policy_->KeyMayMatch(s, filter_);
+  }
+};
+
+TEST(SublevelBloomTest, SublevelPrefixes) {
+  const char* keys[] = {
+    "\xc3\xbf" "a\xc3\xbf" "b\xc3\xbf" "c",
+    "\xc3\xbf" "d",
+  };
+  Build(keys, 2);
+  ASSERT_TRUE(Matches(keys[0]));
+  ASSERT_TRUE(Matches(keys[1]));
+  ASSERT_TRUE(Matches("\xc3\xbf"));
+  ASSERT_TRUE(Matches("\xc3\xbf" "a\xc3\xbf"));
+  ASSERT_TRUE(Matches("\xc3\xbf" "a\xc3\xbf" "b\xc3\xbf"));
+  ASSERT_TRUE(!Matches("\xc3\xbf" "d\xc3\xbf"));
+  ASSERT_TRUE(!Matches("\xc3\xbf" "e\xc3\xbf"));
+  ASSERT_TRUE(!Matches("\xc3\xbf" "a\xc3\xbf" "x\xc3\xbf"));
+}
+
+TEST(SublevelBloomTest, SublevelCoversPrefix) {
+  ASSERT_TRUE(policy_->CoversPrefix("\xc3\xbf" "a\xc3\xbf"));
+  ASSERT_TRUE(!policy_->CoversPrefix("\xc3\xbf" "a"));
+  ASSERT_TRUE(!policy_->CoversPrefix("\xbf"));
+  ASSERT_TRUE(!policy_->CoversPrefix(""));
+
+  const FilterPolicy* bloom = NewBloomFilterPolicy(10);
+  ASSERT_TRUE(!bloom->CoversPrefix("\xc3\xbf"));
+  ASSERT_NE(std::string(bloom->Name()), std::string(policy_->Name()));
+  delete bloom;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -16,6 +16,12 @@ namespace leveldb {
 Cache::~Cache() {
 }
 
+Cache::Handle* Cache::Insert(const Slice& key, void* value, size_t charge,
+                             void (*deleter)(const Slice& key, void* value),
+                             Priority priority) {
+  return Insert(key, value, charge, deleter);
+}
+
 namespace {
 
 // LRU cache implementation
@@ -32,6 +38,7 @@ struct LRUHandle {
   size_t key_length;
   uint32_t refs;
   uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
+  bool in_protected;  // Whether the entry is in the protected LRU segment
   char key_data[1];   // Beginning of key
 
   Slice key() const {
@@ -138,23 +145,28 @@ class LRUCache {
   ~LRUCache();
 
   // Separate from constructor so caller can easily make an array of LRUCache
-  void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  void SetCapacity(size_t capacity, double protected_ratio) {
+    capacity_ = capacity;
+    protected_capacity_ = static_cast<size_t>(capacity * protected_ratio);
+  }
 
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key, uint32_t hash,
                         void* value, size_t charge,
-                        void (*deleter)(const Slice& key, void* value));
+                        void (*deleter)(const Slice& key, void* value),
+                        Cache::Priority priority);
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
 
  private:
   void LRU_Remove(LRUHandle* e);
-  void LRU_Append(LRUHandle* e);
+  void LRU_Append(LRUHandle* e, bool protect);
   void Unref(LRUHandle* e);
 
   // Initialized before use.
   size_t capacity_;
+  size_t protected_capacity_;
 
   // mutex_ protects the following state.
   port::Mutex mutex_;
@@ -162,13 +174,30 @@ class LRUCache {
 
   // Dummy head of LRU list.
   // lru.prev is newest entry, lru.next is oldest entry.
+  //
+  // The list is split in two segments.  New entries start in the
+  // probationary segment, which holds the older half of the list, and
+  // are moved to the protected segment at the newest end when they are
+  // looked up again, or right away for high priority inserts.  When the
+  // protected segment grows past protected_capacity_ its oldest entries
+  // are demoted to the newest end of the probationary segment.  Entries
+  // that are touched only once, like the blocks read by a scan, are
+  // therefore evicted before anything that has been reused.
   LRUHandle lru_;
 
+  // Newest entry of the probationary segment, or &lru_ if it is empty.
+  LRUHandle* probation_newest_;
+  size_t protected_usage_;
+
   HandleTable table_;
 };
 
 LRUCache::LRUCache()
-    : usage_(0) {
+    : capacity_(0),
+      protected_capacity_(0),
+      usage_(0),
+      probation_newest_(&lru_),
+      protected_usage_(0) {
   // Make empty circular linked list
   lru_.next = &lru_;
   lru_.prev = &lru_;
@@ -194,16 +223,41 @@ void LRUCache::Unref(LRUHandle* e) {
 }
 
 void LRUCache::LRU_Remove(LRUHandle* e) {
+  if (e == probation_newest_) {
+    probation_newest_ = e->prev;
+  }
+  if (e->in_protected) {
+    protected_usage_ -= e->charge;
+  }
   e->next->prev = e->prev;
   e->prev->next = e->next;
 }
 
-void LRUCache::LRU_Append(LRUHandle* e) {
-  // Make "e" newest entry by inserting just before lru_
-  e->next = &lru_;
-  e->prev = lru_.prev;
+void LRUCache::LRU_Append(LRUHandle* e, bool protect) {
+  if (protect) {
+    // Make "e" newest entry by inserting just before lru_
+    e->next = &lru_;
+    e->prev = lru_.prev;
+    e->in_protected = true;
+    protected_usage_ += e->charge;
+  } else {
+    // Make "e" the newest probationary entry
+    e->next = probation_newest_->next;
+    e->prev = probation_newest_;
+    e->in_protected = false;
+    probation_newest_ = e;
+  }
   e->prev->next = e;
   e->next->prev = e;
+
+  // Demote the oldest protected entries if the segment is over budget
+  while (protected_usage_ > protected_capacity_) {
+    LRUHandle* oldest = probation_newest_->next;
+    assert(oldest != &lru_ && oldest->in_protected);
+    oldest->in_protected = false;
+    protected_usage_ -= oldest->charge;
+    probation_newest_ = oldest;
+  }
 }
 
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
@@ -212,7 +266,7 @@ Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   if (e != NULL) {
     e->refs++;
     LRU_Remove(e);
-    LRU_Append(e);
+    LRU_Append(e, true);
   }
   return reinterpret_cast<Cache::Handle*>(e);
 }
@@ -224,7 +278,8 @@ void LRUCache::Release(Cache::Handle* handle) {
 
 Cache::Handle* LRUCache::Insert(
     const Slice& key, uint32_t hash, void* value, size_t charge,
-    void (*deleter)(const Slice& key, void* value)) {
+    void (*deleter)(const Slice& key, void* value),
+    Cache::Priority priority) {
   MutexLock l(&mutex_);
 
   LRUHandle* e = reinterpret_cast<LRUHandle*>(
@@ -236,7 +291,7 @@ Cache::Handle* LRUCache::Insert(
   e->hash = hash;
   e->refs = 2;  // One from LRUCache, one for the returned handle
   memcpy(e->key_data, key.data(), key.size());
-  LRU_Append(e);
+  LRU_Append(e, priority == Cache::HIGH);
   usage_ += charge;
 
   LRUHandle* old = table_.Insert(e);
@@ -282,18 +337,24 @@ class ShardedLRUCache : public Cache {
   }
 
  public:
-  explicit ShardedLRUCache(size_t capacity)
+  ShardedLRUCache(size_t capacity, double protected_ratio)
       : last_id_(0) {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
     for (int s = 0; s < kNumShards; s++) {
-      shard_[s].SetCapacity(per_shard);
+      shard_[s].SetCapacity(per_shard, protected_ratio);
     }
   }
   virtual ~ShardedLRUCache() { }
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) {
+    return Insert(key, value, charge, deleter, LOW);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                      priority);
   }
   virtual Handle* Lookup(const Slice& key) {
     const uint32_t hash = HashSlice(key);
@@ -319,7 +380,16 @@ class ShardedLRUCache : public Cache {
 }  // end anonymous namespace
 
 Cache* NewLRUCache(size_t capacity) {
-  return new ShardedLRUCache(capacity);
+  return new ShardedLRUCache(capacity, 0.0);
+}
+
+Cache* NewLRUCache(size_t capacity, double protected_ratio) {
+  if (protected_ratio < 0.0) {
+    protected_ratio = 0.0;
+  } else if (protected_ratio > 1.0) {
+    protected_ratio = 1.0;
+  }
+  return new ShardedLRUCache(capacity, protected_ratio);
 }
 
 }  // namespace leveldb
@@ -5,7 +5,11 @@
 #include "leveldb/cache.h"
 
 #include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -41,6 +45,10 @@ class CacheTest {
     current_ = this;
   }
 
+  explicit CacheTest(Cache* cache) : cache_(cache) {
+    current_ = this;
+  }
+
   ~CacheTest() {
     delete cache_;
   }
@@ -179,8 +187,316 @@ TEST(CacheTest, NewId) {
   ASSERT_NE(a, b);
 }
 
+class MidpointCacheTest : public CacheTest {
+ public:
+  MidpointCacheTest() : CacheTest(NewLRUCache(kCacheSize, 0.5)) { }
+
+  void InsertWithPriority(int key, int value, Cache::Priority priority) {
+    cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(value), 1,
+                                   &CacheTest::Deleter, priority));
+  }
+};
+
+TEST(MidpointCacheTest, ScanDoesNotEvictHotEntries) {
+  // Entries that are looked up again are promoted to the protected
+  // segment and must survive a scan that touches every entry once.
+  const int kHot = 100;
+  for (int i = 0; i < kHot; i++) {
+    Insert(i, 1000+i);
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+  for (int i = 0; i < 5*kCacheSize; i++) {
+    Insert(10000+i, 20000+i);
+  }
+  for (int i = 0; i < kHot; i++) {
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+}
+
+TEST(MidpointCacheTest, HighPriorityEntriesAreProtected) {
+  const int kHigh = 100;
+  for (int i = 0; i < kHigh; i++) {
+    InsertWithPriority(i, 1000+i, Cache::HIGH);
+  }
+  for (int i = 0; i < 5*kCacheSize; i++) {
+    InsertWithPriority(10000+i, 20000+i, Cache::LOW);
+  }
+  for (int i = 0; i < kHigh; i++) {
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+}
+
+TEST(MidpointCacheTest, ProtectedSegmentIsBounded) {
+  // Promoting more entries than the protected segment holds demotes the
+  // oldest of them back into probation, where they are evicted normally.
+  for (int i = 0; i < 2*kCacheSize; i++) {
+    Insert(i, 1000+i);
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+  int cached = 0;
+  for (int i = 0; i < 2*kCacheSize; i++) {
+    if (Lookup(i) >= 0) {
+      cached++;
+    }
+  }
+  ASSERT_LE(cached, kCacheSize + kCacheSize/10);
+  ASSERT_EQ(-1, Lookup(0));
+  ASSERT_EQ(1000 + 2*kCacheSize - 1, Lookup(2*kCacheSize - 1));
+}
+
+TEST(MidpointCacheTest, MidpointEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Frequently used entry must be kept around
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+}
+
+class ClockCacheTest : public CacheTest {
+ public:
+  ClockCacheTest() : CacheTest(NewClockCache(kCacheSize, 4, 1)) { }
+};
+
+TEST(ClockCacheTest, ClockHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1,  Lookup(200));
+
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+}
+
+TEST(ClockCacheTest, ClockErase) {
+  Erase(200);
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  Insert(100, 101);
+  Insert(200, 201);
+  Erase(100);
+  ASSERT_EQ(-1,  Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1,  Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(1, deleted_keys_.size());
+}
+
+TEST(ClockCacheTest, ClockEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+
+  Insert(100, 102);
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+
+  cache_->Release(h2);
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[1]);
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST(ClockCacheTest, ClockEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Frequently used entry must be kept around
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+}
+
+TEST(ClockCacheTest, ClockHeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2*kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000+index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000+i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
+}
+
+TEST(ClockCacheTest, PinnedEntriesOverflowTable) {
+  // Hold on to more handles than the tables have slots.  Entries that do
+  // not fit must still be usable and be deleted once released.
+  std::vector<Cache::Handle*> handles;
+  const int kNum = 10 * kCacheSize;
+  for (int i = 0; i < kNum; i++) {
+    handles.push_back(cache_->Insert(EncodeKey(i), EncodeValue(i), 1,
+                                     &CacheTest::Deleter));
+  }
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(i, DecodeValue(cache_->Value(handles[i])));
+    cache_->Release(handles[i]);
+  }
+  int cached = 0;
+  for (int i = 0; i < kNum; i++) {
+    if (Lookup(i) >= 0) {
+      cached++;
+    }
+  }
+  ASSERT_LE(cached, kCacheSize);
+  ASSERT_EQ(kNum - cached, deleted_keys_.size());
+}
+
+TEST(ClockCacheTest, ClockNewId) {
+  uint64_t a = cache_->NewId();
+  uint64_t b = cache_->NewId();
+  ASSERT_NE(a, b);
+}
+
+// Concurrent readers and writers hammering a shared cache.
+namespace {
+
+struct CacheThreadState {
+  Cache* cache;
+  int key_space;
+  int ops;
+  int seed;
+  bool check_values;
+  port::Mutex* mu;
+  port::CondVar* cv;
+  int* done;
+};
+
+static void NoopDeleter(const Slice& key, void* value) { }
+
+static void CacheThreadBody(void* arg) {
+  CacheThreadState* state = reinterpret_cast<CacheThreadState*>(arg);
+  Cache* cache = state->cache;
+  Random rnd(state->seed);
+  for (int i = 0; i < state->ops; i++) {
+    const int k = rnd.Uniform(state->key_space);
+    const std::string key = EncodeKey(k);
+    Cache::Handle* h = cache->Lookup(key);
+    if (h == NULL) {
+      h = cache->Insert(key, EncodeValue(k), 1, &NoopDeleter);
+    }
+    if (state->check_values) {
+      ASSERT_EQ(k, DecodeValue(cache->Value(h)));
+    }
+    cache->Release(h);
+  }
+  MutexLock l(state->mu);
+  (*state->done)++;
+  state->cv->Signal();
+}
+
+// Runs "num_threads" threads against "cache" and returns the elapsed
+// time in microseconds.
+static uint64_t RunCacheThreads(Cache* cache, int num_threads, int key_space,
+                                int ops_per_thread, bool check_values) {
+  port::Mutex mu;
+  port::CondVar cv(&mu);
+  int done = 0;
+  std::vector<CacheThreadState> states(num_threads);
+  Env* env = Env::Default();
+  const uint64_t start = env->NowMicros();
+  for (int t = 0; t < num_threads; t++) {
+    CacheThreadState* s = &states[t];
+    s->cache = cache;
+    s->key_space = key_space;
+    s->ops = ops_per_thread;
+    s->seed = 301 + t;
+    s->check_values = check_values;
+    s->mu = &mu;
+    s->cv = &cv;
+    s->done = &done;
+    env->StartThread(&CacheThreadBody, s);
+  }
+  MutexLock l(&mu);
+  while (done < num_threads) {
+    cv.Wait();
+  }
+  return env->NowMicros() - start;
+}
+
+}  // namespace
+
+TEST(ClockCacheTest, ConcurrentAccess) {
+  // Key space larger than the cache so that lookups, inserts and
+  // evictions all race with each other.
+  Cache* cache = NewClockCache(100, 2, 1);
+  RunCacheThreads(cache, 8, 400, 20000, true);
+  delete cache;
+}
+
+static void BM_CacheConcurrency(const char* name, Cache* cache,
+                                int num_threads) {
+  const int kOps = 1000000;
+  // Mostly hits: the working set fits in the cache.
+  uint64_t us = RunCacheThreads(cache, num_threads, 10000, kOps, false);
+  fprintf(stderr,
+          "BM_CacheConcurrency/%-5s %2d threads : %9llu us "
+          "(%7.1f Mops/s)\n",
+          name, num_threads, static_cast<unsigned long long>(us),
+          static_cast<double>(kOps) * num_threads / us);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+    const int kThreads[] = { 1, 2, 4, 8, 16 };
+    for (size_t i = 0; i < sizeof(kThreads) / sizeof(kThreads[0]); i++) {
+      leveldb::Cache* lru = leveldb::NewLRUCache(100000);
+      leveldb::BM_CacheConcurrency("lru", lru, kThreads[i]);
+      delete lru;
+      leveldb::Cache* clock = leveldb::NewClockCache(100000, 4, 1);
+      leveldb::BM_CacheConcurrency("clock", clock, kThreads[i]);
+      delete clock;
+    }
+    return 0;
+  }
+
   return leveldb::test::RunAllTests();
 }
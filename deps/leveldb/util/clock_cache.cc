@@ -0,0 +1,468 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// CLOCK cache.
+//
+// Each shard keeps its entries in a fixed-size open addressing table.
+// Every slot carries a 64-bit metadata word that packs the slot state,
+// a CLOCK usage counter and the number of outstanding handles:
+//
+//   bits 0-1   state (empty, under construction, visible, invisible)
+//   bits 2-3   usage counter, set on access and decremented by the clock
+//   bits 4-63  reference count
+//
+// Lookup() and Release() only touch the metadata word of the slots they
+// probe with atomic operations, so readers never take a lock.  A slot is
+// reused only after a thread has moved it from "visible or invisible
+// with no references" to "under construction" with a compare-and-swap,
+// which gives that thread exclusive ownership of the slot contents.
+//
+// When usage exceeds capacity, Insert() advances a shared clock hand over
+// the table.  Unreferenced entries with a non-zero usage counter have it
+// decremented; those whose counter has already reached zero are evicted.
+//
+// Lookups stop probing at the first slot that no live entry has probed
+// past, which each slot tracks in its "displacements" counter.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "leveldb/cache.h"
+#include "port/port.h"
+#include "util/hash.h"
+
+namespace leveldb {
+
+namespace {
+
+enum SlotState {
+  kEmpty = 0,
+  kConstruction = 1,
+  kVisible = 2,
+  kInvisible = 3
+};
+
+static const uint64_t kStateMask = 3;
+static const int kUsageShift = 2;
+static const uint64_t kUsageMask = 3 << kUsageShift;
+static const uint64_t kMaxUsage = 3;
+static const int kRefShift = 4;
+static const uint64_t kOneRef = static_cast<uint64_t>(1) << kRefShift;
+
+static inline uint64_t StateOf(uint64_t meta) { return meta & kStateMask; }
+static inline uint64_t UsageOf(uint64_t meta) {
+  return (meta & kUsageMask) >> kUsageShift;
+}
+static inline uint64_t RefsOf(uint64_t meta) { return meta >> kRefShift; }
+
+template <typename T>
+static inline T AtomicLoad(const T* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+static inline void AtomicStore(T* p, T v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+template <typename T>
+static inline bool AtomicCAS(T* p, T* expected, T desired) {
+  return __atomic_compare_exchange_n(p, expected, desired, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+static inline T AtomicAdd(T* p, T v) {
+  return __atomic_add_fetch(p, v, __ATOMIC_ACQ_REL);
+}
+
+template <typename T>
+static inline T AtomicSub(T* p, T v) {
+  return __atomic_sub_fetch(p, v, __ATOMIC_ACQ_REL);
+}
+
+// A slot in the table, or a standalone entry that could not be placed in
+// the table because it was full.  Standalone entries are never visible to
+// Lookup() and are freed when their last handle is released.
+struct ClockHandle {
+  uint64_t meta;
+  uint32_t displacements;
+  uint32_t hash;
+  bool standalone;
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  size_t charge;
+  size_t key_length;
+  char* key_data;
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+class ClockCacheShard {
+ public:
+  ClockCacheShard();
+  ~ClockCacheShard();
+
+  // Must be called once before the shard is used.
+  void Init(size_t capacity, size_t num_slots);
+
+  Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                        void* value, size_t charge,
+                        void (*deleter)(const Slice& key, void* value),
+                        Cache::Priority priority);
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+
+ private:
+  uint32_t Increment(uint32_t hash) const {
+    // Any odd step visits every slot of a power-of-two table.
+    return ((hash >> 7) | (hash << 25)) | 1;
+  }
+
+  // Take a reference on "h" if it is visible and holds "key".
+  bool TryRef(ClockHandle* h, const Slice& key, uint32_t hash);
+
+  // Drop a reference; frees the entry if it was the last reference to an
+  // invisible entry.
+  void Unref(ClockHandle* h);
+
+  // Free the entry in "h" if it is invisible and unreferenced.
+  void MaybeFree(ClockHandle* h);
+
+  // REQUIRES: caller has moved "h" into the construction state.
+  void FreeSlot(ClockHandle* h);
+
+  // Turn every visible entry for "key" invisible, except "keep".
+  void EraseAllExcept(const Slice& key, uint32_t hash, ClockHandle* keep);
+
+  // Sweep the clock until usage drops to capacity or the sweep has gone
+  // around the table a few times without finding a victim.
+  void EvictIfNeeded();
+
+  size_t capacity_;
+  size_t usage_;             // Accessed atomically
+  uint64_t clock_pointer_;   // Accessed atomically
+  size_t length_;            // Power of two
+  ClockHandle* slots_;
+
+  // No copying allowed
+  ClockCacheShard(const ClockCacheShard&);
+  void operator=(const ClockCacheShard&);
+};
+
+ClockCacheShard::ClockCacheShard()
+    : capacity_(0), usage_(0), clock_pointer_(0), length_(0), slots_(NULL) {
+}
+
+ClockCacheShard::~ClockCacheShard() {
+  for (size_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[i];
+    const uint64_t state = StateOf(h->meta);
+    if (state == kVisible || state == kInvisible) {
+      assert(RefsOf(h->meta) == 0);  // Error if caller has an unreleased handle
+      (*h->deleter)(h->key(), h->value);
+      free(h->key_data);
+    }
+  }
+  delete[] slots_;
+}
+
+void ClockCacheShard::Init(size_t capacity, size_t num_slots) {
+  size_t length = 16;
+  while (length < num_slots) {
+    length *= 2;
+  }
+  capacity_ = capacity;
+  length_ = length;
+  slots_ = new ClockHandle[length_];
+  memset(slots_, 0, sizeof(ClockHandle) * length_);
+}
+
+bool ClockCacheShard::TryRef(ClockHandle* h, const Slice& key, uint32_t hash) {
+  uint64_t meta = AtomicLoad(&h->meta);
+  while (StateOf(meta) == kVisible) {
+    if (__atomic_load_n(&h->hash, __ATOMIC_RELAXED) != hash) {
+      return false;
+    }
+    if (AtomicCAS(&h->meta, &meta, meta + kOneRef)) {
+      // The contents cannot change while we hold a reference.
+      if (h->key() == key) {
+        __atomic_fetch_or(&h->meta, kUsageMask, __ATOMIC_RELAXED);
+        return true;
+      }
+      Unref(h);
+      return false;
+    }
+  }
+  return false;
+}
+
+void ClockCacheShard::Unref(ClockHandle* h) {
+  const bool standalone = h->standalone;  // Read before dropping our ref
+  const uint64_t meta = AtomicSub(&h->meta, kOneRef);
+  if (standalone) {
+    if (RefsOf(meta) == 0) {
+      AtomicSub(&usage_, h->charge);
+      (*h->deleter)(h->key(), h->value);
+      free(h->key_data);
+      delete h;
+    }
+  } else if (RefsOf(meta) == 0) {
+    if (StateOf(meta) == kInvisible) {
+      MaybeFree(h);
+    } else if (AtomicLoad(&usage_) > capacity_) {
+      // Inserts could not make room while this entry was pinned; drop it
+      // now instead of waiting for the next insert.
+      uint64_t expected = meta;
+      if (StateOf(expected) == kVisible &&
+          AtomicCAS(&h->meta, &expected,
+                    static_cast<uint64_t>(kConstruction))) {
+        FreeSlot(h);
+      }
+    }
+  }
+}
+
+void ClockCacheShard::MaybeFree(ClockHandle* h) {
+  uint64_t meta = AtomicLoad(&h->meta);
+  while (StateOf(meta) == kInvisible && RefsOf(meta) == 0) {
+    if (AtomicCAS(&h->meta, &meta, static_cast<uint64_t>(kConstruction))) {
+      FreeSlot(h);
+      return;
+    }
+  }
+}
+
+void ClockCacheShard::FreeSlot(ClockHandle* h) {
+  assert(StateOf(AtomicLoad(&h->meta)) == kConstruction);
+  (*h->deleter)(h->key(), h->value);
+  free(h->key_data);
+  AtomicSub(&usage_, h->charge);
+
+  // Undo the displacements recorded when this entry was inserted.
+  const uint32_t hash = h->hash;
+  const size_t mask = length_ - 1;
+  const uint32_t increment = Increment(hash);
+  size_t index = hash & mask;
+  while (&slots_[index] != h) {
+    AtomicSub(&slots_[index].displacements, static_cast<uint32_t>(1));
+    index = (index + increment) & mask;
+  }
+  AtomicStore(&h->meta, static_cast<uint64_t>(kEmpty));
+}
+
+Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
+  const size_t mask = length_ - 1;
+  const uint32_t increment = Increment(hash);
+  size_t index = hash & mask;
+  for (size_t probe = 0; probe < length_; probe++) {
+    ClockHandle* h = &slots_[index];
+    if (TryRef(h, key, hash)) {
+      return reinterpret_cast<Cache::Handle*>(h);
+    }
+    if (AtomicLoad(&h->displacements) == 0) {
+      break;
+    }
+    index = (index + increment) & mask;
+  }
+  return NULL;
+}
+
+void ClockCacheShard::Release(Cache::Handle* handle) {
+  Unref(reinterpret_cast<ClockHandle*>(handle));
+}
+
+Cache::Handle* ClockCacheShard::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value),
+    Cache::Priority priority) {
+  char* key_data = reinterpret_cast<char*>(malloc(key.size()));
+  memcpy(key_data, key.data(), key.size());
+
+  const size_t mask = length_ - 1;
+  const uint32_t increment = Increment(hash);
+  size_t index = hash & mask;
+  ClockHandle* h = NULL;
+  size_t probe = 0;
+  for (; probe < length_; probe++) {
+    ClockHandle* slot = &slots_[index];
+    uint64_t expected = kEmpty;
+    if (AtomicCAS(&slot->meta, &expected,
+                  static_cast<uint64_t>(kConstruction))) {
+      h = slot;
+      break;
+    }
+    AtomicAdd(&slot->displacements, static_cast<uint32_t>(1));
+    index = (index + increment) & mask;
+  }
+
+  if (h == NULL) {
+    // The table is full: roll back the displacements and hand out an
+    // entry that lives outside of the table.
+    index = hash & mask;
+    for (size_t i = 0; i < probe; i++) {
+      AtomicSub(&slots_[index].displacements, static_cast<uint32_t>(1));
+      index = (index + increment) & mask;
+    }
+    h = new ClockHandle;
+    h->standalone = true;
+    h->displacements = 0;
+  }
+
+  h->value = value;
+  h->deleter = deleter;
+  h->charge = charge;
+  h->key_length = key.size();
+  h->key_data = key_data;
+  __atomic_store_n(&h->hash, hash, __ATOMIC_RELAXED);
+  AtomicAdd(&usage_, charge);
+
+  if (h->standalone) {
+    h->meta = kInvisible | kOneRef;
+  } else {
+    // New entries start with a usage of one so that an entry that is
+    // never looked up again is evicted on the next pass of the clock.
+    // High priority entries start out as if they had been used.
+    const uint64_t usage = (priority == Cache::HIGH) ? kMaxUsage : 1;
+    AtomicStore(&h->meta, kVisible | (usage << kUsageShift) | kOneRef);
+    EraseAllExcept(key, hash, h);
+  }
+
+  EvictIfNeeded();
+  return reinterpret_cast<Cache::Handle*>(h);
+}
+
+void ClockCacheShard::EraseAllExcept(const Slice& key, uint32_t hash,
+                                     ClockHandle* keep) {
+  const size_t mask = length_ - 1;
+  const uint32_t increment = Increment(hash);
+  size_t index = hash & mask;
+  for (size_t probe = 0; probe < length_; probe++) {
+    ClockHandle* h = &slots_[index];
+    if (h != keep && TryRef(h, key, hash)) {
+      uint64_t meta = AtomicLoad(&h->meta);
+      while (StateOf(meta) == kVisible) {
+        const uint64_t invisible = (meta & ~kStateMask) | kInvisible;
+        if (AtomicCAS(&h->meta, &meta, invisible)) {
+          break;
+        }
+      }
+      Unref(h);
+    }
+    if (AtomicLoad(&h->displacements) == 0) {
+      break;
+    }
+    index = (index + increment) & mask;
+  }
+}
+
+void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
+  EraseAllExcept(key, hash, NULL);
+}
+
+void ClockCacheShard::EvictIfNeeded() {
+  const size_t mask = length_ - 1;
+  const size_t max_steps = length_ * (kMaxUsage + 1);
+  for (size_t step = 0;
+       step < max_steps && AtomicLoad(&usage_) > capacity_;
+       step++) {
+    const uint64_t pos = __atomic_fetch_add(&clock_pointer_, 1,
+                                            __ATOMIC_RELAXED);
+    ClockHandle* h = &slots_[pos & mask];
+    uint64_t meta = AtomicLoad(&h->meta);
+    if (StateOf(meta) != kVisible || RefsOf(meta) != 0) {
+      continue;
+    }
+    if (UsageOf(meta) > 0) {
+      // Second chance.  Losing the race just means someone used it.
+      AtomicCAS(&h->meta, &meta, meta - (1 << kUsageShift));
+    } else if (AtomicCAS(&h->meta, &meta,
+                         static_cast<uint64_t>(kConstruction))) {
+      FreeSlot(h);
+    }
+  }
+}
+
+class ShardedClockCache : public Cache {
+ private:
+  ClockCacheShard* shards_;
+  int num_shard_bits_;
+  uint64_t last_id_;    // Accessed atomically
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  ClockCacheShard* Shard(uint32_t hash) {
+    return num_shard_bits_ == 0 ? &shards_[0]
+                                : &shards_[hash >> (32 - num_shard_bits_)];
+  }
+
+ public:
+  ShardedClockCache(size_t capacity, int num_shard_bits,
+                    size_t estimated_entry_charge)
+      : num_shard_bits_(num_shard_bits),
+        last_id_(0) {
+    const int num_shards = 1 << num_shard_bits_;
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    if (estimated_entry_charge == 0) {
+      estimated_entry_charge = 1;
+    }
+    // Leave the table at most half full when the cache is at capacity so
+    // that probe sequences stay short.
+    const size_t slots = 2 * (per_shard / estimated_entry_charge + 1);
+    shards_ = new ClockCacheShard[num_shards];
+    for (int s = 0; s < num_shards; s++) {
+      shards_[s].Init(per_shard, slots);
+    }
+  }
+  virtual ~ShardedClockCache() {
+    delete[] shards_;
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    return Insert(key, value, charge, deleter, LOW);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    const uint32_t hash = HashSlice(key);
+    return Shard(hash)->Insert(key, hash, value, charge, deleter, priority);
+  }
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    return Shard(hash)->Lookup(key, hash);
+  }
+  virtual void Release(Handle* handle) {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    Shard(h->hash)->Release(handle);
+  }
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    Shard(hash)->Erase(key, hash);
+  }
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockHandle*>(handle)->value;
+  }
+  virtual uint64_t NewId() {
+    return AtomicAdd(&last_id_, static_cast<uint64_t>(1));
+  }
+};
+
+}  // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity, int num_shard_bits,
+                     size_t estimated_entry_charge) {
+  if (num_shard_bits < 0) {
+    num_shard_bits = 0;
+  } else if (num_shard_bits > 20) {
+    num_shard_bits = 20;
+  }
+  return new ShardedClockCache(capacity, num_shard_bits,
+                               estimated_entry_charge);
+}
+
+}  // namespace leveldb
@@ -9,15 +9,108 @@ namespace leveldb {
 Env::~Env() {
 }
 
+void Env::Schedule(void (*function)(void*), void* arg, Priority pri) {
+  Schedule(function, arg);
+}
+
+void Env::SetBackgroundThreads(int number, Priority pri) {
+}
+
+Status Env::NewDirectRandomAccessFile(const std::string& fname,
+                                      RandomAccessFile** result) {
+  return NewRandomAccessFile(fname, result);
+}
+
+Status Env::NewDirectWritableFile(const std::string& fname,
+                                  WritableFile** result) {
+  return NewWritableFile(fname, result);
+}
+
+Status Env::ReuseWritableFile(const std::string& fname,
+                              const std::string& old_fname,
+                              WritableFile** result) {
+  Status s = RenameFile(old_fname, fname);
+  if (!s.ok()) {
+    *result = NULL;
+    return s;
+  }
+  return NewWritableFile(fname, result);
+}
+
+void Env::MultiRead(ReadRequest* reqs, int n) {
+  for (int i = 0; i < n; i++) {
+    ReadRequest* r = &reqs[i];
+    r->status = r->file->Read(r->offset, r->n, &r->result, r->scratch);
+  }
+}
+
+void Env::LowerThreadPoolIOPriority(Priority pri) {
+}
+
+void Env::LowerThreadPoolCPUPriority(Priority pri) {
+}
+
+void Env::SetThreadPoolCPUAffinity(const std::vector<int>& cpus,
+                                   Priority pri) {
+}
+
+Status Env::LinkFile(const std::string& src, const std::string& target) {
+  SequentialFile* in;
+  Status s = NewSequentialFile(src, &in);
+  if (!s.ok()) {
+    return s;
+  }
+  WritableFile* out;
+  s = NewWritableFile(target, &out);
+  if (!s.ok()) {
+    delete in;
+    return s;
+  }
+  static const int kBufferSize = 65536;
+  char* space = new char[kBufferSize];
+  while (s.ok()) {
+    Slice fragment;
+    s = in->Read(kBufferSize, &fragment, space);
+    if (!s.ok() || fragment.empty()) {
+      break;
+    }
+    s = out->Append(fragment);
+  }
+  delete[] space;
+  delete in;
+  if (s.ok()) {
+    s = out->Sync();
+  }
+  if (s.ok()) {
+    s = out->Close();
+  }
+  delete out;
+  if (!s.ok()) {
+    DeleteFile(target);
+  }
+  return s;
+}
+
 SequentialFile::~SequentialFile() {
 }
 
 RandomAccessFile::~RandomAccessFile() {
 }
 
+void RandomAccessFile::Hint(AccessPattern pattern) {
+}
+
 WritableFile::~WritableFile() {
 }
 
+Status WritableFile::Allocate(uint64_t offset, uint64_t len) {
+  return Status::OK();
+}
+
+Status WritableFile::RangeSync(uint64_t offset, uint64_t len) {
+  return Status::OK();
+}
+
 Logger::~Logger() {
 }
 
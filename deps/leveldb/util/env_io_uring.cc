@@ -0,0 +1,490 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// An Env that batches the reads of Env::MultiRead() through io_uring.
+// It talks to the kernel through the raw system calls rather than
+// liburing, so that it needs nothing beyond the kernel headers.
+
+#include "util/env_io_uring.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(LEVELDB_IO_URING)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+// Waits for completions still to fail, the error they fail with, and
+// the number that failed, for the Envs of TEST_NewIOUringEnvFailingWaits().
+static int fail_waits = 0;
+static int fail_errno = 0;
+static int failed_waits = 0;
+
+static Status IOError(const std::string& context, int err_number) {
+  return Status::IOError(context, strerror(err_number));
+}
+
+// Reads the whole range unless end of file or an error intervenes,
+// continuing after the first "done" bytes.
+static Status PreadRest(int fd, const std::string& fname, ReadRequest* r,
+                        size_t done) {
+  while (done < r->n) {
+    ssize_t n = pread(fd, r->scratch + done, r->n - done,
+                      static_cast<off_t>(r->offset + done));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      r->result = Slice(r->scratch, 0);
+      return IOError(fname, errno);
+    } else if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  r->result = Slice(r->scratch, done);
+  return Status::OK();
+}
+
+#if defined(LEVELDB_IO_URING)
+// Entries in the submission queue of each ring
+static const unsigned kQueueDepth = 64;
+
+static int IOUringSetup(unsigned entries, struct io_uring_params* p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+typedef int (*EnterFunction)(int fd, unsigned to_submit,
+                             unsigned min_complete, unsigned flags);
+
+static int IOUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                        unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, NULL, 0));
+}
+
+// IOUringEnter() that fails waits as TEST_IOUringFailWaits() asks
+static int FailingIOUringEnter(int fd, unsigned to_submit,
+                               unsigned min_complete, unsigned flags) {
+  if (__atomic_load_n(&fail_waits, __ATOMIC_RELAXED) != 0) {
+    if (to_submit > 0) {
+      // Only submit, leaving the wait to a call that fails
+      min_complete = 0;
+      flags &= ~IORING_ENTER_GETEVENTS;
+    } else {
+      if (__atomic_load_n(&fail_waits, __ATOMIC_RELAXED) > 0) {
+        __atomic_sub_fetch(&fail_waits, 1, __ATOMIC_RELAXED);
+      }
+      __atomic_add_fetch(&failed_waits, 1, __ATOMIC_RELAXED);
+      errno = fail_errno;
+      return -1;
+    }
+  }
+  return IOUringEnter(fd, to_submit, min_complete, flags);
+}
+
+// A submission and completion queue pair, used by a single thread.  It
+// waits for completions through "enter", and gives its submissions
+// "sqe_flags".
+class Ring {
+ public:
+  Ring(EnterFunction enter, unsigned char sqe_flags)
+      : enter_(enter), sqe_flags_(sqe_flags),
+        fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED),
+        sqes_(reinterpret_cast<struct io_uring_sqe*>(MAP_FAILED)) { }
+
+  ~Ring() {
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_len_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_len_);
+    if (sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_len_);
+    if (fd_ >= 0) close(fd_);
+  }
+
+  // Returns false if the kernel does not offer io_uring
+  bool Init() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd_ = IOUringSetup(kQueueDepth, &p);
+    if (fd_ < 0) {
+      return false;
+    }
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+    }
+    sq_ptr_ = mmap(NULL, sq_len_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+      return false;
+    }
+    if (single_mmap) {
+      cq_ptr_ = sq_ptr_;
+    } else {
+      cq_ptr_ = mmap(NULL, cq_len_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+      if (cq_ptr_ == MAP_FAILED) {
+        return false;
+      }
+    }
+    sqes_len_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = reinterpret_cast<struct io_uring_sqe*>(
+        mmap(NULL, sqes_len_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+      return false;
+    }
+
+    char* sq = reinterpret_cast<char*>(sq_ptr_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sq_entries_ = p.sq_entries;
+    char* cq = reinterpret_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  // Perform the reads *reqs[0,n-1] of the files fds[0,n-1], at most a
+  // queue's worth in flight at a time.  Reads the ring fails to complete
+  // are finished with pread().
+  void Read(ReadRequest* const* reqs, const int* fds,
+            const std::string* const* fnames, int n) {
+    int next = 0;         // Next request to submit
+    int in_flight = 0;
+    while (next < n || in_flight > 0) {
+      unsigned to_submit = 0;
+      unsigned tail = *sq_tail_;
+      while (next < n && in_flight + to_submit < sq_entries_) {
+        ReadRequest* r = reqs[next];
+        const unsigned index = tail & sq_mask_;
+        struct io_uring_sqe* sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fds[next];
+        sqe->off = r->offset;
+        sqe->addr = reinterpret_cast<uintptr_t>(r->scratch);
+        sqe->len = static_cast<unsigned>(r->n);
+        sqe->user_data = next;
+        sqe->flags = sqe_flags_;
+        sq_array_[index] = index;
+        tail++;
+        next++;
+        to_submit++;
+      }
+      if (to_submit > 0) {
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+      }
+
+      int r;
+      do {
+        r = (*enter_)(fd_, to_submit, 1, IORING_ENTER_GETEVENTS);
+      } while (r < 0 && errno == EINTR && to_submit == 0);
+      if (r >= 0) {
+        in_flight += r;
+        if (static_cast<unsigned>(r) < to_submit) {
+          // Only some were submitted; the others are taken back
+          for (int i = next - to_submit + r; i < next; i++) {
+            reqs[i]->status = PreadRest(fds[i], *fnames[i], reqs[i], 0);
+          }
+          __atomic_store_n(sq_tail_, tail - (to_submit - r),
+                           __ATOMIC_RELEASE);
+        }
+      } else if (to_submit > 0) {
+        // Nothing was submitted: do this batch one read at a time
+        for (int i = next - to_submit; i < next; i++) {
+          reqs[i]->status = PreadRest(fds[i], *fnames[i], reqs[i], 0);
+        }
+        __atomic_store_n(sq_tail_, tail - to_submit, __ATOMIC_RELEASE);
+      } else {
+        // Waiting failed.  The reads in flight fill their buffers until
+        // they complete, so they have to be drained before returning.
+        // Do the reads not submitted yet with pread(), and wait for the
+        // others by polling the ring, which does not need the call
+        // that failed.
+        for (; next < n; next++) {
+          reqs[next]->status = PreadRest(fds[next], *fnames[next],
+                                         reqs[next], 0);
+        }
+        struct pollfd p;
+        p.fd = fd_;
+        p.events = POLLIN;
+        p.revents = 0;
+        poll(&p, 1, 100);
+      }
+      in_flight -= Reap(reqs, fds, fnames);
+    }
+  }
+
+ private:
+  // Complete the reads whose completions are queued; returns their number
+  int Reap(ReadRequest* const* reqs, const int* fds,
+           const std::string* const* fnames) {
+    int reaped = 0;
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+      const int i = static_cast<int>(cqe->user_data);
+      ReadRequest* r = reqs[i];
+      if (cqe->res < 0) {
+        // Let pread() report the error, or succeed where the kernel
+        // does not support the operation
+        r->status = PreadRest(fds[i], *fnames[i], r, 0);
+      } else if (cqe->res == 0 || static_cast<size_t>(cqe->res) == r->n) {
+        r->result = Slice(r->scratch, cqe->res);
+        r->status = Status::OK();
+      } else {
+        // A short read, which may or may not be at end of file
+        r->status = PreadRest(fds[i], *fnames[i], r, cqe->res);
+      }
+      head++;
+      reaped++;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return reaped;
+  }
+
+  const EnterFunction enter_;
+  const unsigned char sqe_flags_;
+  int fd_;
+  void* sq_ptr_;
+  size_t sq_len_;
+  void* cq_ptr_;
+  size_t cq_len_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_len_;
+
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  // No copying allowed
+  Ring(const Ring&);
+  void operator=(const Ring&);
+};
+
+static void DeleteRing(void* arg) {
+  delete reinterpret_cast<Ring*>(arg);
+}
+#endif
+
+class IOUringEnv;
+
+// pread() based random-access whose reads IOUringEnv can batch
+class IOUringRandomAccessFile : public RandomAccessFile {
+ public:
+  IOUringRandomAccessFile(IOUringEnv* env, const std::string& fname, int fd);
+  virtual ~IOUringRandomAccessFile();
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    ReadRequest r;
+    r.offset = offset;
+    r.n = n;
+    r.scratch = scratch;
+    Status s = PreadRest(fd_, filename_, &r, 0);
+    *result = r.result;
+    return s;
+  }
+
+  virtual void Hint(AccessPattern pattern) {
+#if defined(OS_LINUX)
+    int advice = POSIX_FADV_NORMAL;
+    switch (pattern) {
+      case kNormal:     advice = POSIX_FADV_NORMAL;     break;
+      case kRandom:     advice = POSIX_FADV_RANDOM;     break;
+      case kSequential: advice = POSIX_FADV_SEQUENTIAL; break;
+      case kDontNeed:   advice = POSIX_FADV_DONTNEED;   break;
+    }
+    posix_fadvise(fd_, 0, 0, advice);
+#endif
+  }
+
+  const std::string& filename() const { return filename_; }
+  int fd() const { return fd_; }
+
+ private:
+  IOUringEnv* const env_;
+  const std::string filename_;
+  const int fd_;
+};
+
+class IOUringEnv : public EnvWrapper {
+ public:
+  // If "failing_waits" is set, see TEST_NewIOUringEnvFailingWaits()
+  IOUringEnv(Env* base, bool failing_waits)
+      : EnvWrapper(base), failing_waits_(failing_waits),
+        has_key_(false), no_rings_(NULL) {
+#if defined(LEVELDB_IO_URING)
+    has_key_ = (pthread_key_create(&ring_key_, &DeleteRing) == 0);
+#endif
+  }
+
+  virtual ~IOUringEnv() {
+#if defined(LEVELDB_IO_URING)
+    // The rings of threads that are still running are leaked
+    if (has_key_) {
+      pthread_key_delete(ring_key_);
+    }
+#endif
+  }
+
+  virtual Status NewRandomAccessFile(const std::string& fname,
+                                     RandomAccessFile** result) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      *result = NULL;
+      return IOError(fname, errno);
+    }
+    *result = new IOUringRandomAccessFile(this, fname, fd);
+    return Status::OK();
+  }
+
+  virtual void MultiRead(ReadRequest* reqs, int n) {
+    // Split off the reads of files this Env did not open
+    std::vector<ReadRequest*> mine;
+    std::vector<int> fds;
+    std::vector<const std::string*> fnames;
+    std::vector<ReadRequest> others;
+    std::vector<int> other_index;
+    {
+      MutexLock l(&mu_);
+      for (int i = 0; i < n; i++) {
+        std::map<const RandomAccessFile*, IOUringRandomAccessFile*>::iterator
+            it = files_.find(reqs[i].file);
+        if (it != files_.end()) {
+          mine.push_back(&reqs[i]);
+          fds.push_back(it->second->fd());
+          fnames.push_back(&it->second->filename());
+        } else {
+          others.push_back(reqs[i]);
+          other_index.push_back(i);
+        }
+      }
+    }
+    if (!others.empty()) {
+      target()->MultiRead(&others[0], others.size());
+      for (size_t i = 0; i < others.size(); i++) {
+        reqs[other_index[i]] = others[i];
+      }
+    }
+    if (mine.empty()) {
+      return;
+    }
+
+#if defined(LEVELDB_IO_URING)
+    Ring* ring = (mine.size() > 1) ? GetRing() : NULL;
+    if (ring != NULL) {
+      ring->Read(&mine[0], &fds[0], &fnames[0], mine.size());
+      return;
+    }
+#endif
+    for (size_t i = 0; i < mine.size(); i++) {
+      mine[i]->status = PreadRest(fds[i], *fnames[i], mine[i], 0);
+    }
+  }
+
+  void Register(IOUringRandomAccessFile* file) {
+    MutexLock l(&mu_);
+    files_[file] = file;
+  }
+
+  void Unregister(IOUringRandomAccessFile* file) {
+    MutexLock l(&mu_);
+    files_.erase(file);
+  }
+
+ private:
+#if defined(LEVELDB_IO_URING)
+  // Return the ring of the calling thread, or NULL if io_uring is
+  // not available
+  Ring* GetRing() {
+    if (!has_key_ || no_rings_.Acquire_Load() != NULL) {
+      return NULL;
+    }
+    Ring* ring = reinterpret_cast<Ring*>(pthread_getspecific(ring_key_));
+    if (ring == NULL) {
+      if (failing_waits_) {
+        // Reads complete later, so that there are waits to fail
+        ring = new Ring(&FailingIOUringEnter, IOSQE_ASYNC);
+      } else {
+        ring = new Ring(&IOUringEnter, 0);
+      }
+      if (!ring->Init()) {
+        // Most likely the kernel lacks io_uring or forbids it, so do not
+        // keep trying for every call
+        delete ring;
+        no_rings_.Release_Store(this);
+        return NULL;
+      }
+      pthread_setspecific(ring_key_, ring);
+    }
+    return ring;
+  }
+
+  pthread_key_t ring_key_;
+#endif
+  const bool failing_waits_;
+  bool has_key_;
+  port::AtomicPointer no_rings_;  // Non-NULL once io_uring failed us
+  port::Mutex mu_;
+
+  // The open files this Env created, so that MultiRead() can tell them
+  // from those of other Envs
+  std::map<const RandomAccessFile*, IOUringRandomAccessFile*> files_;
+};
+
+IOUringRandomAccessFile::IOUringRandomAccessFile(IOUringEnv* env,
+                                                 const std::string& fname,
+                                                 int fd)
+    : env_(env), filename_(fname), fd_(fd) {
+  env_->Register(this);
+}
+
+IOUringRandomAccessFile::~IOUringRandomAccessFile() {
+  env_->Unregister(this);
+  close(fd_);
+}
+
+}  // namespace
+
+Env* NewIOUringEnv(Env* base) {
+  return new IOUringEnv(base, false);
+}
+
+Env* TEST_NewIOUringEnvFailingWaits(Env* base) {
+  return new IOUringEnv(base, true);
+}
+
+int TEST_IOUringFailWaits(int n, int err) {
+  __atomic_store_n(&fail_errno, err, __ATOMIC_RELAXED);
+  __atomic_store_n(&fail_waits, n, __ATOMIC_RELAXED);
+  return __atomic_exchange_n(&failed_waits, 0, __ATOMIC_RELAXED);
+}
+
+}  // namespace leveldb
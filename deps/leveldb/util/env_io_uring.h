@@ -0,0 +1,30 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Testing hooks of the io_uring Env (see NewIOUringEnv() in env.h).
+
+#ifndef STORAGE_LEVELDB_UTIL_ENV_IO_URING_H_
+#define STORAGE_LEVELDB_UTIL_ENV_IO_URING_H_
+
+#include "leveldb/env.h"
+
+namespace leveldb {
+
+// Return an Env like NewIOUringEnv(base) whose rings wait for their
+// completions through a wrapper of the system call that can be made to
+// fail (see TEST_IOUringFailWaits()).  Its reads are handed to kernel
+// threads rather than done when submitted, so that there are
+// completions to wait for.  The Envs of NewIOUringEnv() call the
+// kernel directly.
+extern Env* TEST_NewIOUringEnvFailingWaits(Env* base);
+
+// Make the next "n" waits of the rings of TEST_NewIOUringEnvFailingWaits()
+// Envs fail with errno "err", or all of them until the next call if "n"
+// is negative.  Returns the number of waits that failed since the
+// previous call.
+extern int TEST_IOUringFailWaits(int n, int err);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_ENV_IO_URING_H_
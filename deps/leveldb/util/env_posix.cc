@@ -2,8 +2,10 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <algorithm>
 #include <deque>
 #include <set>
+#include <vector>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -20,6 +22,11 @@
 #if defined(LEVELDB_PLATFORM_ANDROID)
 #include <sys/stat.h>
 #endif
+#if defined(OS_LINUX)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 #include "leveldb/env.h"
 #include "leveldb/slice.h"
 #include "port/port.h"
@@ -35,6 +42,13 @@ static Status IOError(const std::string& context, int err_number) {
   return Status::IOError(context, strerror(err_number));
 }
 
+static void PthreadCall(const char* label, int result) {
+  if (result != 0) {
+    fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
+    abort();
+  }
+}
+
 class PosixSequentialFile: public SequentialFile {
  private:
   std::string filename_;
@@ -90,6 +104,19 @@ class PosixRandomAccessFile: public RandomAccessFile {
     }
     return s;
   }
+
+#if defined(OS_LINUX)
+  virtual void Hint(AccessPattern pattern) {
+    int advice = POSIX_FADV_NORMAL;
+    switch (pattern) {
+      case kNormal:     advice = POSIX_FADV_NORMAL;     break;
+      case kRandom:     advice = POSIX_FADV_RANDOM;     break;
+      case kSequential: advice = POSIX_FADV_SEQUENTIAL; break;
+      case kDontNeed:   advice = POSIX_FADV_DONTNEED;   break;
+    }
+    posix_fadvise(fd_, 0, 0, advice);
+  }
+#endif
 };
 
 // Helper class to limit mmap file usage so that we do not end up
@@ -173,21 +200,50 @@ class PosixMmapReadableFile: public RandomAccessFile {
     }
     return s;
   }
+
+  virtual void Hint(AccessPattern pattern) {
+    int advice = MADV_NORMAL;
+    switch (pattern) {
+      case kNormal:     advice = MADV_NORMAL;     break;
+      case kRandom:     advice = MADV_RANDOM;     break;
+      case kSequential: advice = MADV_SEQUENTIAL; break;
+      case kDontNeed:   advice = MADV_DONTNEED;   break;
+    }
+    madvise(mmapped_region_, length_, advice);
+  }
 };
 
+// Reserve storage for [offset,offset+len) of fd without changing its
+// size.  File systems that cannot do so are left to allocate as they go.
+static Status Fallocate(const std::string& fname, int fd,
+                        uint64_t offset, uint64_t len) {
+#if defined(OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE)
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset),
+                static_cast<off_t>(len)) != 0 &&
+      errno != EOPNOTSUPP && errno != ENOSYS) {
+    return IOError(fname, errno);
+  }
+#endif
+  return Status::OK();
+}
+
 class PosixWritableFile : public WritableFile {
  private:
   std::string filename_;
   FILE* file_;
+  uint64_t pos_;           // Offset of the next append
+  uint64_t size_;          // Size of the file, counting buffered appends
+  uint64_t allocated_;     // End of the storage reserved by Allocate()
 
  public:
-  PosixWritableFile(const std::string& fname, FILE* f)
-      : filename_(fname), file_(f) { }
+  // Appends overwrite the "size" bytes *f already holds from the start
+  PosixWritableFile(const std::string& fname, FILE* f, uint64_t size)
+      : filename_(fname), file_(f), pos_(0), size_(size), allocated_(0) { }
 
   ~PosixWritableFile() {
     if (file_ != NULL) {
       // Ignoring any potential errors
-      fclose(file_);
+      Close();
     }
   }
 
@@ -196,18 +252,47 @@ class PosixWritableFile : public WritableFile {
     if (r != data.size()) {
       return IOError(filename_, errno);
     }
+    pos_ += r;
+    size_ = std::max(size_, pos_);
     return Status::OK();
   }
 
   virtual Status Close() {
     Status result;
-    if (fclose(file_) != 0) {
+    if (allocated_ > size_) {
+      // Release the storage reserved past the end of the file
+      if (fflush_unlocked(file_) != 0 ||
+          ftruncate(fileno(file_), static_cast<off_t>(size_)) != 0) {
+        result = IOError(filename_, errno);
+      }
+    }
+    if (fclose(file_) != 0 && result.ok()) {
       result = IOError(filename_, errno);
     }
     file_ = NULL;
     return result;
   }
 
+  virtual Status Allocate(uint64_t offset, uint64_t len) {
+    Status s = Fallocate(filename_, fileno(file_), offset, len);
+    if (s.ok()) {
+      allocated_ = std::max(allocated_, offset + len);
+    }
+    return s;
+  }
+
+  virtual Status RangeSync(uint64_t offset, uint64_t len) {
+#if defined(OS_LINUX)
+    if (fflush_unlocked(file_) != 0 ||
+        sync_file_range(fileno(file_), static_cast<off64_t>(offset),
+                        static_cast<off64_t>(len),
+                        SYNC_FILE_RANGE_WRITE) != 0) {
+      return IOError(filename_, errno);
+    }
+#endif
+    return Status::OK();
+  }
+
   virtual Status Flush() {
     if (fflush_unlocked(file_) != 0) {
       return IOError(filename_, errno);
@@ -256,6 +341,209 @@ class PosixWritableFile : public WritableFile {
   }
 };
 
+#if defined(O_DIRECT)
+// Files opened with O_DIRECT must be read and written in multiples of
+// the logical block size, at offsets and from buffers aligned to it.
+// This is a multiple of the block size of the devices in common use.
+static const size_t kDirectIOAlignment = 4096;
+
+// Direct writes are buffered up to this many bytes
+static const size_t kDirectWriteBufferSize = 1 << 20;
+
+static uint64_t RoundDown(uint64_t x) {
+  return x & ~static_cast<uint64_t>(kDirectIOAlignment - 1);
+}
+
+static uint64_t RoundUp(uint64_t x) {
+  return RoundDown(x + kDirectIOAlignment - 1);
+}
+
+// Reads the whole range unless end of file or an error intervenes.
+// Returns the number of bytes read, or -1 on error.
+static ssize_t PreadFully(int fd, char* buf, size_t n, uint64_t offset) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t r = pread(fd, buf + done, n - done,
+                      static_cast<off_t>(offset + done));
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    } else if (r == 0) {
+      break;
+    }
+    done += r;
+  }
+  return done;
+}
+
+static bool PwriteFully(int fd, const char* buf, size_t n, uint64_t offset) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t r = pwrite(fd, buf + done, n - done,
+                       static_cast<off_t>(offset + done));
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    done += r;
+  }
+  return true;
+}
+
+// pread() based random-access to a file opened with O_DIRECT.  Each read
+// goes through an aligned bounce buffer covering the enclosing blocks.
+class PosixDirectRandomAccessFile: public RandomAccessFile {
+ private:
+  std::string filename_;
+  int fd_;
+
+ public:
+  PosixDirectRandomAccessFile(const std::string& fname, int fd)
+      : filename_(fname), fd_(fd) { }
+  virtual ~PosixDirectRandomAccessFile() { close(fd_); }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    const uint64_t start = RoundDown(offset);
+    const size_t skip = static_cast<size_t>(offset - start);
+    const size_t len = static_cast<size_t>(RoundUp(offset + n) - start);
+    void* buf;
+    if (posix_memalign(&buf, kDirectIOAlignment, len) != 0) {
+      *result = Slice(scratch, 0);
+      return IOError(filename_, ENOMEM);
+    }
+    Status s;
+    ssize_t r = PreadFully(fd_, reinterpret_cast<char*>(buf), len, start);
+    size_t available = 0;
+    if (r < 0) {
+      s = IOError(filename_, errno);
+    } else if (static_cast<size_t>(r) > skip) {
+      available = std::min(n, static_cast<size_t>(r) - skip);
+      memcpy(scratch, reinterpret_cast<char*>(buf) + skip, available);
+    }
+    free(buf);
+    *result = Slice(scratch, available);
+    return s;
+  }
+};
+
+// A file opened with O_DIRECT that collects appends in an aligned buffer
+// and writes them out a whole number of blocks at a time.  The partial
+// block at the end is written zero-padded by Sync() and Close(), which
+// then cut the file back to its true size; later appends rewrite it.
+class PosixDirectWritableFile : public WritableFile {
+ private:
+  std::string filename_;
+  int fd_;
+  char* buf_;
+  size_t buf_len_;         // Bytes in buf_
+  uint64_t buf_offset_;    // File offset of buf_[0]; always aligned
+  uint64_t allocated_;     // End of the storage reserved by Allocate()
+
+  // Write out the whole blocks in the buffer and keep the partial one
+  Status WriteBlocks() {
+    const size_t aligned = static_cast<size_t>(RoundDown(buf_len_));
+    if (aligned == 0) {
+      return Status::OK();
+    }
+    if (!PwriteFully(fd_, buf_, aligned, buf_offset_)) {
+      return IOError(filename_, errno);
+    }
+    memmove(buf_, buf_ + aligned, buf_len_ - aligned);
+    buf_len_ -= aligned;
+    buf_offset_ += aligned;
+    return Status::OK();
+  }
+
+  // Write out the partial block at the end, zero-padded
+  Status WriteTail() {
+    Status s = WriteBlocks();
+    if (s.ok() && buf_len_ > 0) {
+      const size_t padded = static_cast<size_t>(RoundUp(buf_len_));
+      memset(buf_ + buf_len_, 0, padded - buf_len_);
+      if (!PwriteFully(fd_, buf_, padded, buf_offset_) ||
+          ftruncate(fd_, static_cast<off_t>(buf_offset_ + buf_len_)) != 0) {
+        s = IOError(filename_, errno);
+      }
+    }
+    return s;
+  }
+
+ public:
+  PosixDirectWritableFile(const std::string& fname, int fd, char* buf)
+      : filename_(fname), fd_(fd), buf_(buf), buf_len_(0), buf_offset_(0),
+        allocated_(0) { }
+
+  ~PosixDirectWritableFile() {
+    if (fd_ >= 0) {
+      // Ignoring any potential errors
+      Close();
+    }
+    free(buf_);
+  }
+
+  virtual Status Append(const Slice& data) {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+      const size_t n = std::min(left, kDirectWriteBufferSize - buf_len_);
+      memcpy(buf_ + buf_len_, p, n);
+      buf_len_ += n;
+      p += n;
+      left -= n;
+      if (buf_len_ == kDirectWriteBufferSize) {
+        Status s = WriteBlocks();
+        if (!s.ok()) {
+          return s;
+        }
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual Status Close() {
+    Status s = WriteTail();
+    const uint64_t size = buf_offset_ + buf_len_;
+    if (s.ok() && allocated_ > size &&
+        ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+      // Release the storage reserved past the end of the file
+      s = IOError(filename_, errno);
+    }
+    if (close(fd_) < 0 && s.ok()) {
+      s = IOError(filename_, errno);
+    }
+    fd_ = -1;
+    return s;
+  }
+
+  virtual Status Flush() {
+    // The partial block stays buffered: writing it now would only have
+    // to be repeated once it fills up.
+    return WriteBlocks();
+  }
+
+  virtual Status Allocate(uint64_t offset, uint64_t len) {
+    Status s = Fallocate(filename_, fd_, offset, len);
+    if (s.ok()) {
+      allocated_ = std::max(allocated_, offset + len);
+    }
+    return s;
+  }
+
+  virtual Status Sync() {
+    Status s = WriteTail();
+    if (s.ok() && fdatasync(fd_) != 0) {
+      s = IOError(filename_, errno);
+    }
+    return s;
+  }
+};
+#endif
+
 static int LockOrUnlock(int fd, bool lock) {
   errno = 0;
   struct flock f;
@@ -347,11 +635,77 @@ class PosixEnv : public Env {
       *result = NULL;
       s = IOError(fname, errno);
     } else {
-      *result = new PosixWritableFile(fname, f);
+      *result = new PosixWritableFile(fname, f, 0);
     }
     return s;
   }
 
+  virtual Status ReuseWritableFile(const std::string& fname,
+                                   const std::string& old_fname,
+                                   WritableFile** result) {
+    *result = NULL;
+    if (rename(old_fname.c_str(), fname.c_str()) != 0) {
+      return IOError(old_fname, errno);
+    }
+    int fd = open(fname.c_str(), O_WRONLY);
+    if (fd < 0) {
+      return IOError(fname, errno);
+    }
+    struct stat sbuf;
+    FILE* f = NULL;
+    if (fstat(fd, &sbuf) != 0 || (f = fdopen(fd, "w")) == NULL) {
+      Status s = IOError(fname, errno);
+      close(fd);
+      return s;
+    }
+    *result = new PosixWritableFile(fname, f, sbuf.st_size);
+    return Status::OK();
+  }
+
+  virtual Status NewDirectRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result) {
+#if defined(O_DIRECT)
+    *result = NULL;
+    int fd = open(fname.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+      // The file system does not support direct I/O
+      return NewRandomAccessFile(fname, result);
+    } else if (fd < 0) {
+      return IOError(fname, errno);
+    }
+    *result = new PosixDirectRandomAccessFile(fname, fd);
+    return Status::OK();
+#else
+    return NewRandomAccessFile(fname, result);
+#endif
+  }
+
+  virtual Status NewDirectWritableFile(const std::string& fname,
+                                       WritableFile** result) {
+#if defined(O_DIRECT)
+    *result = NULL;
+    int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+                  0644);
+    if (fd < 0 && errno == EINVAL) {
+      // The file system does not support direct I/O
+      return NewWritableFile(fname, result);
+    } else if (fd < 0) {
+      return IOError(fname, errno);
+    }
+    void* buf;
+    if (posix_memalign(&buf, kDirectIOAlignment,
+                       kDirectWriteBufferSize) != 0) {
+      close(fd);
+      return IOError(fname, ENOMEM);
+    }
+    *result = new PosixDirectWritableFile(fname, fd,
+                                          reinterpret_cast<char*>(buf));
+    return Status::OK();
+#else
+    return NewWritableFile(fname, result);
+#endif
+  }
+
   virtual bool FileExists(const std::string& fname) {
     return access(fname.c_str(), F_OK) == 0;
   }
@@ -415,6 +769,17 @@ class PosixEnv : public Env {
     return result;
   }
 
+  virtual Status LinkFile(const std::string& src, const std::string& target) {
+    if (link(src.c_str(), target.c_str()) == 0) {
+      return Status::OK();
+    }
+    if (errno == EXDEV || errno == EPERM || errno == EMLINK) {
+      // Different file systems, or no hard links: copy instead
+      return Env::LinkFile(src, target);
+    }
+    return IOError(src, errno);
+  }
+
   virtual Status LockFile(const std::string& fname, FileLock** lock) {
     *lock = NULL;
     Status result;
@@ -451,6 +816,17 @@ class PosixEnv : public Env {
 
   virtual void Schedule(void (*function)(void*), void* arg);
 
+  virtual void Schedule(void (*function)(void*), void* arg, Priority pri);
+
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
+  virtual void LowerThreadPoolIOPriority(Priority pri);
+
+  virtual void LowerThreadPoolCPUPriority(Priority pri);
+
+  virtual void SetThreadPoolCPUAffinity(const std::vector<int>& cpus,
+                                        Priority pri);
+
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
   virtual Status GetTestDirectory(std::string* result) {
@@ -496,65 +872,209 @@ class PosixEnv : public Env {
   }
 
  private:
-  void PthreadCall(const char* label, int result) {
-    if (result != 0) {
-      fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
-      abort();
+  // A set of background threads that run scheduled work in FIFO order.
+  class ThreadPool {
+   public:
+    ThreadPool();
+    void Schedule(void (*function)(void*), void* arg);
+    void SetThreads(int number);
+    void LowerIOPriority();
+    void LowerCPUPriority();
+    void SetCPUAffinity(const std::vector<int>& cpus);
+
+   private:
+    // Scheduling settings of the threads in the pool.  Each thread
+    // applies them to itself before it runs its next work item.
+    struct ThreadSettings {
+      bool low_io_priority;
+      bool low_cpu_priority;
+      std::vector<int> cpus;     // Empty means any CPU
+      ThreadSettings() : low_io_priority(false), low_cpu_priority(false) { }
+    };
+    static void ApplySettings(const ThreadSettings& old_settings,
+                              const ThreadSettings& settings);
+
+    // BGThread() is the body of each background thread
+    void BGThread();
+    static void* BGThreadWrapper(void* arg) {
+      reinterpret_cast<ThreadPool*>(arg)->BGThread();
+      return NULL;
     }
-  }
 
-  // BGThread() is the body of the background thread
-  void BGThread();
-  static void* BGThreadWrapper(void* arg) {
-    reinterpret_cast<PosixEnv*>(arg)->BGThread();
-    return NULL;
-  }
+    // REQUIRES: mu_ held
+    void StartThreadsIfNeeded();
 
-  pthread_mutex_t mu_;
-  pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
+    pthread_mutex_t mu_;
+    pthread_cond_t bgsignal_;
+    std::vector<pthread_t> bgthreads_;
+    int max_threads_;
+    int idle_threads_;
 
-  // Entry per Schedule() call
-  struct BGItem { void* arg; void (*function)(void*); };
-  typedef std::deque<BGItem> BGQueue;
-  BGQueue queue_;
+    // Entry per Schedule() call
+    struct BGItem { void* arg; void (*function)(void*); };
+    typedef std::deque<BGItem> BGQueue;
+    BGQueue queue_;
+
+    ThreadSettings settings_;
+    uint64_t settings_version_;  // Incremented when settings_ changes
+  };
+
+  ThreadPool pools_[TOTAL];
 
   PosixLockTable locks_;
   MmapLimiter mmap_limit_;
 };
 
-PosixEnv::PosixEnv() : started_bgthread_(false) {
+PosixEnv::PosixEnv() {
+  pools_[HIGH].SetThreads(1);
+  pools_[LOW].SetThreads(1);
+}
+
+void PosixEnv::Schedule(void (*function)(void*), void* arg) {
+  Schedule(function, arg, LOW);
+}
+
+void PosixEnv::Schedule(void (*function)(void*), void* arg, Priority pri) {
+  assert(pri >= LOW && pri < TOTAL);
+  pools_[pri].Schedule(function, arg);
+}
+
+void PosixEnv::SetBackgroundThreads(int number, Priority pri) {
+  assert(pri >= LOW && pri < TOTAL);
+  pools_[pri].SetThreads(number);
+}
+
+void PosixEnv::LowerThreadPoolIOPriority(Priority pri) {
+  assert(pri >= LOW && pri < TOTAL);
+  pools_[pri].LowerIOPriority();
+}
+
+void PosixEnv::LowerThreadPoolCPUPriority(Priority pri) {
+  assert(pri >= LOW && pri < TOTAL);
+  pools_[pri].LowerCPUPriority();
+}
+
+void PosixEnv::SetThreadPoolCPUAffinity(const std::vector<int>& cpus,
+                                        Priority pri) {
+  assert(pri >= LOW && pri < TOTAL);
+  pools_[pri].SetCPUAffinity(cpus);
+}
+
+PosixEnv::ThreadPool::ThreadPool()
+    : max_threads_(0), idle_threads_(0), settings_version_(0) {
   PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
   PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
 }
 
-void PosixEnv::Schedule(void (*function)(void*), void* arg) {
+void PosixEnv::ThreadPool::SetThreads(int number) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  if (number > max_threads_) {
+    max_threads_ = number;
+    // Threads are started lazily, but work that is already queued
+    // may be able to make use of the extra threads right away.
+    if (!queue_.empty()) {
+      StartThreadsIfNeeded();
+    }
+  }
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::ThreadPool::LowerIOPriority() {
   PthreadCall("lock", pthread_mutex_lock(&mu_));
+  settings_.low_io_priority = true;
+  settings_version_++;
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::ThreadPool::LowerCPUPriority() {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  settings_.low_cpu_priority = true;
+  settings_version_++;
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
 
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
+void PosixEnv::ThreadPool::SetCPUAffinity(const std::vector<int>& cpus) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  settings_.cpus = cpus;
+  settings_version_++;
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+// Apply to the calling thread the differences between "old_settings",
+// which are in effect for it, and "settings".  Failures are ignored: the
+// settings only affect performance.
+void PosixEnv::ThreadPool::ApplySettings(const ThreadSettings& old_settings,
+                                         const ThreadSettings& settings) {
+#if defined(OS_LINUX)
+  const pid_t tid = syscall(SYS_gettid);
+  if (settings.low_io_priority && !old_settings.low_io_priority) {
+    // The lowest level of the best-effort class rather than the idle
+    // class: compactions that never got to the disk under a steady read
+    // load would end up stopping writes.
+    const int kIOPrioClassShift = 13;
+    const int kIOPrioClassBestEffort = 2;
+    const int kIOPrioLowestLevel = 7;
+    const int kIOPrioWhoProcess = 1;
+    syscall(SYS_ioprio_set, kIOPrioWhoProcess, tid,
+            (kIOPrioClassBestEffort << kIOPrioClassShift) | kIOPrioLowestLevel);
+  }
+  if (settings.low_cpu_priority && !old_settings.low_cpu_priority) {
+    // Linux applies niceness to single threads
+    setpriority(PRIO_PROCESS, tid, 19);
+  }
+  if (settings.cpus != old_settings.cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (settings.cpus.empty()) {
+      const long n = sysconf(_SC_NPROCESSORS_CONF);
+      for (long cpu = 0; cpu < n && cpu < CPU_SETSIZE; cpu++) {
+        CPU_SET(cpu, &set);
+      }
+    } else {
+      for (size_t i = 0; i < settings.cpus.size(); i++) {
+        if (settings.cpus[i] >= 0 && settings.cpus[i] < CPU_SETSIZE) {
+          CPU_SET(settings.cpus[i], &set);
+        }
+      }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+}
+
+void PosixEnv::ThreadPool::StartThreadsIfNeeded() {
+  // Start another background thread if all current ones are busy
+  size_t wanted = queue_.size();
+  while (static_cast<int>(bgthreads_.size()) < max_threads_ &&
+         static_cast<size_t>(idle_threads_) < wanted) {
+    pthread_t t;
     PthreadCall(
         "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
+        pthread_create(&t, NULL,  &ThreadPool::BGThreadWrapper, this));
+    bgthreads_.push_back(t);
+    idle_threads_++;
   }
+}
 
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
-  }
+void PosixEnv::ThreadPool::Schedule(void (*function)(void*), void* arg) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
 
   // Add to priority queue
   queue_.push_back(BGItem());
   queue_.back().function = function;
   queue_.back().arg = arg;
 
+  StartThreadsIfNeeded();
+
+  // An idle background thread may currently be waiting.
+  PthreadCall("signal", pthread_cond_signal(&bgsignal_));
+
   PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
-void PosixEnv::BGThread() {
+void PosixEnv::ThreadPool::BGThread() {
+  ThreadSettings applied;
+  uint64_t applied_version = 0;
   while (true) {
     // Wait until there is an item that is ready to run
     PthreadCall("lock", pthread_mutex_lock(&mu_));
@@ -565,9 +1085,25 @@ void PosixEnv::BGThread() {
     void (*function)(void*) = queue_.front().function;
     void* arg = queue_.front().arg;
     queue_.pop_front();
+    idle_threads_--;
+
+    ThreadSettings settings;
+    const bool changed = (applied_version != settings_version_);
+    if (changed) {
+      settings = settings_;
+      applied_version = settings_version_;
+    }
 
     PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+    if (changed) {
+      ApplySettings(applied, settings);
+      applied = settings;
+    }
     (*function)(arg);
+
+    PthreadCall("lock", pthread_mutex_lock(&mu_));
+    idle_threads_++;
+    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
   }
 }
 
@@ -4,8 +4,24 @@
 
 #include "leveldb/env.h"
 
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+#if defined(OS_LINUX)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #include "port/port.h"
+#include "util/env_io_uring.h"
+#include "util/mutexlock.h"
+#include "util/readahead_file.h"
+#include "util/syncing_file.h"
 #include "util/testharness.h"
+#include "util/work_queue.h"
 
 namespace leveldb {
 
@@ -97,6 +113,494 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+// Blocks its thread until "release" is set, then counts itself done.
+struct BlockingWork {
+  port::AtomicPointer release;
+  port::AtomicPointer done;
+  BlockingWork() : release(NULL), done(NULL) { }
+
+  static void Run(void* v) {
+    BlockingWork* w = reinterpret_cast<BlockingWork*>(v);
+    while (w->release.Acquire_Load() == NULL) {
+      Env::Default()->SleepForMicroseconds(1000);
+    }
+    w->done.Release_Store(w);
+  }
+};
+
+TEST(EnvPosixTest, HighPriorityDoesNotWaitForLow) {
+  BlockingWork low;
+  port::AtomicPointer called (NULL);
+  env_->Schedule(&BlockingWork::Run, &low, Env::LOW);
+  env_->Schedule(&SetBool, &called, Env::HIGH);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(called.NoBarrier_Load() != NULL);
+  ASSERT_TRUE(low.done.Acquire_Load() == NULL);
+
+  low.release.Release_Store(&low);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(low.done.Acquire_Load() != NULL);
+}
+
+TEST(EnvPosixTest, SetBackgroundThreads) {
+  env_->SetBackgroundThreads(2, Env::LOW);
+
+  // With two threads the second item runs while the first is blocked
+  BlockingWork first;
+  port::AtomicPointer called (NULL);
+  env_->Schedule(&BlockingWork::Run, &first, Env::LOW);
+  env_->Schedule(&SetBool, &called, Env::LOW);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(called.NoBarrier_Load() != NULL);
+
+  first.release.Release_Store(&first);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(first.done.Acquire_Load() != NULL);
+}
+
+// Holds the work scheduled on it until RunScheduled() is called
+class DeferringEnv : public EnvWrapper {
+ public:
+  std::vector<std::pair<void (*)(void*), void*> > scheduled;
+
+  DeferringEnv() : EnvWrapper(Env::Default()) { }
+  virtual void Schedule(void (*function)(void*), void* arg, Priority pri) {
+    scheduled.push_back(std::make_pair(function, arg));
+  }
+  void RunScheduled() {
+    for (size_t i = 0; i < scheduled.size(); i++) {
+      (*scheduled[i].first)(scheduled[i].second);
+    }
+    scheduled.clear();
+  }
+};
+
+struct TaskCounter {
+  port::Mutex mu;
+  int count;
+  TaskCounter() : count(0) { }
+
+  static void Run(void* v) {
+    TaskCounter* c = reinterpret_cast<TaskCounter*>(v);
+    MutexLock l(&c->mu);
+    c->count++;
+  }
+  int Get() {
+    MutexLock l(&mu);
+    return count;
+  }
+};
+
+TEST(EnvPosixTest, WorkQueueOwnerRunsTasks) {
+  DeferringEnv env;
+  TaskCounter counter;
+  WorkQueue* q = new WorkQueue(&env, Env::LOW, 2);
+  for (int i = 0; i < 5; i++) {
+    q->Add(&TaskCounter::Run, &counter);
+  }
+  ASSERT_EQ(2, env.scheduled.size());
+
+  // The owner gets through the tasks while the pool is busy elsewhere
+  while (q->RunOne()) { }
+  ASSERT_EQ(5, counter.Get());
+
+  // Close() drops unstarted tasks and does not wait for the helpers,
+  // which find the queue closed when they start; the last deletes it.
+  q->Add(&TaskCounter::Run, &counter);
+  q->Close();
+  env.RunScheduled();
+  ASSERT_EQ(5, counter.Get());
+}
+
+TEST(EnvPosixTest, WorkQueueHelpers) {
+  TaskCounter counter;
+  WorkQueue* q = new WorkQueue(env_, Env::LOW, 3);
+  for (int i = 0; i < 100; i++) {
+    q->Add(&TaskCounter::Run, &counter);
+  }
+  for (int i = 0; i < 100 && counter.Get() < 100; i++) {
+    Env::Default()->SleepForMicroseconds(kDelayMicros);
+  }
+  ASSERT_EQ(100, counter.Get());
+  ASSERT_TRUE(!q->RunOne());
+  q->Close();
+}
+
+#if defined(OS_LINUX)
+// The scheduling settings of the background thread it runs on
+struct ThreadSettingsProbe {
+  int io_priority;
+  int niceness;
+  int cpus;
+  port::AtomicPointer done;
+  ThreadSettingsProbe() : done(NULL) { }
+
+  static void Run(void* v) {
+    ThreadSettingsProbe* p = reinterpret_cast<ThreadSettingsProbe*>(v);
+    const pid_t tid = syscall(SYS_gettid);
+    p->io_priority = syscall(SYS_ioprio_get, 1, tid);
+    p->niceness = getpriority(PRIO_PROCESS, tid);
+    cpu_set_t set;
+    sched_getaffinity(0, sizeof(set), &set);
+    p->cpus = CPU_COUNT(&set);
+    p->done.Release_Store(p);
+  }
+};
+
+static void Probe(Env* env, ThreadSettingsProbe* p) {
+  env->Schedule(&ThreadSettingsProbe::Run, p, Env::HIGH);
+  while (p->done.Acquire_Load() == NULL) {
+    env->SleepForMicroseconds(1000);
+  }
+}
+
+TEST(EnvPosixTest, ThreadPoolPriority) {
+  ThreadSettingsProbe before;
+  Probe(env_, &before);
+
+  env_->LowerThreadPoolIOPriority(Env::HIGH);
+  env_->LowerThreadPoolCPUPriority(Env::HIGH);
+  std::vector<int> cpus(1, 0);
+  env_->SetThreadPoolCPUAffinity(cpus, Env::HIGH);
+  ThreadSettingsProbe lowered;
+  Probe(env_, &lowered);
+  ASSERT_EQ((2 << 13) | 7, lowered.io_priority);  // Lowest best-effort
+  ASSERT_EQ(19, lowered.niceness);
+  ASSERT_EQ(1, lowered.cpus);
+
+  // The threads of the LOW pool are left alone
+  ThreadSettingsProbe low;
+  env_->Schedule(&ThreadSettingsProbe::Run, &low, Env::LOW);
+  while (low.done.Acquire_Load() == NULL) {
+    env_->SleepForMicroseconds(1000);
+  }
+  ASSERT_EQ(before.niceness, low.niceness);
+
+  env_->SetThreadPoolCPUAffinity(std::vector<int>(), Env::HIGH);
+  ThreadSettingsProbe restored;
+  Probe(env_, &restored);
+  ASSERT_EQ(before.cpus, restored.cpus);
+}
+#endif
+
+TEST(EnvPosixTest, LinkFile) {
+  std::string dir;
+  ASSERT_OK(env_->GetTestDirectory(&dir));
+  const std::string src = dir + "/env_test_link_src";
+  const std::string target = dir + "/env_test_link_target";
+  env_->DeleteFile(target);
+  ASSERT_OK(WriteStringToFile(env_, "contents", src));
+  ASSERT_OK(env_->LinkFile(src, target));
+  ASSERT_TRUE(!env_->LinkFile(src, target).ok());
+
+  // Both names stay
+  ASSERT_OK(env_->DeleteFile(src));
+  std::string data;
+  ASSERT_OK(ReadFileToString(env_, target, &data));
+  ASSERT_EQ("contents", data);
+  ASSERT_OK(env_->DeleteFile(target));
+}
+
+TEST(EnvPosixTest, DirectIO) {
+  std::string dir;
+  ASSERT_OK(env_->GetTestDirectory(&dir));
+  const std::string fname = dir + "/env_test_direct";
+
+  // Appends of odd sizes, with syncs that write out a partial last block
+  std::string expected;
+  WritableFile* wfile;
+  ASSERT_OK(env_->NewDirectWritableFile(fname, &wfile));
+  for (int i = 0; i < 300; i++) {
+    const std::string piece(i * 37 + 1, static_cast<char>('a' + i % 26));
+    ASSERT_OK(wfile->Append(piece));
+    expected += piece;
+    if (i % 50 == 0) {
+      ASSERT_OK(wfile->Sync());
+      uint64_t size;
+      ASSERT_OK(env_->GetFileSize(fname, &size));
+      ASSERT_EQ(expected.size(), size);
+    } else if (i % 7 == 0) {
+      ASSERT_OK(wfile->Flush());
+    }
+  }
+  ASSERT_OK(wfile->Close());
+  delete wfile;
+  std::string data;
+  ASSERT_OK(ReadFileToString(env_, fname, &data));
+  ASSERT_TRUE(data == expected);
+
+  // Unaligned reads, including ones that run past the end of the file
+  RandomAccessFile* rfile;
+  ASSERT_OK(env_->NewDirectRandomAccessFile(fname, &rfile));
+  const size_t size = expected.size();
+  const uint64_t offsets[] = { 0, 1, 4095, 4096, 10000, size - 5, size };
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+    char scratch[10000];
+    Slice result;
+    ASSERT_OK(rfile->Read(offsets[i], sizeof(scratch), &result, scratch));
+    ASSERT_EQ(expected.substr(offsets[i], sizeof(scratch)),
+              result.ToString());
+  }
+  delete rfile;
+  ASSERT_OK(env_->DeleteFile(fname));
+}
+
+// Counts the reads that reach the underlying file
+class CountingFile : public RandomAccessFile {
+ public:
+  RandomAccessFile* base_;
+  int* reads_;
+  CountingFile(RandomAccessFile* base, int* reads)
+      : base_(base), reads_(reads) { }
+  virtual ~CountingFile() { delete base_; }
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    (*reads_)++;
+    return base_->Read(offset, n, result, scratch);
+  }
+};
+
+TEST(EnvPosixTest, Readahead) {
+  std::string dir;
+  ASSERT_OK(env_->GetTestDirectory(&dir));
+  const std::string fname = dir + "/env_test_readahead";
+  std::string expected;
+  for (int i = 0; i < 100000; i++) {
+    expected.push_back(static_cast<char>(i % 251));
+  }
+  ASSERT_OK(WriteStringToFile(env_, expected, fname));
+
+  RandomAccessFile* base;
+  ASSERT_OK(env_->NewRandomAccessFile(fname, &base));
+  int reads = 0;
+  RandomAccessFile* file = NewReadaheadRandomAccessFile(
+      new CountingFile(base, &reads), expected.size(), 16384);
+  char scratch[20000];
+  Slice result;
+
+  // Reading the file in order takes one read per chunk
+  file->Hint(RandomAccessFile::kSequential);
+  for (size_t offset = 0; offset < expected.size(); offset += 1000) {
+    ASSERT_OK(file->Read(offset, 1000, &result, scratch));
+    ASSERT_EQ(expected.substr(offset, 1000), result.ToString());
+  }
+  ASSERT_LE(reads, 7);
+
+  // Reads that straddle chunks, go backwards, or are large are served
+  // too, also after the file's cached pages may have been dropped
+  file->Hint(RandomAccessFile::kDontNeed);
+  const uint64_t offsets[] = { 16000, 500, 99990, 100000 };
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+    ASSERT_OK(file->Read(offsets[i], 1000, &result, scratch));
+    ASSERT_EQ(expected.substr(offsets[i], 1000), result.ToString());
+  }
+  reads = 0;
+  ASSERT_OK(file->Read(10, sizeof(scratch), &result, scratch));
+  ASSERT_EQ(expected.substr(10, sizeof(scratch)), result.ToString());
+  ASSERT_EQ(1, reads);
+  delete file;
+  ASSERT_OK(env_->DeleteFile(fname));
+}
+
+TEST(EnvPosixTest, ReuseWritableFile) {
+  std::string dir;
+  ASSERT_OK(env_->GetTestDirectory(&dir));
+  const std::string old_fname = dir + "/env_test_reuse_old";
+  const std::string fname = dir + "/env_test_reuse";
+  ASSERT_OK(WriteStringToFile(env_, "hello world", old_fname));
+
+  // Appends overwrite the old contents from the start
+  WritableFile* file;
+  ASSERT_OK(env_->ReuseWritableFile(fname, old_fname, &file));
+  ASSERT_TRUE(!env_->FileExists(old_fname));
+  ASSERT_OK(file->Append("HELLO"));
+  ASSERT_OK(file->Close());
+  delete file;
+  std::string data;
+  ASSERT_OK(ReadFileToString(env_, fname, &data));
+  ASSERT_EQ("HELLO world", data);
+  ASSERT_OK(env_->DeleteFile(fname));
+}
+
+TEST(EnvPosixTest, Allocate) {
+  std::string dir;
+  ASSERT_OK(env_->GetTestDirectory(&dir));
+  const std::string fname = dir + "/env_test_allocate";
+  for (int direct = 0; direct < 2; direct++) {
+    WritableFile* file;
+    if (direct) {
+      ASSERT_OK(env_->NewDirectWritableFile(fname, &file));
+    } else {
+      ASSERT_OK(env_->NewWritableFile(fname, &file));
+    }
+    ASSERT_OK(file->Allocate(0, 1 << 20));
+    ASSERT_OK(file->Append(std::string(10000, 'x')));
+    ASSERT_OK(file->RangeSync(0, 8192));
+    uint64_t size;
+    ASSERT_OK(env_->GetFileSize(fname, &size));
+    ASSERT_LE(size, 10000);  // Storage is reserved past the end
+    ASSERT_OK(file->Close());
+    delete file;
+
+    ASSERT_OK(env_->GetFileSize(fname, &size));
+    ASSERT_EQ(10000, size);
+#if defined(OS_LINUX)
+    // What was left unused is released again
+    struct stat sbuf;
+    ASSERT_EQ(0, stat(fname.c_str(), &sbuf));
+    ASSERT_LT(sbuf.st_blocks * 512, 1 << 19);
+#endif
+    ASSERT_OK(env_->DeleteFile(fname));
+  }
+}
+
+// Records the calls that reach the underlying file
+class RecordingFile : public WritableFile {
+ public:
+  std::string calls_;
+  virtual Status Append(const Slice& data) {
+    Record("append", data.size(), 0);
+    return Status::OK();
+  }
+  virtual Status Close() { return Status::OK(); }
+  virtual Status Flush() { return Status::OK(); }
+  virtual Status Sync() { return Status::OK(); }
+  virtual Status Allocate(uint64_t offset, uint64_t len) {
+    Record("allocate", offset, len);
+    return Status::OK();
+  }
+  virtual Status RangeSync(uint64_t offset, uint64_t len) {
+    Record("sync", offset, len);
+    return Status::OK();
+  }
+
+ private:
+  void Record(const char* call, uint64_t a, uint64_t b) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%s(%llu,%llu) ", call,
+             static_cast<unsigned long long>(a),
+             static_cast<unsigned long long>(b));
+    calls_ += buf;
+  }
+};
+
+TEST(EnvPosixTest, SyncingFile) {
+  RecordingFile* base = new RecordingFile;
+  WritableFile* file = NewSyncingWritableFile(base, 10000, 25000);
+  for (int i = 0; i < 4; i++) {
+    ASSERT_OK(file->Append(std::string(6000, 'x')));
+  }
+  ASSERT_OK(file->Append(std::string(60000, 'x')));
+
+  // Write-back stops at the last whole page, and storage is reserved a
+  // chunk at a time, several when an append needs them
+  ASSERT_EQ("allocate(0,25000) append(6000,0) append(6000,0) sync(0,8192) "
+            "append(6000,0) append(6000,0) sync(8192,12288) "
+            "allocate(25000,75000) append(60000,0) sync(20480,61440) ",
+            base->calls_);
+  ASSERT_OK(file->Close());
+  delete file;
+}
+
+TEST(EnvPosixTest, MultiRead) {
+  std::string dir;
+  ASSERT_OK(env_->GetTestDirectory(&dir));
+  const std::string fname = dir + "/env_test_multiread";
+  std::string expected;
+  for (int i = 0; i < 300000; i++) {
+    expected.push_back(static_cast<char>(i % 253));
+  }
+  ASSERT_OK(WriteStringToFile(env_, expected, fname));
+
+  // One file opened by the io_uring Env, and one by another Env
+  Env* env = NewIOUringEnv(env_);
+  RandomAccessFile* files[2];
+  ASSERT_OK(env->NewRandomAccessFile(fname, &files[0]));
+  ASSERT_OK(env_->NewRandomAccessFile(fname, &files[1]));
+
+  // More reads than fit in the ring at once, including ones of the
+  // io_uring file that run past the end of the file or start there
+  const int kReads = 150;
+  std::vector<ReadRequest> reqs(kReads);
+  std::vector<std::string> scratch(kReads);
+  for (int i = 0; i < kReads; i++) {
+    reqs[i].file = files[i % 3 == 0 ? 1 : 0];
+    reqs[i].offset = (i * 7919) % expected.size();
+    reqs[i].n = 1 + (i * 131) % 10000;
+    if (i == 10) {
+      reqs[i].offset = expected.size();
+    } else if (i % 3 == 0) {
+      // mmap()ed files reject reads past the end
+      reqs[i].n = std::min<size_t>(reqs[i].n,
+                                   expected.size() - reqs[i].offset);
+    }
+    scratch[i].resize(reqs[i].n);
+    reqs[i].scratch = &scratch[i][0];
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    env->MultiRead(&reqs[0], pass == 0 ? kReads : 1);
+    for (int i = 0; i < (pass == 0 ? kReads : 1); i++) {
+      ASSERT_OK(reqs[i].status);
+      ASSERT_EQ(expected.substr(reqs[i].offset, reqs[i].n),
+                reqs[i].result.ToString());
+    }
+  }
+  delete files[0];
+  delete files[1];
+  delete env;
+  ASSERT_OK(env_->DeleteFile(fname));
+}
+
+TEST(EnvPosixTest, MultiReadWaitFailure) {
+  std::string dir;
+  ASSERT_OK(env_->GetTestDirectory(&dir));
+  const std::string fname = dir + "/env_test_multiread_wait";
+  std::string expected;
+  for (int i = 0; i < 300000; i++) {
+    expected.push_back(static_cast<char>(i % 251));
+  }
+  ASSERT_OK(WriteStringToFile(env_, expected, fname));
+
+  Env* env = TEST_NewIOUringEnvFailingWaits(env_);
+  RandomAccessFile* file;
+  ASSERT_OK(env->NewRandomAccessFile(fname, &file));
+  const int kReads = 150;
+  std::vector<ReadRequest> reqs(kReads);
+  std::vector<std::string> scratch(kReads);
+  for (int i = 0; i < kReads; i++) {
+    reqs[i].file = file;
+    reqs[i].offset = (i * 7919) % expected.size();
+    reqs[i].n = 1 + (i * 131) % 10000;
+    scratch[i].resize(reqs[i].n);
+    reqs[i].scratch = &scratch[i][0];
+  }
+
+  // Waits that fail once, and waits that keep failing, still end with
+  // every read done, without retrying the wait over and over
+  const int kFailures[] = { 1, -1 };
+  const int kErrors[] = { ENOMEM, EBUSY };
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < kReads; i++) {
+      reqs[i].result = Slice();
+      reqs[i].status = Status::OK();
+      memset(reqs[i].scratch, 0, reqs[i].n);
+    }
+    TEST_IOUringFailWaits(kFailures[pass], kErrors[pass]);
+    env->MultiRead(&reqs[0], kReads);
+    ASSERT_LE(TEST_IOUringFailWaits(0, 0), kReads);
+    for (int i = 0; i < kReads; i++) {
+      ASSERT_OK(reqs[i].status);
+      const size_t n = std::min<size_t>(reqs[i].n,
+                                        expected.size() - reqs[i].offset);
+      ASSERT_EQ(expected.substr(reqs[i].offset, n),
+                reqs[i].result.ToString());
+    }
+  }
+  delete file;
+  delete env;
+  ASSERT_OK(env_->DeleteFile(fname));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -8,4 +8,8 @@ namespace leveldb {
 
 FilterPolicy::~FilterPolicy() { }
 
+bool FilterPolicy::CoversPrefix(const Slice& prefix) const {
+  return false;
+}
+
 }  // namespace leveldb
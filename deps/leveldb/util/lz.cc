@@ -0,0 +1,357 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/lz.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include "util/coding.h"
+
+namespace leveldb {
+namespace lz {
+
+static const size_t kMinMatch = 4;
+static const size_t kMaxDistance = 65535;
+static const int kMaxHashBits = 14;
+
+static inline uint32_t HashBytes(uint32_t bytes, int shift) {
+  return (bytes * 0x1e35a7bd) >> shift;
+}
+
+// Append "len", the part of a length that did not fit into its nibble
+static char* PutExtension(char* op, size_t len) {
+  while (len >= 255) {
+    *op++ = static_cast<char>(255);
+    len -= 255;
+  }
+  *op++ = static_cast<char>(len);
+  return op;
+}
+
+static char* PutCommand(char* op, const char* literals, size_t num_literals,
+                        size_t distance, size_t match_len) {
+  char* tag = op++;
+  const size_t m = (match_len == 0) ? 0 : match_len - kMinMatch;
+  *tag = static_cast<char>(((num_literals < 15 ? num_literals : 15) << 4) |
+                           (m < 15 ? m : 15));
+  if (num_literals >= 15) {
+    op = PutExtension(op, num_literals - 15);
+  }
+  memcpy(op, literals, num_literals);
+  op += num_literals;
+  if (match_len > 0) {
+    *op++ = static_cast<char>(distance & 0xff);
+    *op++ = static_cast<char>(distance >> 8);
+    if (m >= 15) {
+      op = PutExtension(op, m - 15);
+    }
+  }
+  return op;
+}
+
+Dictionary::Dictionary(const Slice& contents)
+    : contents_(contents.data(), contents.size()),
+      table_(static_cast<size_t>(1) << kMaxHashBits, 0) {
+  assert(contents_.size() <= kMaxDictionarySize);
+  const int shift = 32 - kMaxHashBits;
+  for (size_t i = 0; i + kMinMatch <= contents_.size(); i++) {
+    table_[HashBytes(DecodeFixed32(contents_.data() + i), shift)] = i + 1;
+  }
+}
+
+bool Compress(const char* input, size_t n, std::string* output) {
+  return Compress(input, n, NULL, output);
+}
+
+bool Compress(const char* input, size_t n, const Dictionary* dict,
+              std::string* output) {
+  if (n > 0xffffffffu) {
+    return false;
+  }
+
+  // Worst case: everything is stored as literals
+  output->resize(5 + n + n / 255 + 16);
+  char* const base = &(*output)[0];
+  char* op = EncodeVarint32(base, static_cast<uint32_t>(n));
+
+  // Small inputs only need a small table, which is cheaper to clear
+  int bits = 8;
+  while (bits < kMaxHashBits && (static_cast<size_t>(1) << bits) < n) {
+    bits++;
+  }
+  const int shift = 32 - bits;
+  uint32_t table[1 << kMaxHashBits];
+  memset(table, 0, sizeof(table[0]) << bits);
+
+  const char* dict_data = NULL;
+  size_t dict_size = 0;
+  if (dict != NULL) {
+    dict_data = dict->contents_.data();
+    dict_size = dict->contents_.size();
+  }
+
+  size_t anchor = 0;  // Start of the pending literals
+  size_t ip = 0;
+  if (n >= kMinMatch) {
+    const size_t limit = n - kMinMatch;
+    while (ip <= limit) {
+      const uint32_t bytes = DecodeFixed32(input + ip);
+      uint32_t* slot = &table[HashBytes(bytes, shift)];
+      const size_t candidate = *slot;
+      *slot = static_cast<uint32_t>(ip);
+
+      size_t len = 0;
+      size_t distance = 0;
+      if (candidate < ip && ip - candidate <= kMaxDistance &&
+          DecodeFixed32(input + candidate) == bytes) {
+        len = kMinMatch;
+        while (ip + len < n && input[candidate + len] == input[ip + len]) {
+          len++;
+        }
+        distance = ip - candidate;
+      } else if (dict != NULL) {
+        const uint32_t d = dict->table_[HashBytes(bytes, 32 - kMaxHashBits)];
+        if (d > 0) {
+          const size_t c = d - 1;
+          if (ip + dict_size - c <= kMaxDistance &&
+              DecodeFixed32(dict_data + c) == bytes) {
+            len = kMinMatch;
+            while (ip + len < n && c + len < dict_size &&
+                   dict_data[c + len] == input[ip + len]) {
+              len++;
+            }
+            distance = ip + dict_size - c;
+          }
+        }
+      }
+
+      if (len == 0) {
+        // Skip ahead faster the longer no match has been found, so that
+        // incompressible data costs little time.
+        ip += 1 + ((ip - anchor) >> 5);
+        continue;
+      }
+      op = PutCommand(op, input + anchor, ip - anchor, distance, len);
+      ip += len;
+      anchor = ip;
+      if (ip <= limit) {
+        // Let a repeat of the bytes just before ip match as well
+        table[HashBytes(DecodeFixed32(input + ip - 1), shift)] =
+            static_cast<uint32_t>(ip - 1);
+      }
+    }
+  }
+  if (anchor < n) {
+    op = PutCommand(op, input + anchor, n - anchor, 0, 0);
+  }
+  output->resize(op - base);
+  return true;
+}
+
+bool GetUncompressedLength(const char* input, size_t n, size_t* result) {
+  uint32_t len;
+  if (GetVarint32Ptr(input, input + n, &len) == NULL) {
+    return false;
+  }
+  *result = len;
+  return true;
+}
+
+// Add the extension bytes at *ip to *len.  Returns false if they run
+// past limit.
+static bool GetExtension(const unsigned char** ip,
+                         const unsigned char* limit,
+                         size_t* len) {
+  const unsigned char* p = *ip;
+  unsigned char b;
+  do {
+    if (p >= limit) {
+      return false;
+    }
+    b = *p++;
+    *len += b;
+  } while (b == 255);
+  *ip = p;
+  return true;
+}
+
+bool Uncompress(const char* input, size_t n, char* output) {
+  return Uncompress(input, n, Slice(), output);
+}
+
+bool Uncompress(const char* input, size_t n, const Slice& dict,
+                char* output) {
+  uint32_t ulength;
+  const char* start = GetVarint32Ptr(input, input + n, &ulength);
+  if (start == NULL) {
+    return false;
+  }
+  const unsigned char* ip = reinterpret_cast<const unsigned char*>(start);
+  const unsigned char* const limit =
+      reinterpret_cast<const unsigned char*>(input + n);
+  size_t op = 0;
+
+  while (ip < limit) {
+    const unsigned char tag = *ip++;
+    size_t num_literals = tag >> 4;
+    if (num_literals == 15 && !GetExtension(&ip, limit, &num_literals)) {
+      return false;
+    }
+    if (num_literals > static_cast<size_t>(limit - ip) ||
+        num_literals > ulength - op) {
+      return false;
+    }
+    memcpy(output + op, ip, num_literals);
+    ip += num_literals;
+    op += num_literals;
+    if (ip == limit) {
+      break;  // Last command
+    }
+
+    if (limit - ip < 2) {
+      return false;
+    }
+    const size_t distance = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t len = tag & 0xf;
+    if (len == 15 && !GetExtension(&ip, limit, &len)) {
+      return false;
+    }
+    len += kMinMatch;
+    if (distance == 0 || distance > op + dict.size() || len > ulength - op) {
+      return false;
+    }
+    char* dst = output + op;
+    if (distance > op) {
+      // The match starts in the dictionary
+      const size_t back = distance - op;
+      const size_t k = std::min(len, back);
+      memcpy(dst, dict.data() + dict.size() - back, k);
+      dst += k;
+      len -= k;
+      op += k;
+    }
+    op += len;
+    if (len == 0) {
+      continue;
+    }
+    const char* src = dst - distance;
+    if (distance >= len) {
+      memcpy(dst, src, len);
+    } else {
+      // Overlapping copy repeats the last "distance" bytes
+      for (size_t i = 0; i < len; i++) {
+        dst[i] = src[i];
+      }
+    }
+  }
+  return op == ulength;
+}
+
+namespace {
+
+// The dictionary is assembled from segments of the samples of this many
+// bytes.  Segments are chosen by how often the strings of kTrainingKmer
+// bytes in them occur throughout the samples.
+static const size_t kSegmentSize = 64;
+static const size_t kTrainingKmer = 6;
+static const int kTrainingHashBits = 16;
+
+struct Segment {
+  uint64_t score;
+  size_t offset;
+
+  bool operator<(const Segment& other) const {
+    if (score != other.score) {
+      return score < other.score;
+    }
+    return offset > other.offset;  // Prefer earlier segments on ties
+  }
+};
+
+inline uint32_t KmerHash(const char* p) {
+  uint64_t v = DecodeFixed32(p) |
+      (static_cast<uint64_t>(DecodeFixed32(p + kTrainingKmer - 4)) << 32);
+  return static_cast<uint32_t>((v * 0x9e3779b97f4a7c15ull) >>
+                               (64 - kTrainingHashBits));
+}
+
+// Sum of the counts of the k-mers starting in the segment.  K-mers seen
+// only once do not recur, so they do not count.
+uint64_t SegmentScore(const Slice& samples, size_t offset,
+                      const std::vector<uint32_t>& counts) {
+  uint64_t score = 0;
+  const size_t end = std::min(offset + kSegmentSize,
+                              samples.size() - kTrainingKmer + 1);
+  for (size_t i = offset; i < end; i++) {
+    const uint32_t c = counts[KmerHash(samples.data() + i)];
+    if (c > 1) {
+      score += c;
+    }
+  }
+  return score;
+}
+
+}  // namespace
+
+void TrainDictionary(const Slice& samples, size_t max_size,
+                     std::string* dict) {
+  dict->clear();
+  max_size = std::min(max_size, kMaxDictionarySize);
+  if (samples.size() <= max_size) {
+    dict->assign(samples.data(), samples.size());
+    return;
+  }
+  if (max_size < kSegmentSize) {
+    return;
+  }
+
+  std::vector<uint32_t> counts(static_cast<size_t>(1) << kTrainingHashBits,
+                               0);
+  for (size_t i = 0; i + kTrainingKmer <= samples.size(); i++) {
+    counts[KmerHash(samples.data() + i)]++;
+  }
+
+  std::priority_queue<Segment> queue;
+  for (size_t offset = 0; offset + kSegmentSize <= samples.size();
+       offset += kSegmentSize) {
+    Segment seg;
+    seg.offset = offset;
+    seg.score = SegmentScore(samples, offset, counts);
+    queue.push(seg);
+  }
+
+  // Greedily take the best segment.  Its k-mers no longer count for the
+  // others once it is in the dictionary, so scores only ever drop and a
+  // segment whose recomputed score still beats the rest is the best.
+  std::vector<size_t> chosen;
+  while (!queue.empty() && (chosen.size() + 1) * kSegmentSize <= max_size) {
+    Segment seg = queue.top();
+    queue.pop();
+    const uint64_t score = SegmentScore(samples, seg.offset, counts);
+    if (score == 0) {
+      break;
+    }
+    if (score < seg.score && !queue.empty() && score < queue.top().score) {
+      seg.score = score;
+      queue.push(seg);
+      continue;
+    }
+    chosen.push_back(seg.offset);
+    for (size_t i = seg.offset; i < seg.offset + kSegmentSize &&
+             i + kTrainingKmer <= samples.size(); i++) {
+      counts[KmerHash(samples.data() + i)] = 0;
+    }
+  }
+
+  // The best segments go last, where matches are nearest to the data
+  for (size_t i = chosen.size(); i > 0; i--) {
+    dict->append(samples.data() + chosen[i - 1], kSegmentSize);
+  }
+}
+
+}  // namespace lz
+}  // namespace leveldb
@@ -0,0 +1,95 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A small LZ77 codec that needs no external library, so that tables can
+// be compressed on platforms without Snappy.  Like Snappy it favors
+// speed over compression ratio.
+//
+// A compressed buffer starts with the varint32 length of the
+// uncompressed data, followed by a sequence of commands.  Each command
+// is a tag byte whose high four bits hold the number of literal bytes
+// that follow and whose low four bits hold the length of the match
+// that comes after them, minus four.  A nibble of 15 is extended by
+// bytes that are added to it until one of them is less than 255.  The
+// literals are followed by the two byte little-endian distance of the
+// match, and then by the extension bytes of the match length.  A command
+// whose literals reach the end of the buffer has no match.
+//
+// Buffers may be compressed against a dictionary, which acts as if it
+// preceded the data: a match whose distance reaches back past the start
+// of the data copies bytes from the end of the dictionary.
+
+#ifndef STORAGE_LEVELDB_UTIL_LZ_H_
+#define STORAGE_LEVELDB_UTIL_LZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "leveldb/slice.h"
+
+namespace leveldb {
+namespace lz {
+
+// Matches reach at most this far back, so only the last bytes of a
+// larger dictionary would ever be used.
+static const size_t kMaxDictionarySize = 65535;
+
+// Content that is expected to recur in the buffers compressed against
+// it, indexed for the compressor.  Safe for concurrent use.
+class Dictionary {
+ public:
+  // REQUIRES: contents.size() <= kMaxDictionarySize
+  explicit Dictionary(const Slice& contents);
+
+  Slice contents() const { return contents_; }
+
+ private:
+  friend bool Compress(const char*, size_t, const Dictionary*,
+                       std::string*);
+
+  std::string contents_;
+  // Position + 1 of the last occurrence of each hash of four bytes in
+  // contents_, or 0 if none
+  std::vector<uint32_t> table_;
+
+  // No copying allowed
+  Dictionary(const Dictionary&);
+  void operator=(const Dictionary&);
+};
+
+// Store the compressed form of input[0,n-1] in *output.  Returns false
+// if the input is too large to be compressed.
+extern bool Compress(const char* input, size_t n, std::string* output);
+
+// Like Compress(), but also finds matches in *dict.  The result can only
+// be uncompressed with the same dictionary contents.
+extern bool Compress(const char* input, size_t n, const Dictionary* dict,
+                     std::string* output);
+
+// If input[0,n-1] looks like a compressed buffer, store the size of the
+// uncompressed data in *result and return true.  Else return false.
+extern bool GetUncompressedLength(const char* input, size_t n,
+                                  size_t* result);
+
+// Attempt to uncompress input[0,n-1] into *output, which must have room
+// for the length returned by GetUncompressedLength().  Returns true if
+// successful, false if the input is corrupted.
+extern bool Uncompress(const char* input, size_t n, char* output);
+
+// Uncompress a buffer that was compressed against a dictionary with the
+// given contents.
+extern bool Uncompress(const char* input, size_t n, const Slice& dict,
+                       char* output);
+
+// Store in *dict up to max_size bytes of the content that occurs most
+// often in "samples", for use as a Dictionary when compressing data
+// like the samples.
+extern void TrainDictionary(const Slice& samples, size_t max_size,
+                            std::string* dict);
+
+}  // namespace lz
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_LZ_H_
@@ -0,0 +1,195 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/lz.h"
+
+#include "util/random.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class LZTest { };
+
+// Compress "input", check that it uncompresses to itself, and return
+// the compressed size
+static size_t RoundTrip(const std::string& input) {
+  std::string compressed;
+  ASSERT_TRUE(lz::Compress(input.data(), input.size(), &compressed));
+  size_t ulength;
+  ASSERT_TRUE(lz::GetUncompressedLength(compressed.data(), compressed.size(),
+                                        &ulength));
+  ASSERT_EQ(input.size(), ulength);
+  std::string output(ulength, '\0');
+  ASSERT_TRUE(lz::Uncompress(compressed.data(), compressed.size(),
+                             ulength > 0 ? &output[0] : NULL));
+  ASSERT_TRUE(input == output);
+  return compressed.size();
+}
+
+TEST(LZTest, Empty) {
+  RoundTrip("");
+  RoundTrip("a");
+  RoundTrip("abcd");
+}
+
+TEST(LZTest, Repeats) {
+  // Overlapping matches and long length extensions
+  ASSERT_LT(RoundTrip(std::string(100000, 'x')), 500);
+  std::string s;
+  for (int i = 0; i < 1000; i++) {
+    s.append("abc");
+  }
+  ASSERT_LT(RoundTrip(s), 100);
+  ASSERT_LT(RoundTrip("0123456789" + s + "0123456789" + s), 200);
+}
+
+TEST(LZTest, Random) {
+  Random rnd(301);
+  for (int i = 0; i < 1000; i++) {
+    std::string s;
+    const size_t len = rnd.Skewed(17);
+    if (rnd.OneIn(2)) {
+      test::RandomString(&rnd, len, &s);
+      // Incompressible data only grows by a little
+      ASSERT_LE(RoundTrip(s), len + len / 255 + 16);
+    } else {
+      test::CompressibleString(&rnd, 0.1 * rnd.Uniform(10), len, &s);
+      RoundTrip(s);
+    }
+  }
+}
+
+TEST(LZTest, LongDistance) {
+  // Matches farther back than the codec can refer to are not used
+  Random rnd(301);
+  std::string block;
+  test::RandomString(&rnd, 1000, &block);
+  std::string filler;
+  test::RandomString(&rnd, 70000, &filler);
+  std::string s = block + filler + block;
+  ASSERT_GT(RoundTrip(s), s.size());
+}
+
+TEST(LZTest, Corrupted) {
+  Random rnd(301);
+  std::string input;
+  test::CompressibleString(&rnd, 0.3, 10000, &input);
+  std::string compressed;
+  ASSERT_TRUE(lz::Compress(input.data(), input.size(), &compressed));
+  std::string output(input.size(), '\0');
+
+  // Truncation is always detected
+  for (size_t n = 0; n < compressed.size(); n++) {
+    ASSERT_TRUE(!lz::Uncompress(compressed.data(), n, &output[0]));
+  }
+
+  // Damaged input must not write past the output or read past the
+  // input, whether or not the damage is detected.
+  for (int i = 0; i < 1000; i++) {
+    std::string damaged = compressed;
+    const int changes = 1 + rnd.Uniform(4);
+    for (int j = 0; j < changes; j++) {
+      damaged[rnd.Uniform(damaged.size())] = static_cast<char>(rnd.Next());
+    }
+    size_t ulength;
+    if (lz::GetUncompressedLength(damaged.data(), damaged.size(), &ulength) &&
+        ulength <= 2 * input.size()) {
+      std::string out(ulength, '\0');
+      lz::Uncompress(damaged.data(), damaged.size(),
+                     ulength > 0 ? &out[0] : NULL);
+    }
+  }
+}
+
+// Like RoundTrip(), compressing against a dictionary with "dict"
+static size_t DictRoundTrip(const std::string& dict, const std::string& input) {
+  lz::Dictionary d(dict);
+  std::string compressed;
+  ASSERT_TRUE(lz::Compress(input.data(), input.size(), &d, &compressed));
+  size_t ulength;
+  ASSERT_TRUE(lz::GetUncompressedLength(compressed.data(), compressed.size(),
+                                        &ulength));
+  ASSERT_EQ(input.size(), ulength);
+  std::string output(ulength, '\0');
+  ASSERT_TRUE(lz::Uncompress(compressed.data(), compressed.size(), dict,
+                             ulength > 0 ? &output[0] : NULL));
+  ASSERT_TRUE(input == output);
+  return compressed.size();
+}
+
+TEST(LZTest, Dictionary) {
+  Random rnd(301);
+  std::string dict;
+  test::RandomString(&rnd, 4096, &dict);
+  DictRoundTrip(dict, "");
+  DictRoundTrip("", "abcdabcdabcd");
+
+  // Data made of pieces of the dictionary only compresses with it
+  std::string input;
+  for (int i = 0; i < 20; i++) {
+    const size_t start = rnd.Uniform(dict.size() - 100);
+    input.append(dict.data() + start, 10 + rnd.Uniform(90));
+    input.push_back('x');
+  }
+  ASSERT_GT(RoundTrip(input), input.size() / 2);
+  ASSERT_LT(DictRoundTrip(dict, input), input.size() / 4);
+
+  // Without the dictionary the data cannot be uncompressed
+  lz::Dictionary d(dict);
+  std::string compressed;
+  ASSERT_TRUE(lz::Compress(input.data(), input.size(), &d, &compressed));
+  std::string output(input.size(), '\0');
+  ASSERT_TRUE(!lz::Uncompress(compressed.data(), compressed.size(),
+                              &output[0]));
+
+  for (int i = 0; i < 100; i++) {
+    std::string s;
+    test::CompressibleString(&rnd, 0.5, rnd.Skewed(14), &s);
+    DictRoundTrip(dict + s.substr(0, s.size() / 2), s);
+  }
+}
+
+TEST(LZTest, DictionaryMatchIntoData) {
+  // A match that starts in the dictionary and runs on into the data
+  std::string compressed;
+  compressed.push_back(8);     // Uncompressed length
+  compressed.push_back(0x04);  // No literals, match of 8
+  compressed.push_back(2);     // Distance 2
+  compressed.push_back(0);
+  char output[8];
+  ASSERT_TRUE(lz::Uncompress(compressed.data(), compressed.size(), "abcd",
+                             output));
+  ASSERT_EQ("cdcdcdcd", std::string(output, 8));
+  ASSERT_TRUE(!lz::Uncompress(compressed.data(), compressed.size(), "a",
+                              output));
+}
+
+TEST(LZTest, TrainDictionary) {
+  Random rnd(301);
+  const std::string common = "/home/user/projects/leveldb/db/";
+  std::string samples;
+  for (int i = 0; i < 2000; i++) {
+    std::string s;
+    samples.append(test::RandomString(&rnd, 30, &s).ToString());
+    samples.append(common);
+  }
+  std::string dict;
+  lz::TrainDictionary(samples, 1024, &dict);
+  ASSERT_LE(dict.size(), 1024);
+  ASSERT_GT(dict.size(), 0);
+  ASSERT_TRUE(dict.find(common.substr(0, 16)) != std::string::npos);
+
+  // Samples that fit are the dictionary
+  lz::TrainDictionary("short", 1024, &dict);
+  ASSERT_EQ("short", dict);
+  lz::TrainDictionary(samples, 10, &dict);
+  ASSERT_EQ("", dict);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,17 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/merge_operator.h"
+
+namespace leveldb {
+
+MergeOperator::~MergeOperator() { }
+
+bool MergeOperator::PartialMerge(const Slice& key, const Slice& left_operand,
+                                 const Slice& right_operand,
+                                 std::string* new_operand) const {
+  return false;
+}
+
+}  // namespace leveldb
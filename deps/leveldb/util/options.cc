@@ -17,12 +17,38 @@ Options::Options()
       env(Env::Default()),
       info_log(NULL),
       write_buffer_size(4<<20),
+      allow_concurrent_memtable_write(false),
+      enable_pipelined_write(false),
+      level0_file_num_compaction_trigger(4),
+      level0_slowdown_writes_trigger(8),
+      level0_stop_writes_trigger(12),
+      soft_pending_compaction_bytes_limit(64ull << 30),
+      hard_pending_compaction_bytes_limit(256ull << 30),
+      delayed_write_rate(16 << 20),
+      rate_limiter(NULL),
+      use_direct_io_for_flush_and_compaction(false),
+      use_direct_reads(false),
+      compaction_readahead_size(2 << 20),
+      advise_random_on_open(true),
+      bytes_per_sync(0),
+      allow_fallocate(true),
+      recycle_log_file_num(0),
       max_open_files(1000),
+      max_subcompactions(1),
       block_cache(NULL),
+      cache_index_and_filter_blocks(false),
+      pin_l0_filter_and_index_blocks_in_cache(false),
       block_size(4096),
       block_restart_interval(16),
+      index_partition_size(0),
       compression(kSnappyCompression),
-      filter_policy(NULL) {
+      compression_threads(1),
+      compression_dict_size(0),
+      filter_policy(NULL),
+      merge_operator(NULL),
+      compaction_filter(NULL),
+      value_log_threshold(0),
+      value_log_gc_ratio(0.5) {
 }
 
 
@@ -0,0 +1,65 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/pinnable_slice.h"
+
+namespace leveldb {
+
+PinnableSlice::PinnableSlice() {
+  cleanup_.function = NULL;
+  cleanup_.next = NULL;
+}
+
+PinnableSlice::~PinnableSlice() {
+  Reset();
+}
+
+void PinnableSlice::PinSlice(const Slice& s) {
+  *static_cast<Slice*>(this) = s;
+}
+
+void PinnableSlice::PinSelf(const Slice& s) {
+  Reset();
+  buf_.assign(s.data(), s.size());
+  *static_cast<Slice*>(this) = buf_;
+}
+
+void PinnableSlice::PinSelf() {
+  assert(!IsPinned());
+  *static_cast<Slice*>(this) = buf_;
+}
+
+void PinnableSlice::Reset() {
+  if (cleanup_.function != NULL) {
+    (*cleanup_.function)(cleanup_.arg1, cleanup_.arg2);
+    for (Cleanup* c = cleanup_.next; c != NULL; ) {
+      (*c->function)(c->arg1, c->arg2);
+      Cleanup* next = c->next;
+      delete c;
+      c = next;
+    }
+    cleanup_.function = NULL;
+    cleanup_.next = NULL;
+  }
+  buf_.clear();
+  clear();
+}
+
+void PinnableSlice::RegisterCleanup(CleanupFunction func,
+                                    void* arg1, void* arg2) {
+  assert(func != NULL);
+  Cleanup* c;
+  if (cleanup_.function == NULL) {
+    c = &cleanup_;
+  } else {
+    c = new Cleanup;
+    c->next = cleanup_.next;
+    cleanup_.next = c;
+  }
+  c->function = func;
+  c->arg1 = arg1;
+  c->arg2 = arg2;
+}
+
+}  // namespace leveldb
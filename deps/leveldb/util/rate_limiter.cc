@@ -0,0 +1,223 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include <algorithm>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+RateLimiter::~RateLimiter() { }
+
+namespace {
+
+// An auto-tuned rate is reconsidered after this many microseconds
+static const uint64_t kTunePeriodMicros = 1000000;
+
+// ...is raised if more than this fraction of the requests of the last
+// period had to wait, and lowered if fewer than the low fraction did...
+static const double kTuneHighWaits = 0.9;
+static const double kTuneLowWaits = 0.5;
+
+// ...by this factor, and never lowered below this fraction of its bound
+static const double kTuneFactor = 1.1;
+static const int kTuneMinDivisor = 20;
+
+class GenericRateLimiter : public RateLimiter {
+ public:
+  GenericRateLimiter(int64_t flush_bytes_per_sec,
+                     int64_t compaction_bytes_per_sec,
+                     int64_t burst_micros,
+                     bool auto_tuned)
+      : env_(Env::Default()),
+        burst_micros_(std::max<int64_t>(burst_micros, 0)),
+        auto_tuned_(auto_tuned) {
+    const uint64_t now = env_->NowMicros();
+    buckets_[kFlush].Init(flush_bytes_per_sec, now);
+    buckets_[kCompaction].Init(compaction_bytes_per_sec, now);
+  }
+
+  virtual void Request(int64_t bytes, IOPriority pri) {
+    uint64_t delay = 0;
+    {
+      MutexLock l(&mu_);
+      Bucket* b = &buckets_[pri];
+      b->bytes_through += bytes;
+      if (b->rate <= 0) {
+        return;
+      }
+      const uint64_t now = env_->NowMicros();
+      Refill(b, now);
+      // Writers that find the bucket in debt wait until their bytes
+      // have been paid off, which also covers the debt of earlier ones.
+      b->tokens -= bytes;
+      if (b->tokens < 0) {
+        delay = static_cast<uint64_t>(-b->tokens * 1e6 / b->rate);
+        b->throttled_micros += delay;
+        b->period_waits++;
+      }
+      b->period_requests++;
+      if (auto_tuned_) {
+        MaybeTune(b, now);
+      }
+    }
+    if (delay > 0) {
+      env_->SleepForMicroseconds(static_cast<int>(delay));
+    }
+  }
+
+  virtual int64_t GetRate(IOPriority pri) {
+    MutexLock l(&mu_);
+    return buckets_[pri].rate;
+  }
+
+  virtual int64_t GetBytesThrough(IOPriority pri) {
+    MutexLock l(&mu_);
+    return buckets_[pri].bytes_through;
+  }
+
+  virtual int64_t GetThrottledMicros(IOPriority pri) {
+    MutexLock l(&mu_);
+    return buckets_[pri].throttled_micros;
+  }
+
+ private:
+  struct Bucket {
+    int64_t max_rate;         // Configured rate; zero if unlimited
+    int64_t rate;             // Current rate
+    double tokens;            // Bytes that may pass without waiting
+    uint64_t last_refill;
+    int64_t bytes_through;
+    int64_t throttled_micros;
+
+    // Requests in the current tuning period, and those that waited
+    uint64_t period_start;
+    int64_t period_requests;
+    int64_t period_waits;
+
+    void Init(int64_t bytes_per_sec, uint64_t now) {
+      max_rate = std::max<int64_t>(bytes_per_sec, 0);
+      rate = max_rate;
+      tokens = 0;
+      last_refill = now;
+      bytes_through = 0;
+      throttled_micros = 0;
+      period_start = now;
+      period_requests = 0;
+      period_waits = 0;
+    }
+  };
+
+  void Refill(Bucket* b, uint64_t now) {
+    if (now > b->last_refill) {
+      const double burst = static_cast<double>(b->rate) * burst_micros_ / 1e6;
+      b->tokens += static_cast<double>(b->rate) * (now - b->last_refill) / 1e6;
+      b->tokens = std::min(b->tokens, burst);
+      b->last_refill = now;
+    }
+  }
+
+  void MaybeTune(Bucket* b, uint64_t now) {
+    if (now < b->period_start + kTunePeriodMicros) {
+      return;
+    }
+    const double waits = static_cast<double>(b->period_waits) /
+                         b->period_requests;
+    if (waits > kTuneHighWaits) {
+      b->rate = std::min(static_cast<int64_t>(b->rate * kTuneFactor),
+                         b->max_rate);
+    } else if (waits < kTuneLowWaits) {
+      b->rate = std::max(static_cast<int64_t>(b->rate / kTuneFactor),
+                         std::max<int64_t>(b->max_rate / kTuneMinDivisor, 1));
+    }
+    b->period_start = now;
+    b->period_requests = 0;
+    b->period_waits = 0;
+  }
+
+  Env* const env_;
+  const int64_t burst_micros_;
+  const bool auto_tuned_;
+  port::Mutex mu_;
+  Bucket buckets_[kNumPriorities];
+};
+
+class RateLimitedFile : public WritableFile {
+ public:
+  RateLimitedFile(WritableFile* base, RateLimiter* limiter,
+                  RateLimiter::IOPriority pri)
+      : base_(base), limiter_(limiter), pri_(pri) { }
+  virtual ~RateLimitedFile() { delete base_; }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size(), pri_);
+    return base_->Append(data);
+  }
+  virtual Status Close() { return base_->Close(); }
+  virtual Status Flush() { return base_->Flush(); }
+  virtual Status Sync() { return base_->Sync(); }
+  virtual Status Allocate(uint64_t offset, uint64_t len) {
+    return base_->Allocate(offset, len);
+  }
+  virtual Status RangeSync(uint64_t offset, uint64_t len) {
+    return base_->RangeSync(offset, len);
+  }
+
+ private:
+  WritableFile* base_;
+  RateLimiter* limiter_;
+  const RateLimiter::IOPriority pri_;
+};
+
+class RateLimitedEnv : public EnvWrapper {
+ public:
+  RateLimitedEnv(Env* base, RateLimiter* limiter, RateLimiter::IOPriority pri)
+      : EnvWrapper(base), limiter_(limiter), pri_(pri) { }
+
+  virtual Status NewWritableFile(const std::string& fname,
+                                 WritableFile** result) {
+    Status s = target()->NewWritableFile(fname, result);
+    Wrap(s, result);
+    return s;
+  }
+
+  virtual Status NewDirectWritableFile(const std::string& fname,
+                                       WritableFile** result) {
+    Status s = target()->NewDirectWritableFile(fname, result);
+    Wrap(s, result);
+    return s;
+  }
+
+ private:
+  void Wrap(const Status& s, WritableFile** result) {
+    if (s.ok()) {
+      *result = new RateLimitedFile(*result, limiter_, pri_);
+    } else {
+      *result = NULL;
+    }
+  }
+
+  RateLimiter* limiter_;
+  const RateLimiter::IOPriority pri_;
+};
+
+}  // namespace
+
+RateLimiter* NewGenericRateLimiter(int64_t flush_bytes_per_sec,
+                                   int64_t compaction_bytes_per_sec,
+                                   int64_t burst_micros,
+                                   bool auto_tuned) {
+  return new GenericRateLimiter(flush_bytes_per_sec, compaction_bytes_per_sec,
+                                burst_micros, auto_tuned);
+}
+
+Env* NewRateLimitedEnv(Env* base, RateLimiter* limiter,
+                       RateLimiter::IOPriority pri) {
+  return new RateLimitedEnv(base, limiter, pri);
+}
+
+}  // namespace leveldb
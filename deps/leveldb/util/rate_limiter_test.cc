@@ -0,0 +1,92 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include "leveldb/env.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class RateLimiterTest { };
+
+TEST(RateLimiterTest, Unlimited) {
+  RateLimiter* limiter = NewGenericRateLimiter(0, 0, 100000, false);
+  for (int i = 0; i < 1000; i++) {
+    limiter->Request(1 << 20, RateLimiter::kCompaction);
+  }
+  ASSERT_EQ(0, limiter->GetRate(RateLimiter::kCompaction));
+  ASSERT_EQ(1000LL << 20, limiter->GetBytesThrough(RateLimiter::kCompaction));
+  ASSERT_EQ(0, limiter->GetThrottledMicros(RateLimiter::kCompaction));
+  ASSERT_EQ(0, limiter->GetBytesThrough(RateLimiter::kFlush));
+  delete limiter;
+}
+
+TEST(RateLimiterTest, Pacing) {
+  Env* env = Env::Default();
+  RateLimiter* limiter = NewGenericRateLimiter(0, 1 << 20, 10000, false);
+
+  // 200KB at 1MB/s take about 200ms
+  const uint64_t start = env->NowMicros();
+  for (int i = 0; i < 20; i++) {
+    limiter->Request(10 << 10, RateLimiter::kCompaction);
+  }
+  const uint64_t elapsed = env->NowMicros() - start;
+  ASSERT_GE(elapsed, 150000);
+  ASSERT_GE(limiter->GetThrottledMicros(RateLimiter::kCompaction), 150000);
+  ASSERT_EQ(200 << 10, limiter->GetBytesThrough(RateLimiter::kCompaction));
+
+  // Flushes have a budget of their own
+  const uint64_t flush_start = env->NowMicros();
+  limiter->Request(100 << 20, RateLimiter::kFlush);
+  ASSERT_LT(env->NowMicros() - flush_start, 100000);
+  ASSERT_EQ(0, limiter->GetThrottledMicros(RateLimiter::kFlush));
+  delete limiter;
+}
+
+TEST(RateLimiterTest, AutoTuned) {
+  Env* env = Env::Default();
+  RateLimiter* limiter = NewGenericRateLimiter(64 << 20, 0, 100000, true);
+  ASSERT_EQ(64 << 20, limiter->GetRate(RateLimiter::kFlush));
+
+  // Requests that never wait lower the rate once a second
+  for (int i = 0; i < 3; i++) {
+    env->SleepForMicroseconds(1100000);
+    limiter->Request(1, RateLimiter::kFlush);
+  }
+  const int64_t lowered = limiter->GetRate(RateLimiter::kFlush);
+  ASSERT_LT(lowered, 64 << 20);
+  ASSERT_GE(lowered, (64 << 20) / 20);
+
+  // Requests that always wait raise it again
+  const uint64_t start = env->NowMicros();
+  while (env->NowMicros() - start < 2500000) {
+    limiter->Request(lowered / 20, RateLimiter::kFlush);
+  }
+  ASSERT_GT(limiter->GetRate(RateLimiter::kFlush), lowered);
+  delete limiter;
+}
+
+TEST(RateLimiterTest, Env) {
+  Env* base = Env::Default();
+  RateLimiter* limiter = NewGenericRateLimiter(0, 0, 100000, false);
+  Env* env = NewRateLimitedEnv(base, limiter, RateLimiter::kCompaction);
+  std::string dir;
+  ASSERT_OK(base->GetTestDirectory(&dir));
+  const std::string fname = dir + "/rate_limiter_test";
+  ASSERT_OK(WriteStringToFile(env, "hello world", fname));
+  ASSERT_EQ(11, limiter->GetBytesThrough(RateLimiter::kCompaction));
+  std::string data;
+  ASSERT_OK(ReadFileToString(env, fname, &data));
+  ASSERT_EQ("hello world", data);
+  ASSERT_OK(env->DeleteFile(fname));
+  delete env;
+  delete limiter;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/readahead_file.h"
+
+#include <string.h>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+class ReadaheadRandomAccessFile : public RandomAccessFile {
+ public:
+  ReadaheadRandomAccessFile(RandomAccessFile* file, uint64_t file_size,
+                            size_t readahead_size)
+      : file_(file),
+        file_size_(file_size),
+        readahead_size_(readahead_size),
+        buf_(new char[readahead_size]),
+        buf_offset_(0),
+        buf_len_(0) {
+  }
+
+  virtual ~ReadaheadRandomAccessFile() {
+    delete[] buf_;
+    delete file_;
+  }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    if (n >= readahead_size_) {
+      return file_->Read(offset, n, result, scratch);
+    }
+
+    MutexLock l(&mu_);
+    if (offset < buf_offset_ || offset + n > buf_offset_ + buf_len_) {
+      // Past the end of the buffered chunk: read the next one.  Some
+      // files refuse reads that extend past their end.
+      size_t len = readahead_size_;
+      if (offset >= file_size_) {
+        len = 0;
+      } else if (file_size_ - offset < len) {
+        len = static_cast<size_t>(file_size_ - offset);
+      }
+      Slice chunk;
+      Status s = file_->Read(offset, len, &chunk, buf_);
+      if (!s.ok()) {
+        buf_len_ = 0;
+        *result = Slice(scratch, 0);
+        return s;
+      }
+      if (chunk.data() != buf_) {
+        memcpy(buf_, chunk.data(), chunk.size());
+      }
+      buf_offset_ = offset;
+      buf_len_ = chunk.size();
+    }
+
+    // Short only at end of file
+    const size_t skip = static_cast<size_t>(offset - buf_offset_);
+    const size_t available = (skip < buf_len_) ? buf_len_ - skip : 0;
+    const size_t len = (n < available) ? n : available;
+    memcpy(scratch, buf_ + skip, len);
+    *result = Slice(scratch, len);
+    return Status::OK();
+  }
+
+  virtual void Hint(AccessPattern pattern) {
+    file_->Hint(pattern);
+  }
+
+ private:
+  RandomAccessFile* const file_;
+  const uint64_t file_size_;
+  const size_t readahead_size_;
+
+  mutable port::Mutex mu_;
+  char* const buf_;                  // Guarded by mu_
+  mutable uint64_t buf_offset_;      // File offset of buf_[0]
+  mutable size_t buf_len_;           // Bytes in buf_
+
+  // No copying allowed
+  ReadaheadRandomAccessFile(const ReadaheadRandomAccessFile&);
+  void operator=(const ReadaheadRandomAccessFile&);
+};
+
+}  // namespace
+
+RandomAccessFile* NewReadaheadRandomAccessFile(RandomAccessFile* file,
+                                               uint64_t file_size,
+                                               size_t readahead_size) {
+  return new ReadaheadRandomAccessFile(file, file_size, readahead_size);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,29 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_READAHEAD_FILE_H_
+#define STORAGE_LEVELDB_UTIL_READAHEAD_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace leveldb {
+
+class RandomAccessFile;
+
+// Return a file that reads *file, which is "file_size" bytes long, ahead
+// in chunks of "readahead_size" bytes and serves reads that fall within
+// the last chunk from memory.  Meant for files read mostly in order, such
+// as compaction inputs opened for direct I/O, where the operating system
+// does no readahead of its own.  Reads of at least "readahead_size" bytes
+// go straight to *file.
+//
+// The result takes ownership of *file.
+extern RandomAccessFile* NewReadaheadRandomAccessFile(RandomAccessFile* file,
+                                                      uint64_t file_size,
+                                                      size_t readahead_size);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_READAHEAD_FILE_H_
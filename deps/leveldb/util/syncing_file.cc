@@ -0,0 +1,85 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/syncing_file.h"
+
+#include "leveldb/env.h"
+
+namespace leveldb {
+
+namespace {
+
+// The partial page at the end of the file is left out of write-back,
+// since the next append would dirty it again.
+static const uint64_t kPageSize = 4096;
+
+class SyncingWritableFile : public WritableFile {
+ public:
+  SyncingWritableFile(WritableFile* file, uint64_t bytes_per_sync,
+                      uint64_t preallocation_size)
+      : file_(file),
+        bytes_per_sync_(bytes_per_sync),
+        preallocation_size_(preallocation_size),
+        offset_(0),
+        allocated_(0),
+        synced_(0) {
+  }
+
+  virtual ~SyncingWritableFile() {
+    delete file_;
+  }
+
+  virtual Status Append(const Slice& data) {
+    Status s;
+    const uint64_t end = offset_ + data.size();
+    if (preallocation_size_ > 0 && end > allocated_) {
+      const uint64_t chunks =
+          (end - allocated_ + preallocation_size_ - 1) / preallocation_size_;
+      s = file_->Allocate(allocated_, chunks * preallocation_size_);
+      if (!s.ok()) {
+        return s;
+      }
+      allocated_ += chunks * preallocation_size_;
+    }
+    s = file_->Append(data);
+    if (!s.ok()) {
+      return s;
+    }
+    offset_ = end;
+    if (bytes_per_sync_ > 0 && offset_ - synced_ >= bytes_per_sync_) {
+      const uint64_t limit = offset_ - offset_ % kPageSize;
+      s = file_->RangeSync(synced_, limit - synced_);
+      synced_ = limit;
+    }
+    return s;
+  }
+
+  virtual Status Close() { return file_->Close(); }
+  virtual Status Flush() { return file_->Flush(); }
+  virtual Status Sync() { return file_->Sync(); }
+  virtual Status Allocate(uint64_t offset, uint64_t len) {
+    return file_->Allocate(offset, len);
+  }
+  virtual Status RangeSync(uint64_t offset, uint64_t len) {
+    return file_->RangeSync(offset, len);
+  }
+
+ private:
+  WritableFile* const file_;
+  const uint64_t bytes_per_sync_;
+  const uint64_t preallocation_size_;
+  uint64_t offset_;        // Bytes appended so far
+  uint64_t allocated_;     // End of the storage reserved so far
+  uint64_t synced_;        // End of the data whose write-back was started
+};
+
+}  // namespace
+
+WritableFile* NewSyncingWritableFile(WritableFile* file,
+                                     uint64_t bytes_per_sync,
+                                     uint64_t preallocation_size) {
+  return new SyncingWritableFile(file, bytes_per_sync, preallocation_size);
+}
+
+}  // namespace leveldb
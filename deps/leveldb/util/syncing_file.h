@@ -0,0 +1,29 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_SYNCING_FILE_H_
+#define STORAGE_LEVELDB_UTIL_SYNCING_FILE_H_
+
+#include <stdint.h>
+
+namespace leveldb {
+
+class WritableFile;
+
+// Return a file that appends to *file, reserving its storage
+// "preallocation_size" bytes at a time ahead of the appends, and starting
+// the write-back of what has been appended every "bytes_per_sync" bytes.
+// This spreads the writes of a large file over the time it takes to
+// build, where a single Sync() at its end would flush them all at once
+// and hold up everyone else's writes while it does.  Either size may be
+// zero to leave that part out.
+//
+// The result takes ownership of *file.
+extern WritableFile* NewSyncingWritableFile(WritableFile* file,
+                                            uint64_t bytes_per_sync,
+                                            uint64_t preallocation_size);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_SYNCING_FILE_H_
@@ -0,0 +1,95 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/work_queue.h"
+
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+WorkQueue::WorkQueue(Env* env, Env::Priority pri, int max_helpers)
+    : env_(env),
+      pri_(pri),
+      max_helpers_(max_helpers),
+      done_cv_(&mu_),
+      helpers_(0),
+      refs_(1),
+      running_(0),
+      closed_(false) {
+}
+
+void WorkQueue::Add(void (*function)(void*), void* arg) {
+  Task t;
+  t.function = function;
+  t.arg = arg;
+  bool schedule = false;
+  {
+    MutexLock l(&mu_);
+    assert(!closed_);
+    tasks_.push_back(t);
+    if (helpers_ < max_helpers_) {
+      helpers_++;
+      refs_++;
+      schedule = true;
+    }
+  }
+  if (schedule) {
+    env_->Schedule(&WorkQueue::Helper, this, pri_);
+  }
+}
+
+bool WorkQueue::RunOne() {
+  Task t;
+  {
+    MutexLock l(&mu_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    t = tasks_.front();
+    tasks_.pop_front();
+  }
+  (*t.function)(t.arg);
+  return true;
+}
+
+void WorkQueue::Close() {
+  bool last;
+  {
+    MutexLock l(&mu_);
+    closed_ = true;
+    tasks_.clear();
+    while (running_ > 0) {
+      done_cv_.Wait();
+    }
+    last = (--refs_ == 0);
+  }
+  if (last) {
+    delete this;
+  }
+}
+
+void WorkQueue::Helper(void* arg) {
+  WorkQueue* q = reinterpret_cast<WorkQueue*>(arg);
+  bool last;
+  {
+    MutexLock l(&q->mu_);
+    while (!q->closed_ && !q->tasks_.empty()) {
+      Task t = q->tasks_.front();
+      q->tasks_.pop_front();
+      q->running_++;
+      q->mu_.Unlock();
+      (*t.function)(t.arg);
+      q->mu_.Lock();
+      q->running_--;
+      q->done_cv_.SignalAll();
+    }
+    q->helpers_--;
+    last = (--q->refs_ == 0);
+  }
+  if (last) {
+    delete q;
+  }
+}
+
+}  // namespace leveldb
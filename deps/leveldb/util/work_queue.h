@@ -0,0 +1,74 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A queue of tasks that the threads of one of the background pools of an
+// Env (see Env::Schedule()) help the owner of the queue to work through.
+// The owner runs queued tasks itself as well, so it never depends on a
+// pool thread being free: the tasks get done even if the pool is busy
+// with other work, or is the very pool the owner runs on.
+//
+// Thread-safe (provides internal synchronization)
+
+#ifndef STORAGE_LEVELDB_UTIL_WORK_QUEUE_H_
+#define STORAGE_LEVELDB_UTIL_WORK_QUEUE_H_
+
+#include <deque>
+#include "leveldb/env.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+class WorkQueue {
+ public:
+  // Create a queue that has at most "max_helpers" threads of the "pri"
+  // pool of "env" working on it at a time.  With "max_helpers" zero the
+  // owner runs every task itself.
+  WorkQueue(Env* env, Env::Priority pri, int max_helpers);
+
+  // Queue a call of (*function)(arg), and hand it to a pool thread if
+  // fewer than max_helpers are working on the queue.
+  // REQUIRES: Close() has not been called
+  void Add(void (*function)(void*), void* arg);
+
+  // Run the oldest queued task on the calling thread.  Returns false if
+  // there was none.
+  bool RunOne();
+
+  // Drop the tasks that no thread has started, wait for the ones that
+  // pool threads are running, and delete the queue.  Pool threads that
+  // were handed the queue but have not started yet find it closed and
+  // leave it alone, so Close() does not wait for the pool to get to them.
+  void Close();
+
+ private:
+  struct Task {
+    void (*function)(void*);
+    void* arg;
+  };
+
+  // Deleted by Close() or by the last helper to leave
+  ~WorkQueue() { }
+
+  static void Helper(void* arg);
+
+  Env* const env_;
+  const Env::Priority pri_;
+  const int max_helpers_;
+
+  port::Mutex mu_;
+  port::CondVar done_cv_;     // Signalled when a helper finishes a task
+  std::deque<Task> tasks_;
+  int helpers_;               // Handed to the pool and not yet left
+  int refs_;                  // helpers_, plus one until Close()
+  int running_;               // Tasks that helpers are running
+  bool closed_;
+
+  // No copying allowed
+  WorkQueue(const WorkQueue&);
+  void operator=(const WorkQueue&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_WORK_QUEUE_H_
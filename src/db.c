@@ -1,25 +1,498 @@
 
+#include <fnmatch.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "db.h"
+#include "path.h"
+
+/* block cache size, same as leveldb's default */
+#define DB_CACHE_SIZE (8 << 20)
+/* 2^4 cache shards */
+#define DB_CACHE_SHARD_BITS 4
+/* leveldb's default block size */
+#define DB_CACHE_ENTRY_SIZE 4096
+/* ~1% false positives */
+#define DB_BLOOM_BITS_PER_KEY 10
+/* file contents of at least a page go to the value log */
+#define DB_VALUE_LOG_THRESHOLD 4096
+/* a patch operand is the offset as 8 little endian bytes, then the data */
+#define DB_PATCH_HEADER 8
+/* values and patches of paths with a ttl end with the write time, in
+ * seconds since the epoch as 8 little endian bytes */
+#define DB_MTIME_SIZE 8
+/* the ttl patterns the db was first opened with. path keys all start
+ * with the sublevel seperator, so no path maps to this key */
+#define DB_TTLS_KEY "levelfs.ttls"
+#define DB_TTLS_VERSION 1
+/* dictionary trained on the paths and metadata of each table */
+#define DB_COMPRESSION_DICT_SIZE (16 << 10)
+/* level 0 files at which writes are slowed down and stopped */
+#define DB_L0_SLOWDOWN_TRIGGER 8
+#define DB_L0_STOP_TRIGGER 24
+/* bytes per second compactions may write at most, and the burst allowed
+ * after a pause in microseconds */
+#define DB_COMPACTION_RATE (32 << 20)
+#define DB_RATE_BURST_MICROS 100000
+/* bytes written to tables between background syncs, and the number of
+ * obsolete logs kept for reuse */
+#define DB_BYTES_PER_SYNC (1 << 20)
+#define DB_RECYCLE_LOGS 2
+
+static void
+encode_fixed64(char *buf, uint64_t n) {
+	int i;
+
+	for (i = 0; i < 8; i++)
+		buf[i] = (n >> (8 * i)) & 0xff;
+}
+
+static uint64_t
+decode_fixed64(const char *buf) {
+	uint64_t n;
+	int i;
+
+	n = 0;
+	for (i = 0; i < 8; i++)
+		n |= (uint64_t)(unsigned char)buf[i] << (8 * i);
+	return n;
+}
+
+/*
+ * returns the ttl of the path of key, 0 if it has none
+ */
+static uint64_t
+db_ttl(db_t *db, const char *key, size_t klen) {
+	char *path;
+	uint64_t ttl;
+	int i;
+
+	if (!db->nttls || sepcmp(key, klen) != 0)
+		return 0;
+	ttl = 0;
+	path = key_to_path(key, klen);
+	for (i = 0; i < db->nttls; i++) {
+		if (fnmatch(db->ttls[i].pattern, path, 0) == 0) {
+			ttl = db->ttls[i].ttl;
+			break;
+		}
+	}
+	free(path);
+	return ttl;
+}
+
+/*
+ * returns val with the write time appended if the path of key has a
+ * ttl, in a buffer left in *buf to be freed
+ */
+static const char *
+value_encode(db_t *db, const char *key, size_t klen,
+             const char *val, size_t *vlen, char **buf) {
+	*buf = NULL;
+	if (!db_ttl(db, key, klen))
+		return val;
+	*buf = malloc(*vlen + DB_MTIME_SIZE);
+	if (*vlen)
+		memcpy(*buf, val, *vlen);
+	encode_fixed64(*buf + *vlen, time(NULL));
+	*vlen += DB_MTIME_SIZE;
+	return *buf;
+}
+
+/*
+ * returns len without the mtime trailer of buf, raising *mtime to the
+ * trailer's time. buffers too short for a trailer after min bytes are
+ * left alone
+ */
+static size_t
+split_mtime(const char *buf, size_t len, size_t min, uint64_t *mtime) {
+	uint64_t t;
+
+	if (len < min + DB_MTIME_SIZE)
+		return len;
+	len -= DB_MTIME_SIZE;
+	t = decode_fixed64(buf + len);
+	if (t > *mtime)
+		*mtime = t;
+	return len;
+}
+
+/*
+ * strips the mtime trailer off the value of a path with a ttl, returns
+ * 0 if the value has expired
+ */
+static int
+value_live(db_t *db, const char *key, size_t klen,
+           const char *val, size_t *vlen) {
+	uint64_t ttl, mtime;
+
+	ttl = db_ttl(db, key, klen);
+	if (!ttl)
+		return 1;
+	mtime = 0;
+	*vlen = split_mtime(val, *vlen, 0, &mtime);
+	return mtime == 0 || (uint64_t)time(NULL) < mtime + ttl;
+}
+
+/*
+ * apply the patches, oldest first, to the existing file contents
+ */
+static char *
+patch_full_merge(void *state, const char *key, size_t klen,
+                 const char *val, size_t vlen,
+                 const char *const *ops, const size_t *ops_len, int nops,
+                 unsigned char *success, size_t *new_len) {
+	char *out;
+	uint64_t offset, size, mtime;
+	size_t len, trailer, total;
+	int i;
+
+	*success = 0;
+	/* the result keeps the newest write time */
+	trailer = db_ttl(state, key, klen) ? DB_MTIME_SIZE : 0;
+	mtime = 0;
+	if (trailer)
+		vlen = split_mtime(val, vlen, 0, &mtime);
+	size = vlen;
+	for (i = 0; i < nops; i++) {
+		len = ops_len[i];
+		if (trailer)
+			len = split_mtime(ops[i], len, DB_PATCH_HEADER, &mtime);
+		if (len < DB_PATCH_HEADER)
+			return NULL;
+		offset = decode_fixed64(ops[i]);
+		if (offset + len - DB_PATCH_HEADER > size)
+			size = offset + len - DB_PATCH_HEADER;
+	}
+
+	total = size + trailer;
+	out = malloc(total ? total : 1);
+	if (vlen)
+		memcpy(out, val, vlen);
+	memset(out + vlen, 0, size - vlen);
+	for (i = 0; i < nops; i++) {
+		len = ops_len[i];
+		if (trailer)
+			len = split_mtime(ops[i], len, DB_PATCH_HEADER, &mtime);
+		offset = decode_fixed64(ops[i]);
+		memcpy(out + offset, ops[i] + DB_PATCH_HEADER,
+		       len - DB_PATCH_HEADER);
+	}
+	if (trailer)
+		encode_fixed64(out + size, mtime);
+	*new_len = total;
+	*success = 1;
+	return out;
+}
+
+/*
+ * combine two patches into one if their ranges touch, so runs of
+ * appends collapse into a single operand during compactions
+ */
+static char *
+patch_partial_merge(void *state, const char *key, size_t klen,
+                    const char *left, size_t left_len,
+                    const char *right, size_t right_len,
+                    unsigned char *success, size_t *new_len) {
+	char *out;
+	uint64_t loff, lend, roff, rend, start, end, mtime;
+	size_t trailer;
+
+	*success = 0;
+	trailer = db_ttl(state, key, klen) ? DB_MTIME_SIZE : 0;
+	mtime = 0;
+	if (trailer) {
+		left_len = split_mtime(left, left_len, DB_PATCH_HEADER, &mtime);
+		right_len = split_mtime(right, right_len, DB_PATCH_HEADER,
+		                        &mtime);
+	}
+	if (left_len < DB_PATCH_HEADER || right_len < DB_PATCH_HEADER)
+		return NULL;
+	loff = decode_fixed64(left);
+	lend = loff + left_len - DB_PATCH_HEADER;
+	roff = decode_fixed64(right);
+	rend = roff + right_len - DB_PATCH_HEADER;
+	if (roff > lend || loff > rend)
+		return NULL;
+
+	start = loff < roff ? loff : roff;
+	end = lend > rend ? lend : rend;
+	out = malloc(DB_PATCH_HEADER + end - start + trailer);
+	encode_fixed64(out, start);
+	/* the newer right patch wins where they overlap */
+	memcpy(out + DB_PATCH_HEADER + loff - start, left + DB_PATCH_HEADER,
+	       lend - loff);
+	memcpy(out + DB_PATCH_HEADER + roff - start, right + DB_PATCH_HEADER,
+	       rend - roff);
+	if (trailer)
+		encode_fixed64(out + DB_PATCH_HEADER + end - start, mtime);
+	*new_len = DB_PATCH_HEADER + end - start + trailer;
+	*success = 1;
+	return out;
+}
+
+static void
+patch_destroy(void *state) {
+}
+
+static const char *
+patch_name(void *state) {
+	return "levelfs.patch";
+}
+
+/*
+ * drop values of paths whose ttl has passed since their last write
+ */
+static unsigned char
+expire_filter(void *state, int level, const char *key, size_t klen,
+              const char *val, size_t vlen,
+              char **new_val, size_t *new_len, unsigned char *changed) {
+	return !value_live(state, key, klen, val, &vlen);
+}
+
+/*
+ * only paths with a ttl can expire, so the values of others are not
+ * even read
+ */
+static unsigned char
+expire_may_filter(void *state, int level, const char *key, size_t klen) {
+	return db_ttl(state, key, klen) != 0;
+}
+
+static void
+expire_destroy(void *state) {
+}
+
+static const char *
+expire_name(void *state) {
+	return "levelfs.expire";
+}
+
+int
+db_ttl_parse(const char *arg, db_ttl_t *ttl) {
+	const char *colon;
+	char *end;
+	unsigned long long secs;
+
+	colon = strrchr(arg, ':');
+	if (!colon || colon == arg)
+		return -1;
+	secs = strtoull(colon + 1, &end, 10);
+	if (end == colon + 1 || *end != '\0' || secs == 0)
+		return -1;
+	ttl->pattern = strndup(arg, colon - arg);
+	ttl->ttl = secs;
+	return 0;
+}
+
+/*
+ * encode ttls as they are kept under DB_TTLS_KEY: a version byte, then
+ * per pattern its ttl and length as 8 little endian bytes each and the
+ * pattern itself
+ */
+static char *
+ttls_encode(const db_ttl_t *ttls, int nttls, size_t *len) {
+	char *buf, *p;
+	size_t plen;
+	int i;
+
+	*len = 1;
+	for (i = 0; i < nttls; i++)
+		*len += 16 + strlen(ttls[i].pattern);
+	buf = malloc(*len);
+	buf[0] = DB_TTLS_VERSION;
+	p = buf + 1;
+	for (i = 0; i < nttls; i++) {
+		plen = strlen(ttls[i].pattern);
+		encode_fixed64(p, ttls[i].ttl);
+		encode_fixed64(p + 8, plen);
+		memcpy(p + 16, ttls[i].pattern, plen);
+		p += 16 + plen;
+	}
+	return buf;
+}
+
+/*
+ * returns the ttl options that encoded ttls stand for, for messages
+ */
+static char *
+ttls_describe(const char *buf, size_t len) {
+	char *out;
+	size_t n, pos, plen, size;
+	uint64_t ttl;
+
+	size = len * 4 + 32;
+	out = malloc(size);
+	n = 0;
+	pos = 1;
+	while (pos + 16 <= len) {
+		ttl = decode_fixed64(buf + pos);
+		plen = decode_fixed64(buf + pos + 8);
+		pos += 16;
+		if (plen > len - pos)
+			break;
+		n += snprintf(out + n, size - n, "%s-o 'ttl=%.*s:%llu'",
+		              n ? " " : "", (int)plen, buf + pos,
+		              (unsigned long long)ttl);
+		pos += plen;
+	}
+	if (n == 0)
+		snprintf(out, size, "no ttl options");
+	return out;
+}
+
+/*
+ * values and patches of paths with a ttl end with their write time, and
+ * it is the ttl patterns that tell which ones do. the patterns of the
+ * first open are kept in the db, which refuses to be opened with others
+ */
+static void
+ttls_check(db_t *db, char **errptr) {
+	leveldb_readoptions_t *ropts;
+	leveldb_writeoptions_t *wopts;
+	char *want, *have, *desc;
+	size_t want_len, have_len;
+
+	want = ttls_encode(db->ttls, db->nttls, &want_len);
+	ropts = leveldb_readoptions_create();
+	have = leveldb_get(db->db, ropts, DB_TTLS_KEY, strlen(DB_TTLS_KEY),
+	                   &have_len, errptr);
+	leveldb_readoptions_destroy(ropts);
+	if (*errptr) {
+		free(want);
+		return;
+	}
+
+	if (!have) {
+		/* a new db, or one from before the patterns were kept, which
+		 * takes those of this open */
+		wopts = leveldb_writeoptions_create();
+		leveldb_writeoptions_set_sync(wopts, 1);
+		leveldb_put(db->db, wopts, DB_TTLS_KEY, strlen(DB_TTLS_KEY),
+		            want, want_len, errptr);
+		leveldb_writeoptions_destroy(wopts);
+	} else if (have_len != want_len || memcmp(have, want, want_len)) {
+		desc = ttls_describe(have, have_len);
+		*errptr = malloc(strlen(desc) + 64);
+		sprintf(*errptr, "ttl options differ from the db's: %s", desc);
+		free(desc);
+	}
+	leveldb_free(have);
+	free(want);
+}
 
 db_t *
-db_open(const char *path, char **errptr) {
+db_open(const char *path, db_ttl_t *ttls, int nttls, char **errptr) {
 	db_t *out;
 	leveldb_options_t *opts;
+	leveldb_env_t *env;
+	leveldb_cache_t *cache;
+	leveldb_ratelimiter_t *limiter;
+	leveldb_filterpolicy_t *filter;
+	leveldb_mergeoperator_t *patch;
+	leveldb_compactionfilter_t *expire;
 	leveldb_t *db;
+	int compression[2];
+	const char *sep;
+	size_t seplen;
+
+	/* the merge operator and compaction filter look up ttls in out */
+	out = malloc(sizeof(db_t));
+	memset(out, 0, sizeof(db_t));
+	out->ttls = ttls;
+	out->nttls = nttls;
 
 	opts = leveldb_options_create();
 	leveldb_options_set_create_if_missing(opts, 1);
+	/* compactions run on the low priority pool. their disk reads and
+	 * writes yield to those of fuse requests */
+	env = leveldb_create_default_env();
+	leveldb_env_lower_thread_pool_io_priority(env,
+	    leveldb_env_low_priority);
+	leveldb_options_set_env(opts, env);
+	/* fuse serves reads from many threads, use the lock free cache */
+	cache = leveldb_cache_create_clock(DB_CACHE_SIZE, DB_CACHE_SHARD_BITS,
+	                                   DB_CACHE_ENTRY_SIZE);
+	leveldb_options_set_cache(opts, cache);
+	/* writes of fuse threads that are logged together insert into the
+	 * memtable in parallel */
+	leveldb_options_set_allow_concurrent_memtable_write(opts, 1);
+	/* fuse requests time out while writes are stopped, leave writes
+	 * a wide range in which they are slowed down instead */
+	leveldb_options_set_level0_slowdown_writes_trigger(opts,
+	    DB_L0_SLOWDOWN_TRIGGER);
+	leveldb_options_set_level0_stop_writes_trigger(opts, DB_L0_STOP_TRIGGER);
+	/* compactions share the disk with fuse reads. flushes are left
+	 * unlimited since writers wait for them */
+	limiter = leveldb_ratelimiter_create(0, DB_COMPACTION_RATE,
+	    DB_RATE_BURST_MICROS, 1);
+	leveldb_options_set_rate_limiter(opts, limiter);
+	/* every write syncs the log, which costs less when the log file
+	 * already has its blocks. tables are synced as they are written so
+	 * that closing them does not flush all of their pages at once */
+	leveldb_options_set_bytes_per_sync(opts, DB_BYTES_PER_SYNC);
+	leveldb_options_set_recycle_log_file_num(opts, DB_RECYCLE_LOGS);
+	/* paths and text compress well. the built in codec works where
+	 * leveldb was built without snappy. level 0 tables are soon
+	 * compacted away, so flushes skip compression */
+	compression[0] = leveldb_no_compression;
+	compression[1] = leveldb_lz_compression;
+	leveldb_options_set_compression_per_level(opts, compression, 2);
+	/* keys of a table share long directory prefixes */
+	leveldb_options_set_compression_dict_size(opts,
+	    DB_COMPRESSION_DICT_SIZE);
+	/* filter every directory prefix of a key as well as the key, so
+	 * lookups of missing paths rarely touch a data block */
+	sep = path_sep(&seplen);
+	filter = leveldb_filterpolicy_create_sublevel_bloom(
+	    DB_BLOOM_BITS_PER_KEY, sep, seplen);
+	leveldb_options_set_filter_policy(opts, filter);
+	/* keep large file contents out of the tables so compactions do not
+	 * rewrite them */
+	leveldb_options_set_value_log_threshold(opts, DB_VALUE_LOG_THRESHOLD);
+	/* writes are stored as patches and applied on read */
+	patch = leveldb_mergeoperator_create(out, patch_destroy,
+	    patch_full_merge, patch_partial_merge, patch_name);
+	leveldb_options_set_merge_operator(opts, patch);
+	/* expired paths disappear as compactions reach them */
+	expire = NULL;
+	if (nttls) {
+		expire = leveldb_compactionfilter_create(out, expire_destroy,
+		    expire_filter, expire_name);
+		leveldb_compactionfilter_set_may_filter(expire,
+		                                        expire_may_filter);
+		leveldb_options_set_compaction_filter(opts, expire);
+	}
 	db = leveldb_open(opts, path, errptr);
 	if (*errptr) {
 		leveldb_options_destroy(opts);
+		leveldb_env_destroy(env);
+		leveldb_cache_destroy(cache);
+		leveldb_ratelimiter_destroy(limiter);
+		leveldb_filterpolicy_destroy(filter);
+		leveldb_mergeoperator_destroy(patch);
+		if (expire)
+			leveldb_compactionfilter_destroy(expire);
+		free(out);
 		return NULL;
 	}
 
-	out = malloc(sizeof(db_t));
-	*out = (db_t){ .db=db, .opts=opts };
+	out->db = db;
+	out->opts = opts;
+	out->env = env;
+	out->cache = cache;
+	out->limiter = limiter;
+	out->filter = filter;
+	out->patch = patch;
+	out->expire = expire;
+
+	ttls_check(out, errptr);
+	if (*errptr) {
+		db_close(out);
+		return NULL;
+	}
 	return out;
 }
 
@@ -27,6 +500,13 @@ void
 db_close(db_t *db) {
 	leveldb_options_destroy(db->opts);
 	leveldb_close(db->db);
+	leveldb_env_destroy(db->env);
+	leveldb_cache_destroy(db->cache);
+	leveldb_ratelimiter_destroy(db->limiter);
+	leveldb_filterpolicy_destroy(db->filter);
+	leveldb_mergeoperator_destroy(db->patch);
+	if (db->expire)
+		leveldb_compactionfilter_destroy(db->expire);
 	free(db);
 }
 
@@ -40,19 +520,216 @@ db_get(db_t *db, const char *key, size_t klen,
 	val = leveldb_get(db->db, opts, key, klen, vlen, errptr);
 	leveldb_readoptions_destroy(opts);
 
+	if (val && !value_live(db, key, klen, val, vlen)) {
+		leveldb_free((char *)val);
+		val = NULL;
+		*vlen = 0;
+	}
 	return val;
 }
 
+/*
+ * look up key with its patches left unapplied, returns NULL if key is
+ * missing or has expired. sets *size to the size of the file the
+ * patches make. the value they apply to is read only if read_base is
+ * set, or if its write time decides whether the path has expired
+ */
+static leveldb_mergeoperands_t *
+patches_get(db_t *db, const char *key, size_t klen, int read_base,
+            uint64_t *size, char **errptr) {
+	leveldb_mergeoperands_t *m;
+	leveldb_readoptions_t *opts;
+	const char *op, *val;
+	uint64_t ttl, mtime, end;
+	size_t i, n, len, vlen;
+
+	ttl = db_ttl(db, key, klen);
+	opts = leveldb_readoptions_create();
+	m = leveldb_get_merge_operands(db->db, opts, key, klen, read_base,
+	                               errptr);
+
+	*size = 0;
+	mtime = 0;
+	n = m ? leveldb_mergeoperands_count(m) : 0;
+	for (i = 0; i < n; i++) {
+		op = leveldb_mergeoperands_operand(m, i, &len);
+		if (ttl)
+			len = split_mtime(op, len, DB_PATCH_HEADER, &mtime);
+		if (len < DB_PATCH_HEADER) {
+			*errptr = strdup("malformed patch");
+			leveldb_mergeoperands_destroy(m);
+			m = NULL;
+			break;
+		}
+		end = decode_fixed64(op) + len - DB_PATCH_HEADER;
+		if (end > *size)
+			*size = end;
+	}
+
+	if (m && leveldb_mergeoperands_has_value(m)) {
+		if (ttl && !read_base &&
+		    (mtime == 0 || (uint64_t)time(NULL) >= mtime + ttl)) {
+			/* the patches leave it to the value's write time */
+			leveldb_mergeoperands_destroy(m);
+			m = leveldb_get_merge_operands(db->db, opts, key, klen,
+			                               1, errptr);
+			read_base = 1;
+		}
+		vlen = 0;
+		if (m && read_base) {
+			val = leveldb_mergeoperands_value(m, &vlen);
+			if (ttl)
+				vlen = split_mtime(val, vlen, 0, &mtime);
+		} else if (m) {
+			vlen = leveldb_mergeoperands_value_size(m);
+			if (ttl && vlen >= DB_MTIME_SIZE)
+				vlen -= DB_MTIME_SIZE;
+		}
+		if (vlen > *size)
+			*size = vlen;
+	}
+	leveldb_readoptions_destroy(opts);
+
+	if (m && ttl && mtime != 0 && (uint64_t)time(NULL) >= mtime + ttl) {
+		leveldb_mergeoperands_destroy(m);
+		m = NULL;
+	}
+	if (!m)
+		*size = 0;
+	return m;
+}
+
+int
+db_size(db_t *db, const char *key, size_t klen, uint64_t *size,
+        char **errptr) {
+	leveldb_mergeoperands_t *m;
+
+	m = patches_get(db, key, klen, 0, size, errptr);
+	if (!m)
+		return 0;
+	leveldb_mergeoperands_destroy(m);
+	return 1;
+}
+
+size_t
+db_read(db_t *db, const char *key, size_t klen, uint64_t offset,
+        char *buf, size_t len, char **errptr) {
+	leveldb_mergeoperands_t *m;
+	const char *op, *val;
+	uint64_t size, ttl, mtime, start, end;
+	size_t i, n, oplen, vlen;
+
+	m = patches_get(db, key, klen, 1, &size, errptr);
+	if (!m)
+		return 0;
+	if (offset >= size) {
+		leveldb_mergeoperands_destroy(m);
+		return 0;
+	}
+	if (len > size - offset)
+		len = size - offset;
+
+	/* the value, then the patches, oldest first, over the range */
+	ttl = db_ttl(db, key, klen);
+	mtime = 0;
+	vlen = 0;
+	val = leveldb_mergeoperands_value(m, &vlen);
+	if (ttl)
+		vlen = split_mtime(val, vlen, 0, &mtime);
+	n = 0;
+	if (offset < vlen) {
+		n = vlen - offset < len ? vlen - offset : len;
+		memcpy(buf, val + offset, n);
+	}
+	memset(buf + n, 0, len - n);
+
+	n = leveldb_mergeoperands_count(m);
+	for (i = 0; i < n; i++) {
+		op = leveldb_mergeoperands_operand(m, i, &oplen);
+		if (ttl)
+			oplen = split_mtime(op, oplen, DB_PATCH_HEADER, &mtime);
+		start = decode_fixed64(op);
+		end = start + oplen - DB_PATCH_HEADER;
+		op += DB_PATCH_HEADER;
+		if (start < offset) {
+			op += offset - start;
+			start = offset;
+		}
+		if (end > offset + len)
+			end = offset + len;
+		if (start < end)
+			memcpy(buf + (start - offset), op, end - start);
+	}
+	leveldb_mergeoperands_destroy(m);
+	return len;
+}
+
 void
 db_put(db_t *db, const char *key, size_t klen,
        const char *val, size_t vlen, char **errptr) {
 	leveldb_writeoptions_t *opts;
+	char *buf;
+
+	val = value_encode(db, key, klen, val, &vlen, &buf);
 
 	opts = leveldb_writeoptions_create();
 	/* sync=true flushed buffer */
 	leveldb_writeoptions_set_sync(opts, 1);
 	leveldb_put(db->db, opts, key, klen, val, vlen, errptr);
 	leveldb_writeoptions_destroy(opts);
+	free(buf);
+}
+
+void
+db_patch(db_t *db, const char *key, size_t klen, uint64_t offset,
+         const char *buf, size_t len, char **errptr) {
+	leveldb_writeoptions_t *opts;
+	char *val;
+	size_t vlen, trailer;
+
+	trailer = db_ttl(db, key, klen) ? DB_MTIME_SIZE : 0;
+	vlen = DB_PATCH_HEADER + len + trailer;
+	val = malloc(vlen);
+	encode_fixed64(val, offset);
+	if (len)
+		memcpy(val + DB_PATCH_HEADER, buf, len);
+	if (trailer)
+		encode_fixed64(val + DB_PATCH_HEADER + len, time(NULL));
+
+	opts = leveldb_writeoptions_create();
+	/* sync=true flushed buffer */
+	leveldb_writeoptions_set_sync(opts, 1);
+	leveldb_merge(db->db, opts, key, klen, val, vlen, errptr);
+	leveldb_writeoptions_destroy(opts);
+	free(val);
+}
+
+leveldb_sstfilewriter_t *
+db_table_writer(db_t *db) {
+	return leveldb_sstfilewriter_create(db->opts);
+}
+
+void
+db_table_add(db_t *db, leveldb_sstfilewriter_t *w, const char *key,
+             size_t klen, const char *val, size_t vlen, char **errptr) {
+	char *buf;
+
+	val = value_encode(db, key, klen, val, &vlen, &buf);
+	leveldb_sstfilewriter_add(w, key, klen, val, vlen, errptr);
+	free(buf);
+}
+
+int
+db_value_logged(db_t *db, const char *key, size_t klen, uint64_t size) {
+	if (db_ttl(db, key, klen))
+		size += DB_MTIME_SIZE;
+	return size >= DB_VALUE_LOG_THRESHOLD;
+}
+
+void
+db_ingest(db_t *db, const char *const *files, size_t nfiles,
+          char **errptr) {
+	leveldb_ingest_external_files(db->db, files, nfiles, errptr);
 }
 
 void
@@ -66,14 +743,81 @@ db_del(db_t *db, const char *key,
 	leveldb_delete(db->db, opts, key, klen, errptr);
 }
 
+/*
+ * smallest key greater than every key starting with prefix, returns
+ * NULL if there is none (prefix is all 0xff)
+ */
+static char *
+prefix_successor(const char *prefix, size_t plen, size_t *slen) {
+	char *succ;
+
+	while (plen > 0 && (unsigned char)prefix[plen-1] == 0xff)
+		plen--;
+	if (plen == 0)
+		return NULL;
+	succ = malloc(plen);
+	memcpy(succ, prefix, plen);
+	succ[plen-1]++;
+	*slen = plen;
+	return succ;
+}
+
+int
+db_has_prefix(db_t *db, const char *prefix, size_t plen) {
+	int found;
+	leveldb_iterator_t *it;
+	leveldb_readoptions_t *opts;
+	leveldb_mergeoperands_t *m;
+	const char *key;
+	char *bound, *err;
+	size_t klen, bound_len;
+	uint64_t size;
+
+	opts = leveldb_readoptions_create();
+	leveldb_readoptions_set_prefix(opts, prefix, plen);
+	/* only the keys are looked at, leave the patches alone */
+	leveldb_readoptions_set_keys_only(opts, 1);
+	bound = prefix_successor(prefix, plen, &bound_len);
+	if (bound) {
+		leveldb_readoptions_set_iterate_upper_bound(opts, bound, bound_len);
+		free(bound);
+	}
+	it = leveldb_create_iterator(db->db, opts);
+	found = 0;
+	for (leveldb_iter_seek(it, prefix, plen); leveldb_iter_valid(it);
+	     leveldb_iter_next(it)) {
+		key = leveldb_iter_key(it, &klen);
+		if (!db_ttl(db, key, klen)) {
+			found = 1;
+			break;
+		}
+		/* skip expired paths compactions have not dropped yet */
+		err = NULL;
+		m = patches_get(db, key, klen, 0, &size, &err);
+		free(err);
+		if (m) {
+			leveldb_mergeoperands_destroy(m);
+			found = 1;
+			break;
+		}
+	}
+	leveldb_iter_destroy(it);
+	leveldb_readoptions_destroy(opts);
+
+	return found;
+}
+
 db_iter_t *
 db_iter_seek(db_t *db, const char *key, size_t klen) {
 	db_iter_t *it;
 	leveldb_readoptions_t *opts;
+	char *bound;
+	size_t bound_len;
 
 	it = malloc(sizeof(db_iter_t));
 	memset(it, 0, sizeof(db_iter_t));
 
+	it->db = db;
 	it->base_key_len = klen;
 	it->base_key = malloc(klen);
 	memcpy(it->base_key, key, klen);
@@ -81,6 +825,14 @@ db_iter_seek(db_t *db, const char *key, size_t klen) {
 	opts = leveldb_readoptions_create();
 	/* don't fill cache in iterations */
 	leveldb_readoptions_set_fill_cache(opts, 0);
+	leveldb_readoptions_set_prefix(opts, it->base_key, it->base_key_len);
+	/* stop reading blocks and skipping deletes past the prefix */
+	bound = prefix_successor(it->base_key, it->base_key_len, &bound_len);
+	if (bound) {
+		leveldb_readoptions_set_iterate_upper_bound(opts, bound, bound_len);
+		free(bound);
+	}
+	it->opts = opts;
 	it->it = leveldb_create_iterator(db->db, opts);
 	leveldb_iter_seek(it->it, it->base_key, it->base_key_len);
 	it->first = 1;
@@ -91,34 +843,49 @@ db_iter_seek(db_t *db, const char *key, size_t klen) {
 const char *
 db_iter_next(db_iter_t *it, size_t *klen) {
 	const char *next_key = NULL;
+	const char *val;
+	size_t vlen;
 	*klen = 0;
 
-	if (it->first) {
-		if (!leveldb_iter_valid(it->it))
+	do {
+		if (it->first) {
+			if (!leveldb_iter_valid(it->it))
+				return NULL;
+			it->first = 0;
+		} else {
+			leveldb_iter_next(it->it);
+			if (!leveldb_iter_valid(it->it))
+				return NULL;
+		}
+
+		next_key = leveldb_iter_key(it->it, klen);
+		if (it->base_key_len > *klen) {
+			klen = 0;
 			return NULL;
-		it->first = 0;
-	} else {
-		leveldb_iter_next(it->it);
-		if (!leveldb_iter_valid(it->it))
+		}
+		if (strncmp(it->base_key, next_key, it->base_key_len) != 0) {
+			klen = 0;
 			return NULL;
-	}
-
-	next_key = leveldb_iter_key(it->it, klen);
-	if (it->base_key_len > *klen) {
-		klen = 0;
-		return NULL;
-	}
-	if (strncmp(it->base_key, next_key, it->base_key_len) != 0) {
-		klen = 0;
-		return NULL;
-	}
+		}
+		/* skip expired paths compactions have not dropped yet */
+		val = NULL;
+		vlen = 0;
+		if (db_ttl(it->db, next_key, *klen))
+			val = leveldb_iter_value(it->it, &vlen);
+	} while (val && !value_live(it->db, next_key, *klen, val, &vlen));
 
 	return next_key;
 }
 
 const char *
 db_iter_value(db_iter_t *it, size_t *vlen) {
-	return leveldb_iter_value(it->it, vlen);
+	const char *key, *val;
+	size_t klen;
+
+	key = leveldb_iter_key(it->it, &klen);
+	val = leveldb_iter_value(it->it, vlen);
+	value_live(it->db, key, klen, val, vlen);
+	return val;
 }
 
 void
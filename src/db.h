@@ -1,12 +1,30 @@
 
 #include "../deps/leveldb/include/leveldb/c.h"
 
+/*
+ * paths matching pattern (see fnmatch(3)) expire ttl seconds after
+ * their last write
+ */
+typedef struct {
+	char     *pattern;
+	uint64_t ttl;
+} db_ttl_t;
+
 typedef struct {
 	leveldb_t         *db;
 	leveldb_options_t *opts;
+	leveldb_env_t     *env;
+	leveldb_cache_t   *cache;
+	leveldb_ratelimiter_t *limiter;
+	leveldb_filterpolicy_t *filter;
+	leveldb_mergeoperator_t *patch;
+	leveldb_compactionfilter_t *expire;
+	db_ttl_t          *ttls;
+	int               nttls;
 } db_t;
 
 typedef struct {
+	db_t                  *db;
 	leveldb_iterator_t    *it;
 	leveldb_readoptions_t *opts;
 	char                  *base_key;
@@ -14,11 +32,19 @@ typedef struct {
 	int                   first;
 } db_iter_t;
 
+/*
+ * parse a PATTERN:SECONDS ttl option into ttl, returns -1 if arg is
+ * malformed
+ */
+int
+db_ttl_parse(const char *arg, db_ttl_t *ttl);
+
 /* 
- * open database
+ * open database. the nttls entries of ttls must outlive it. a db keeps
+ * the ttls it is first opened with and refuses to be opened with others
  */
 db_t *
-db_open(const char *path, char **errptr);
+db_open(const char *path, db_ttl_t *ttls, int nttls, char **errptr);
 
 /*
  * close database
@@ -33,6 +59,23 @@ const char *
 db_get(db_t *db, const char *key, size_t klen,
        size_t *vlen, char **errptr);
 
+/*
+ * returns 1 and sets *size to the size of the value of key, 0 if key
+ * is missing. patches are not applied, and values kept in the value log
+ * are not read
+ */
+int
+db_size(db_t *db, const char *key, size_t klen, uint64_t *size,
+        char **errptr);
+
+/*
+ * read up to len bytes at offset of the value of key into buf, applying
+ * only the patches that overlap them. returns the number of bytes read
+ */
+size_t
+db_read(db_t *db, const char *key, size_t klen, uint64_t offset,
+        char *buf, size_t len, char **errptr);
+
 /*
  * db put
  */
@@ -40,6 +83,46 @@ void
 db_put(db_t *db, const char *key, size_t klen,
        const char *val, size_t vlen, char **errptr);
 
+/*
+ * write len bytes of buf at offset of the value of key without reading
+ * it. the value grows as needed, gaps are zero filled
+ */
+void
+db_patch(db_t *db, const char *key, size_t klen, uint64_t offset,
+         const char *buf, size_t len, char **errptr);
+
+/*
+ * create a writer of tables that db_ingest can add to db. keys must be
+ * added in increasing order
+ */
+leveldb_sstfilewriter_t *
+db_table_writer(db_t *db);
+
+/*
+ * add the contents of the file at key to a table of db_table_writer,
+ * stored as db_put would store them
+ */
+void
+db_table_add(db_t *db, leveldb_sstfilewriter_t *w, const char *key,
+             size_t klen, const char *val, size_t vlen, char **errptr);
+
+/*
+ * returns 1 if a file of size bytes at key belongs in the value log
+ * rather than in the tables. tables of db_table_writer keep all values
+ * in place, so such files are better added with db_put
+ */
+int
+db_value_logged(db_t *db, const char *key, size_t klen, uint64_t size);
+
+/*
+ * add tables built by db_table_writer writers to db without going
+ * through the write path. their keys replace the db's, and their key
+ * ranges must not overlap each other
+ */
+void
+db_ingest(db_t *db, const char *const *files, size_t nfiles,
+          char **errptr);
+
 /*
  * db delete
  */
@@ -47,6 +130,14 @@ void
 db_del(db_t *db, const char *key,
        size_t klen, char **errptr);
 
+/*
+ * returns 1 if any key begins with prefix, not counting expired paths.
+ * prefixes ending with the sublevel seperator are answered from the
+ * bloom filters when possible
+ */
+int
+db_has_prefix(db_t *db, const char *prefix, size_t plen);
+
 /*
  * create iterator for keys which begines with key
  */
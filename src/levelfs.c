@@ -72,6 +72,8 @@ static struct fuse_operations levelfs_oper = {
  */
 typedef struct {
 	char        *db_path;
+	db_ttl_t    *ttls;
+	int         nttls;
 } conf_t;
 
 static conf_t conf;
@@ -94,7 +96,7 @@ levelfs_init(struct fuse_conn_info *conn) {
 	char *err = NULL;
 
 	ctx = malloc(sizeof(ctx_t));
-	ctx->db = db_open(conf.db_path, &err);
+	ctx->db = db_open(conf.db_path, conf.ttls, conf.nttls, &err);
 	if (err) {
 		fprintf(stderr, "error opening db: %s", err);
 		exit(1);
@@ -111,17 +113,49 @@ levelfs_destroy(void *ctx) {
 	db_close(((ctx_t *)ctx)->db);
 }
 
+/*
+ * look up path in leveldb, returns S_IFREG for a file (setting *size),
+ * S_IFDIR for a directory with entries or 0 if path is missing
+ */
+static int
+path_lookup(const char *path, off_t *size)
+{
+	int res, found;
+	char *key, *err = NULL;
+	size_t klen;
+	uint64_t vlen;
+
+	/* only the size is needed, so don't read or patch the value */
+	res = 0;
+	key = path_to_key(path, &klen, 0);
+	found = db_size(CTX_DB, key, klen, &vlen, &err);
+	free(key);
+	if (err) {
+		fprintf(stderr, "leveldb get error: %s\n", err);
+		free(err);
+		return 0;
+	}
+	if (found) {
+		/* exact match = file */
+		if (size) *size = vlen;
+		return S_IFREG;
+	}
+
+	/* sublevel = directory, missing paths are ruled out by the filter */
+	key = path_to_key(path, &klen, 1);
+	if (db_has_prefix(CTX_DB, key, klen))
+		res = S_IFDIR;
+	free(key);
+
+	return res;
+}
+
 /*
  * determine directory entry type, i.e. dir/file
  */
 static int
 levelfs_getattr(const char *path, struct stat *stbuf)
 {
-	int res;
-	db_iter_t *it;
-	const char *key, *val;
-	char *base_key;
-	size_t base_key_len, klen, vlen;
 	struct fuse_context *fuse_ctx = fuse_get_context();
 
 	memset(stbuf, sizeof(struct stat), 0);
@@ -141,32 +175,18 @@ levelfs_getattr(const char *path, struct stat *stbuf)
 		return 0;
 	}
 
-	res = -ENOENT;
-	base_key = path_to_key(path, &base_key_len, 0);
-	it = db_iter_seek(CTX_DB, base_key, base_key_len);
-
-	while ((key = db_iter_next(it, &klen)) != NULL) {
-		if (base_key_len == klen) {
-			/* exact match = file */
-			stbuf->st_mode = S_IFREG | 0666;
-			stbuf->st_nlink = 1;
-			val = db_iter_value(it, &vlen);
-			stbuf->st_size = vlen;
-			res = 0;
-			break;
-		} else if (sepcmp(key+base_key_len, klen - base_key_len) == 0) {
-			/* sublevel = directory */
-			stbuf->st_mode = S_IFDIR | 0755;
-			stbuf->st_nlink = 2;
-			res = 0;
-			break;
-		}
+	switch (path_lookup(path, &stbuf->st_size)) {
+	case S_IFREG:
+		stbuf->st_mode = S_IFREG | 0666;
+		stbuf->st_nlink = 1;
+		return 0;
+	case S_IFDIR:
+		stbuf->st_mode = S_IFDIR | 0755;
+		stbuf->st_nlink = 2;
+		return 0;
 	}
 
-	db_iter_close(it);
-	free(base_key);
-
-	return res;
+	return -ENOENT;
 }
 
 /*
@@ -231,12 +251,13 @@ levelfs_read(const char *path, char *buf, size_t size, off_t offset,
            struct fuse_file_info *fi)
 {
 	char *key;
-	const char *val;
-	size_t keylen, vallen;
+	size_t keylen;
 	char *err = NULL;
 
+	/* only the patches over the range read are applied, straight into
+	 * fuse's buffer */
 	key = path_to_key(path, &keylen, 0);
-	val = db_get(CTX_DB, key, keylen, &vallen, &err);
+	size = db_read(CTX_DB, key, keylen, offset, buf, size, &err);
 	free(key);
 
 	if (err) {
@@ -245,12 +266,6 @@ levelfs_read(const char *path, char *buf, size_t size, off_t offset,
 		return 0;
 	}
 
-	if (vallen < offset)
-		return 0;
-	if (vallen - offset < size) 
-		size = vallen - offset;
-	memcpy(buf, val+offset, size);
-
 	return size;
 }
 
@@ -261,42 +276,22 @@ static int
 levelfs_write(const char *path, const char *buf, size_t bufsize,
               off_t offset, struct fuse_file_info *fi) {
 	int res;
-	char *key, *new_val;
-	const char *val;
-	size_t klen, vlen, new_val_len;
+	char *key;
+	size_t klen;
 	char *err = NULL;
 
-	res = 0;
-	new_val = NULL;
-
+	/* store a patch instead of rewriting the whole file, so appending
+	 * costs the bytes written */
+	res = bufsize;
 	key = path_to_key(path, &klen, 0);
-	val = db_get(CTX_DB, key, klen, &vlen, &err);
+	db_patch(CTX_DB, key, klen, offset, buf, bufsize, &err);
 	if (err) {
-		res = -ENOENT;
-		goto error;
-	}
-	if (offset + bufsize > vlen) {
-		/* allocate a bigger buffer */
-		new_val_len = offset + bufsize;
-		new_val = malloc(new_val_len);
-		memcpy(new_val, val, offset);
-	} else {
-		new_val_len = vlen;
-		new_val = malloc(new_val_len);
-		memcpy(new_val, val, new_val_len);
-	}
-	memcpy(new_val+offset, buf, bufsize);
-	db_put(CTX_DB, key, klen, new_val, new_val_len, &err);
-	if (err) {
-		fprintf(stderr, "leveldb put error: %s\n", err);
+		fprintf(stderr, "leveldb merge error: %s\n", err);
 		// TODO: change errno
 		res = -ENOENT;
 	}
-	res = bufsize;
 
-error:
 	free(key);
-	free(new_val);
 	leveldb_free(err);
 
 	return res;
@@ -371,10 +366,20 @@ levelfs_truncate(const char *path, off_t offset) {
 			res = -ENOENT;
 			goto error;
 		}
+	} else if (vlen < offset) {
+		/* an empty patch at the new size zero fills the file */
+		db_patch(CTX_DB, key, klen, offset, NULL, 0, &err);
+		if (err) {
+			fprintf(stderr, "leveldb merge: %s\n", err);
+			// TODO: change errno
+			res = -ENOENT;
+			goto error;
+		}
 	}
 
 error:
 	free(key);
+	free((char *)val);
 	free(err);
 	return res;
 }
@@ -384,32 +389,15 @@ error:
  */
 static int
 levelfs_mkdir(const char *path, mode_t mode) {
-	int res;
-	char *base_key;
-	const char *key;
-	size_t base_key_len, klen;
-	db_iter_t *it;
-
-	res = 0;
-	base_key = path_to_key(path, &base_key_len, 0);
-	if (newdirs_exists(path)) {
-		res = -EEXIST;
-		goto error;
-	}
-	it = db_iter_seek(CTX_DB, base_key, base_key_len);
-	if ((key = db_iter_next(it, &klen)) != NULL) {
-		if (base_key_len == klen ||
-		    sepcmp(key+base_key_len, klen - base_key_len) == 0) {
-			printf("mkdir: %s found in leveldb\n", path);
-			res = -EEXIST;
-			goto error;
-		}
+	if (newdirs_exists(path))
+		return -EEXIST;
+	if (path_lookup(path, NULL) != 0) {
+		printf("mkdir: %s found in leveldb\n", path);
+		return -EEXIST;
 	}
 	newdirs_add(path);
 
-error:
-	free(base_key);
-	return res;
+	return 0;
 }
 
 /*
@@ -417,38 +405,19 @@ error:
  */
 static int
 levelfs_rmdir(const char *path) {
-	int res;
-	char *base_key;
-	const char *key;
-	size_t base_key_len, klen;
-	db_iter_t *it;
-
-	res = 0;
-	base_key = path_to_key(path, &base_key_len, 0);
-
-	it = db_iter_seek(CTX_DB, base_key, base_key_len);
-	if ((key = db_iter_next(it, &klen)) != NULL) {
-		if (base_key_len == klen) {
-			res = -ENOTDIR;
-			goto error;
-		} else if (sepcmp(key+base_key_len, klen - base_key_len) == 0) {
-			res = -ENOTEMPTY;
-			goto error;
-		}
-	}
-	if (!newdirs_exists(path)) {
-		res = -ENOENT;
-		goto error;
-	}
-	if (newdirs_list(path) != NULL) {
-		res = -ENOTEMPTY;
-		goto error;
+	switch (path_lookup(path, NULL)) {
+	case S_IFREG:
+		return -ENOTDIR;
+	case S_IFDIR:
+		return -ENOTEMPTY;
 	}
+	if (!newdirs_exists(path))
+		return -ENOENT;
+	if (newdirs_list(path) != NULL)
+		return -ENOTEMPTY;
 	newdirs_remove(path);
 
-error:
-	free(base_key);
-	return res;
+	return 0;
 }
 
 static int
@@ -514,6 +483,10 @@ usage(char *proc) {
 	    "    -h   --help            print help\n"
 	    "    -V   --version         print version\n"
 	    "\n"
+	    "levelfs options:\n"
+	    "    -o ttl=PATTERN:SECONDS paths matching PATTERN expire SECONDS\n"
+	    "                           after their last write (repeatable)\n"
+	    "\n"
 	    "FUSE options:\n"
 	    "    -d   -o debug          enable debug output (implies -f)\n"
 	    "    -f                     foreground operation\n"
@@ -524,6 +497,7 @@ usage(char *proc) {
 enum {
      KEY_HELP,
      KEY_VERSION,
+     KEY_TTL,
 };
 
 static struct fuse_opt opts[] = {
@@ -531,6 +505,7 @@ static struct fuse_opt opts[] = {
 	FUSE_OPT_KEY("--version",     KEY_VERSION),
 	FUSE_OPT_KEY("-h",            KEY_HELP),
 	FUSE_OPT_KEY("--help",        KEY_HELP),
+	FUSE_OPT_KEY("ttl=",          KEY_TTL),
 	FUSE_OPT_END
 };
 
@@ -544,6 +519,18 @@ static char *unrealpath(const char *name) {
 	return realpath(name, NULL);
 }
 
+/*
+ * add a ttl=PATTERN:SECONDS option to conf
+ */
+static int
+ttl_parse(const char *arg) {
+	conf.ttls = realloc(conf.ttls, (conf.nttls + 1) * sizeof(db_ttl_t));
+	if (db_ttl_parse(arg + strlen("ttl="), &conf.ttls[conf.nttls]) != 0)
+		return -1;
+	conf.nttls++;
+	return 0;
+}
+
 static int
 opt_parse(void *data, const char *arg, int key, struct fuse_args *outargs)
 {
@@ -561,6 +548,12 @@ opt_parse(void *data, const char *arg, int key, struct fuse_args *outargs)
 		case KEY_VERSION:
 			fprintf(stderr, "v%s\n", LEVELFS_VERSION);
 			exit(0);
+		case KEY_TTL:
+			if (ttl_parse(arg) != 0) {
+				fprintf(stderr, "invalid option: %s\n", arg);
+				exit(1);
+			}
+			return 0;
 	}
 	return 1;
 }
@@ -15,6 +15,12 @@ sepcmp(const char *str, size_t len) {
 	return strncmp(str, &(sep[0]), seplen);
 }
 
+const char *
+path_sep(size_t *len) {
+	*len = seplen;
+	return sep;
+}
+
 /*
  * /foo/bar -> .foo.bar
  */
@@ -60,10 +66,9 @@ key_to_path(const char *key, size_t klen) {
 	char *path, *p;
 	const char *k;
 
-	path = malloc(klen);
+	path = malloc(klen + 1);
 
 	for (k = key, p = path; k < key+klen; ++p) {
-		printf("%x ", *k);
 		if (strncmp(k, &(sep[0]), seplen) == 0) {
 			*p = '/';
 			k += seplen;
@@ -72,11 +77,8 @@ key_to_path(const char *key, size_t klen) {
 			k++;
 		}
 	}
-	printf("\n");
-	fflush(stdout);
 
 	*p = '\0';
-	printf("path: %s\n", path);
 	return path;
 }
 
@@ -7,6 +7,12 @@
 int
 sepcmp(const char *str, size_t len);
 
+/*
+ * returns the sublevel seperator, not null terminated
+ */
+const char *
+path_sep(size_t *len);
+
 /*
  * returns a db key representaiton of a path
  */
@@ -0,0 +1,442 @@
+/*
+ * bulk load a directory tree into a levelfs db
+ *
+ * files are read into sorted tables by parallel workers and the tables
+ * are added to the db at once, bypassing its write path. files that the
+ * db keeps in its value log are written through the write path after
+ * that, so that they end up there rather than in the tables
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/db.h"
+#include "../src/path.h"
+
+/* tables are cut at about this many bytes of file contents */
+#define IMPORT_TABLE_SIZE (64 << 20)
+/* open file descriptors used by nftw */
+#define IMPORT_FTW_FDS 64
+
+typedef struct {
+	char   *src;
+	char   *key;
+	size_t klen;
+	off_t  size;
+} entry_t;
+
+/*
+ * entries [start, end) go to the table file name
+ */
+typedef struct {
+	size_t start;
+	size_t end;
+	char   *name;
+} table_t;
+
+static entry_t *entries;
+static size_t nentries;
+static size_t entries_cap;
+
+/* entries [0, ntabled) go to tables, the rest is put */
+static size_t ntabled;
+
+static size_t src_len;
+static const char *dest;
+
+static table_t *tables;
+static size_t ntables;
+
+static db_t *db;
+static db_ttl_t *ttls;
+static int nttls;
+
+/*
+ * work queue shared by the workers, of tables or of entries to put
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t next_item;
+static char *import_err;
+
+static void
+usage(char *proc) {
+	fprintf(stderr,
+	    "usage: %s [options] srcdir dbpath\n"
+	    "\n"
+	    "copies the files under srcdir into the levelfs db at dbpath\n"
+	    "\n"
+	    "options:\n"
+	    "    -d DIR                 import under DIR of the file system\n"
+	    "                           (default /)\n"
+	    "    -j N                   write N tables in parallel\n"
+	    "                           (default number of cpus)\n"
+	    "    -o ttl=PATTERN:SECONDS paths matching PATTERN expire SECONDS\n"
+	    "                           after their import (repeatable), as\n"
+	    "                           the db is mounted with\n"
+	    "    -h                     print help\n"
+	    , proc);
+}
+
+/*
+ * nftw callback collecting regular files
+ */
+static int
+collect(const char *fpath, const struct stat *sb, int type,
+        struct FTW *ftwbuf) {
+	entry_t *e;
+	char *path;
+
+	if (type != FTW_F || !S_ISREG(sb->st_mode))
+		return 0;
+	if (nentries == entries_cap) {
+		entries_cap = entries_cap ? 2 * entries_cap : 1024;
+		entries = realloc(entries, entries_cap * sizeof(entry_t));
+	}
+	e = &entries[nentries++];
+	e->src = strdup(fpath);
+	e->size = sb->st_size;
+	if (asprintf(&path, "%s%s", dest, fpath + src_len) < 0) {
+		perror("asprintf");
+		exit(1);
+	}
+	e->key = path_to_key(path, &e->klen, 0);
+	free(path);
+	return 0;
+}
+
+/*
+ * order keys as leveldb's default comparator does
+ */
+static int
+entry_cmp(const void *a, const void *b) {
+	const entry_t *ea = a, *eb = b;
+	size_t n;
+	int r;
+
+	n = ea->klen < eb->klen ? ea->klen : eb->klen;
+	r = memcmp(ea->key, eb->key, n);
+	if (r)
+		return r;
+	if (ea->klen != eb->klen)
+		return ea->klen < eb->klen ? -1 : 1;
+	return 0;
+}
+
+/*
+ * read the whole file at path, returns NULL on error
+ */
+static char *
+read_file(const char *path, off_t size, size_t *len) {
+	char *buf;
+	ssize_t n = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	buf = malloc(size ? size : 1);
+	*len = 0;
+	while (*len < size) {
+		n = read(fd, buf + *len, size - *len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		*len += n;
+	}
+	if (n < 0) {
+		free(buf);
+		buf = NULL;
+	}
+	close(fd);
+	return buf;
+}
+
+/*
+ * record the first error, which stops all workers
+ */
+static void
+set_error(const char *what, const char *msg) {
+	pthread_mutex_lock(&lock);
+	if (!import_err && asprintf(&import_err, "%s: %s", what, msg) < 0)
+		import_err = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * write one table
+ */
+static void
+write_table(leveldb_sstfilewriter_t *w, table_t *t) {
+	entry_t *e;
+	char *val, *err = NULL;
+	size_t i, vlen;
+
+	leveldb_sstfilewriter_open(w, t->name, &err);
+	for (i = t->start; !err && i < t->end; i++) {
+		e = &entries[i];
+		val = read_file(e->src, e->size, &vlen);
+		if (!val) {
+			set_error(e->src, strerror(errno));
+			break;
+		}
+		db_table_add(db, w, e->key, e->klen, val, vlen, &err);
+		free(val);
+	}
+	if (!err && i == t->end)
+		leveldb_sstfilewriter_finish(w, &err);
+	if (err) {
+		set_error(t->name, err);
+		leveldb_free(err);
+	}
+}
+
+/*
+ * returns the next item of the work queue below end, or end if none or
+ * an error is left
+ */
+static size_t
+next_work(size_t end) {
+	size_t i;
+
+	pthread_mutex_lock(&lock);
+	i = next_item++;
+	if (import_err || i > end)
+		i = end;
+	pthread_mutex_unlock(&lock);
+	return i;
+}
+
+/*
+ * worker thread, writes tables until none or an error is left
+ */
+static void *
+table_worker(void *arg) {
+	leveldb_sstfilewriter_t *w;
+	size_t i;
+
+	w = db_table_writer(db);
+	while ((i = next_work(ntables)) < ntables)
+		write_table(w, &tables[i]);
+	leveldb_sstfilewriter_destroy(w);
+	return NULL;
+}
+
+/*
+ * worker thread, puts the entries past the tables until none or an
+ * error is left. the writes of the workers are logged together
+ */
+static void *
+put_worker(void *arg) {
+	entry_t *e;
+	char *val, *err = NULL;
+	size_t i, vlen;
+
+	while ((i = next_work(nentries)) < nentries) {
+		e = &entries[i];
+		val = read_file(e->src, e->size, &vlen);
+		if (!val) {
+			set_error(e->src, strerror(errno));
+			break;
+		}
+		db_put(db, e->key, e->klen, val, vlen, &err);
+		free(val);
+		if (err) {
+			set_error(e->src, err);
+			leveldb_free(err);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * run nthreads of worker and wait for them
+ */
+static void
+run_workers(void *(*worker)(void *), size_t start, long nthreads) {
+	pthread_t *threads;
+	long i;
+
+	next_item = start;
+	threads = malloc(nthreads * sizeof(pthread_t));
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*
+ * move the entries that belong in the value log past the others,
+ * keeping both runs sorted
+ */
+static void
+split_entries(void) {
+	entry_t *logged;
+	size_t i, nlogged;
+
+	logged = malloc((nentries ? nentries : 1) * sizeof(entry_t));
+	nlogged = 0;
+	ntabled = 0;
+	for (i = 0; i < nentries; i++) {
+		if (db_value_logged(db, entries[i].key, entries[i].klen,
+		                    entries[i].size))
+			logged[nlogged++] = entries[i];
+		else
+			entries[ntabled++] = entries[i];
+	}
+	memcpy(entries + ntabled, logged, nlogged * sizeof(entry_t));
+	free(logged);
+}
+
+/*
+ * cut the sorted entries into tables of about IMPORT_TABLE_SIZE bytes
+ */
+static void
+plan_tables(const char *tmpdir) {
+	size_t i, start, bytes;
+	table_t *t;
+
+	start = 0;
+	bytes = 0;
+	for (i = 0; i < ntabled; i++) {
+		bytes += entries[i].size + entries[i].klen;
+		if (bytes < IMPORT_TABLE_SIZE && i + 1 < ntabled)
+			continue;
+		tables = realloc(tables, (ntables + 1) * sizeof(table_t));
+		t = &tables[ntables];
+		t->start = start;
+		t->end = i + 1;
+		if (asprintf(&t->name, "%s/%06zu.sst", tmpdir, ntables) < 0) {
+			perror("asprintf");
+			exit(1);
+		}
+		ntables++;
+		start = i + 1;
+		bytes = 0;
+	}
+}
+
+int
+main(int argc, char **argv) {
+	char *src, *dbpath, *tmpdir, *dir, *err = NULL;
+	const char **files;
+	long nthreads;
+	size_t i;
+	int c, res;
+
+	dest = "";
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "d:j:o:h")) != -1) {
+		switch (c) {
+		case 'd':
+			if (optarg[0] != '/') {
+				fprintf(stderr, "-d needs an absolute path\n");
+				return 1;
+			}
+			/* keys get no trailing seperator, "/" is the root */
+			dir = strdup(optarg);
+			while (*dir && dir[strlen(dir) - 1] == '/')
+				dir[strlen(dir) - 1] = '\0';
+			dest = dir;
+			break;
+		case 'j':
+			nthreads = atol(optarg);
+			break;
+		case 'o':
+			ttls = realloc(ttls, (nttls + 1) * sizeof(db_ttl_t));
+			if (strncmp(optarg, "ttl=", 4) != 0 ||
+			    db_ttl_parse(optarg + 4, &ttls[nttls]) != 0) {
+				fprintf(stderr, "invalid option: %s\n", optarg);
+				return 1;
+			}
+			nttls++;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind != 2 || nthreads < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	src = realpath(argv[optind], NULL);
+	if (!src) {
+		perror(argv[optind]);
+		return 1;
+	}
+	src_len = strlen(src);
+	dbpath = argv[optind + 1];
+
+	if (nftw(src, collect, IMPORT_FTW_FDS, FTW_PHYS) != 0) {
+		perror(src);
+		return 1;
+	}
+	qsort(entries, nentries, sizeof(entry_t), entry_cmp);
+	if (nentries == 0) {
+		fprintf(stderr, "no files under %s\n", src);
+		return 0;
+	}
+
+	/* the ttls decide how the files are stored, and must be the db's */
+	db = db_open(dbpath, ttls, nttls, &err);
+	if (err) {
+		fprintf(stderr, "error opening db: %s\n", err);
+		return 1;
+	}
+	split_entries();
+
+	/* next to the db, so the tables can be linked rather than copied */
+	if (asprintf(&tmpdir, "%s.import-XXXXXX", dbpath) < 0 ||
+	    !mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	plan_tables(tmpdir);
+
+	res = 1;
+	run_workers(table_worker, 0, nthreads);
+	if (import_err) {
+		fprintf(stderr, "error writing tables: %s\n", import_err);
+		goto out;
+	}
+	if (ntables) {
+		files = malloc(ntables * sizeof(char *));
+		for (i = 0; i < ntables; i++)
+			files[i] = tables[i].name;
+		db_ingest(db, files, ntables, &err);
+		free(files);
+		if (err) {
+			fprintf(stderr, "error importing tables: %s\n", err);
+			leveldb_free(err);
+			goto out;
+		}
+	}
+	/* the keys are within the ranges of the tables, so they can only
+	 * be put once those are in */
+	run_workers(put_worker, ntabled, nthreads);
+	if (import_err) {
+		fprintf(stderr, "error writing files: %s\n", import_err);
+		goto out;
+	}
+	printf("imported %zu files, %zu in %zu tables\n",
+	       nentries, ntabled, ntables);
+	res = 0;
+
+out:
+	for (i = 0; i < ntables; i++)
+		unlink(tables[i].name);
+	rmdir(tmpdir);
+	db_close(db);
+	return res;
+}